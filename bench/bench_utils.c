@@ -0,0 +1,153 @@
+/* utility code used by the benchmark programs
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "bench_utils.h"
+
+
+void logging_fn(ImxVpuLogLevel level, char const *file, int const line, char const *fn, const char *format, ...)
+{
+	va_list args;
+
+	char const *lvlstr = "";
+	switch (level)
+	{
+		case IMX_VPU_LOG_LEVEL_ERROR: lvlstr = "ERROR"; break;
+		case IMX_VPU_LOG_LEVEL_WARNING: lvlstr = "WARNING"; break;
+		case IMX_VPU_LOG_LEVEL_INFO: lvlstr = "info"; break;
+		case IMX_VPU_LOG_LEVEL_DEBUG: lvlstr = "debug"; break;
+		case IMX_VPU_LOG_LEVEL_TRACE: lvlstr = "trace"; break;
+		case IMX_VPU_LOG_LEVEL_LOG: lvlstr = "log"; break;
+		default: break;
+	}
+
+	fprintf(stderr, "%s:%d (%s)   %s: ", file, line, fn, lvlstr);
+
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+
+	fprintf(stderr, "\n");
+}
+
+
+uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)(ts.tv_sec)) * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+int parse_resolution(char const *str, Resolution *resolution)
+{
+	return (sscanf(str, "%ux%u", &(resolution->width), &(resolution->height)) == 2) && (resolution->width > 0) && (resolution->height > 0);
+}
+
+
+void fill_framebuffer(ImxVpuFramebuffer *framebuffer, unsigned int width, unsigned int height, unsigned int index)
+{
+	unsigned int x, y;
+	uint8_t *pixels, *plane;
+
+	pixels = imx_vpu_dma_buffer_map(framebuffer->dma_buffer, IMX_VPU_MAPPING_FLAG_WRITE);
+	if (pixels == NULL)
+		return;
+
+	plane = pixels + framebuffer->y_offset;
+	for (y = 0; y < height; ++y)
+	{
+		for (x = 0; x < width; ++x)
+			plane[y * framebuffer->y_stride + x] = (uint8_t)((x ^ y) + ((x * y) >> 6) + index * 8);
+	}
+
+	plane = pixels + framebuffer->cb_offset;
+	for (y = 0; y < height / 2; ++y)
+	{
+		for (x = 0; x < width / 2; ++x)
+			plane[y * framebuffer->cbcr_stride + x] = (uint8_t)(96 + ((x + index * 2) & 63));
+	}
+
+	plane = pixels + framebuffer->cr_offset;
+	for (y = 0; y < height / 2; ++y)
+	{
+		for (x = 0; x < width / 2; ++x)
+			plane[y * framebuffer->cbcr_stride + x] = (uint8_t)(96 + ((y + index) & 63));
+	}
+
+	imx_vpu_dma_buffer_unmap(framebuffer->dma_buffer);
+}
+
+
+int stored_stream_add(StoredStream *stream, uint8_t *data, size_t size)
+{
+	if (stream->num_frames >= stream->capacity)
+	{
+		unsigned int new_capacity = (stream->capacity == 0) ? 64 : (stream->capacity * 2);
+		StoredFrame *new_frames = realloc(stream->frames, new_capacity * sizeof(StoredFrame));
+		if (new_frames == NULL)
+			return 0;
+		stream->frames = new_frames;
+		stream->capacity = new_capacity;
+	}
+
+	stream->frames[stream->num_frames].data = data;
+	stream->frames[stream->num_frames].size = size;
+	stream->num_frames++;
+
+	return 1;
+}
+
+
+void stored_stream_cleanup(StoredStream *stream)
+{
+	unsigned int i;
+
+	if (stream->frames == NULL)
+		return;
+
+	for (i = 0; i < stream->num_frames; ++i)
+		free(stream->frames[i].data);
+	free(stream->frames);
+
+	memset(stream, 0, sizeof(StoredStream));
+}
+
+
+void* acquire_output_buffer(void *context, size_t size, void **acquired_handle)
+{
+	void *mem;
+
+	((void)(context));
+
+	mem = malloc(size);
+	*acquired_handle = mem;
+	return mem;
+}
+
+
+void finish_output_buffer(void *context, void *acquired_handle)
+{
+	((void)(context));
+	((void)(acquired_handle));
+}
@@ -0,0 +1,101 @@
+/* utility code used by the benchmark programs
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "imxvpuapi/imxvpuapi.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Name of the backend and version of the library; set by the build script */
+#ifndef IMXVPU_BENCH_BACKEND
+#define IMXVPU_BENCH_BACKEND "unknown"
+#endif
+
+#ifndef IMXVPU_BENCH_VERSION
+#define IMXVPU_BENCH_VERSION "unknown"
+#endif
+
+
+typedef struct
+{
+	unsigned int width, height;
+}
+Resolution;
+
+
+/* One encoded frame, allocated with malloc() */
+typedef struct
+{
+	uint8_t *data;
+	size_t size;
+}
+StoredFrame;
+
+
+/* Sequence of encoded frames, kept in memory */
+typedef struct
+{
+	StoredFrame *frames;
+	unsigned int num_frames, capacity;
+}
+StoredStream;
+
+
+/* Logging function for imx_vpu_set_logging_function() which prints to stderr */
+void logging_fn(ImxVpuLogLevel level, char const *file, int const line, char const *fn, const char *format, ...);
+
+/* Returns the current time of a monotonic clock, in microseconds */
+uint64_t get_time(void);
+
+/* Parses a resolution in WIDTHxHEIGHT format. Returns 0 if the string is invalid. */
+int parse_resolution(char const *str, Resolution *resolution);
+
+/* Fills the framebuffer with a test pattern. Different index values produce
+ * different patterns, so that encoders have to deal with changing content.
+ * The framebuffer must use a planar 4:2:0 format. */
+void fill_framebuffer(ImxVpuFramebuffer *framebuffer, unsigned int width, unsigned int height, unsigned int index);
+
+/* Appends a frame to the stream. The stream takes ownership over data, which
+ * must have been allocated with malloc(). Returns 0 if memory allocation failed
+ * (data is not freed in that case). */
+int stored_stream_add(StoredStream *stream, uint8_t *data, size_t size);
+/* Frees all frames in the stream */
+void stored_stream_cleanup(StoredStream *stream);
+
+/* ImxVpuEncAcquireOutputBuffer and ImxVpuEncFinishOutputBuffer functions which
+ * allocate output buffers with malloc(). The acquired handle is the pointer to
+ * the allocated memory, and must be freed with free(). */
+void* acquire_output_buffer(void *context, size_t size, void **acquired_handle);
+void finish_output_buffer(void *context, void *acquired_handle);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
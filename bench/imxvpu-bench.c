@@ -0,0 +1,1624 @@
+/* benchmark suite for the imxvpuapi decoder, encoder, JPEG, DMA, and conversion interfaces
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "imxvpuapi/imxvpuapi.h"
+#include "imxvpuapi/imxvpuapi_jpeg.h"
+#include "imxvpuapi/imxvpuapi_convert.h"
+#include "bench_utils.h"
+
+
+
+/* This benchmark measures the throughput and per-frame latency of the
+ * library with procedurally generated content, so that results are
+ * reproducible and do not depend on input files.
+ *
+ * These tests are available:
+ *
+ * encode : encodes frames with the video encoder API
+ * decode : decodes the frames produced by the encode test again with the
+ *          video decoder API (the encoding is run even if the encode test
+ *          is not selected, since it produces the input for this test)
+ * jpeg   : encodes and decodes frames with the simplified JPEG API, and
+ *          reports encoding, decoding, and the whole round-trip separately
+ * dma    : allocates and deallocates DMA buffers of framebuffer size with
+ *          the default allocator and with a DMA buffer pool
+ * convert: converts frames between system memory images and framebuffers
+ *          with the NEON (if available) and the scalar implementation
+ *
+ * Each test is run for each selected codec format (encode and decode only)
+ * and resolution. Latencies are the wall clock time of one API call, in
+ * microseconds. The frames per second value is the number of processed
+ * frames divided by the sum of all latencies, that is, the throughput when
+ * frames are processed one after the other. The first frames of each run
+ * can be excluded from the results with the -w option, since they include
+ * one-time setup work like framebuffer registration.
+ *
+ * The results are written as JSON (the default) or CSV. Both contain the
+ * name of the backend the library was built with, so results of builds
+ * with the vpulib and the fslwrapper backends can be told apart. */
+
+
+
+#define DEFAULT_NUM_FRAMES 100
+#define DEFAULT_NUM_WARMUP_FRAMES 5
+#define NUM_INPUT_FRAMES 8
+#define MAX_NUM_RESOLUTIONS 16
+#define FPS_N 25
+#define FPS_D 1
+#define JPEG_QUALITY_FACTOR 85
+/* Maximum number of results per resolution: encode and decode for each
+ * codec format, three JPEG results, four DMA buffer results, and two
+ * results (SIMD and scalar) for each conversion */
+#define MAX_NUM_RESULTS_PER_RESOLUTION (NUM_CODECS * 2 + 3 + 4 + NUM_CONVERSIONS * 2)
+
+
+typedef enum
+{
+	TEST_ENCODE  = (1 << 0),
+	TEST_DECODE  = (1 << 1),
+	TEST_JPEG    = (1 << 2),
+	TEST_DMA     = (1 << 3),
+	TEST_CONVERT = (1 << 4)
+}
+TestFlags;
+
+
+typedef enum
+{
+	OUTPUT_FORMAT_JSON,
+	OUTPUT_FORMAT_CSV
+}
+OutputFormat;
+
+
+typedef struct
+{
+	char const *name;
+	ImxVpuCodecFormat codec_format;
+	unsigned int quant_param;
+}
+CodecEntry;
+
+
+static CodecEntry const codecs[] =
+{
+	{ "h264", IMX_VPU_CODEC_FORMAT_H264, 28 },
+	{ "mpeg4", IMX_VPU_CODEC_FORMAT_MPEG4, 8 },
+	{ "mjpeg", IMX_VPU_CODEC_FORMAT_MJPEG, 0 }
+};
+#define NUM_CODECS (sizeof(codecs) / sizeof(CodecEntry))
+
+
+static Resolution const default_resolutions[] =
+{
+	{ 320, 240 },
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1088 }
+};
+#define NUM_DEFAULT_RESOLUTIONS (sizeof(default_resolutions) / sizeof(Resolution))
+
+
+typedef struct
+{
+	uint64_t *values;
+	size_t num_values, capacity;
+	/* Number of values which still have to be discarded (warmup) */
+	unsigned int num_to_skip;
+}
+LatencyList;
+
+
+typedef struct
+{
+	char const *test;
+	char const *codec;
+	unsigned int width, height;
+	int ok;
+
+	unsigned long num_frames;
+	uint64_t num_bytes;
+	uint64_t busy_time;
+	double fps;
+	uint64_t min_latency, mean_latency, max_latency;
+	uint64_t p50_latency, p90_latency, p99_latency;
+	/* Mean time per frame spent waiting for the VPU, as reported by the
+	 * en/decoder statistics (0 if not available) */
+	uint64_t mean_vpu_wait_time;
+}
+BenchResult;
+
+
+typedef struct
+{
+	unsigned int num_frames;
+	unsigned int num_warmup_frames;
+	unsigned int tests;
+	int codec_enabled[NUM_CODECS];
+	Resolution resolutions[MAX_NUM_RESOLUTIONS];
+	unsigned int num_resolutions;
+
+	/* Allocated in main() for the maximum number of results, so
+	 * pointers to results stay valid while tests are running */
+	BenchResult *results;
+	unsigned int num_results, max_num_results;
+
+	/* If not NULL, the trace events of each encode and decode
+	 * run are written to this file (see write_trace_run()) */
+	FILE *trace_file;
+	unsigned int num_trace_runs;
+}
+Bench;
+
+
+
+
+/******************/
+/* misc utilities */
+/******************/
+
+
+static void latency_list_init(LatencyList *list, unsigned int num_to_skip)
+{
+	memset(list, 0, sizeof(LatencyList));
+	list->num_to_skip = num_to_skip;
+}
+
+
+static void latency_list_cleanup(LatencyList *list)
+{
+	free(list->values);
+	list->values = NULL;
+}
+
+
+static int latency_list_add(LatencyList *list, uint64_t latency)
+{
+	if (list->num_to_skip > 0)
+	{
+		list->num_to_skip--;
+		return 1;
+	}
+
+	if (list->num_values >= list->capacity)
+	{
+		size_t new_capacity = (list->capacity == 0) ? 128 : (list->capacity * 2);
+		uint64_t *new_values = realloc(list->values, new_capacity * sizeof(uint64_t));
+		if (new_values == NULL)
+			return 0;
+		list->values = new_values;
+		list->capacity = new_capacity;
+	}
+
+	list->values[list->num_values++] = latency;
+	return 1;
+}
+
+
+static int compare_latencies(void const *a, void const *b)
+{
+	uint64_t va = *((uint64_t const *)a);
+	uint64_t vb = *((uint64_t const *)b);
+	return (va < vb) ? -1 : ((va > vb) ? 1 : 0);
+}
+
+
+static uint64_t get_percentile(uint64_t const *sorted_values, size_t num_values, unsigned int percentile)
+{
+	/* nearest-rank method */
+	size_t rank = (num_values * percentile + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+	return sorted_values[rank - 1];
+}
+
+
+/* Sorts the latency list and fills the latency and throughput fields of result */
+static void compute_latency_stats(LatencyList *list, BenchResult *result)
+{
+	size_t i;
+	uint64_t sum = 0;
+
+	result->num_frames = list->num_values;
+
+	if (list->num_values == 0)
+		return;
+
+	qsort(list->values, list->num_values, sizeof(uint64_t), compare_latencies);
+
+	for (i = 0; i < list->num_values; ++i)
+		sum += list->values[i];
+
+	result->busy_time = sum;
+	result->fps = (sum > 0) ? ((double)(list->num_values) * 1000000.0 / (double)sum) : 0.0;
+	result->min_latency = list->values[0];
+	result->max_latency = list->values[list->num_values - 1];
+	result->mean_latency = sum / list->num_values;
+	result->p50_latency = get_percentile(list->values, list->num_values, 50);
+	result->p90_latency = get_percentile(list->values, list->num_values, 90);
+	result->p99_latency = get_percentile(list->values, list->num_values, 99);
+}
+
+
+static BenchResult* add_result(Bench *bench, char const *test, char const *codec, unsigned int width, unsigned int height)
+{
+	BenchResult *result;
+
+	if (bench->num_results >= bench->max_num_results)
+	{
+		fprintf(stderr, "too many results\n");
+		return NULL;
+	}
+
+	result = &(bench->results[bench->num_results++]);
+	memset(result, 0, sizeof(BenchResult));
+	result->test = test;
+	result->codec = codec;
+	result->width = width;
+	result->height = height;
+
+	return result;
+}
+
+
+/* Writes the trace events of one encode or decode run to the trace file, as
+ * events of the Chrome trace event JSON format, which chrome://tracing and
+ * the Perfetto UI can load. Each run gets its own track. */
+static void write_trace_run(Bench *bench, char const *test, CodecEntry const *codec, Resolution const *resolution, ImxVpuTraceEvent const *events, unsigned int num_events)
+{
+	unsigned int i, track = ++(bench->num_trace_runs);
+
+	fprintf(
+		bench->trace_file,
+		"%s\n\t\t{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": { \"name\": \"%s %s %ux%u\" } }",
+		(track > 1) ? "," : "",
+		track, test, codec->name, resolution->width, resolution->height
+	);
+
+	for (i = 0; i < num_events; ++i)
+	{
+		ImxVpuTraceEvent const *event = &(events[i]);
+		fprintf(
+			bench->trace_file,
+			",\n\t\t{ \"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %llu, \"pid\": 1, \"tid\": %u, \"args\": { \"arg0\": %llu, \"arg1\": %llu, \"arg2\": %llu } }",
+			imx_vpu_trace_event_name(event->id),
+			(unsigned long long)(event->timestamp),
+			track,
+			(unsigned long long)(event->args[0]),
+			(unsigned long long)(event->args[1]),
+			(unsigned long long)(event->args[2])
+		);
+	}
+}
+
+
+
+
+/*************************/
+/* video encoder testing */
+/*************************/
+
+
+/* Encodes bench->num_frames frames, and stores the encoded frames in stream.
+ * If result is not NULL, the measurements are stored there. */
+static int bench_encode(Bench *bench, CodecEntry const *codec, Resolution const *resolution, StoredStream *stream, BenchResult *result)
+{
+	ImxVpuEncOpenParams open_params;
+	ImxVpuEncInitialInfo initial_info;
+	ImxVpuEncParams enc_params;
+	ImxVpuEncStats stats;
+	ImxVpuFramebufferSizes calculated_sizes;
+	ImxVpuEncoder *encoder = NULL;
+	ImxVpuDMABuffer *bitstream_buffer = NULL;
+	size_t bitstream_buffer_size;
+	unsigned int bitstream_buffer_alignment;
+	ImxVpuFramebuffer *framebuffers = NULL;
+	ImxVpuDMABuffer **fb_dmabuffers = NULL;
+	unsigned int num_framebuffers = 0;
+	ImxVpuFramebuffer input_framebuffers[NUM_INPUT_FRAMES];
+	ImxVpuDMABuffer *input_dmabuffers[NUM_INPUT_FRAMES];
+	LatencyList latencies;
+	ImxVpuEncReturnCodes ret;
+	unsigned int i;
+	int ok = 0;
+
+	memset(input_dmabuffers, 0, sizeof(input_dmabuffers));
+	latency_list_init(&latencies, bench->num_warmup_frames);
+
+	memset(&open_params, 0, sizeof(open_params));
+	imx_vpu_enc_set_default_open_params(codec->codec_format, &open_params);
+	open_params.bitrate = 0;
+	open_params.frame_width = resolution->width;
+	open_params.frame_height = resolution->height;
+	open_params.frame_rate_numerator = FPS_N;
+	open_params.frame_rate_denominator = FPS_D;
+	open_params.color_format = IMX_VPU_COLOR_FORMAT_YUV420;
+	if (codec->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
+		open_params.codec_params.mjpeg_params.quality_factor = JPEG_QUALITY_FACTOR;
+
+	imx_vpu_enc_get_bitstream_buffer_info(&bitstream_buffer_size, &bitstream_buffer_alignment);
+	bitstream_buffer = imx_vpu_dma_buffer_allocate(imx_vpu_enc_get_default_allocator(), bitstream_buffer_size, bitstream_buffer_alignment, 0);
+	if (bitstream_buffer == NULL)
+	{
+		fprintf(stderr, "could not allocate bitstream buffer\n");
+		goto cleanup;
+	}
+
+	if ((ret = imx_vpu_enc_open(&encoder, &open_params, bitstream_buffer)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not open encoder: %s\n", imx_vpu_enc_error_string(ret));
+		encoder = NULL;
+		goto cleanup;
+	}
+
+	if ((ret = imx_vpu_enc_get_initial_info(encoder, &initial_info)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not get initial info: %s\n", imx_vpu_enc_error_string(ret));
+		goto cleanup;
+	}
+
+	imx_vpu_calc_framebuffer_sizes(open_params.color_format, resolution->width, resolution->height, initial_info.framebuffer_alignment, 0, 0, &calculated_sizes);
+
+	num_framebuffers = initial_info.min_num_required_framebuffers;
+	framebuffers = calloc(num_framebuffers, sizeof(ImxVpuFramebuffer));
+	fb_dmabuffers = calloc(num_framebuffers, sizeof(ImxVpuDMABuffer*));
+	if ((framebuffers == NULL) || (fb_dmabuffers == NULL))
+		goto cleanup;
+
+	for (i = 0; i < num_framebuffers; ++i)
+	{
+		fb_dmabuffers[i] = imx_vpu_dma_buffer_allocate(imx_vpu_enc_get_default_allocator(), calculated_sizes.total_size, initial_info.framebuffer_alignment, 0);
+		if (fb_dmabuffers[i] == NULL)
+		{
+			fprintf(stderr, "could not allocate framebuffer\n");
+			goto cleanup;
+		}
+		imx_vpu_fill_framebuffer_params(&(framebuffers[i]), &calculated_sizes, fb_dmabuffers[i], 0);
+	}
+
+	if ((ret = imx_vpu_enc_register_framebuffers(encoder, framebuffers, num_framebuffers)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not register framebuffers: %s\n", imx_vpu_enc_error_string(ret));
+		goto cleanup;
+	}
+
+	/* Generate the input frames before the measurements begin, so
+	 * that the pattern generation does not distort the results */
+	for (i = 0; i < NUM_INPUT_FRAMES; ++i)
+	{
+		input_dmabuffers[i] = imx_vpu_dma_buffer_allocate(imx_vpu_enc_get_default_allocator(), calculated_sizes.total_size, initial_info.framebuffer_alignment, 0);
+		if (input_dmabuffers[i] == NULL)
+		{
+			fprintf(stderr, "could not allocate input framebuffer\n");
+			goto cleanup;
+		}
+		imx_vpu_fill_framebuffer_params(&(input_framebuffers[i]), &calculated_sizes, input_dmabuffers[i], 0);
+		fill_framebuffer(&(input_framebuffers[i]), resolution->width, resolution->height, i);
+	}
+
+	memset(&enc_params, 0, sizeof(enc_params));
+	enc_params.quant_param = codec->quant_param;
+	enc_params.acquire_output_buffer = acquire_output_buffer;
+	enc_params.finish_output_buffer = finish_output_buffer;
+
+	for (i = 0; i < bench->num_frames; ++i)
+	{
+		ImxVpuRawFrame input_frame;
+		ImxVpuEncodedFrame output_frame;
+		unsigned int output_code;
+		uint64_t start_time;
+
+		memset(&input_frame, 0, sizeof(input_frame));
+		input_frame.framebuffer = &(input_framebuffers[i % NUM_INPUT_FRAMES]);
+		memset(&output_frame, 0, sizeof(output_frame));
+
+		start_time = get_time();
+		ret = imx_vpu_enc_encode(encoder, &input_frame, &output_frame, &enc_params, &output_code);
+		if (!latency_list_add(&latencies, get_time() - start_time))
+			goto cleanup;
+
+		if (ret != IMX_VPU_ENC_RETURN_CODE_OK)
+		{
+			fprintf(stderr, "could not encode frame: %s\n", imx_vpu_enc_error_string(ret));
+			free(output_frame.acquired_handle);
+			goto cleanup;
+		}
+
+		if ((output_frame.acquired_handle != NULL) && !stored_stream_add(stream, output_frame.acquired_handle, output_frame.data_size))
+		{
+			free(output_frame.acquired_handle);
+			goto cleanup;
+		}
+
+		if (result != NULL)
+			result->num_bytes += output_frame.data_size;
+	}
+
+	if (result != NULL)
+	{
+		compute_latency_stats(&latencies, result);
+		imx_vpu_enc_get_stats(encoder, &stats);
+		if (stats.totals.num_frames > 0)
+			result->mean_vpu_wait_time = stats.totals.wait_time / stats.totals.num_frames;
+	}
+
+	ok = 1;
+
+
+cleanup:
+	if (encoder != NULL)
+	{
+		if (bench->trace_file != NULL)
+		{
+			ImxVpuTraceEvent events[IMX_VPU_TRACE_RING_SIZE];
+			unsigned int num_events = imx_vpu_enc_get_trace_events(encoder, events, IMX_VPU_TRACE_RING_SIZE);
+			write_trace_run(bench, "encode", codec, resolution, events, num_events);
+		}
+
+		imx_vpu_enc_close(encoder);
+	}
+
+	for (i = 0; i < NUM_INPUT_FRAMES; ++i)
+	{
+		if (input_dmabuffers[i] != NULL)
+			imx_vpu_dma_buffer_deallocate(input_dmabuffers[i]);
+	}
+
+	if (fb_dmabuffers != NULL)
+	{
+		for (i = 0; i < num_framebuffers; ++i)
+		{
+			if (fb_dmabuffers[i] != NULL)
+				imx_vpu_dma_buffer_deallocate(fb_dmabuffers[i]);
+		}
+		free(fb_dmabuffers);
+	}
+	free(framebuffers);
+
+	if (bitstream_buffer != NULL)
+		imx_vpu_dma_buffer_deallocate(bitstream_buffer);
+
+	latency_list_cleanup(&latencies);
+
+	if (result != NULL)
+		result->ok = ok;
+
+	return ok;
+}
+
+
+
+
+/*************************/
+/* video decoder testing */
+/*************************/
+
+
+typedef struct
+{
+	ImxVpuFramebuffer *framebuffers;
+	ImxVpuDMABuffer **fb_dmabuffers;
+	unsigned int num_framebuffers;
+}
+DecodeFramebuffers;
+
+
+static void free_decode_framebuffers(DecodeFramebuffers *dec_framebuffers)
+{
+	unsigned int i;
+
+	if (dec_framebuffers->fb_dmabuffers != NULL)
+	{
+		for (i = 0; i < dec_framebuffers->num_framebuffers; ++i)
+		{
+			if (dec_framebuffers->fb_dmabuffers[i] != NULL)
+				imx_vpu_dma_buffer_deallocate(dec_framebuffers->fb_dmabuffers[i]);
+		}
+		free(dec_framebuffers->fb_dmabuffers);
+	}
+	free(dec_framebuffers->framebuffers);
+
+	memset(dec_framebuffers, 0, sizeof(DecodeFramebuffers));
+}
+
+
+static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *new_initial_info, unsigned int output_code, void *user_data)
+{
+	DecodeFramebuffers *dec_framebuffers = (DecodeFramebuffers *)user_data;
+	ImxVpuFramebufferSizes calculated_sizes;
+	unsigned int i;
+
+	((void)(output_code));
+
+	free_decode_framebuffers(dec_framebuffers);
+
+	imx_vpu_calc_framebuffer_sizes(
+		new_initial_info->color_format,
+		new_initial_info->frame_width,
+		new_initial_info->frame_height,
+		new_initial_info->framebuffer_alignment,
+		new_initial_info->interlacing,
+		0,
+		&calculated_sizes
+	);
+
+	dec_framebuffers->num_framebuffers = new_initial_info->min_num_required_framebuffers;
+	dec_framebuffers->framebuffers = calloc(dec_framebuffers->num_framebuffers, sizeof(ImxVpuFramebuffer));
+	dec_framebuffers->fb_dmabuffers = calloc(dec_framebuffers->num_framebuffers, sizeof(ImxVpuDMABuffer*));
+	if ((dec_framebuffers->framebuffers == NULL) || (dec_framebuffers->fb_dmabuffers == NULL))
+		return 0;
+
+	for (i = 0; i < dec_framebuffers->num_framebuffers; ++i)
+	{
+		dec_framebuffers->fb_dmabuffers[i] = imx_vpu_dma_buffer_allocate(imx_vpu_dec_get_default_allocator(), calculated_sizes.total_size, new_initial_info->framebuffer_alignment, 0);
+		if (dec_framebuffers->fb_dmabuffers[i] == NULL)
+		{
+			fprintf(stderr, "could not allocate framebuffer\n");
+			return 0;
+		}
+		imx_vpu_fill_framebuffer_params(&(dec_framebuffers->framebuffers[i]), &calculated_sizes, dec_framebuffers->fb_dmabuffers[i], 0);
+	}
+
+	return imx_vpu_dec_register_framebuffers(decoder, dec_framebuffers->framebuffers, dec_framebuffers->num_framebuffers) == IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+/* Decodes one frame (or, in drain mode, retrieves one queued frame), and
+ * returns the decoded frame right away. Returns 0 on error, 1 if decoding
+ * can continue, and 2 if the decoder reported EOS. */
+static int decode_one_frame(ImxVpuDecoder *decoder, ImxVpuEncodedFrame *encoded_frame, LatencyList *latencies)
+{
+	ImxVpuDecReturnCodes ret;
+	unsigned int output_code;
+	uint64_t start_time;
+
+	start_time = get_time();
+	ret = imx_vpu_dec_decode(decoder, encoded_frame, &output_code);
+	if (!latency_list_add(latencies, get_time() - start_time))
+		return 0;
+
+	if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not decode frame: %s\n", imx_vpu_dec_error_string(ret));
+		return 0;
+	}
+
+	if (output_code & IMX_VPU_DEC_OUTPUT_CODE_VIDEO_PARAMS_CHANGED)
+	{
+		fprintf(stderr, "unexpected video parameter change\n");
+		return 0;
+	}
+
+	if (output_code & IMX_VPU_DEC_OUTPUT_CODE_DECODED_FRAME_AVAILABLE)
+	{
+		ImxVpuRawFrame decoded_frame;
+		imx_vpu_dec_get_decoded_frame(decoder, &decoded_frame);
+		imx_vpu_dec_mark_framebuffer_as_displayed(decoder, decoded_frame.framebuffer);
+	}
+	else if (output_code & IMX_VPU_DEC_OUTPUT_CODE_DROPPED)
+		imx_vpu_dec_get_dropped_frame_info(decoder, NULL, NULL, NULL);
+
+	return (output_code & IMX_VPU_DEC_OUTPUT_CODE_EOS) ? 2 : 1;
+}
+
+
+static int bench_decode(Bench *bench, CodecEntry const *codec, Resolution const *resolution, StoredStream const *stream, BenchResult *result)
+{
+	ImxVpuDecOpenParams open_params;
+	ImxVpuDecStats stats;
+	ImxVpuDecoder *decoder = NULL;
+	ImxVpuDMABuffer *bitstream_buffer = NULL;
+	size_t bitstream_buffer_size;
+	unsigned int bitstream_buffer_alignment;
+	DecodeFramebuffers dec_framebuffers;
+	ImxVpuEncodedFrame encoded_frame;
+	LatencyList latencies;
+	ImxVpuDecReturnCodes ret;
+	unsigned int i;
+	int ok = 0, dret = 1;
+
+	memset(&dec_framebuffers, 0, sizeof(dec_framebuffers));
+	latency_list_init(&latencies, bench->num_warmup_frames);
+
+	memset(&open_params, 0, sizeof(open_params));
+	open_params.codec_format = codec->codec_format;
+	open_params.enable_frame_reordering = (codec->codec_format == IMX_VPU_CODEC_FORMAT_H264);
+	open_params.frame_width = resolution->width;
+	open_params.frame_height = resolution->height;
+
+	imx_vpu_dec_get_bitstream_buffer_info(&bitstream_buffer_size, &bitstream_buffer_alignment);
+	bitstream_buffer = imx_vpu_dma_buffer_allocate(imx_vpu_dec_get_default_allocator(), bitstream_buffer_size, bitstream_buffer_alignment, 0);
+	if (bitstream_buffer == NULL)
+	{
+		fprintf(stderr, "could not allocate bitstream buffer\n");
+		goto cleanup;
+	}
+
+	if ((ret = imx_vpu_dec_open(&decoder, &open_params, bitstream_buffer, initial_info_callback, &dec_framebuffers)) != IMX_VPU_DEC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not open decoder: %s\n", imx_vpu_dec_error_string(ret));
+		decoder = NULL;
+		goto cleanup;
+	}
+
+	memset(&encoded_frame, 0, sizeof(encoded_frame));
+
+	for (i = 0; (i < stream->num_frames) && (dret == 1); ++i)
+	{
+		encoded_frame.data = stream->frames[i].data;
+		encoded_frame.data_size = stream->frames[i].size;
+		result->num_bytes += stream->frames[i].size;
+
+		if ((dret = decode_one_frame(decoder, &encoded_frame, &latencies)) == 0)
+			goto cleanup;
+	}
+
+	/* Retrieve the frames that are still queued inside the decoder */
+	imx_vpu_dec_enable_drain_mode(decoder, 1);
+	encoded_frame.data = NULL;
+	encoded_frame.data_size = 0;
+	while (dret == 1)
+	{
+		if ((dret = decode_one_frame(decoder, &encoded_frame, &latencies)) == 0)
+			goto cleanup;
+	}
+
+	compute_latency_stats(&latencies, result);
+	imx_vpu_dec_get_stats(decoder, &stats);
+	if (stats.totals.num_frames > 0)
+		result->mean_vpu_wait_time = stats.totals.wait_time / stats.totals.num_frames;
+
+	ok = 1;
+
+
+cleanup:
+	if (decoder != NULL)
+	{
+		if (bench->trace_file != NULL)
+		{
+			ImxVpuTraceEvent events[IMX_VPU_TRACE_RING_SIZE];
+			unsigned int num_events = imx_vpu_dec_get_trace_events(decoder, events, IMX_VPU_TRACE_RING_SIZE);
+			write_trace_run(bench, "decode", codec, resolution, events, num_events);
+		}
+
+		imx_vpu_dec_close(decoder);
+	}
+
+	free_decode_framebuffers(&dec_framebuffers);
+
+	if (bitstream_buffer != NULL)
+		imx_vpu_dma_buffer_deallocate(bitstream_buffer);
+
+	latency_list_cleanup(&latencies);
+
+	result->ok = ok;
+
+	return ok;
+}
+
+
+
+
+/****************/
+/* JPEG testing */
+/****************/
+
+
+static int bench_jpeg(Bench *bench, Resolution const *resolution)
+{
+	ImxVpuJPEGEncoder *jpeg_encoder = NULL;
+	ImxVpuJPEGDecoder *jpeg_decoder = NULL;
+	ImxVpuJPEGEncParams enc_params;
+	ImxVpuFramebuffer input_framebuffers[NUM_INPUT_FRAMES];
+	ImxVpuDMABuffer *input_dmabuffers[NUM_INPUT_FRAMES];
+	LatencyList enc_latencies, dec_latencies, roundtrip_latencies;
+	BenchResult *enc_result, *dec_result, *roundtrip_result;
+	unsigned int width = resolution->width, height = resolution->height;
+	unsigned int y_size = width * height, cbcr_size = width * height / 4;
+	ImxVpuEncReturnCodes enc_ret;
+	ImxVpuDecReturnCodes dec_ret;
+	unsigned int i;
+	int ok = 0;
+
+	memset(input_dmabuffers, 0, sizeof(input_dmabuffers));
+	latency_list_init(&enc_latencies, bench->num_warmup_frames);
+	latency_list_init(&dec_latencies, bench->num_warmup_frames);
+	latency_list_init(&roundtrip_latencies, bench->num_warmup_frames);
+
+	enc_result = add_result(bench, "jpeg_encode", "jpeg", width, height);
+	dec_result = add_result(bench, "jpeg_decode", "jpeg", width, height);
+	roundtrip_result = add_result(bench, "jpeg_roundtrip", "jpeg", width, height);
+	if ((enc_result == NULL) || (dec_result == NULL) || (roundtrip_result == NULL))
+		goto cleanup;
+
+	if ((enc_ret = imx_vpu_jpeg_enc_open(&jpeg_encoder, NULL)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not open JPEG encoder: %s\n", imx_vpu_enc_error_string(enc_ret));
+		jpeg_encoder = NULL;
+		goto cleanup;
+	}
+
+	if ((dec_ret = imx_vpu_jpeg_dec_open(&jpeg_decoder, NULL, 0)) != IMX_VPU_DEC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not open JPEG decoder: %s\n", imx_vpu_dec_error_string(dec_ret));
+		jpeg_decoder = NULL;
+		goto cleanup;
+	}
+
+	for (i = 0; i < NUM_INPUT_FRAMES; ++i)
+	{
+		memset(&(input_framebuffers[i]), 0, sizeof(ImxVpuFramebuffer));
+		input_framebuffers[i].y_stride = width;
+		input_framebuffers[i].cbcr_stride = width / 2;
+		input_framebuffers[i].y_offset = 0;
+		input_framebuffers[i].cb_offset = y_size;
+		input_framebuffers[i].cr_offset = y_size + cbcr_size;
+
+		input_dmabuffers[i] = imx_vpu_dma_buffer_allocate(imx_vpu_enc_get_default_allocator(), y_size + cbcr_size * 2, 1, 0);
+		if (input_dmabuffers[i] == NULL)
+		{
+			fprintf(stderr, "could not allocate input framebuffer\n");
+			goto cleanup;
+		}
+		input_framebuffers[i].dma_buffer = input_dmabuffers[i];
+		fill_framebuffer(&(input_framebuffers[i]), width, height, i);
+	}
+
+	memset(&enc_params, 0, sizeof(enc_params));
+	enc_params.frame_width = width;
+	enc_params.frame_height = height;
+	enc_params.quality_factor = JPEG_QUALITY_FACTOR;
+	enc_params.color_format = IMX_VPU_COLOR_FORMAT_YUV420;
+	enc_params.acquire_output_buffer = acquire_output_buffer;
+	enc_params.finish_output_buffer = finish_output_buffer;
+
+	for (i = 0; i < bench->num_frames; ++i)
+	{
+		ImxVpuJPEGDecInfo info;
+		void *acquired_handle = NULL;
+		size_t output_buffer_size = 0;
+		uint64_t t0, t1, t2;
+		int frame_ok;
+
+		t0 = get_time();
+		enc_ret = imx_vpu_jpeg_enc_encode(jpeg_encoder, &(input_framebuffers[i % NUM_INPUT_FRAMES]), &enc_params, &acquired_handle, &output_buffer_size);
+		t1 = get_time();
+
+		if (enc_ret != IMX_VPU_ENC_RETURN_CODE_OK)
+		{
+			fprintf(stderr, "could not encode JPEG: %s\n", imx_vpu_enc_error_string(enc_ret));
+			free(acquired_handle);
+			goto cleanup;
+		}
+
+		dec_ret = imx_vpu_jpeg_dec_decode(jpeg_decoder, acquired_handle, output_buffer_size);
+		t2 = get_time();
+
+		enc_result->num_bytes += output_buffer_size;
+		dec_result->num_bytes += output_buffer_size;
+		roundtrip_result->num_bytes += output_buffer_size;
+		free(acquired_handle);
+
+		if (dec_ret != IMX_VPU_DEC_RETURN_CODE_OK)
+		{
+			fprintf(stderr, "could not decode JPEG: %s\n", imx_vpu_dec_error_string(dec_ret));
+			goto cleanup;
+		}
+
+		imx_vpu_jpeg_dec_get_info(jpeg_decoder, &info);
+		if (info.framebuffer == NULL)
+		{
+			fprintf(stderr, "JPEG decoder did not produce a frame\n");
+			goto cleanup;
+		}
+		imx_vpu_jpeg_dec_frame_finished(jpeg_decoder, info.framebuffer);
+
+		frame_ok = latency_list_add(&enc_latencies, t1 - t0);
+		frame_ok = frame_ok && latency_list_add(&dec_latencies, t2 - t1);
+		frame_ok = frame_ok && latency_list_add(&roundtrip_latencies, t2 - t0);
+		if (!frame_ok)
+			goto cleanup;
+	}
+
+	compute_latency_stats(&enc_latencies, enc_result);
+	compute_latency_stats(&dec_latencies, dec_result);
+	compute_latency_stats(&roundtrip_latencies, roundtrip_result);
+
+	ok = 1;
+
+
+cleanup:
+	if (jpeg_decoder != NULL)
+		imx_vpu_jpeg_dec_close(jpeg_decoder);
+	if (jpeg_encoder != NULL)
+		imx_vpu_jpeg_enc_close(jpeg_encoder);
+
+	for (i = 0; i < NUM_INPUT_FRAMES; ++i)
+	{
+		if (input_dmabuffers[i] != NULL)
+			imx_vpu_dma_buffer_deallocate(input_dmabuffers[i]);
+	}
+
+	latency_list_cleanup(&enc_latencies);
+	latency_list_cleanup(&dec_latencies);
+	latency_list_cleanup(&roundtrip_latencies);
+
+	if (enc_result != NULL)
+		enc_result->ok = ok;
+	if (dec_result != NULL)
+		dec_result->ok = ok;
+	if (roundtrip_result != NULL)
+		roundtrip_result->ok = ok;
+
+	return ok;
+}
+
+
+
+
+/**********************/
+/* DMA buffer testing */
+/**********************/
+
+
+/* Allocates and deallocates framebuffer sized DMA buffers with the given
+ * allocator. Each iteration allocates NUM_INPUT_FRAMES buffers and then
+ * deallocates them again, so the allocator has to deal with more than
+ * one live buffer. */
+static int bench_dma_allocator(Bench *bench, ImxVpuDMABufferAllocator *allocator, char const *alloc_test, char const *dealloc_test, Resolution const *resolution, size_t size)
+{
+	ImxVpuDMABuffer *buffers[NUM_INPUT_FRAMES];
+	LatencyList alloc_latencies, dealloc_latencies;
+	BenchResult *alloc_result, *dealloc_result;
+	unsigned int i, j, num_iterations;
+	int ok = 0;
+
+	memset(buffers, 0, sizeof(buffers));
+	latency_list_init(&alloc_latencies, bench->num_warmup_frames);
+	latency_list_init(&dealloc_latencies, bench->num_warmup_frames);
+
+	alloc_result = add_result(bench, alloc_test, "none", resolution->width, resolution->height);
+	dealloc_result = add_result(bench, dealloc_test, "none", resolution->width, resolution->height);
+	if ((alloc_result == NULL) || (dealloc_result == NULL))
+		goto cleanup;
+
+	num_iterations = (bench->num_frames + NUM_INPUT_FRAMES - 1) / NUM_INPUT_FRAMES;
+
+	for (i = 0; i < num_iterations; ++i)
+	{
+		for (j = 0; j < NUM_INPUT_FRAMES; ++j)
+		{
+			uint64_t start_time = get_time();
+			buffers[j] = imx_vpu_dma_buffer_allocate(allocator, size, 16, 0);
+			if (!latency_list_add(&alloc_latencies, get_time() - start_time))
+				goto cleanup;
+
+			if (buffers[j] == NULL)
+			{
+				fprintf(stderr, "could not allocate DMA buffer with %zu bytes\n", size);
+				goto cleanup;
+			}
+			alloc_result->num_bytes += size;
+		}
+
+		for (j = 0; j < NUM_INPUT_FRAMES; ++j)
+		{
+			uint64_t start_time = get_time();
+			imx_vpu_dma_buffer_deallocate(buffers[j]);
+			buffers[j] = NULL;
+			if (!latency_list_add(&dealloc_latencies, get_time() - start_time))
+				goto cleanup;
+			dealloc_result->num_bytes += size;
+		}
+	}
+
+	compute_latency_stats(&alloc_latencies, alloc_result);
+	compute_latency_stats(&dealloc_latencies, dealloc_result);
+
+	ok = 1;
+
+
+cleanup:
+	for (j = 0; j < NUM_INPUT_FRAMES; ++j)
+	{
+		if (buffers[j] != NULL)
+			imx_vpu_dma_buffer_deallocate(buffers[j]);
+	}
+
+	latency_list_cleanup(&alloc_latencies);
+	latency_list_cleanup(&dealloc_latencies);
+
+	if (alloc_result != NULL)
+		alloc_result->ok = ok;
+	if (dealloc_result != NULL)
+		dealloc_result->ok = ok;
+
+	return ok;
+}
+
+
+static int bench_dma(Bench *bench, Resolution const *resolution)
+{
+	ImxVpuFramebufferSizes calculated_sizes;
+	ImxVpuDMABufferPool *pool;
+	int ok;
+
+	imx_vpu_calc_framebuffer_sizes(IMX_VPU_COLOR_FORMAT_YUV420, resolution->width, resolution->height, 16, 0, 0, &calculated_sizes);
+
+	ok = bench_dma_allocator(bench, imx_vpu_dec_get_default_allocator(), "dma_allocate", "dma_deallocate", resolution, calculated_sizes.total_size);
+
+	pool = imx_vpu_dma_buffer_pool_create(imx_vpu_dec_get_default_allocator(), 0);
+	if (pool == NULL)
+	{
+		fprintf(stderr, "could not create DMA buffer pool\n");
+		return 0;
+	}
+
+	ok = bench_dma_allocator(bench, imx_vpu_dma_buffer_pool_get_allocator(pool), "dma_pool_allocate", "dma_pool_deallocate", resolution, calculated_sizes.total_size) && ok;
+
+	imx_vpu_dma_buffer_pool_destroy(pool);
+
+	return ok;
+}
+
+
+
+
+/**********************/
+/* conversion testing */
+/**********************/
+
+
+typedef struct
+{
+	/* Test names for the SIMD and the scalar implementation */
+	char const *simd_test, *scalar_test;
+	/* Format of the system memory image. For conversions into
+	 * framebuffers, this is the source, otherwise the destination. */
+	ImxVpuImageFormat image_format;
+	int chroma_interleave;
+	int to_framebuffer;
+}
+ConvertEntry;
+
+
+static ConvertEntry const conversions[] =
+{
+	{ "convert_i420_to_nv12_neon", "convert_i420_to_nv12_scalar", IMX_VPU_IMAGE_FORMAT_I420, 1, 1 },
+	{ "convert_nv12_to_i420_neon", "convert_nv12_to_i420_scalar", IMX_VPU_IMAGE_FORMAT_NV12, 0, 1 },
+	{ "convert_yuyv_to_nv12_neon", "convert_yuyv_to_nv12_scalar", IMX_VPU_IMAGE_FORMAT_YUYV, 1, 1 },
+	{ "convert_yuyv_to_i420_neon", "convert_yuyv_to_i420_scalar", IMX_VPU_IMAGE_FORMAT_YUYV, 0, 1 },
+	{ "convert_rgb24_to_nv12_neon", "convert_rgb24_to_nv12_scalar", IMX_VPU_IMAGE_FORMAT_RGB24, 1, 1 },
+	{ "convert_rgba32_to_nv12_neon", "convert_rgba32_to_nv12_scalar", IMX_VPU_IMAGE_FORMAT_RGBA32, 1, 1 },
+	{ "convert_nv12_readback_to_i420_neon", "convert_nv12_readback_to_i420_scalar", IMX_VPU_IMAGE_FORMAT_I420, 1, 0 }
+};
+#define NUM_CONVERSIONS (sizeof(conversions) / sizeof(ConvertEntry))
+
+
+/* Sets up a tightly packed system memory image. If pixels is NULL, only
+ * the format, size, and strides are set. Returns the size of the image. */
+static size_t init_image(ImxVpuImage *image, ImxVpuImageFormat format, unsigned int width, unsigned int height, uint8_t *pixels)
+{
+	unsigned int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+	size_t y_size = (size_t)width * height;
+
+	memset(image, 0, sizeof(ImxVpuImage));
+	image->format = format;
+	image->width = width;
+	image->height = height;
+
+	switch (format)
+	{
+		case IMX_VPU_IMAGE_FORMAT_I420:
+			image->strides[0] = width;
+			image->strides[1] = image->strides[2] = chroma_width;
+			if (pixels != NULL)
+			{
+				image->planes[0] = pixels;
+				image->planes[1] = pixels + y_size;
+				image->planes[2] = pixels + y_size + (size_t)chroma_width * chroma_height;
+			}
+			return y_size + (size_t)chroma_width * chroma_height * 2;
+
+		case IMX_VPU_IMAGE_FORMAT_NV12:
+			image->strides[0] = width;
+			image->strides[1] = chroma_width * 2;
+			if (pixels != NULL)
+			{
+				image->planes[0] = pixels;
+				image->planes[1] = pixels + y_size;
+			}
+			return y_size + (size_t)chroma_width * chroma_height * 2;
+
+		case IMX_VPU_IMAGE_FORMAT_YUYV:
+			image->strides[0] = chroma_width * 4;
+			break;
+
+		case IMX_VPU_IMAGE_FORMAT_RGB24:
+			image->strides[0] = width * 3;
+			break;
+
+		case IMX_VPU_IMAGE_FORMAT_RGBA32:
+			image->strides[0] = width * 4;
+			break;
+
+		default:
+			return 0;
+	}
+
+	image->planes[0] = pixels;
+	return (size_t)(image->strides[0]) * height;
+}
+
+
+/* Verifies the output of a SIMD conversion against the scalar implementation.
+ * The SIMD output must already be in the framebuffer (for conversions into
+ * framebuffers) or in pixels. It is saved, the conversion is repeated with
+ * the scalar code, and both outputs are compared. Since both write the same
+ * areas, the bytes outside of these are identical as well. SIMD is enabled
+ * again afterwards. Returns 0 if the outputs differ. */
+static int check_convert_against_scalar(ConvertEntry const *conversion, ImxVpuImage *image, ImxVpuFramebuffer const *framebuffer, ImxVpuFramebufferSizes const *calculated_sizes, uint8_t *fb_virtual_address, uint8_t *pixels, size_t image_size)
+{
+	uint8_t *output = conversion->to_framebuffer ? fb_virtual_address : pixels;
+	size_t output_size = conversion->to_framebuffer ? calculated_sizes->total_size : image_size;
+	uint8_t *simd_output;
+	size_t i;
+	int ok;
+
+	simd_output = malloc(output_size);
+	if (simd_output == NULL)
+	{
+		fprintf(stderr, "could not allocate %zu bytes for the reference check\n", output_size);
+		return 0;
+	}
+	memcpy(simd_output, output, output_size);
+
+	imx_vpu_convert_enable_simd(0);
+	if (conversion->to_framebuffer)
+		ok = imx_vpu_convert_to_framebuffer(image, framebuffer, calculated_sizes, IMX_VPU_COLOR_FORMAT_YUV420, fb_virtual_address);
+	else
+		ok = imx_vpu_convert_from_framebuffer(framebuffer, calculated_sizes, IMX_VPU_COLOR_FORMAT_YUV420, fb_virtual_address, image);
+	imx_vpu_convert_enable_simd(1);
+
+	for (i = 0; ok && (i < output_size); ++i)
+	{
+		if (simd_output[i] != output[i])
+		{
+			fprintf(stderr, "first mismatch at byte %zu: SIMD %u scalar %u\n", i, (unsigned int)(simd_output[i]), (unsigned int)(output[i]));
+			ok = 0;
+		}
+	}
+
+	free(simd_output);
+
+	return ok;
+}
+
+
+/* Runs one conversion bench->num_frames times with either the SIMD or the
+ * scalar implementation. The framebuffer is mapped once for all frames,
+ * like a real application which reuses its mappings would do. */
+static int bench_convert_run(Bench *bench, ConvertEntry const *conversion, int use_simd, Resolution const *resolution)
+{
+	ImxVpuFramebufferSizes calculated_sizes;
+	ImxVpuFramebuffer framebuffer;
+	ImxVpuDMABuffer *dma_buffer = NULL;
+	ImxVpuImage image;
+	LatencyList latencies;
+	BenchResult *result;
+	uint8_t *fb_virtual_address = NULL;
+	uint8_t *pixels = NULL;
+	size_t image_size, i;
+	unsigned int frame;
+	int ok = 0;
+
+	latency_list_init(&latencies, bench->num_warmup_frames);
+
+	result = add_result(bench, use_simd ? conversion->simd_test : conversion->scalar_test, "none", resolution->width, resolution->height);
+	if (result == NULL)
+		goto cleanup;
+
+	imx_vpu_convert_enable_simd(use_simd);
+
+	imx_vpu_calc_framebuffer_sizes(IMX_VPU_COLOR_FORMAT_YUV420, resolution->width, resolution->height, 16, 0, conversion->chroma_interleave, &calculated_sizes);
+
+	dma_buffer = imx_vpu_dma_buffer_allocate(imx_vpu_dec_get_default_allocator(), calculated_sizes.total_size, 16, 0);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "could not allocate framebuffer\n");
+		goto cleanup;
+	}
+	imx_vpu_fill_framebuffer_params(&framebuffer, &calculated_sizes, dma_buffer, NULL);
+
+	fb_virtual_address = imx_vpu_dma_buffer_map(dma_buffer, IMX_VPU_MAPPING_FLAG_READ | IMX_VPU_MAPPING_FLAG_WRITE);
+	if (fb_virtual_address == NULL)
+	{
+		fprintf(stderr, "could not map framebuffer\n");
+		goto cleanup;
+	}
+
+	image_size = init_image(&image, conversion->image_format, resolution->width, resolution->height, NULL);
+	pixels = malloc(image_size);
+	if (pixels == NULL)
+	{
+		fprintf(stderr, "could not allocate %zu bytes for the image\n", image_size);
+		goto cleanup;
+	}
+	init_image(&image, conversion->image_format, resolution->width, resolution->height, pixels);
+
+	/* Fill the source with a gradient, so the chroma averaging does not
+	 * operate on constant values */
+	if (conversion->to_framebuffer)
+	{
+		for (i = 0; i < image_size; ++i)
+			pixels[i] = (uint8_t)(i * 7);
+	}
+	else
+	{
+		for (i = 0; i < calculated_sizes.total_size; ++i)
+			fb_virtual_address[i] = (uint8_t)(i * 7);
+	}
+
+	for (frame = 0; frame < bench->num_frames; ++frame)
+	{
+		uint64_t start_time = get_time();
+		int convert_ok;
+
+		if (conversion->to_framebuffer)
+			convert_ok = imx_vpu_convert_to_framebuffer(&image, &framebuffer, &calculated_sizes, IMX_VPU_COLOR_FORMAT_YUV420, fb_virtual_address);
+		else
+			convert_ok = imx_vpu_convert_from_framebuffer(&framebuffer, &calculated_sizes, IMX_VPU_COLOR_FORMAT_YUV420, fb_virtual_address, &image);
+
+		if (!latency_list_add(&latencies, get_time() - start_time))
+			goto cleanup;
+
+		if (!convert_ok)
+		{
+			fprintf(stderr, "conversion %s failed\n", result->test);
+			goto cleanup;
+		}
+
+		result->num_bytes += image_size;
+	}
+
+	compute_latency_stats(&latencies, result);
+
+	/* The SIMD output must match the plain C reference exactly */
+	if (use_simd && !check_convert_against_scalar(conversion, &image, &framebuffer, &calculated_sizes, fb_virtual_address, pixels, image_size))
+	{
+		fprintf(stderr, "conversion %s does not match the scalar reference\n", result->test);
+		goto cleanup;
+	}
+
+	ok = 1;
+
+
+cleanup:
+	free(pixels);
+
+	if (fb_virtual_address != NULL)
+		imx_vpu_dma_buffer_unmap(dma_buffer);
+	if (dma_buffer != NULL)
+		imx_vpu_dma_buffer_deallocate(dma_buffer);
+
+	latency_list_cleanup(&latencies);
+
+	if (result != NULL)
+		result->ok = ok;
+
+	return ok;
+}
+
+
+static int bench_convert(Bench *bench, Resolution const *resolution)
+{
+	unsigned int i;
+	int ok = 1;
+
+	/* The SIMD variants are only run if the library was built with
+	 * NEON support; otherwise, they would just measure the scalar code */
+	if (imx_vpu_convert_has_simd())
+	{
+		for (i = 0; i < NUM_CONVERSIONS; ++i)
+			ok = bench_convert_run(bench, &(conversions[i]), 1, resolution) && ok;
+	}
+
+	for (i = 0; i < NUM_CONVERSIONS; ++i)
+		ok = bench_convert_run(bench, &(conversions[i]), 0, resolution) && ok;
+
+	imx_vpu_convert_enable_simd(1);
+
+	return ok;
+}
+
+
+
+
+/**********/
+/* output */
+/**********/
+
+
+static void write_json(Bench *bench, FILE *fout)
+{
+	unsigned int i;
+
+	fprintf(fout, "{\n");
+	fprintf(fout, "\t\"backend\": \"%s\",\n", IMXVPU_BENCH_BACKEND);
+	fprintf(fout, "\t\"version\": \"%s\",\n", IMXVPU_BENCH_VERSION);
+	fprintf(fout, "\t\"num_frames\": %u,\n", bench->num_frames);
+	fprintf(fout, "\t\"num_warmup_frames\": %u,\n", bench->num_warmup_frames);
+	fprintf(fout, "\t\"results\": [\n");
+
+	for (i = 0; i < bench->num_results; ++i)
+	{
+		BenchResult const *r = &(bench->results[i]);
+
+		fprintf(fout, "\t\t{ ");
+		fprintf(fout, "\"test\": \"%s\", \"codec\": \"%s\", \"width\": %u, \"height\": %u, ", r->test, r->codec, r->width, r->height);
+		fprintf(fout, "\"ok\": %s, \"frames\": %lu, \"bytes\": %llu, ", r->ok ? "true" : "false", r->num_frames, (unsigned long long)(r->num_bytes));
+		fprintf(fout, "\"busy_time_us\": %llu, \"fps\": %.2f, ", (unsigned long long)(r->busy_time), r->fps);
+		fprintf(
+			fout,
+			"\"latency_us\": { \"min\": %llu, \"mean\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu }, ",
+			(unsigned long long)(r->min_latency), (unsigned long long)(r->mean_latency),
+			(unsigned long long)(r->p50_latency), (unsigned long long)(r->p90_latency),
+			(unsigned long long)(r->p99_latency), (unsigned long long)(r->max_latency)
+		);
+		fprintf(fout, "\"mean_vpu_wait_us\": %llu }%s\n", (unsigned long long)(r->mean_vpu_wait_time), (i + 1 < bench->num_results) ? "," : "");
+	}
+
+	fprintf(fout, "\t]\n");
+	fprintf(fout, "}\n");
+}
+
+
+static void write_csv(Bench *bench, FILE *fout)
+{
+	unsigned int i;
+
+	fprintf(fout, "backend,version,test,codec,width,height,ok,frames,bytes,busy_time_us,fps,min_us,mean_us,p50_us,p90_us,p99_us,max_us,mean_vpu_wait_us\n");
+
+	for (i = 0; i < bench->num_results; ++i)
+	{
+		BenchResult const *r = &(bench->results[i]);
+
+		fprintf(
+			fout,
+			"%s,%s,%s,%s,%u,%u,%d,%lu,%llu,%llu,%.2f,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+			IMXVPU_BENCH_BACKEND, IMXVPU_BENCH_VERSION,
+			r->test, r->codec, r->width, r->height, r->ok,
+			r->num_frames, (unsigned long long)(r->num_bytes),
+			(unsigned long long)(r->busy_time), r->fps,
+			(unsigned long long)(r->min_latency), (unsigned long long)(r->mean_latency),
+			(unsigned long long)(r->p50_latency), (unsigned long long)(r->p90_latency),
+			(unsigned long long)(r->p99_latency), (unsigned long long)(r->max_latency),
+			(unsigned long long)(r->mean_vpu_wait_time)
+		);
+	}
+}
+
+
+
+
+/*************************/
+/* command line handling */
+/*************************/
+
+
+static void usage(char *progname)
+{
+	static char options[] =
+		"\t-t tests to run, comma separated (encode,decode,jpeg,dma,convert; default: all)\n"
+		"\t-c codec formats for encode and decode, comma separated (h264,mpeg4,mjpeg; default: all)\n"
+		"\t-r resolutions, comma separated, in WIDTHxHEIGHT format (default: 320x240,640x480,1280x720,1920x1088)\n"
+		"\t-n number of frames per run (default: 100)\n"
+		"\t-w number of warmup frames per run which are excluded from the results (default: 5)\n"
+		"\t-f output format (json or csv; default: json)\n"
+		"\t-o output file (default: stdout)\n"
+		"\t-T trace output file; the last trace events of each encode and decode run are written there\n"
+		"\t   in the Chrome trace event JSON format (requires a library configured with --enable-tracing)\n"
+		;
+
+	fprintf(stderr, "usage:\t%s [option]\n\noption:\n%s\n", progname, options);
+}
+
+
+static int parse_tests(char *str, unsigned int *tests)
+{
+	char *token, *saveptr = NULL;
+
+	*tests = 0;
+
+	for (token = strtok_r(str, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr))
+	{
+		if (strcmp(token, "encode") == 0)
+			*tests |= TEST_ENCODE;
+		else if (strcmp(token, "decode") == 0)
+			*tests |= TEST_DECODE;
+		else if (strcmp(token, "jpeg") == 0)
+			*tests |= TEST_JPEG;
+		else if (strcmp(token, "dma") == 0)
+			*tests |= TEST_DMA;
+		else if (strcmp(token, "convert") == 0)
+			*tests |= TEST_CONVERT;
+		else
+		{
+			fprintf(stderr, "unknown test \"%s\"\n", token);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+static int parse_codecs(char *str, int *codec_enabled)
+{
+	char *token, *saveptr = NULL;
+	unsigned int i;
+
+	memset(codec_enabled, 0, sizeof(int) * NUM_CODECS);
+
+	for (token = strtok_r(str, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr))
+	{
+		for (i = 0; i < NUM_CODECS; ++i)
+		{
+			if (strcmp(token, codecs[i].name) == 0)
+				break;
+		}
+
+		if (i == NUM_CODECS)
+		{
+			fprintf(stderr, "unknown codec format \"%s\"\n", token);
+			return 0;
+		}
+
+		codec_enabled[i] = 1;
+	}
+
+	return 1;
+}
+
+
+static int parse_resolutions(char *str, Resolution *resolutions, unsigned int *num_resolutions)
+{
+	char *token, *saveptr = NULL;
+
+	*num_resolutions = 0;
+
+	for (token = strtok_r(str, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr))
+	{
+		if (*num_resolutions >= MAX_NUM_RESOLUTIONS)
+		{
+			fprintf(stderr, "too many resolutions; at most %d can be given\n", MAX_NUM_RESOLUTIONS);
+			return 0;
+		}
+
+		if (!parse_resolution(token, &(resolutions[*num_resolutions])))
+		{
+			fprintf(stderr, "invalid resolution \"%s\"\n", token);
+			return 0;
+		}
+
+		(*num_resolutions)++;
+	}
+
+	return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	Bench bench;
+	OutputFormat output_format = OUTPUT_FORMAT_JSON;
+	char *output_filename = NULL;
+	char *trace_filename = NULL;
+	FILE *fout = stdout;
+	unsigned int i, j;
+	int opt, ok = 1;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.num_frames = DEFAULT_NUM_FRAMES;
+	bench.num_warmup_frames = DEFAULT_NUM_WARMUP_FRAMES;
+	bench.tests = TEST_ENCODE | TEST_DECODE | TEST_JPEG | TEST_DMA | TEST_CONVERT;
+	for (i = 0; i < NUM_CODECS; ++i)
+		bench.codec_enabled[i] = 1;
+	memcpy(bench.resolutions, default_resolutions, sizeof(default_resolutions));
+	bench.num_resolutions = NUM_DEFAULT_RESOLUTIONS;
+
+	while ((opt = getopt(argc, argv, "t:c:r:n:w:f:o:T:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 't':
+				if (!parse_tests(optarg, &(bench.tests)))
+					return 1;
+				break;
+			case 'c':
+				if (!parse_codecs(optarg, bench.codec_enabled))
+					return 1;
+				break;
+			case 'r':
+				if (!parse_resolutions(optarg, bench.resolutions, &(bench.num_resolutions)))
+					return 1;
+				break;
+			case 'n':
+				bench.num_frames = strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				bench.num_warmup_frames = strtoul(optarg, NULL, 10);
+				break;
+			case 'f':
+				if (strcmp(optarg, "json") == 0)
+					output_format = OUTPUT_FORMAT_JSON;
+				else if (strcmp(optarg, "csv") == 0)
+					output_format = OUTPUT_FORMAT_CSV;
+				else
+				{
+					fprintf(stderr, "unknown output format \"%s\"\n", optarg);
+					return 1;
+				}
+				break;
+			case 'o':
+				output_filename = optarg;
+				break;
+			case 'T':
+				trace_filename = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (bench.num_frames <= bench.num_warmup_frames)
+	{
+		fprintf(stderr, "number of frames must be larger than the number of warmup frames\n");
+		return 1;
+	}
+
+	bench.max_num_results = bench.num_resolutions * MAX_NUM_RESULTS_PER_RESOLUTION;
+	bench.results = calloc(bench.max_num_results, sizeof(BenchResult));
+	if (bench.results == NULL)
+	{
+		fprintf(stderr, "could not allocate memory for results\n");
+		return 1;
+	}
+
+	if (trace_filename != NULL)
+	{
+		if (!imx_vpu_trace_is_available())
+			fprintf(stderr, "the library was built without tracing support; the trace file will not contain any events\n");
+
+		bench.trace_file = fopen(trace_filename, "w");
+		if (bench.trace_file == NULL)
+		{
+			fprintf(stderr, "could not open trace file \"%s\"\n", trace_filename);
+			free(bench.results);
+			return 1;
+		}
+
+		fprintf(bench.trace_file, "{\n\t\"traceEvents\": [");
+	}
+
+	imx_vpu_set_logging_threshold(IMX_VPU_LOG_LEVEL_WARNING);
+	imx_vpu_set_logging_function(logging_fn);
+
+	imx_vpu_enc_load();
+	imx_vpu_dec_load();
+
+	fprintf(stderr, "running benchmarks with the %s backend, %u frames per run\n", IMXVPU_BENCH_BACKEND, bench.num_frames);
+
+	for (j = 0; j < bench.num_resolutions; ++j)
+	{
+		Resolution const *resolution = &(bench.resolutions[j]);
+
+		if (bench.tests & (TEST_ENCODE | TEST_DECODE))
+		{
+			for (i = 0; i < NUM_CODECS; ++i)
+			{
+				StoredStream stream;
+				BenchResult *result = NULL;
+
+				if (!bench.codec_enabled[i])
+					continue;
+
+				fprintf(stderr, "%s %ux%u\n", codecs[i].name, resolution->width, resolution->height);
+
+				memset(&stream, 0, sizeof(stream));
+
+				if (bench.tests & TEST_ENCODE)
+					result = add_result(&bench, "encode", codecs[i].name, resolution->width, resolution->height);
+
+				if (bench_encode(&bench, &(codecs[i]), resolution, &stream, result))
+				{
+					if (bench.tests & TEST_DECODE)
+					{
+						result = add_result(&bench, "decode", codecs[i].name, resolution->width, resolution->height);
+						if (result != NULL)
+							ok = bench_decode(&bench, &(codecs[i]), resolution, &stream, result) && ok;
+					}
+				}
+				else
+					ok = 0;
+
+				stored_stream_cleanup(&stream);
+			}
+		}
+
+		if (bench.tests & TEST_JPEG)
+		{
+			fprintf(stderr, "jpeg %ux%u\n", resolution->width, resolution->height);
+			ok = bench_jpeg(&bench, resolution) && ok;
+		}
+
+		if (bench.tests & TEST_DMA)
+		{
+			fprintf(stderr, "dma %ux%u\n", resolution->width, resolution->height);
+			ok = bench_dma(&bench, resolution) && ok;
+		}
+
+		if (bench.tests & TEST_CONVERT)
+		{
+			fprintf(stderr, "convert %ux%u\n", resolution->width, resolution->height);
+			ok = bench_convert(&bench, resolution) && ok;
+		}
+	}
+
+	imx_vpu_dec_unload();
+	imx_vpu_enc_unload();
+
+	if (bench.trace_file != NULL)
+	{
+		fprintf(bench.trace_file, "\n\t]\n}\n");
+		fclose(bench.trace_file);
+	}
+
+	if (output_filename != NULL)
+	{
+		fout = fopen(output_filename, "w");
+		if (fout == NULL)
+		{
+			fprintf(stderr, "could not open output file \"%s\"\n", output_filename);
+			free(bench.results);
+			return 1;
+		}
+	}
+
+	switch (output_format)
+	{
+		case OUTPUT_FORMAT_JSON: write_json(&bench, fout); break;
+		case OUTPUT_FORMAT_CSV: write_csv(&bench, fout); break;
+		default: break;
+	}
+
+	if (fout != stdout)
+		fclose(fout);
+
+	free(bench.results);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,1256 @@
+/* multi-stream stress test for the imxvpuapi decoder and encoder interfaces
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "imxvpuapi/imxvpuapi.h"
+#include "h264_utils.h"
+#include "bench_utils.h"
+
+
+
+/* This program measures how the VPU behaves when many streams compete for it.
+ * It runs N h.264 decoder and M h.264 encoder instances at the same time, each
+ * one in its own thread, and each one as fast as it can. Only the public,
+ * blocking API is used, without the scheduler. All instances live in this one
+ * process. The library lets only one frame be in flight at a time; a blocking
+ * call whose instance has to wait for another instance's frame blocks until
+ * that frame is done. (With the fslwrapper backend, the VPU wrapper
+ * serializes the calls itself.) The instances therefore compete for the VPU
+ * in whatever order the threads reach it. This shows how well that unmanaged
+ * sharing works; the scheduler (imxvpuapi_scheduler.h) is the managed
+ * alternative.
+ *
+ * Decoders loop over an h.264 byte-stream, either read from the file given with
+ * -i (for example example/test-320x240.h264), or encoded from generated frames
+ * at startup. Encoders encode generated frames.
+ *
+ * At the end of each run, these values are reported:
+ *
+ * - Frames per second of each instance, and the sums for all decoders and all
+ *   encoders (the aggregate throughput).
+ * - Fairness among the decoders and among the encoders, as Jain's fairness index
+ *   of the per-instance frame rates: (sum x)^2 / (n * sum x^2). 1.0 means all
+ *   instances got the same throughput, 1/n means one instance got everything.
+ * - Peak size of all DMA buffers allocated by the instances (bitstream buffers,
+ *   framebuffers, input frames). These are tracked with a wrapping allocator.
+ * - Peak CMA usage of the whole system (CmaTotal - CmaFree in /proc/meminfo),
+ *   sampled every SAMPLE_INTERVAL_MS milliseconds. This also includes memory
+ *   that is not allocated through the allocator, like VPU-internal buffers. If
+ *   the kernel does not report CMA usage, -1 is reported.
+ *
+ * With -s, the instance counts are increased step by step: run k uses min(k, N)
+ * decoders and min(k, M) encoders, for k = 1 .. max(N, M). This shows where the
+ * aggregate throughput stops growing. */
+
+
+
+#define DEFAULT_DURATION 10
+#define DEFAULT_WIDTH 320
+#define DEFAULT_HEIGHT 240
+#define NUM_INPUT_FRAMES 8
+#define NUM_GENERATED_STREAM_FRAMES 64
+#define SAMPLE_INTERVAL_MS 100
+#define FPS_N 25
+#define FPS_D 1
+#define QUANT_PARAM 28
+
+
+typedef enum
+{
+	OUTPUT_FORMAT_JSON,
+	OUTPUT_FORMAT_CSV
+}
+OutputFormat;
+
+
+/* Allocator which forwards to the default allocator, and keeps track of the
+ * total size of all live buffers. Instances use it from multiple threads. */
+typedef struct
+{
+	ImxVpuDMABufferAllocator parent;
+	ImxVpuDMABufferAllocator *backing_allocator;
+	pthread_mutex_t mutex;
+	size_t allocated_size, peak_allocated_size;
+}
+TrackingAllocator;
+
+
+typedef struct
+{
+	ImxVpuDMABuffer parent;
+	ImxVpuDMABuffer *backing_buffer;
+	size_t size;
+}
+TrackedDMABuffer;
+
+
+typedef struct _Stress Stress;
+
+
+typedef struct
+{
+	Stress *stress;
+	int is_encoder;
+	unsigned int index;
+	pthread_t thread;
+
+	int ok;
+	unsigned long num_frames;
+	uint64_t num_bytes;
+	uint64_t elapsed_time;
+	uint64_t latency_sum, max_latency;
+
+	/* Output buffer for encoders; grown as needed, reused for all frames */
+	uint8_t *output_buffer;
+	size_t output_buffer_size;
+}
+Instance;
+
+
+typedef struct
+{
+	unsigned int num_decoders, num_encoders;
+	int ok;
+	double decode_fps, encode_fps;
+	double decoder_fairness, encoder_fairness;
+	size_t dma_peak_size;
+	long long cma_peak_used;
+
+	Instance *instances;
+}
+RunResult;
+
+
+struct _Stress
+{
+	unsigned int max_num_decoders, max_num_encoders;
+	unsigned int duration;
+	int sweep;
+	Resolution resolution;
+	char const *input_filename;
+
+	StoredStream decoder_input;
+	TrackingAllocator allocator;
+
+	/* Used for starting all instances at the same time, after their setup */
+	pthread_barrier_t start_barrier;
+
+	RunResult *runs;
+	unsigned int num_runs;
+};
+
+
+
+
+/**********************/
+/* tracking allocator */
+/**********************/
+
+
+static ImxVpuDMABuffer* tracking_allocator_allocate(ImxVpuDMABufferAllocator *allocator, size_t size, unsigned int alignment, unsigned int flags)
+{
+	TrackingAllocator *tracking_allocator = (TrackingAllocator *)allocator;
+	TrackedDMABuffer *buffer;
+
+	buffer = malloc(sizeof(TrackedDMABuffer));
+	if (buffer == NULL)
+		return NULL;
+
+	buffer->backing_buffer = imx_vpu_dma_buffer_allocate(tracking_allocator->backing_allocator, size, alignment, flags);
+	if (buffer->backing_buffer == NULL)
+	{
+		free(buffer);
+		return NULL;
+	}
+
+	buffer->parent.allocator = allocator;
+	buffer->size = size;
+
+	pthread_mutex_lock(&(tracking_allocator->mutex));
+	tracking_allocator->allocated_size += size;
+	if (tracking_allocator->allocated_size > tracking_allocator->peak_allocated_size)
+		tracking_allocator->peak_allocated_size = tracking_allocator->allocated_size;
+	pthread_mutex_unlock(&(tracking_allocator->mutex));
+
+	return (ImxVpuDMABuffer *)buffer;
+}
+
+
+static void tracking_allocator_deallocate(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	TrackingAllocator *tracking_allocator = (TrackingAllocator *)allocator;
+	TrackedDMABuffer *tracked_buffer = (TrackedDMABuffer *)buffer;
+
+	pthread_mutex_lock(&(tracking_allocator->mutex));
+	tracking_allocator->allocated_size -= tracked_buffer->size;
+	pthread_mutex_unlock(&(tracking_allocator->mutex));
+
+	imx_vpu_dma_buffer_deallocate(tracked_buffer->backing_buffer);
+	free(tracked_buffer);
+}
+
+
+static uint8_t* tracking_allocator_map(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, unsigned int flags)
+{
+	((void)(allocator));
+	return imx_vpu_dma_buffer_map(((TrackedDMABuffer *)buffer)->backing_buffer, flags);
+}
+
+
+static void tracking_allocator_unmap(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	((void)(allocator));
+	imx_vpu_dma_buffer_unmap(((TrackedDMABuffer *)buffer)->backing_buffer);
+}
+
+
+static int tracking_allocator_get_fd(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	((void)(allocator));
+	return imx_vpu_dma_buffer_get_fd(((TrackedDMABuffer *)buffer)->backing_buffer);
+}
+
+
+static imx_vpu_phys_addr_t tracking_allocator_get_physical_address(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	((void)(allocator));
+	return imx_vpu_dma_buffer_get_physical_address(((TrackedDMABuffer *)buffer)->backing_buffer);
+}
+
+
+static size_t tracking_allocator_get_size(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	((void)(allocator));
+	return ((TrackedDMABuffer *)buffer)->size;
+}
+
+
+static void tracking_allocator_sync_for_cpu(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	((void)(allocator));
+	imx_vpu_dma_buffer_sync_for_cpu(((TrackedDMABuffer *)buffer)->backing_buffer, offset, length);
+}
+
+
+static void tracking_allocator_sync_for_device(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	((void)(allocator));
+	imx_vpu_dma_buffer_sync_for_device(((TrackedDMABuffer *)buffer)->backing_buffer, offset, length);
+}
+
+
+static ImxVpuDMABufferSyncFuncs const tracking_allocator_sync_funcs =
+{
+	tracking_allocator_sync_for_cpu,
+	tracking_allocator_sync_for_device
+};
+
+
+static void tracking_allocator_init(TrackingAllocator *allocator, ImxVpuDMABufferAllocator *backing_allocator)
+{
+	memset(allocator, 0, sizeof(TrackingAllocator));
+
+	allocator->parent.allocate = tracking_allocator_allocate;
+	allocator->parent.deallocate = tracking_allocator_deallocate;
+	allocator->parent.map = tracking_allocator_map;
+	allocator->parent.unmap = tracking_allocator_unmap;
+	allocator->parent.get_fd = tracking_allocator_get_fd;
+	allocator->parent.get_physical_address = tracking_allocator_get_physical_address;
+	allocator->parent.get_size = tracking_allocator_get_size;
+	imx_vpu_dma_buffer_allocator_set_sync_funcs(&(allocator->parent), &tracking_allocator_sync_funcs);
+	allocator->backing_allocator = backing_allocator;
+
+	pthread_mutex_init(&(allocator->mutex), NULL);
+}
+
+
+static void tracking_allocator_reset_peak(TrackingAllocator *allocator)
+{
+	pthread_mutex_lock(&(allocator->mutex));
+	allocator->peak_allocated_size = allocator->allocated_size;
+	pthread_mutex_unlock(&(allocator->mutex));
+}
+
+
+static size_t tracking_allocator_get_peak(TrackingAllocator *allocator)
+{
+	size_t peak;
+	pthread_mutex_lock(&(allocator->mutex));
+	peak = allocator->peak_allocated_size;
+	pthread_mutex_unlock(&(allocator->mutex));
+	return peak;
+}
+
+
+
+
+/******************/
+/* misc utilities */
+/******************/
+
+
+/* Returns CmaTotal - CmaFree from /proc/meminfo in bytes, or -1 if this is not available */
+static long long get_system_cma_usage(void)
+{
+	FILE *f;
+	char line[128];
+	long long total = -1, free_size = -1, value;
+
+	f = fopen("/proc/meminfo", "r");
+	if (f == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if (sscanf(line, "CmaTotal: %lld kB", &value) == 1)
+			total = value;
+		else if (sscanf(line, "CmaFree: %lld kB", &value) == 1)
+			free_size = value;
+	}
+
+	fclose(f);
+
+	if ((total < 0) || (free_size < 0))
+		return -1;
+
+	return (total - free_size) * 1024;
+}
+
+
+static double get_instance_fps(Instance const *instance)
+{
+	return (instance->elapsed_time > 0) ? ((double)(instance->num_frames) * 1000000.0 / (double)(instance->elapsed_time)) : 0.0;
+}
+
+
+static double compute_fairness(Instance const *instances, unsigned int num_instances, int encoders)
+{
+	unsigned int i, n = 0;
+	double sum = 0.0, sum_sq = 0.0;
+
+	for (i = 0; i < num_instances; ++i)
+	{
+		double fps;
+
+		if (instances[i].is_encoder != encoders)
+			continue;
+
+		fps = get_instance_fps(&(instances[i]));
+		sum += fps;
+		sum_sq += fps * fps;
+		n++;
+	}
+
+	return ((n == 0) || (sum_sq == 0.0)) ? 0.0 : ((sum * sum) / ((double)n * sum_sq));
+}
+
+
+static void* acquire_instance_output_buffer(void *context, size_t size, void **acquired_handle)
+{
+	Instance *instance = (Instance *)context;
+
+	if (size > instance->output_buffer_size)
+	{
+		uint8_t *new_buffer = realloc(instance->output_buffer, size);
+		if (new_buffer == NULL)
+			return NULL;
+		instance->output_buffer = new_buffer;
+		instance->output_buffer_size = size;
+	}
+
+	*acquired_handle = instance->output_buffer;
+	return instance->output_buffer;
+}
+
+
+static void finish_instance_output_buffer(void *context, void *acquired_handle)
+{
+	((void)(context));
+	((void)(acquired_handle));
+}
+
+
+
+
+/***********/
+/* encoder */
+/***********/
+
+
+typedef struct
+{
+	ImxVpuEncoder *encoder;
+	ImxVpuDMABuffer *bitstream_buffer;
+	ImxVpuFramebuffer *framebuffers;
+	ImxVpuDMABuffer **fb_dmabuffers;
+	unsigned int num_framebuffers;
+	ImxVpuFramebuffer input_framebuffers[NUM_INPUT_FRAMES];
+	ImxVpuDMABuffer *input_dmabuffers[NUM_INPUT_FRAMES];
+}
+EncoderSetup;
+
+
+static void encoder_setup_cleanup(EncoderSetup *setup)
+{
+	unsigned int i;
+
+	if (setup->encoder != NULL)
+		imx_vpu_enc_close(setup->encoder);
+
+	for (i = 0; i < NUM_INPUT_FRAMES; ++i)
+	{
+		if (setup->input_dmabuffers[i] != NULL)
+			imx_vpu_dma_buffer_deallocate(setup->input_dmabuffers[i]);
+	}
+
+	if (setup->fb_dmabuffers != NULL)
+	{
+		for (i = 0; i < setup->num_framebuffers; ++i)
+		{
+			if (setup->fb_dmabuffers[i] != NULL)
+				imx_vpu_dma_buffer_deallocate(setup->fb_dmabuffers[i]);
+		}
+		free(setup->fb_dmabuffers);
+	}
+	free(setup->framebuffers);
+
+	if (setup->bitstream_buffer != NULL)
+		imx_vpu_dma_buffer_deallocate(setup->bitstream_buffer);
+
+	memset(setup, 0, sizeof(EncoderSetup));
+}
+
+
+/* Opens an h.264 encoder, registers its framebuffers, and fills its input frames */
+static int encoder_setup_init(EncoderSetup *setup, ImxVpuDMABufferAllocator *allocator, Resolution const *resolution)
+{
+	ImxVpuEncOpenParams open_params;
+	ImxVpuEncInitialInfo initial_info;
+	ImxVpuFramebufferSizes calculated_sizes;
+	size_t bitstream_buffer_size;
+	unsigned int bitstream_buffer_alignment;
+	ImxVpuEncReturnCodes ret;
+	unsigned int i;
+
+	memset(setup, 0, sizeof(EncoderSetup));
+
+	memset(&open_params, 0, sizeof(open_params));
+	imx_vpu_enc_set_default_open_params(IMX_VPU_CODEC_FORMAT_H264, &open_params);
+	open_params.bitrate = 0;
+	open_params.frame_width = resolution->width;
+	open_params.frame_height = resolution->height;
+	open_params.frame_rate_numerator = FPS_N;
+	open_params.frame_rate_denominator = FPS_D;
+	open_params.additional_dmabuffers_allocator = allocator;
+
+	imx_vpu_enc_get_bitstream_buffer_info(&bitstream_buffer_size, &bitstream_buffer_alignment);
+	setup->bitstream_buffer = imx_vpu_dma_buffer_allocate(allocator, bitstream_buffer_size, bitstream_buffer_alignment, 0);
+	if (setup->bitstream_buffer == NULL)
+	{
+		fprintf(stderr, "could not allocate bitstream buffer\n");
+		goto error;
+	}
+
+	if ((ret = imx_vpu_enc_open(&(setup->encoder), &open_params, setup->bitstream_buffer)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not open encoder: %s\n", imx_vpu_enc_error_string(ret));
+		setup->encoder = NULL;
+		goto error;
+	}
+
+	if ((ret = imx_vpu_enc_get_initial_info(setup->encoder, &initial_info)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not get initial info: %s\n", imx_vpu_enc_error_string(ret));
+		goto error;
+	}
+
+	imx_vpu_calc_framebuffer_sizes(IMX_VPU_COLOR_FORMAT_YUV420, resolution->width, resolution->height, initial_info.framebuffer_alignment, 0, 0, &calculated_sizes);
+
+	setup->num_framebuffers = initial_info.min_num_required_framebuffers;
+	setup->framebuffers = calloc(setup->num_framebuffers, sizeof(ImxVpuFramebuffer));
+	setup->fb_dmabuffers = calloc(setup->num_framebuffers, sizeof(ImxVpuDMABuffer*));
+	if ((setup->framebuffers == NULL) || (setup->fb_dmabuffers == NULL))
+		goto error;
+
+	for (i = 0; i < setup->num_framebuffers; ++i)
+	{
+		setup->fb_dmabuffers[i] = imx_vpu_dma_buffer_allocate(allocator, calculated_sizes.total_size, initial_info.framebuffer_alignment, 0);
+		if (setup->fb_dmabuffers[i] == NULL)
+		{
+			fprintf(stderr, "could not allocate framebuffer\n");
+			goto error;
+		}
+		imx_vpu_fill_framebuffer_params(&(setup->framebuffers[i]), &calculated_sizes, setup->fb_dmabuffers[i], 0);
+	}
+
+	if ((ret = imx_vpu_enc_register_framebuffers(setup->encoder, setup->framebuffers, setup->num_framebuffers)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not register framebuffers: %s\n", imx_vpu_enc_error_string(ret));
+		goto error;
+	}
+
+	for (i = 0; i < NUM_INPUT_FRAMES; ++i)
+	{
+		setup->input_dmabuffers[i] = imx_vpu_dma_buffer_allocate(allocator, calculated_sizes.total_size, initial_info.framebuffer_alignment, 0);
+		if (setup->input_dmabuffers[i] == NULL)
+		{
+			fprintf(stderr, "could not allocate input framebuffer\n");
+			goto error;
+		}
+		imx_vpu_fill_framebuffer_params(&(setup->input_framebuffers[i]), &calculated_sizes, setup->input_dmabuffers[i], 0);
+		fill_framebuffer(&(setup->input_framebuffers[i]), resolution->width, resolution->height, i);
+	}
+
+	return 1;
+
+
+error:
+	encoder_setup_cleanup(setup);
+	return 0;
+}
+
+
+static int encode_frame(EncoderSetup *setup, unsigned int frame_index, ImxVpuEncParams *enc_params, ImxVpuEncodedFrame *output_frame)
+{
+	ImxVpuRawFrame input_frame;
+	ImxVpuEncReturnCodes ret;
+	unsigned int output_code;
+
+	memset(&input_frame, 0, sizeof(input_frame));
+	input_frame.framebuffer = &(setup->input_framebuffers[frame_index % NUM_INPUT_FRAMES]);
+	memset(output_frame, 0, sizeof(ImxVpuEncodedFrame));
+
+	if ((ret = imx_vpu_enc_encode(setup->encoder, &input_frame, output_frame, enc_params, &output_code)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not encode frame: %s\n", imx_vpu_enc_error_string(ret));
+		return 0;
+	}
+
+	return 1;
+}
+
+
+static void* encoder_thread(void *arg)
+{
+	Instance *instance = (Instance *)arg;
+	Stress *stress = instance->stress;
+	EncoderSetup setup;
+	ImxVpuEncParams enc_params;
+	uint64_t start_time, end_time, now;
+	unsigned int i;
+	int setup_ok;
+
+	setup_ok = encoder_setup_init(&setup, &(stress->allocator.parent), &(stress->resolution));
+
+	memset(&enc_params, 0, sizeof(enc_params));
+	enc_params.quant_param = QUANT_PARAM;
+	enc_params.acquire_output_buffer = acquire_instance_output_buffer;
+	enc_params.finish_output_buffer = finish_instance_output_buffer;
+	enc_params.output_buffer_context = instance;
+
+	/* Wait even if the setup failed, since the other threads wait for this one */
+	pthread_barrier_wait(&(stress->start_barrier));
+	if (!setup_ok)
+		return NULL;
+
+	start_time = now = get_time();
+	end_time = start_time + (uint64_t)(stress->duration) * 1000000;
+
+	for (i = 0; now < end_time; ++i)
+	{
+		ImxVpuEncodedFrame output_frame;
+		uint64_t latency, frame_start_time = now;
+
+		if (!encode_frame(&setup, i, &enc_params, &output_frame))
+			goto finish;
+
+		now = get_time();
+		latency = now - frame_start_time;
+
+		instance->num_frames++;
+		instance->num_bytes += output_frame.data_size;
+		instance->latency_sum += latency;
+		if (latency > instance->max_latency)
+			instance->max_latency = latency;
+	}
+
+	instance->ok = 1;
+
+
+finish:
+	instance->elapsed_time = now - start_time;
+	encoder_setup_cleanup(&setup);
+	return NULL;
+}
+
+
+
+
+/***********/
+/* decoder */
+/***********/
+
+
+typedef struct
+{
+	ImxVpuDMABufferAllocator *allocator;
+	ImxVpuFramebuffer *framebuffers;
+	ImxVpuDMABuffer **fb_dmabuffers;
+	unsigned int num_framebuffers;
+}
+DecoderFramebuffers;
+
+
+static void free_decoder_framebuffers(DecoderFramebuffers *dec_framebuffers)
+{
+	unsigned int i;
+
+	if (dec_framebuffers->fb_dmabuffers != NULL)
+	{
+		for (i = 0; i < dec_framebuffers->num_framebuffers; ++i)
+		{
+			if (dec_framebuffers->fb_dmabuffers[i] != NULL)
+				imx_vpu_dma_buffer_deallocate(dec_framebuffers->fb_dmabuffers[i]);
+		}
+		free(dec_framebuffers->fb_dmabuffers);
+	}
+	free(dec_framebuffers->framebuffers);
+
+	dec_framebuffers->framebuffers = NULL;
+	dec_framebuffers->fb_dmabuffers = NULL;
+	dec_framebuffers->num_framebuffers = 0;
+}
+
+
+static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *new_initial_info, unsigned int output_code, void *user_data)
+{
+	DecoderFramebuffers *dec_framebuffers = (DecoderFramebuffers *)user_data;
+	ImxVpuFramebufferSizes calculated_sizes;
+	unsigned int i;
+
+	((void)(output_code));
+
+	free_decoder_framebuffers(dec_framebuffers);
+
+	imx_vpu_calc_framebuffer_sizes(
+		new_initial_info->color_format,
+		new_initial_info->frame_width,
+		new_initial_info->frame_height,
+		new_initial_info->framebuffer_alignment,
+		new_initial_info->interlacing,
+		0,
+		&calculated_sizes
+	);
+
+	dec_framebuffers->num_framebuffers = new_initial_info->min_num_required_framebuffers;
+	dec_framebuffers->framebuffers = calloc(dec_framebuffers->num_framebuffers, sizeof(ImxVpuFramebuffer));
+	dec_framebuffers->fb_dmabuffers = calloc(dec_framebuffers->num_framebuffers, sizeof(ImxVpuDMABuffer*));
+	if ((dec_framebuffers->framebuffers == NULL) || (dec_framebuffers->fb_dmabuffers == NULL))
+		return 0;
+
+	for (i = 0; i < dec_framebuffers->num_framebuffers; ++i)
+	{
+		dec_framebuffers->fb_dmabuffers[i] = imx_vpu_dma_buffer_allocate(dec_framebuffers->allocator, calculated_sizes.total_size, new_initial_info->framebuffer_alignment, 0);
+		if (dec_framebuffers->fb_dmabuffers[i] == NULL)
+		{
+			fprintf(stderr, "could not allocate framebuffer\n");
+			return 0;
+		}
+		imx_vpu_fill_framebuffer_params(&(dec_framebuffers->framebuffers[i]), &calculated_sizes, dec_framebuffers->fb_dmabuffers[i], 0);
+	}
+
+	return imx_vpu_dec_register_framebuffers(decoder, dec_framebuffers->framebuffers, dec_framebuffers->num_framebuffers) == IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+static void* decoder_thread(void *arg)
+{
+	Instance *instance = (Instance *)arg;
+	Stress *stress = instance->stress;
+	ImxVpuDecOpenParams open_params;
+	ImxVpuDecoder *decoder = NULL;
+	ImxVpuDMABuffer *bitstream_buffer = NULL;
+	DecoderFramebuffers dec_framebuffers;
+	size_t bitstream_buffer_size;
+	unsigned int bitstream_buffer_alignment;
+	uint64_t start_time = 0, end_time, now = 0;
+	unsigned int i;
+	int setup_ok = 0;
+
+	memset(&dec_framebuffers, 0, sizeof(dec_framebuffers));
+	dec_framebuffers.allocator = &(stress->allocator.parent);
+
+	memset(&open_params, 0, sizeof(open_params));
+	open_params.codec_format = IMX_VPU_CODEC_FORMAT_H264;
+	open_params.enable_frame_reordering = 1;
+
+	imx_vpu_dec_get_bitstream_buffer_info(&bitstream_buffer_size, &bitstream_buffer_alignment);
+	bitstream_buffer = imx_vpu_dma_buffer_allocate(&(stress->allocator.parent), bitstream_buffer_size, bitstream_buffer_alignment, 0);
+	if (bitstream_buffer == NULL)
+		fprintf(stderr, "could not allocate bitstream buffer\n");
+	else if (imx_vpu_dec_open(&decoder, &open_params, bitstream_buffer, initial_info_callback, &dec_framebuffers) != IMX_VPU_DEC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not open decoder\n");
+		decoder = NULL;
+	}
+	else
+		setup_ok = 1;
+
+	/* Wait even if the setup failed, since the other threads wait for this one */
+	pthread_barrier_wait(&(stress->start_barrier));
+	if (!setup_ok)
+		goto cleanup;
+
+	start_time = now = get_time();
+	end_time = start_time + (uint64_t)(stress->duration) * 1000000;
+
+	/* Loop over the input stream until the run is over */
+	for (i = 0; now < end_time; ++i)
+	{
+		StoredFrame const *input = &(stress->decoder_input.frames[i % stress->decoder_input.num_frames]);
+		ImxVpuEncodedFrame encoded_frame;
+		ImxVpuDecReturnCodes ret;
+		unsigned int output_code;
+		uint64_t latency, frame_start_time = now;
+
+		memset(&encoded_frame, 0, sizeof(encoded_frame));
+		encoded_frame.data = input->data;
+		encoded_frame.data_size = input->size;
+
+		if ((ret = imx_vpu_dec_decode(decoder, &encoded_frame, &output_code)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		{
+			fprintf(stderr, "decoder %u could not decode frame: %s\n", instance->index, imx_vpu_dec_error_string(ret));
+			goto cleanup;
+		}
+
+		now = get_time();
+		latency = now - frame_start_time;
+
+		instance->num_bytes += input->size;
+		instance->latency_sum += latency;
+		if (latency > instance->max_latency)
+			instance->max_latency = latency;
+
+		if (output_code & IMX_VPU_DEC_OUTPUT_CODE_DECODED_FRAME_AVAILABLE)
+		{
+			ImxVpuRawFrame decoded_frame;
+			imx_vpu_dec_get_decoded_frame(decoder, &decoded_frame);
+			imx_vpu_dec_mark_framebuffer_as_displayed(decoder, decoded_frame.framebuffer);
+			instance->num_frames++;
+		}
+		else if (output_code & IMX_VPU_DEC_OUTPUT_CODE_DROPPED)
+			imx_vpu_dec_get_dropped_frame_info(decoder, NULL, NULL, NULL);
+	}
+
+	instance->ok = 1;
+
+
+cleanup:
+	instance->elapsed_time = now - start_time;
+
+	if (decoder != NULL)
+		imx_vpu_dec_close(decoder);
+	free_decoder_framebuffers(&dec_framebuffers);
+	if (bitstream_buffer != NULL)
+		imx_vpu_dma_buffer_deallocate(bitstream_buffer);
+
+	return NULL;
+}
+
+
+
+
+/*****************/
+/* decoder input */
+/*****************/
+
+
+static int load_input_file(Stress *stress)
+{
+	FILE *fin;
+	h264_context h264_ctx;
+	int ok;
+
+	fin = fopen(stress->input_filename, "rb");
+	if (fin == NULL)
+	{
+		fprintf(stderr, "could not open input file \"%s\"\n", stress->input_filename);
+		return 0;
+	}
+
+	h264_ctx_init(&h264_ctx, fin);
+
+	do
+	{
+		size_t size;
+		uint8_t *data;
+
+		ok = h264_ctx_read_access_unit(&h264_ctx);
+		if (h264_ctx.au_end_offset <= h264_ctx.au_start_offset)
+			break;
+
+		size = h264_ctx.au_end_offset - h264_ctx.au_start_offset;
+		data = malloc(size);
+		if (data == NULL)
+			break;
+		memcpy(data, h264_ctx.in_buffer + h264_ctx.au_start_offset, size);
+
+		if (!stored_stream_add(&(stress->decoder_input), data, size))
+		{
+			free(data);
+			break;
+		}
+	}
+	while (ok);
+
+	h264_ctx_cleanup(&h264_ctx);
+	fclose(fin);
+
+	return stress->decoder_input.num_frames > 0;
+}
+
+
+static int generate_input_stream(Stress *stress)
+{
+	EncoderSetup setup;
+	ImxVpuEncParams enc_params;
+	unsigned int i;
+	int ok = 0;
+
+	if (!encoder_setup_init(&setup, imx_vpu_enc_get_default_allocator(), &(stress->resolution)))
+		return 0;
+
+	memset(&enc_params, 0, sizeof(enc_params));
+	enc_params.quant_param = QUANT_PARAM;
+	enc_params.acquire_output_buffer = acquire_output_buffer;
+	enc_params.finish_output_buffer = finish_output_buffer;
+
+	for (i = 0; i < NUM_GENERATED_STREAM_FRAMES; ++i)
+	{
+		ImxVpuEncodedFrame output_frame;
+
+		if (!encode_frame(&setup, i, &enc_params, &output_frame))
+			goto finish;
+
+		if ((output_frame.acquired_handle != NULL) && !stored_stream_add(&(stress->decoder_input), output_frame.acquired_handle, output_frame.data_size))
+		{
+			free(output_frame.acquired_handle);
+			goto finish;
+		}
+	}
+
+	ok = 1;
+
+
+finish:
+	encoder_setup_cleanup(&setup);
+	return ok;
+}
+
+
+
+
+/********/
+/* runs */
+/********/
+
+
+static int run_stress(Stress *stress, unsigned int num_decoders, unsigned int num_encoders, RunResult *result)
+{
+	unsigned int i, num_instances = num_decoders + num_encoders, num_started = 0;
+	uint64_t end_time;
+	long long cma_usage;
+
+	memset(result, 0, sizeof(RunResult));
+	result->num_decoders = num_decoders;
+	result->num_encoders = num_encoders;
+	result->cma_peak_used = get_system_cma_usage();
+
+	result->instances = calloc(num_instances, sizeof(Instance));
+	if (result->instances == NULL)
+		return 0;
+
+	if (pthread_barrier_init(&(stress->start_barrier), NULL, num_instances + 1) != 0)
+		return 0;
+
+	tracking_allocator_reset_peak(&(stress->allocator));
+
+	fprintf(stderr, "running %u decoder(s) and %u encoder(s) for %u second(s)\n", num_decoders, num_encoders, stress->duration);
+
+	for (i = 0; i < num_instances; ++i)
+	{
+		Instance *instance = &(result->instances[i]);
+
+		instance->stress = stress;
+		instance->is_encoder = (i >= num_decoders);
+		instance->index = instance->is_encoder ? (i - num_decoders) : i;
+
+		if (pthread_create(&(instance->thread), NULL, instance->is_encoder ? encoder_thread : decoder_thread, instance) != 0)
+		{
+			fprintf(stderr, "could not create thread\n");
+			break;
+		}
+
+		num_started++;
+	}
+
+	if (num_started < num_instances)
+	{
+		/* The barrier can never be passed if not all threads exist, so there
+		 * is no way to stop the started ones; give up */
+		fprintf(stderr, "only %u of %u threads could be started\n", num_started, num_instances);
+		exit(1);
+	}
+
+	pthread_barrier_wait(&(stress->start_barrier));
+
+	/* Sample the system CMA usage while the instances are running */
+	end_time = get_time() + (uint64_t)(stress->duration) * 1000000;
+	while (get_time() < end_time)
+	{
+		usleep(SAMPLE_INTERVAL_MS * 1000);
+		cma_usage = get_system_cma_usage();
+		if (cma_usage > result->cma_peak_used)
+			result->cma_peak_used = cma_usage;
+	}
+
+	for (i = 0; i < num_instances; ++i)
+		pthread_join(result->instances[i].thread, NULL);
+
+	pthread_barrier_destroy(&(stress->start_barrier));
+
+	result->ok = 1;
+	for (i = 0; i < num_instances; ++i)
+	{
+		Instance *instance = &(result->instances[i]);
+
+		if (!instance->ok)
+			result->ok = 0;
+
+		if (instance->is_encoder)
+			result->encode_fps += get_instance_fps(instance);
+		else
+			result->decode_fps += get_instance_fps(instance);
+
+		free(instance->output_buffer);
+		instance->output_buffer = NULL;
+	}
+
+	result->decoder_fairness = compute_fairness(result->instances, num_instances, 0);
+	result->encoder_fairness = compute_fairness(result->instances, num_instances, 1);
+	result->dma_peak_size = tracking_allocator_get_peak(&(stress->allocator));
+
+	return 1;
+}
+
+
+
+
+/**********/
+/* output */
+/**********/
+
+
+static void write_json(Stress *stress, FILE *fout)
+{
+	unsigned int i, j;
+
+	fprintf(fout, "{\n");
+	fprintf(fout, "\t\"backend\": \"%s\",\n", IMXVPU_BENCH_BACKEND);
+	fprintf(fout, "\t\"version\": \"%s\",\n", IMXVPU_BENCH_VERSION);
+	fprintf(fout, "\t\"decoder_input\": \"%s\",\n", (stress->input_filename != NULL) ? stress->input_filename : "generated");
+	fprintf(fout, "\t\"width\": %u,\n", stress->resolution.width);
+	fprintf(fout, "\t\"height\": %u,\n", stress->resolution.height);
+	fprintf(fout, "\t\"duration_s\": %u,\n", stress->duration);
+	fprintf(fout, "\t\"runs\": [\n");
+
+	for (i = 0; i < stress->num_runs; ++i)
+	{
+		RunResult const *run = &(stress->runs[i]);
+		unsigned int num_instances = run->num_decoders + run->num_encoders;
+
+		fprintf(fout, "\t\t{\n");
+		fprintf(fout, "\t\t\t\"num_decoders\": %u, \"num_encoders\": %u, \"ok\": %s,\n", run->num_decoders, run->num_encoders, run->ok ? "true" : "false");
+		fprintf(fout, "\t\t\t\"decode_fps\": %.2f, \"encode_fps\": %.2f,\n", run->decode_fps, run->encode_fps);
+		fprintf(fout, "\t\t\t\"decoder_fairness\": %.3f, \"encoder_fairness\": %.3f,\n", run->decoder_fairness, run->encoder_fairness);
+		fprintf(fout, "\t\t\t\"dma_peak_bytes\": %zu, \"cma_peak_used_bytes\": %lld,\n", run->dma_peak_size, run->cma_peak_used);
+		fprintf(fout, "\t\t\t\"instances\": [\n");
+
+		for (j = 0; j < num_instances; ++j)
+		{
+			Instance const *instance = &(run->instances[j]);
+
+			fprintf(
+				fout,
+				"\t\t\t\t{ \"type\": \"%s\", \"index\": %u, \"ok\": %s, \"frames\": %lu, \"bytes\": %llu, \"fps\": %.2f, \"mean_latency_us\": %llu, \"max_latency_us\": %llu }%s\n",
+				instance->is_encoder ? "encoder" : "decoder",
+				instance->index,
+				instance->ok ? "true" : "false",
+				instance->num_frames,
+				(unsigned long long)(instance->num_bytes),
+				get_instance_fps(instance),
+				(unsigned long long)((instance->num_frames > 0) ? (instance->latency_sum / instance->num_frames) : 0),
+				(unsigned long long)(instance->max_latency),
+				(j + 1 < num_instances) ? "," : ""
+			);
+		}
+
+		fprintf(fout, "\t\t\t]\n");
+		fprintf(fout, "\t\t}%s\n", (i + 1 < stress->num_runs) ? "," : "");
+	}
+
+	fprintf(fout, "\t]\n");
+	fprintf(fout, "}\n");
+}
+
+
+/* Writes one row per instance, and one row with the totals for all decoders
+ * and all encoders of each run (with index "all") */
+static void write_csv(Stress *stress, FILE *fout)
+{
+	unsigned int i, j;
+
+	fprintf(fout, "backend,version,num_decoders,num_encoders,type,index,ok,frames,bytes,fps,mean_latency_us,max_latency_us,fairness,dma_peak_bytes,cma_peak_used_bytes\n");
+
+	for (i = 0; i < stress->num_runs; ++i)
+	{
+		RunResult const *run = &(stress->runs[i]);
+		unsigned int num_instances = run->num_decoders + run->num_encoders;
+
+		for (j = 0; j < num_instances; ++j)
+		{
+			Instance const *instance = &(run->instances[j]);
+
+			fprintf(
+				fout,
+				"%s,%s,%u,%u,%s,%u,%d,%lu,%llu,%.2f,%llu,%llu,,,\n",
+				IMXVPU_BENCH_BACKEND, IMXVPU_BENCH_VERSION,
+				run->num_decoders, run->num_encoders,
+				instance->is_encoder ? "encoder" : "decoder",
+				instance->index,
+				instance->ok,
+				instance->num_frames,
+				(unsigned long long)(instance->num_bytes),
+				get_instance_fps(instance),
+				(unsigned long long)((instance->num_frames > 0) ? (instance->latency_sum / instance->num_frames) : 0),
+				(unsigned long long)(instance->max_latency)
+			);
+		}
+
+		if (run->num_decoders > 0)
+			fprintf(fout, "%s,%s,%u,%u,decoder,all,%d,,,%.2f,,,%.3f,%zu,%lld\n", IMXVPU_BENCH_BACKEND, IMXVPU_BENCH_VERSION, run->num_decoders, run->num_encoders, run->ok, run->decode_fps, run->decoder_fairness, run->dma_peak_size, run->cma_peak_used);
+		if (run->num_encoders > 0)
+			fprintf(fout, "%s,%s,%u,%u,encoder,all,%d,,,%.2f,,,%.3f,%zu,%lld\n", IMXVPU_BENCH_BACKEND, IMXVPU_BENCH_VERSION, run->num_decoders, run->num_encoders, run->ok, run->encode_fps, run->encoder_fairness, run->dma_peak_size, run->cma_peak_used);
+	}
+}
+
+
+
+
+/*************************/
+/* command line handling */
+/*************************/
+
+
+static void usage(char *progname)
+{
+	static char options[] =
+		"\t-d number of h.264 decoder instances (default: 1)\n"
+		"\t-e number of h.264 encoder instances (default: 0)\n"
+		"\t-i h.264 byte-stream file for the decoders (default: encode generated frames at startup)\n"
+		"\t-r resolution of generated frames, in WIDTHxHEIGHT format (default: 320x240)\n"
+		"\t-t duration of each run, in seconds (default: 10)\n"
+		"\t-s sweep: increase the number of instances step by step, up to the given numbers\n"
+		"\t-f output format (json or csv; default: json)\n"
+		"\t-o output file (default: stdout)\n"
+		;
+
+	fprintf(stderr, "usage:\t%s [option]\n\noption:\n%s\n", progname, options);
+}
+
+
+int main(int argc, char *argv[])
+{
+	Stress stress;
+	OutputFormat output_format = OUTPUT_FORMAT_JSON;
+	char *output_filename = NULL;
+	FILE *fout = stdout;
+	unsigned int i, num_steps;
+	int opt, ok = 0;
+
+	memset(&stress, 0, sizeof(stress));
+	stress.max_num_decoders = 1;
+	stress.max_num_encoders = 0;
+	stress.duration = DEFAULT_DURATION;
+	stress.resolution.width = DEFAULT_WIDTH;
+	stress.resolution.height = DEFAULT_HEIGHT;
+
+	while ((opt = getopt(argc, argv, "d:e:i:r:t:sf:o:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd':
+				stress.max_num_decoders = strtoul(optarg, NULL, 10);
+				break;
+			case 'e':
+				stress.max_num_encoders = strtoul(optarg, NULL, 10);
+				break;
+			case 'i':
+				stress.input_filename = optarg;
+				break;
+			case 'r':
+				if (!parse_resolution(optarg, &(stress.resolution)))
+				{
+					fprintf(stderr, "invalid resolution \"%s\"\n", optarg);
+					return 1;
+				}
+				break;
+			case 't':
+				stress.duration = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				stress.sweep = 1;
+				break;
+			case 'f':
+				if (strcmp(optarg, "json") == 0)
+					output_format = OUTPUT_FORMAT_JSON;
+				else if (strcmp(optarg, "csv") == 0)
+					output_format = OUTPUT_FORMAT_CSV;
+				else
+				{
+					fprintf(stderr, "unknown output format \"%s\"\n", optarg);
+					return 1;
+				}
+				break;
+			case 'o':
+				output_filename = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if ((stress.max_num_decoders + stress.max_num_encoders) == 0)
+	{
+		fprintf(stderr, "at least one decoder or encoder is needed\n");
+		return 1;
+	}
+
+	if (stress.duration == 0)
+	{
+		fprintf(stderr, "duration must be at least one second\n");
+		return 1;
+	}
+
+	num_steps = stress.sweep ? ((stress.max_num_decoders > stress.max_num_encoders) ? stress.max_num_decoders : stress.max_num_encoders) : 1;
+	stress.runs = calloc(num_steps, sizeof(RunResult));
+	if (stress.runs == NULL)
+		return 1;
+
+	imx_vpu_set_logging_threshold(IMX_VPU_LOG_LEVEL_WARNING);
+	imx_vpu_set_logging_function(logging_fn);
+
+	/* Load the firmware here, since loading is not meant to be done
+	 * concurrently by the instance threads */
+	imx_vpu_dec_load();
+	imx_vpu_enc_load();
+
+	tracking_allocator_init(&(stress.allocator), imx_vpu_dec_get_default_allocator());
+
+	if (stress.max_num_decoders > 0)
+	{
+		if (stress.input_filename != NULL)
+			ok = load_input_file(&stress);
+		else
+			ok = generate_input_stream(&stress);
+
+		if (!ok)
+		{
+			fprintf(stderr, "could not set up the decoder input\n");
+			goto finish;
+		}
+	}
+
+	ok = 1;
+
+	for (i = 0; i < num_steps; ++i)
+	{
+		unsigned int num_decoders = stress.max_num_decoders, num_encoders = stress.max_num_encoders;
+
+		if (stress.sweep)
+		{
+			if (num_decoders > (i + 1))
+				num_decoders = i + 1;
+			if (num_encoders > (i + 1))
+				num_encoders = i + 1;
+		}
+
+		if (!run_stress(&stress, num_decoders, num_encoders, &(stress.runs[i])))
+		{
+			fprintf(stderr, "could not set up run\n");
+			ok = 0;
+			break;
+		}
+
+		stress.num_runs++;
+		ok = ok && stress.runs[i].ok;
+	}
+
+	if (output_filename != NULL)
+	{
+		fout = fopen(output_filename, "w");
+		if (fout == NULL)
+		{
+			fprintf(stderr, "could not open output file \"%s\"\n", output_filename);
+			ok = 0;
+			goto finish;
+		}
+	}
+
+	switch (output_format)
+	{
+		case OUTPUT_FORMAT_JSON: write_json(&stress, fout); break;
+		case OUTPUT_FORMAT_CSV: write_csv(&stress, fout); break;
+		default: break;
+	}
+
+	if (fout != stdout)
+		fclose(fout);
+
+
+finish:
+	for (i = 0; i < num_steps; ++i)
+		free(stress.runs[i].instances);
+	free(stress.runs);
+	stored_stream_cleanup(&(stress.decoder_input));
+	imx_vpu_dma_buffer_allocator_set_sync_funcs(&(stress.allocator.parent), NULL);
+	pthread_mutex_destroy(&(stress.allocator.mutex));
+
+	imx_vpu_enc_unload();
+	imx_vpu_dec_unload();
+
+	return ok ? 0 : 1;
+}
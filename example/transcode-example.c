@@ -0,0 +1,213 @@
+/* example for how to use the imxvpuapi transcoder interface
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "imxvpuapi/imxvpuapi_transcoder.h"
+
+
+
+/* This is a simple example of how to transcode with the imxvpuapi library.
+ * It reads motion JPEG data (a sequence of concatenated JPEG images, which is
+ * what many USB cameras produce), encodes it to h.264 with a bitrate of
+ * 256 kbps, and writes the resulting byte stream to a file. The decoded
+ * frames are passed to the encoder directly, without being copied.
+ * Also look into imxvpuapi_transcoder.h for documentation. */
+
+
+
+#define BITRATE 256
+
+
+struct _Context
+{
+	FILE *fin, *fout;
+
+	/* The entire input data, and the offset of the next JPEG image in it */
+	uint8_t *in_buffer;
+	size_t in_buffer_size;
+	size_t in_offset;
+
+	ImxVpuTranscoder *transcoder;
+	ImxVpuEncParams enc_params;
+
+	unsigned int frame_id_counter;
+};
+
+
+/* Finds the next JPEG image in the input data, by looking for its start
+ * of image and end of image markers. Returns 0 if there is no complete
+ * image left. */
+static int find_next_jpeg_image(Context *ctx, size_t *start_offset, size_t *end_offset)
+{
+	size_t i;
+	uint8_t const *buf = ctx->in_buffer;
+
+	for (i = ctx->in_offset; (i + 1) < ctx->in_buffer_size; ++i)
+	{
+		if ((buf[i] == 0xFF) && (buf[i + 1] == 0xD8))
+			break;
+	}
+	if ((i + 1) >= ctx->in_buffer_size)
+		return 0;
+	*start_offset = i;
+
+	for (i += 2; (i + 1) < ctx->in_buffer_size; ++i)
+	{
+		if ((buf[i] == 0xFF) && (buf[i + 1] == 0xD9))
+		{
+			*end_offset = i + 2;
+			ctx->in_offset = i + 2;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+static int write_output_data(void *context, uint8_t const *data, uint32_t size, ImxVpuEncodedFrame *encoded_frame)
+{
+	((void)(encoded_frame));
+	fwrite(data, 1, size, (FILE *)context);
+	return 1;
+}
+
+
+static void encoded_frame_callback(ImxVpuTranscoder *transcoder, ImxVpuEncReturnCodes ret, ImxVpuEncodedFrame *encoded_frame, unsigned int output_code, void *user_data)
+{
+	((void)(transcoder));
+	((void)(output_code));
+	((void)(user_data));
+
+	if (ret != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "encoding failed: %s\n", imx_vpu_enc_error_string(ret));
+		return;
+	}
+
+	/* The context of the encoded frame is the one of the input frame it was decoded from */
+	fprintf(stderr, "encoded output frame:  frame id: 0x%x  size: %zu byte\n", (unsigned int)((uintptr_t)(encoded_frame->context)), encoded_frame->data_size);
+}
+
+
+Context* init(FILE *input_file, FILE *output_file)
+{
+	Context *ctx;
+	ImxVpuTranscoderOpenParams open_params;
+	ImxVpuDecReturnCodes ret;
+	long size;
+
+	ctx = calloc(1, sizeof(Context));
+	ctx->fin = input_file;
+	ctx->fout = output_file;
+	ctx->frame_id_counter = 100;
+
+	/* Read all of the input data in one go */
+	fseek(ctx->fin, 0, SEEK_END);
+	size = ftell(ctx->fin);
+	fseek(ctx->fin, 0, SEEK_SET);
+
+	ctx->in_buffer = malloc(size);
+	ctx->in_buffer_size = fread(ctx->in_buffer, 1, size, ctx->fin);
+
+	/* Set up the decoder and encoder parameters. The encoder's frame
+	 * size and color format are taken from the decoded frames. 4:2:2
+	 * frames, which are common with motion JPEG, are encoded as 4:2:0. */
+	imx_vpu_transcoder_set_default_open_params(IMX_VPU_CODEC_FORMAT_MJPEG, IMX_VPU_CODEC_FORMAT_H264, &open_params);
+	open_params.enc_open_params.bitrate = BITRATE;
+	open_params.encoded_frame_callback = encoded_frame_callback;
+	open_params.callback_user_data = ctx;
+
+	/* Opening the transcoder also loads the VPU firmware */
+	if ((ret = imx_vpu_transcoder_open(&(ctx->transcoder), &open_params)) != IMX_VPU_DEC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "could not open transcoder: %s\n", imx_vpu_dec_error_string(ret));
+		free(ctx->in_buffer);
+		free(ctx);
+		return NULL;
+	}
+
+	/* The encoded data is written to the output file with write_output_data().
+	 * The parameters are copied for each frame, so it is OK to set them once. */
+	memset(&(ctx->enc_params), 0, sizeof(ImxVpuEncParams));
+	ctx->enc_params.write_output_data = write_output_data;
+	ctx->enc_params.output_buffer_context = ctx->fout;
+
+	return ctx;
+}
+
+
+Retval run(Context *ctx)
+{
+	ImxVpuEncodedFrame input_frame;
+	ImxVpuDecReturnCodes ret;
+	unsigned int output_code;
+	size_t start_offset, end_offset;
+
+	while (find_next_jpeg_image(ctx, &start_offset, &end_offset))
+	{
+		memset(&input_frame, 0, sizeof(input_frame));
+		input_frame.data = ctx->in_buffer + start_offset;
+		input_frame.data_size = end_offset - start_offset;
+		input_frame.context = (void *)((uintptr_t)(ctx->frame_id_counter));
+
+		fprintf(stderr, "encoded input frame:  frame id: 0x%x  size: %zu byte\n", ctx->frame_id_counter, input_frame.data_size);
+		ctx->frame_id_counter++;
+
+		/* This decodes the input frame and starts encoding the decoded frame.
+		 * The encoded frame is delivered during the next call, while the
+		 * VPU encodes in the meantime. */
+		if ((ret = imx_vpu_transcoder_transcode(ctx->transcoder, &input_frame, &(ctx->enc_params), &output_code)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		{
+			fprintf(stderr, "imx_vpu_transcoder_transcode() failed: %s\n", imx_vpu_dec_error_string(ret));
+			return RETVAL_ERROR;
+		}
+
+		if (output_code & IMX_VPU_DEC_OUTPUT_CODE_VIDEO_PARAMS_CHANGED)
+		{
+			fprintf(stderr, "video parameters changed; this example does not handle such changes\n");
+			return RETVAL_ERROR;
+		}
+	}
+
+	/* Get the frames that are still in the decoder, and the last encoded one */
+	fprintf(stderr, "draining transcoder\n");
+	if ((ret = imx_vpu_transcoder_drain(ctx->transcoder, &(ctx->enc_params))) != IMX_VPU_DEC_RETURN_CODE_OK)
+	{
+		fprintf(stderr, "imx_vpu_transcoder_drain() failed: %s\n", imx_vpu_dec_error_string(ret));
+		return RETVAL_ERROR;
+	}
+
+	return RETVAL_OK;
+}
+
+
+void shutdown(Context *ctx)
+{
+	/* This also frees all DMA buffers and unloads the VPU firmware */
+	imx_vpu_transcoder_close(ctx->transcoder);
+
+	free(ctx->in_buffer);
+
+	free(ctx);
+}
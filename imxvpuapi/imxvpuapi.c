@@ -17,8 +17,21 @@
  * USA
  */
 
+/* Necessary for clock_gettime(), O_CLOEXEC, and F_DUPFD_CLOEXEC in C99 mode */
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include "imxvpuapi.h"
 #include "imxvpuapi_priv.h"
 
@@ -141,6 +154,117 @@ size_t imx_vpu_dma_buffer_get_size(ImxVpuDMABuffer *buffer)
 }
 
 
+/* Registered sync functions. These are kept outside of ImxVpuDMABufferAllocator,
+ * since allocators which were written for older versions of the API do not have
+ * such fields. The list is short (one entry per allocator which has sync
+ * functions), so it is searched linearly. */
+
+typedef struct _ImxVpuDMABufferSyncEntry ImxVpuDMABufferSyncEntry;
+
+struct _ImxVpuDMABufferSyncEntry
+{
+	ImxVpuDMABufferAllocator *allocator;
+	ImxVpuDMABufferSyncFuncs sync_funcs;
+	ImxVpuDMABufferSyncEntry *next;
+};
+
+static ImxVpuDMABufferSyncEntry *dma_buffer_sync_entries = NULL;
+static pthread_mutex_t dma_buffer_sync_entries_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int imx_vpu_dma_buffer_get_sync_funcs(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABufferSyncFuncs *sync_funcs)
+{
+	ImxVpuDMABufferSyncEntry *entry;
+	int found = 0;
+
+	pthread_mutex_lock(&dma_buffer_sync_entries_mutex);
+
+	for (entry = dma_buffer_sync_entries; entry != NULL; entry = entry->next)
+	{
+		if (entry->allocator == allocator)
+		{
+			*sync_funcs = entry->sync_funcs;
+			found = 1;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&dma_buffer_sync_entries_mutex);
+
+	return found;
+}
+
+
+int imx_vpu_dma_buffer_allocator_set_sync_funcs(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABufferSyncFuncs const *sync_funcs)
+{
+	ImxVpuDMABufferSyncEntry *entry, **link;
+	int ret = 1;
+
+	assert(allocator != NULL);
+
+	pthread_mutex_lock(&dma_buffer_sync_entries_mutex);
+
+	for (link = &dma_buffer_sync_entries; *link != NULL; link = &((*link)->next))
+	{
+		if ((*link)->allocator == allocator)
+			break;
+	}
+
+	entry = *link;
+
+	if (sync_funcs == NULL)
+	{
+		if (entry != NULL)
+		{
+			*link = entry->next;
+			IMX_VPU_FREE(entry, sizeof(ImxVpuDMABufferSyncEntry));
+		}
+	}
+	else if (entry != NULL)
+	{
+		entry->sync_funcs = *sync_funcs;
+	}
+	else
+	{
+		entry = IMX_VPU_ALLOC(sizeof(ImxVpuDMABufferSyncEntry));
+		if (entry != NULL)
+		{
+			entry->allocator = allocator;
+			entry->sync_funcs = *sync_funcs;
+			entry->next = dma_buffer_sync_entries;
+			dma_buffer_sync_entries = entry;
+		}
+		else
+		{
+			IMX_VPU_ERROR("allocating heap block for DMA buffer sync functions failed");
+			ret = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&dma_buffer_sync_entries_mutex);
+
+	return ret;
+}
+
+
+void imx_vpu_dma_buffer_sync_for_cpu(ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	ImxVpuDMABufferSyncFuncs sync_funcs;
+
+	if ((length > 0) && imx_vpu_dma_buffer_get_sync_funcs(buffer->allocator, &sync_funcs) && (sync_funcs.sync_for_cpu != NULL))
+		sync_funcs.sync_for_cpu(buffer->allocator, buffer, offset, length);
+}
+
+
+void imx_vpu_dma_buffer_sync_for_device(ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	ImxVpuDMABufferSyncFuncs sync_funcs;
+
+	if ((length > 0) && imx_vpu_dma_buffer_get_sync_funcs(buffer->allocator, &sync_funcs) && (sync_funcs.sync_for_device != NULL))
+		sync_funcs.sync_for_device(buffer->allocator, buffer, offset, length);
+}
+
+
 void imx_vpu_init_wrapped_dma_buffer(ImxVpuWrappedDMABuffer *buffer)
 {
 	memset(buffer, 0, sizeof(ImxVpuWrappedDMABuffer));
@@ -150,107 +274,2194 @@ void imx_vpu_init_wrapped_dma_buffer(ImxVpuWrappedDMABuffer *buffer)
 
 
 
-static void* default_heap_alloc_fn(size_t const size, void *context, char const *file, int const line, char const *fn)
+/* Pooling allocator. Size classes are in units of pages. The first
+ * classes are 1-4 pages, the rest are four geometric steps per power of
+ * two. Sizes beyond the last class are not pooled, and go directly to
+ * the backing allocator. */
+
+#define DMA_BUFFER_POOL_PAGE_SIZE 4096
+#define DMA_BUFFER_POOL_NUM_LINEAR_CLASSES 4
+#define DMA_BUFFER_POOL_NUM_CLASSES 64
+
+
+typedef struct _ImxVpuPooledDMABuffer ImxVpuPooledDMABuffer;
+
+struct _ImxVpuPooledDMABuffer
 {
-	IMXVPUAPI_UNUSED_PARAM(context);
-	IMXVPUAPI_UNUSED_PARAM(file);
-	IMXVPUAPI_UNUSED_PARAM(line);
-	IMXVPUAPI_UNUSED_PARAM(fn);
-	return malloc(size);
+	ImxVpuDMABuffer parent;
+
+	ImxVpuDMABuffer *backing_buffer;
+	size_t requested_size;
+	size_t class_size;
+	unsigned int class_index;
+	unsigned int alignment;
+	unsigned int flags;
+
+	ImxVpuPooledDMABuffer *next;
+};
+
+
+struct _ImxVpuDMABufferPool
+{
+	ImxVpuDMABufferAllocator parent;
+
+	ImxVpuDMABufferAllocator *backing_allocator;
+	size_t max_free_size;
+
+	ImxVpuPooledDMABuffer *free_lists[DMA_BUFFER_POOL_NUM_CLASSES];
+
+	ImxVpuDMABufferPoolStats stats;
+};
+
+
+static unsigned int dma_buffer_pool_get_class_index(size_t size)
+{
+	size_t num_pages = (size + DMA_BUFFER_POOL_PAGE_SIZE - 1) / DMA_BUFFER_POOL_PAGE_SIZE;
+	size_t quarter, num_steps;
+	unsigned int msb;
+
+	if (num_pages == 0)
+		num_pages = 1;
+
+	if (num_pages <= DMA_BUFFER_POOL_NUM_LINEAR_CLASSES)
+		return num_pages - 1;
+
+	for (msb = 0; (num_pages >> (msb + 1)) != 0; ++msb);
+
+	quarter = ((size_t)1) << (msb - 2);
+	num_steps = (num_pages + quarter - 1) / quarter;
+
+	return DMA_BUFFER_POOL_NUM_LINEAR_CLASSES + (msb - 2) * 4 + (num_steps - 4);
 }
 
-static void default_heap_free_fn(void *memblock, size_t const size, void *context, char const *file, int const line, char const *fn)
+
+static size_t dma_buffer_pool_get_class_size(unsigned int class_index)
 {
-	IMXVPUAPI_UNUSED_PARAM(context);
-	IMXVPUAPI_UNUSED_PARAM(size);
-	IMXVPUAPI_UNUSED_PARAM(file);
-	IMXVPUAPI_UNUSED_PARAM(line);
-	IMXVPUAPI_UNUSED_PARAM(fn);
-	free(memblock);
+	unsigned int i;
+
+	if (class_index < DMA_BUFFER_POOL_NUM_LINEAR_CLASSES)
+		return (class_index + 1) * DMA_BUFFER_POOL_PAGE_SIZE;
+
+	i = class_index - DMA_BUFFER_POOL_NUM_LINEAR_CLASSES;
+	return (((size_t)(4 + i % 4)) << (i / 4)) * DMA_BUFFER_POOL_PAGE_SIZE;
 }
 
-void *imx_vpu_cur_heap_alloc_context;
-ImxVpuHeapAllocFunc imx_vpu_cur_heap_alloc_fn = default_heap_alloc_fn;
-ImxVpuHeapFreeFunc imx_vpu_cur_heap_free_fn = default_heap_free_fn;
 
-void imx_vpu_set_heap_allocator_functions(ImxVpuHeapAllocFunc heap_alloc_fn, ImxVpuHeapFreeFunc heap_free_fn, void *context)
+static ImxVpuPooledDMABuffer* dma_buffer_pool_allocate_backing_buffer(ImxVpuDMABufferPool *pool, size_t size, unsigned int alignment, unsigned int flags)
 {
-	imx_vpu_cur_heap_alloc_context = context;
-	if ((heap_alloc_fn == NULL) || (heap_free_fn == NULL))
+	ImxVpuPooledDMABuffer *pooled_buffer;
+	unsigned int class_index = dma_buffer_pool_get_class_index(size);
+	size_t class_size = (class_index < DMA_BUFFER_POOL_NUM_CLASSES) ? dma_buffer_pool_get_class_size(class_index) : size;
+
+	pooled_buffer = IMX_VPU_ALLOC(sizeof(ImxVpuPooledDMABuffer));
+	if (pooled_buffer == NULL)
 	{
-		imx_vpu_cur_heap_alloc_fn = default_heap_alloc_fn;
-		imx_vpu_cur_heap_free_fn = default_heap_free_fn;
+		IMX_VPU_ERROR("allocating heap block for pooled DMA buffer failed");
+		return NULL;
 	}
-	else
+
+	pooled_buffer->backing_buffer = imx_vpu_dma_buffer_allocate(pool->backing_allocator, class_size, alignment, flags);
+	if (pooled_buffer->backing_buffer == NULL)
 	{
-		imx_vpu_cur_heap_alloc_fn = heap_alloc_fn;
-		imx_vpu_cur_heap_free_fn = heap_free_fn;
+		IMX_VPU_ERROR("could not allocate %zu byte from backing allocator", class_size);
+		IMX_VPU_FREE(pooled_buffer, sizeof(ImxVpuPooledDMABuffer));
+		return NULL;
 	}
+
+	pooled_buffer->parent.allocator = (ImxVpuDMABufferAllocator *)pool;
+	pooled_buffer->requested_size = size;
+	pooled_buffer->class_size = class_size;
+	pooled_buffer->class_index = class_index;
+	pooled_buffer->alignment = (alignment == 0) ? 1 : alignment;
+	pooled_buffer->flags = flags;
+	pooled_buffer->next = NULL;
+
+	pool->stats.allocated_size += class_size;
+	pool->stats.num_backing_allocations++;
+	if (pool->stats.allocated_size > pool->stats.high_water_mark)
+		pool->stats.high_water_mark = pool->stats.allocated_size;
+
+	return pooled_buffer;
+}
+
+
+static void dma_buffer_pool_deallocate_backing_buffer(ImxVpuDMABufferPool *pool, ImxVpuPooledDMABuffer *pooled_buffer)
+{
+	pool->stats.allocated_size -= pooled_buffer->class_size;
+	imx_vpu_dma_buffer_deallocate(pooled_buffer->backing_buffer);
+	IMX_VPU_FREE(pooled_buffer, sizeof(ImxVpuPooledDMABuffer));
 }
 
 
+static ImxVpuDMABuffer* dma_buffer_pool_allocator_allocate(ImxVpuDMABufferAllocator *allocator, size_t size, unsigned int alignment, unsigned int flags)
+{
+	ImxVpuDMABufferPool *pool = (ImxVpuDMABufferPool *)allocator;
+	ImxVpuPooledDMABuffer *pooled_buffer, **prev_next;
+	unsigned int class_index = dma_buffer_pool_get_class_index(size);
 
+	if (alignment == 0)
+		alignment = 1;
 
-/***********************/
-/******* LOGGING *******/
-/***********************/
+	if (class_index < DMA_BUFFER_POOL_NUM_CLASSES)
+	{
+		/* Look for a free buffer with the same flags and a compatible alignment */
+		for (prev_next = &(pool->free_lists[class_index]); *prev_next != NULL; prev_next = &((*prev_next)->next))
+		{
+			pooled_buffer = *prev_next;
+			if ((pooled_buffer->flags != flags) || ((pooled_buffer->alignment % alignment) != 0))
+				continue;
 
+			*prev_next = pooled_buffer->next;
+			pooled_buffer->next = NULL;
+			pooled_buffer->requested_size = size;
 
-static void default_logging_fn(ImxVpuLogLevel level, char const *file, int const line, char const *fn, const char *format, ...)
+			pool->stats.free_size -= pooled_buffer->class_size;
+			pool->stats.in_use_size += pooled_buffer->class_size;
+			pool->stats.num_reused_allocations++;
+
+			IMX_VPU_LOG("reusing pooled DMA buffer %p for allocation of %zu byte", (void *)pooled_buffer, size);
+
+			return (ImxVpuDMABuffer *)pooled_buffer;
+		}
+	}
+
+	pooled_buffer = dma_buffer_pool_allocate_backing_buffer(pool, size, alignment, flags);
+	if (pooled_buffer == NULL)
+		return NULL;
+
+	pool->stats.in_use_size += pooled_buffer->class_size;
+
+	return (ImxVpuDMABuffer *)pooled_buffer;
+}
+
+
+static void dma_buffer_pool_allocator_deallocate(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
 {
-	IMXVPUAPI_UNUSED_PARAM(level);
-	IMXVPUAPI_UNUSED_PARAM(file);
-	IMXVPUAPI_UNUSED_PARAM(line);
-	IMXVPUAPI_UNUSED_PARAM(fn);
-	IMXVPUAPI_UNUSED_PARAM(format);
+	ImxVpuDMABufferPool *pool = (ImxVpuDMABufferPool *)allocator;
+	ImxVpuPooledDMABuffer *pooled_buffer = (ImxVpuPooledDMABuffer *)buffer;
+
+	pool->stats.in_use_size -= pooled_buffer->class_size;
+
+	if ((pooled_buffer->class_index >= DMA_BUFFER_POOL_NUM_CLASSES) || ((pool->max_free_size != 0) && ((pool->stats.free_size + pooled_buffer->class_size) > pool->max_free_size)))
+	{
+		dma_buffer_pool_deallocate_backing_buffer(pool, pooled_buffer);
+		return;
+	}
+
+	pooled_buffer->next = pool->free_lists[pooled_buffer->class_index];
+	pool->free_lists[pooled_buffer->class_index] = pooled_buffer;
+	pool->stats.free_size += pooled_buffer->class_size;
 }
 
-ImxVpuLogLevel imx_vpu_cur_log_level_threshold = IMX_VPU_LOG_LEVEL_ERROR;
-ImxVpuLoggingFunc imx_vpu_cur_logging_fn = default_logging_fn;
 
-void imx_vpu_set_logging_function(ImxVpuLoggingFunc logging_fn)
+static uint8_t* dma_buffer_pool_allocator_map(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, unsigned int flags)
 {
-	imx_vpu_cur_logging_fn = (logging_fn != NULL) ? logging_fn : default_logging_fn;
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	return imx_vpu_dma_buffer_map(((ImxVpuPooledDMABuffer *)buffer)->backing_buffer, flags);
 }
 
-void imx_vpu_set_logging_threshold(ImxVpuLogLevel threshold)
+
+static void dma_buffer_pool_allocator_unmap(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
 {
-	imx_vpu_cur_log_level_threshold = threshold;
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	imx_vpu_dma_buffer_unmap(((ImxVpuPooledDMABuffer *)buffer)->backing_buffer);
 }
 
 
+static int dma_buffer_pool_allocator_get_fd(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	return imx_vpu_dma_buffer_get_fd(((ImxVpuPooledDMABuffer *)buffer)->backing_buffer);
+}
 
 
-/******************************************************/
-/******* MISCELLANEOUS STRUCTURES AND FUNCTIONS *******/
-/******************************************************/
+static imx_vpu_phys_addr_t dma_buffer_pool_allocator_get_physical_address(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	return imx_vpu_dma_buffer_get_physical_address(((ImxVpuPooledDMABuffer *)buffer)->backing_buffer);
+}
 
 
-char const *imx_vpu_color_format_string(ImxVpuColorFormat color_format)
+static size_t dma_buffer_pool_allocator_get_size(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
 {
-	switch (color_format)
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	return ((ImxVpuPooledDMABuffer *)buffer)->requested_size;
+}
+
+
+static void dma_buffer_pool_allocator_sync_for_cpu(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	imx_vpu_dma_buffer_sync_for_cpu(((ImxVpuPooledDMABuffer *)buffer)->backing_buffer, offset, length);
+}
+
+
+static void dma_buffer_pool_allocator_sync_for_device(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	imx_vpu_dma_buffer_sync_for_device(((ImxVpuPooledDMABuffer *)buffer)->backing_buffer, offset, length);
+}
+
+
+static ImxVpuDMABufferSyncFuncs const dma_buffer_pool_sync_funcs =
+{
+	dma_buffer_pool_allocator_sync_for_cpu,
+	dma_buffer_pool_allocator_sync_for_device
+};
+
+
+ImxVpuDMABufferPool* imx_vpu_dma_buffer_pool_create(ImxVpuDMABufferAllocator *backing_allocator, size_t max_free_size)
+{
+	ImxVpuDMABufferPool *pool;
+
+	pool = IMX_VPU_ALLOC(sizeof(ImxVpuDMABufferPool));
+	if (pool == NULL)
 	{
-		case IMX_VPU_COLOR_FORMAT_YUV420: return "YUV 4:2:0";
-		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL: return "YUV 4:2:2 horizontal";
-		case IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL: return "YUV 2:2:4 vertical";
-		case IMX_VPU_COLOR_FORMAT_YUV444: return "YUV 4:4:4";
-		case IMX_VPU_COLOR_FORMAT_YUV400: return "YUV 4:0:0 (8-bit grayscale)";
-		default:
-			return "<unknown>";
+		IMX_VPU_ERROR("allocating heap block for DMA buffer pool failed");
+		return NULL;
+	}
+
+	memset(pool, 0, sizeof(ImxVpuDMABufferPool));
+
+	pool->parent.allocate = dma_buffer_pool_allocator_allocate;
+	pool->parent.deallocate = dma_buffer_pool_allocator_deallocate;
+	pool->parent.map = dma_buffer_pool_allocator_map;
+	pool->parent.unmap = dma_buffer_pool_allocator_unmap;
+	pool->parent.get_fd = dma_buffer_pool_allocator_get_fd;
+	pool->parent.get_physical_address = dma_buffer_pool_allocator_get_physical_address;
+	pool->parent.get_size = dma_buffer_pool_allocator_get_size;
+
+	if (!imx_vpu_dma_buffer_allocator_set_sync_funcs(&(pool->parent), &dma_buffer_pool_sync_funcs))
+	{
+		IMX_VPU_FREE(pool, sizeof(ImxVpuDMABufferPool));
+		return NULL;
 	}
+
+	pool->backing_allocator = backing_allocator;
+	pool->max_free_size = max_free_size;
+
+	return pool;
 }
 
 
-char const *imx_vpu_frame_type_string(ImxVpuFrameType frame_type)
+void imx_vpu_dma_buffer_pool_destroy(ImxVpuDMABufferPool *pool)
 {
-	switch (frame_type)
+	if (pool == NULL)
+		return;
+
+	if (pool->stats.in_use_size != 0)
+		IMX_VPU_ERROR("destroying DMA buffer pool while %zu byte are still in use", pool->stats.in_use_size);
+
+	imx_vpu_dma_buffer_pool_trim(pool);
+	imx_vpu_dma_buffer_allocator_set_sync_funcs(&(pool->parent), NULL);
+	IMX_VPU_FREE(pool, sizeof(ImxVpuDMABufferPool));
+}
+
+
+ImxVpuDMABufferAllocator* imx_vpu_dma_buffer_pool_get_allocator(ImxVpuDMABufferPool *pool)
+{
+	return &(pool->parent);
+}
+
+
+int imx_vpu_dma_buffer_pool_preallocate(ImxVpuDMABufferPool *pool, size_t size, unsigned int alignment, unsigned int flags, unsigned int num_buffers)
+{
+	ImxVpuPooledDMABuffer *pooled_buffer;
+	unsigned int i;
+
+	if (dma_buffer_pool_get_class_index(size) >= DMA_BUFFER_POOL_NUM_CLASSES)
 	{
-		case IMX_VPU_FRAME_TYPE_I: return "I";
-		case IMX_VPU_FRAME_TYPE_P: return "P";
-		case IMX_VPU_FRAME_TYPE_B: return "B";
-		case IMX_VPU_FRAME_TYPE_IDR: return "IDR";
-		case IMX_VPU_FRAME_TYPE_BI: return "BI";
-		case IMX_VPU_FRAME_TYPE_SKIP: return "SKIP";
-		default: return "<unknown>";
+		IMX_VPU_ERROR("cannot preallocate %zu byte buffers: size exceeds the largest size class", size);
+		return 0;
+	}
+
+	for (i = 0; i < num_buffers; ++i)
+	{
+		pooled_buffer = dma_buffer_pool_allocate_backing_buffer(pool, size, alignment, flags);
+		if (pooled_buffer == NULL)
+			return 0;
+
+		pooled_buffer->next = pool->free_lists[pooled_buffer->class_index];
+		pool->free_lists[pooled_buffer->class_index] = pooled_buffer;
+		pool->stats.free_size += pooled_buffer->class_size;
+	}
+
+	return 1;
+}
+
+
+void imx_vpu_dma_buffer_pool_trim(ImxVpuDMABufferPool *pool)
+{
+	unsigned int i;
+	ImxVpuPooledDMABuffer *pooled_buffer, *next;
+
+	for (i = 0; i < DMA_BUFFER_POOL_NUM_CLASSES; ++i)
+	{
+		for (pooled_buffer = pool->free_lists[i]; pooled_buffer != NULL; pooled_buffer = next)
+		{
+			next = pooled_buffer->next;
+			dma_buffer_pool_deallocate_backing_buffer(pool, pooled_buffer);
+		}
+
+		pool->free_lists[i] = NULL;
+	}
+
+	pool->stats.free_size = 0;
+}
+
+
+void imx_vpu_dma_buffer_pool_get_stats(ImxVpuDMABufferPool *pool, ImxVpuDMABufferPoolStats *stats)
+{
+	*stats = pool->stats;
+}
+
+
+
+
+/* Arena allocator. Sub-buffers are kept in a list that is sorted by
+ * offset; free space is the space between them. Each sub-buffer's
+ * block starts at block_offset, and its (aligned) data at offset. */
+
+typedef struct _ImxVpuArenaDMABuffer ImxVpuArenaDMABuffer;
+
+struct _ImxVpuArenaDMABuffer
+{
+	ImxVpuDMABuffer parent;
+
+	size_t block_offset, block_size;
+	size_t offset, size;
+	int mapped;
+
+	ImxVpuArenaDMABuffer *next;
+};
+
+
+struct _ImxVpuDMABufferArena
+{
+	ImxVpuDMABufferAllocator parent;
+
+	ImxVpuDMABuffer *backing_buffer;
+	imx_vpu_phys_addr_t physical_address;
+	unsigned int alignment;
+
+	uint8_t *virtual_address;
+	unsigned int num_mapped_sub_buffers;
+
+	ImxVpuArenaDMABuffer *sub_buffers;
+
+	ImxVpuDMABufferArenaStats stats;
+};
+
+
+static size_t dma_buffer_arena_align_offset(ImxVpuDMABufferArena *arena, size_t offset, unsigned int alignment)
+{
+	/* Align the absolute physical address, not just the offset,
+	 * unless the arena has no physical address */
+	imx_vpu_phys_addr_t base = arena->physical_address;
+	return (size_t)(IMX_VPU_ALIGN_VAL_TO(base + offset, alignment) - base);
+}
+
+
+static ImxVpuDMABuffer* dma_buffer_arena_allocator_allocate(ImxVpuDMABufferAllocator *allocator, size_t size, unsigned int alignment, unsigned int flags)
+{
+	ImxVpuDMABufferArena *arena = (ImxVpuDMABufferArena *)allocator;
+	ImxVpuArenaDMABuffer *sub_buffer, **prev_next;
+	size_t free_begin, free_end, data_offset;
+
+	IMXVPUAPI_UNUSED_PARAM(flags);
+
+	if (alignment == 0)
+		alignment = 1;
+
+	if ((arena->alignment % alignment) != 0)
+	{
+		IMX_VPU_ERROR("sub-buffer alignment %u is incompatible with arena alignment %u", alignment, arena->alignment);
+		return NULL;
 	}
+
+	/* First fit: go through the gaps between the sub-buffers, and the gap after the last one */
+	free_begin = 0;
+	for (prev_next = &(arena->sub_buffers); ; prev_next = &((*prev_next)->next))
+	{
+		free_end = (*prev_next != NULL) ? (*prev_next)->block_offset : arena->stats.size;
+		data_offset = dma_buffer_arena_align_offset(arena, free_begin, alignment);
+
+		if ((data_offset <= free_end) && ((free_end - data_offset) >= size))
+			break;
+
+		if (*prev_next == NULL)
+		{
+			IMX_VPU_ERROR("no free block in DMA buffer arena is large enough for %zu byte", size);
+			arena->stats.num_failed_allocations++;
+			return NULL;
+		}
+
+		free_begin = (*prev_next)->block_offset + (*prev_next)->block_size;
+	}
+
+	sub_buffer = IMX_VPU_ALLOC(sizeof(ImxVpuArenaDMABuffer));
+	if (sub_buffer == NULL)
+	{
+		IMX_VPU_ERROR("allocating heap block for arena DMA buffer failed");
+		return NULL;
+	}
+
+	sub_buffer->parent.allocator = allocator;
+	sub_buffer->block_offset = free_begin;
+	sub_buffer->block_size = data_offset + size - free_begin;
+	sub_buffer->offset = data_offset;
+	sub_buffer->size = size;
+	sub_buffer->mapped = 0;
+
+	sub_buffer->next = *prev_next;
+	*prev_next = sub_buffer;
+
+	arena->stats.in_use_size += sub_buffer->block_size;
+	arena->stats.num_sub_buffers++;
+	if (arena->stats.in_use_size > arena->stats.high_water_mark)
+		arena->stats.high_water_mark = arena->stats.in_use_size;
+
+	IMX_VPU_LOG("allocated %zu byte at offset %zu in DMA buffer arena", size, data_offset);
+
+	return (ImxVpuDMABuffer *)sub_buffer;
+}
+
+
+static void dma_buffer_arena_allocator_unmap(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer);
+
+
+static void dma_buffer_arena_allocator_deallocate(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	ImxVpuDMABufferArena *arena = (ImxVpuDMABufferArena *)allocator;
+	ImxVpuArenaDMABuffer *sub_buffer = (ImxVpuArenaDMABuffer *)buffer;
+	ImxVpuArenaDMABuffer **prev_next;
+
+	dma_buffer_arena_allocator_unmap(allocator, buffer);
+
+	/* Removing the sub-buffer from the list is all it takes to
+	 * merge its block with the adjacent free space */
+	for (prev_next = &(arena->sub_buffers); *prev_next != NULL; prev_next = &((*prev_next)->next))
+	{
+		if (*prev_next == sub_buffer)
+		{
+			*prev_next = sub_buffer->next;
+			break;
+		}
+	}
+
+	arena->stats.in_use_size -= sub_buffer->block_size;
+	arena->stats.num_sub_buffers--;
+
+	IMX_VPU_FREE(sub_buffer, sizeof(ImxVpuArenaDMABuffer));
+}
+
+
+static uint8_t* dma_buffer_arena_allocator_map(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, unsigned int flags)
+{
+	ImxVpuDMABufferArena *arena = (ImxVpuDMABufferArena *)allocator;
+	ImxVpuArenaDMABuffer *sub_buffer = (ImxVpuArenaDMABuffer *)buffer;
+
+	IMXVPUAPI_UNUSED_PARAM(flags);
+
+	if (!(sub_buffer->mapped))
+	{
+		if (arena->num_mapped_sub_buffers == 0)
+		{
+			/* Other sub-buffers may be written to, so always map for reading and writing */
+			arena->virtual_address = imx_vpu_dma_buffer_map(arena->backing_buffer, 0);
+			if (arena->virtual_address == NULL)
+				return NULL;
+		}
+
+		sub_buffer->mapped = 1;
+		arena->num_mapped_sub_buffers++;
+	}
+
+	return arena->virtual_address + sub_buffer->offset;
+}
+
+
+static void dma_buffer_arena_allocator_unmap(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	ImxVpuDMABufferArena *arena = (ImxVpuDMABufferArena *)allocator;
+	ImxVpuArenaDMABuffer *sub_buffer = (ImxVpuArenaDMABuffer *)buffer;
+
+	if (!(sub_buffer->mapped))
+		return;
+
+	sub_buffer->mapped = 0;
+	arena->num_mapped_sub_buffers--;
+
+	if (arena->num_mapped_sub_buffers == 0)
+	{
+		imx_vpu_dma_buffer_unmap(arena->backing_buffer);
+		arena->virtual_address = NULL;
+	}
+}
+
+
+static int dma_buffer_arena_allocator_get_fd(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	IMXVPUAPI_UNUSED_PARAM(buffer);
+	return -1;
+}
+
+
+static imx_vpu_phys_addr_t dma_buffer_arena_allocator_get_physical_address(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	ImxVpuDMABufferArena *arena = (ImxVpuDMABufferArena *)allocator;
+
+	if (arena->physical_address == 0)
+		return 0;
+
+	return arena->physical_address + ((ImxVpuArenaDMABuffer *)buffer)->offset;
+}
+
+
+static size_t dma_buffer_arena_allocator_get_size(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	return ((ImxVpuArenaDMABuffer *)buffer)->size;
+}
+
+
+static void dma_buffer_arena_allocator_sync_for_cpu(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	ImxVpuDMABufferArena *arena = (ImxVpuDMABufferArena *)allocator;
+	imx_vpu_dma_buffer_sync_for_cpu(arena->backing_buffer, ((ImxVpuArenaDMABuffer *)buffer)->offset + offset, length);
+}
+
+
+static void dma_buffer_arena_allocator_sync_for_device(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	ImxVpuDMABufferArena *arena = (ImxVpuDMABufferArena *)allocator;
+	imx_vpu_dma_buffer_sync_for_device(arena->backing_buffer, ((ImxVpuArenaDMABuffer *)buffer)->offset + offset, length);
+}
+
+
+static ImxVpuDMABufferSyncFuncs const dma_buffer_arena_sync_funcs =
+{
+	dma_buffer_arena_allocator_sync_for_cpu,
+	dma_buffer_arena_allocator_sync_for_device
+};
+
+
+ImxVpuDMABufferArena* imx_vpu_dma_buffer_arena_create(ImxVpuDMABufferAllocator *backing_allocator, size_t size, unsigned int alignment, unsigned int flags)
+{
+	ImxVpuDMABufferArena *arena;
+
+	arena = IMX_VPU_ALLOC(sizeof(ImxVpuDMABufferArena));
+	if (arena == NULL)
+	{
+		IMX_VPU_ERROR("allocating heap block for DMA buffer arena failed");
+		return NULL;
+	}
+
+	memset(arena, 0, sizeof(ImxVpuDMABufferArena));
+
+	arena->backing_buffer = imx_vpu_dma_buffer_allocate(backing_allocator, size, alignment, flags);
+	if (arena->backing_buffer == NULL)
+	{
+		IMX_VPU_ERROR("could not allocate %zu byte for DMA buffer arena", size);
+		IMX_VPU_FREE(arena, sizeof(ImxVpuDMABufferArena));
+		return NULL;
+	}
+
+	arena->parent.allocate = dma_buffer_arena_allocator_allocate;
+	arena->parent.deallocate = dma_buffer_arena_allocator_deallocate;
+	arena->parent.map = dma_buffer_arena_allocator_map;
+	arena->parent.unmap = dma_buffer_arena_allocator_unmap;
+	arena->parent.get_fd = dma_buffer_arena_allocator_get_fd;
+	arena->parent.get_physical_address = dma_buffer_arena_allocator_get_physical_address;
+	arena->parent.get_size = dma_buffer_arena_allocator_get_size;
+
+	if (!imx_vpu_dma_buffer_allocator_set_sync_funcs(&(arena->parent), &dma_buffer_arena_sync_funcs))
+	{
+		imx_vpu_dma_buffer_deallocate(arena->backing_buffer);
+		IMX_VPU_FREE(arena, sizeof(ImxVpuDMABufferArena));
+		return NULL;
+	}
+
+	arena->physical_address = imx_vpu_dma_buffer_get_physical_address(arena->backing_buffer);
+	arena->alignment = (alignment == 0) ? 1 : alignment;
+	arena->stats.size = size;
+
+	return arena;
+}
+
+
+void imx_vpu_dma_buffer_arena_destroy(ImxVpuDMABufferArena *arena)
+{
+	if (arena == NULL)
+		return;
+
+	if (arena->sub_buffers != NULL)
+		IMX_VPU_ERROR("destroying DMA buffer arena while %u sub-buffer(s) are still allocated", arena->stats.num_sub_buffers);
+
+	if (arena->num_mapped_sub_buffers != 0)
+		imx_vpu_dma_buffer_unmap(arena->backing_buffer);
+
+	imx_vpu_dma_buffer_deallocate(arena->backing_buffer);
+	imx_vpu_dma_buffer_allocator_set_sync_funcs(&(arena->parent), NULL);
+	IMX_VPU_FREE(arena, sizeof(ImxVpuDMABufferArena));
+}
+
+
+ImxVpuDMABufferAllocator* imx_vpu_dma_buffer_arena_get_allocator(ImxVpuDMABufferArena *arena)
+{
+	return &(arena->parent);
+}
+
+
+void imx_vpu_dma_buffer_arena_get_stats(ImxVpuDMABufferArena *arena, ImxVpuDMABufferArenaStats *stats)
+{
+	ImxVpuArenaDMABuffer *sub_buffer;
+	size_t free_begin = 0, free_end;
+
+	*stats = arena->stats;
+
+	stats->largest_free_block_size = 0;
+	for (sub_buffer = arena->sub_buffers; ; sub_buffer = sub_buffer->next)
+	{
+		free_end = (sub_buffer != NULL) ? sub_buffer->block_offset : arena->stats.size;
+		if ((free_end - free_begin) > stats->largest_free_block_size)
+			stats->largest_free_block_size = free_end - free_begin;
+
+		if (sub_buffer == NULL)
+			break;
+
+		free_begin = sub_buffer->block_offset + sub_buffer->block_size;
+	}
+}
+
+
+/* dma-heap and dma-buf ioctls. These are defined here instead of including
+ * <linux/dma-heap.h> and <linux/dma-buf.h>, since the kernel headers of older
+ * BSPs do not contain them. DMA_BUF_IOCTL_PHYS is an NXP kernel extension. */
+
+typedef struct
+{
+	uint64_t len;
+	uint32_t fd;
+	uint32_t fd_flags;
+	uint64_t heap_flags;
+}
+ImxVpuDMAHeapAllocationData;
+
+typedef struct
+{
+	uint64_t flags;
+}
+ImxVpuDMABufSync;
+
+typedef struct
+{
+	unsigned long phys;
+}
+ImxVpuDMABufPhys;
+
+#define IMX_VPU_DMA_HEAP_IOCTL_ALLOC  _IOWR('H', 0x0, ImxVpuDMAHeapAllocationData)
+#define IMX_VPU_DMA_BUF_IOCTL_SYNC    _IOW('b', 0, ImxVpuDMABufSync)
+#define IMX_VPU_DMA_BUF_IOCTL_PHYS    _IOW('b', 10, ImxVpuDMABufPhys)
+
+#define IMX_VPU_DMA_BUF_SYNC_READ     (1 << 0)
+#define IMX_VPU_DMA_BUF_SYNC_WRITE    (2 << 0)
+#define IMX_VPU_DMA_BUF_SYNC_START    (0 << 2)
+#define IMX_VPU_DMA_BUF_SYNC_END      (1 << 2)
+
+
+typedef struct
+{
+	ImxVpuDMABuffer parent;
+
+	int fd;
+	imx_vpu_phys_addr_t physical_address;
+	size_t size;
+
+	uint8_t *virtual_address;
+	uint64_t sync_flags;
+	int manual_sync;
+}
+ImxVpuDMAHeapDMABuffer;
+
+
+struct _ImxVpuDMAHeapAllocator
+{
+	ImxVpuDMABufferAllocator parent;
+
+	int heap_fd;
+};
+
+
+/* Creates an ImxVpuDMAHeapDMABuffer for the given dma-buf FD, which it takes ownership of.
+ * The FD is not closed if this fails. */
+static ImxVpuDMABuffer* dma_heap_allocator_wrap_fd(ImxVpuDMAHeapAllocator *heap_allocator, int fd, size_t size)
+{
+	ImxVpuDMAHeapDMABuffer *dmabuffer;
+	ImxVpuDMABufPhys dma_buf_phys;
+
+	if (ioctl(fd, IMX_VPU_DMA_BUF_IOCTL_PHYS, &dma_buf_phys) < 0)
+	{
+		IMX_VPU_ERROR("could not get physical address of dma-buf FD %d: %s", fd, strerror(errno));
+		return NULL;
+	}
+
+	dmabuffer = IMX_VPU_ALLOC(sizeof(ImxVpuDMAHeapDMABuffer));
+	if (dmabuffer == NULL)
+	{
+		IMX_VPU_ERROR("allocating heap block for DMA heap buffer failed");
+		return NULL;
+	}
+
+	dmabuffer->parent.allocator = &(heap_allocator->parent);
+	dmabuffer->fd = fd;
+	dmabuffer->physical_address = (imx_vpu_phys_addr_t)(dma_buf_phys.phys);
+	dmabuffer->size = size;
+	dmabuffer->virtual_address = NULL;
+	dmabuffer->sync_flags = 0;
+	dmabuffer->manual_sync = 0;
+
+	IMX_VPU_DEBUG("dma-buf FD %d: %zu byte at physical address %" IMX_VPU_PHYS_ADDR_FORMAT, fd, size, dmabuffer->physical_address);
+
+	return (ImxVpuDMABuffer *)dmabuffer;
+}
+
+
+static ImxVpuDMABuffer* dma_heap_allocator_allocate(ImxVpuDMABufferAllocator *allocator, size_t size, unsigned int alignment, unsigned int flags)
+{
+	ImxVpuDMAHeapAllocator *heap_allocator = (ImxVpuDMAHeapAllocator *)allocator;
+	ImxVpuDMAHeapAllocationData allocation_data;
+	ImxVpuDMABuffer *dmabuffer;
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	IMXVPUAPI_UNUSED_PARAM(flags);
+
+	/* DMA heap buffers are page aligned, and cannot be offset
+	 * without breaking the offsets seen by dma-buf importers */
+	if ((page_size > 0) && (alignment > (unsigned long)page_size))
+	{
+		IMX_VPU_ERROR("alignment %u is larger than the page size %ld", alignment, page_size);
+		return NULL;
+	}
+
+	memset(&allocation_data, 0, sizeof(allocation_data));
+	allocation_data.len = size;
+	allocation_data.fd_flags = O_RDWR | O_CLOEXEC;
+
+	if (ioctl(heap_allocator->heap_fd, IMX_VPU_DMA_HEAP_IOCTL_ALLOC, &allocation_data) < 0)
+	{
+		IMX_VPU_ERROR("allocating %zu byte from DMA heap failed: %s", size, strerror(errno));
+		return NULL;
+	}
+
+	dmabuffer = dma_heap_allocator_wrap_fd(heap_allocator, (int)(allocation_data.fd), size);
+	if (dmabuffer == NULL)
+		close((int)(allocation_data.fd));
+
+	return dmabuffer;
+}
+
+
+static void dma_heap_allocator_unmap(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer);
+
+
+static void dma_heap_allocator_deallocate(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	ImxVpuDMAHeapDMABuffer *dmabuffer = (ImxVpuDMAHeapDMABuffer *)buffer;
+
+	dma_heap_allocator_unmap(allocator, buffer);
+
+	close(dmabuffer->fd);
+	IMX_VPU_FREE(dmabuffer, sizeof(ImxVpuDMAHeapDMABuffer));
+}
+
+
+static uint8_t* dma_heap_allocator_map(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, unsigned int flags)
+{
+	ImxVpuDMAHeapDMABuffer *dmabuffer = (ImxVpuDMAHeapDMABuffer *)buffer;
+	ImxVpuDMABufSync dma_buf_sync;
+	void *virtual_address;
+
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+
+	if (dmabuffer->virtual_address != NULL)
+		return dmabuffer->virtual_address;
+
+	virtual_address = mmap(NULL, dmabuffer->size, PROT_READ | PROT_WRITE, MAP_SHARED, dmabuffer->fd, 0);
+	if (virtual_address == MAP_FAILED)
+	{
+		IMX_VPU_ERROR("mapping dma-buf FD %d failed: %s", dmabuffer->fd, strerror(errno));
+		return NULL;
+	}
+
+	dmabuffer->sync_flags = 0;
+	if (flags & IMX_VPU_MAPPING_FLAG_READ)
+		dmabuffer->sync_flags |= IMX_VPU_DMA_BUF_SYNC_READ;
+	if (flags & IMX_VPU_MAPPING_FLAG_WRITE)
+		dmabuffer->sync_flags |= IMX_VPU_DMA_BUF_SYNC_WRITE;
+	if (dmabuffer->sync_flags == 0)
+		dmabuffer->sync_flags = IMX_VPU_DMA_BUF_SYNC_READ | IMX_VPU_DMA_BUF_SYNC_WRITE;
+
+	/* With manual sync, the caller brackets its accesses with sync_for_cpu() and sync_for_device() */
+	dmabuffer->manual_sync = !!(flags & IMX_VPU_MAPPING_FLAG_MANUAL_SYNC);
+	if (!(dmabuffer->manual_sync))
+	{
+		dma_buf_sync.flags = IMX_VPU_DMA_BUF_SYNC_START | dmabuffer->sync_flags;
+		if (ioctl(dmabuffer->fd, IMX_VPU_DMA_BUF_IOCTL_SYNC, &dma_buf_sync) < 0)
+			IMX_VPU_WARNING("could not begin CPU access to dma-buf FD %d: %s", dmabuffer->fd, strerror(errno));
+	}
+
+	dmabuffer->virtual_address = virtual_address;
+
+	return dmabuffer->virtual_address;
+}
+
+
+static void dma_heap_allocator_unmap(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	ImxVpuDMAHeapDMABuffer *dmabuffer = (ImxVpuDMAHeapDMABuffer *)buffer;
+	ImxVpuDMABufSync dma_buf_sync;
+
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+
+	if (dmabuffer->virtual_address == NULL)
+		return;
+
+	if (!(dmabuffer->manual_sync))
+	{
+		dma_buf_sync.flags = IMX_VPU_DMA_BUF_SYNC_END | dmabuffer->sync_flags;
+		if (ioctl(dmabuffer->fd, IMX_VPU_DMA_BUF_IOCTL_SYNC, &dma_buf_sync) < 0)
+			IMX_VPU_WARNING("could not end CPU access to dma-buf FD %d: %s", dmabuffer->fd, strerror(errno));
+	}
+
+	munmap(dmabuffer->virtual_address, dmabuffer->size);
+	dmabuffer->virtual_address = NULL;
+}
+
+
+static int dma_heap_allocator_get_fd(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	return ((ImxVpuDMAHeapDMABuffer *)buffer)->fd;
+}
+
+
+static imx_vpu_phys_addr_t dma_heap_allocator_get_physical_address(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	return ((ImxVpuDMAHeapDMABuffer *)buffer)->physical_address;
+}
+
+
+static size_t dma_heap_allocator_get_size(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	return ((ImxVpuDMAHeapDMABuffer *)buffer)->size;
+}
+
+
+/* DMA_BUF_IOCTL_SYNC has no ranges, so the offset and length
+ * arguments of the sync functions are ignored. The kernel expects
+ * every START to be followed by an END, so each sync function
+ * issues a complete pair. The direction flag selects the cache
+ * maintenance: with READ, START invalidates the CPU caches; with
+ * WRITE, END cleans them. */
+
+static void dma_heap_allocator_sync(ImxVpuDMAHeapDMABuffer *dmabuffer, uint64_t direction, char const *description)
+{
+	ImxVpuDMABufSync dma_buf_sync;
+
+	dma_buf_sync.flags = IMX_VPU_DMA_BUF_SYNC_START | direction;
+	if (ioctl(dmabuffer->fd, IMX_VPU_DMA_BUF_IOCTL_SYNC, &dma_buf_sync) < 0)
+	{
+		IMX_VPU_WARNING("could not sync dma-buf FD %d for %s: %s", dmabuffer->fd, description, strerror(errno));
+		return;
+	}
+
+	dma_buf_sync.flags = IMX_VPU_DMA_BUF_SYNC_END | direction;
+	if (ioctl(dmabuffer->fd, IMX_VPU_DMA_BUF_IOCTL_SYNC, &dma_buf_sync) < 0)
+		IMX_VPU_WARNING("could not sync dma-buf FD %d for %s: %s", dmabuffer->fd, description, strerror(errno));
+}
+
+
+static void dma_heap_allocator_sync_for_cpu(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	IMXVPUAPI_UNUSED_PARAM(offset);
+	IMXVPUAPI_UNUSED_PARAM(length);
+
+	dma_heap_allocator_sync((ImxVpuDMAHeapDMABuffer *)buffer, IMX_VPU_DMA_BUF_SYNC_READ, "CPU access");
+}
+
+
+static void dma_heap_allocator_sync_for_device(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length)
+{
+	IMXVPUAPI_UNUSED_PARAM(allocator);
+	IMXVPUAPI_UNUSED_PARAM(offset);
+	IMXVPUAPI_UNUSED_PARAM(length);
+
+	dma_heap_allocator_sync((ImxVpuDMAHeapDMABuffer *)buffer, IMX_VPU_DMA_BUF_SYNC_WRITE, "device access");
+}
+
+
+static ImxVpuDMABufferSyncFuncs const dma_heap_allocator_sync_funcs =
+{
+	dma_heap_allocator_sync_for_cpu,
+	dma_heap_allocator_sync_for_device
+};
+
+
+ImxVpuDMAHeapAllocator* imx_vpu_dma_heap_allocator_create(char const *heap_device)
+{
+	ImxVpuDMAHeapAllocator *heap_allocator;
+
+	if (heap_device == NULL)
+		heap_device = IMX_VPU_DEFAULT_DMA_HEAP_DEVICE;
+
+	heap_allocator = IMX_VPU_ALLOC(sizeof(ImxVpuDMAHeapAllocator));
+	if (heap_allocator == NULL)
+	{
+		IMX_VPU_ERROR("allocating heap block for DMA heap allocator failed");
+		return NULL;
+	}
+
+	memset(heap_allocator, 0, sizeof(ImxVpuDMAHeapAllocator));
+
+	heap_allocator->heap_fd = open(heap_device, O_RDWR | O_CLOEXEC);
+	if (heap_allocator->heap_fd < 0)
+	{
+		IMX_VPU_ERROR("could not open DMA heap device %s: %s", heap_device, strerror(errno));
+		IMX_VPU_FREE(heap_allocator, sizeof(ImxVpuDMAHeapAllocator));
+		return NULL;
+	}
+
+	heap_allocator->parent.allocate = dma_heap_allocator_allocate;
+	heap_allocator->parent.deallocate = dma_heap_allocator_deallocate;
+	heap_allocator->parent.map = dma_heap_allocator_map;
+	heap_allocator->parent.unmap = dma_heap_allocator_unmap;
+	heap_allocator->parent.get_fd = dma_heap_allocator_get_fd;
+	heap_allocator->parent.get_physical_address = dma_heap_allocator_get_physical_address;
+	heap_allocator->parent.get_size = dma_heap_allocator_get_size;
+
+	if (!imx_vpu_dma_buffer_allocator_set_sync_funcs(&(heap_allocator->parent), &dma_heap_allocator_sync_funcs))
+	{
+		close(heap_allocator->heap_fd);
+		IMX_VPU_FREE(heap_allocator, sizeof(ImxVpuDMAHeapAllocator));
+		return NULL;
+	}
+
+	IMX_VPU_DEBUG("opened DMA heap device %s", heap_device);
+
+	return heap_allocator;
+}
+
+
+void imx_vpu_dma_heap_allocator_destroy(ImxVpuDMAHeapAllocator *allocator)
+{
+	if (allocator == NULL)
+		return;
+
+	close(allocator->heap_fd);
+	imx_vpu_dma_buffer_allocator_set_sync_funcs(&(allocator->parent), NULL);
+	IMX_VPU_FREE(allocator, sizeof(ImxVpuDMAHeapAllocator));
+}
+
+
+ImxVpuDMABufferAllocator* imx_vpu_dma_heap_allocator_get_allocator(ImxVpuDMAHeapAllocator *allocator)
+{
+	return &(allocator->parent);
+}
+
+
+ImxVpuDMABuffer* imx_vpu_dma_heap_allocator_import_fd(ImxVpuDMAHeapAllocator *allocator, int fd)
+{
+	ImxVpuDMABuffer *dmabuffer;
+	off_t size;
+	int own_fd;
+
+	assert(allocator != NULL);
+
+	/* The size of a dma-buf is reported by seeking to its end */
+	size = lseek(fd, 0, SEEK_END);
+	if (size <= 0)
+	{
+		IMX_VPU_ERROR("could not get size of dma-buf FD %d: %s", fd, strerror(errno));
+		return NULL;
+	}
+	lseek(fd, 0, SEEK_SET);
+
+	own_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (own_fd < 0)
+	{
+		IMX_VPU_ERROR("could not duplicate dma-buf FD %d: %s", fd, strerror(errno));
+		return NULL;
+	}
+
+	dmabuffer = dma_heap_allocator_wrap_fd(allocator, own_fd, (size_t)size);
+	if (dmabuffer == NULL)
+		close(own_fd);
+
+	return dmabuffer;
+}
+
+
+
+
+static void* default_heap_alloc_fn(size_t const size, void *context, char const *file, int const line, char const *fn)
+{
+	IMXVPUAPI_UNUSED_PARAM(context);
+	IMXVPUAPI_UNUSED_PARAM(file);
+	IMXVPUAPI_UNUSED_PARAM(line);
+	IMXVPUAPI_UNUSED_PARAM(fn);
+	return malloc(size);
+}
+
+static void default_heap_free_fn(void *memblock, size_t const size, void *context, char const *file, int const line, char const *fn)
+{
+	IMXVPUAPI_UNUSED_PARAM(context);
+	IMXVPUAPI_UNUSED_PARAM(size);
+	IMXVPUAPI_UNUSED_PARAM(file);
+	IMXVPUAPI_UNUSED_PARAM(line);
+	IMXVPUAPI_UNUSED_PARAM(fn);
+	free(memblock);
+}
+
+void *imx_vpu_cur_heap_alloc_context;
+ImxVpuHeapAllocFunc imx_vpu_cur_heap_alloc_fn = default_heap_alloc_fn;
+ImxVpuHeapFreeFunc imx_vpu_cur_heap_free_fn = default_heap_free_fn;
+
+void imx_vpu_set_heap_allocator_functions(ImxVpuHeapAllocFunc heap_alloc_fn, ImxVpuHeapFreeFunc heap_free_fn, void *context)
+{
+	imx_vpu_cur_heap_alloc_context = context;
+	if ((heap_alloc_fn == NULL) || (heap_free_fn == NULL))
+	{
+		imx_vpu_cur_heap_alloc_fn = default_heap_alloc_fn;
+		imx_vpu_cur_heap_free_fn = default_heap_free_fn;
+	}
+	else
+	{
+		imx_vpu_cur_heap_alloc_fn = heap_alloc_fn;
+		imx_vpu_cur_heap_free_fn = heap_free_fn;
+	}
+}
+
+
+
+
+/***********************/
+/******* LOGGING *******/
+/***********************/
+
+
+static void default_logging_fn(ImxVpuLogLevel level, char const *file, int const line, char const *fn, const char *format, ...)
+{
+	IMXVPUAPI_UNUSED_PARAM(level);
+	IMXVPUAPI_UNUSED_PARAM(file);
+	IMXVPUAPI_UNUSED_PARAM(line);
+	IMXVPUAPI_UNUSED_PARAM(fn);
+	IMXVPUAPI_UNUSED_PARAM(format);
+}
+
+ImxVpuLogLevel imx_vpu_cur_log_level_threshold = IMX_VPU_LOG_LEVEL_ERROR;
+ImxVpuLoggingFunc imx_vpu_cur_logging_fn = default_logging_fn;
+
+void imx_vpu_set_logging_function(ImxVpuLoggingFunc logging_fn)
+{
+	imx_vpu_cur_logging_fn = (logging_fn != NULL) ? logging_fn : default_logging_fn;
+}
+
+void imx_vpu_set_logging_threshold(ImxVpuLogLevel threshold)
+{
+	imx_vpu_cur_log_level_threshold = threshold;
+}
+
+
+
+
+/***********************/
+/******* TRACING *******/
+/***********************/
+
+
+static char const * const trace_event_names[IMX_VPU_NUM_TRACE_EVENT_IDS] =
+{
+	"dec_step_begin",
+	"dec_push_input",
+	"dec_vpu_start",
+	"dec_wait_timeout",
+	"dec_step_end",
+	"dec_framebuffer_displayed",
+	"dec_flush",
+	"enc_step_begin",
+	"enc_vpu_start",
+	"enc_wait_timeout",
+	"enc_step_end",
+	"enc_flush"
+};
+
+
+int imx_vpu_trace_is_available(void)
+{
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
+char const * imx_vpu_trace_event_name(ImxVpuTraceEventID id)
+{
+	if ((unsigned int)id >= IMX_VPU_NUM_TRACE_EVENT_IDS)
+		return "<unknown>";
+	return trace_event_names[id];
+}
+
+
+void imx_vpu_trace_ring_add(ImxVpuTraceRing *ring, ImxVpuTraceEventID id, uint64_t arg0, uint64_t arg1, uint64_t arg2)
+{
+	ImxVpuTraceEvent *event = &(ring->events[ring->num_recorded_events % IMX_VPU_TRACE_RING_SIZE]);
+
+	event->timestamp = imx_vpu_get_monotonic_time();
+	event->id = id;
+	event->args[0] = arg0;
+	event->args[1] = arg1;
+	event->args[2] = arg2;
+
+	ring->num_recorded_events++;
+}
+
+
+unsigned int imx_vpu_trace_ring_get_events(ImxVpuTraceRing const *ring, ImxVpuTraceEvent *events, unsigned int max_events)
+{
+	unsigned long num_events, first, i;
+
+	num_events = ring->num_recorded_events;
+	if (num_events > IMX_VPU_TRACE_RING_SIZE)
+		num_events = IMX_VPU_TRACE_RING_SIZE;
+	if (num_events > max_events)
+		num_events = max_events;
+
+	first = ring->num_recorded_events - num_events;
+	for (i = 0; i < num_events; ++i)
+		events[i] = ring->events[(first + i) % IMX_VPU_TRACE_RING_SIZE];
+
+	return num_events;
+}
+
+
+void imx_vpu_trace_ring_clear(ImxVpuTraceRing *ring)
+{
+	ring->num_recorded_events = 0;
+}
+
+
+
+
+/******************************************************/
+/******* MISCELLANEOUS STRUCTURES AND FUNCTIONS *******/
+/******************************************************/
+
+
+char const *imx_vpu_dec_error_string(ImxVpuDecReturnCodes code)
+{
+	switch (code)
+	{
+		case IMX_VPU_DEC_RETURN_CODE_OK:                        return "ok";
+		case IMX_VPU_DEC_RETURN_CODE_ERROR:                     return "unspecified error";
+		case IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS:            return "invalid params";
+		case IMX_VPU_DEC_RETURN_CODE_INVALID_HANDLE:            return "invalid handle";
+		case IMX_VPU_DEC_RETURN_CODE_INVALID_FRAMEBUFFER:       return "invalid framebuffer";
+		case IMX_VPU_DEC_RETURN_CODE_INSUFFICIENT_FRAMEBUFFERS: return "insufficient framebuffers";
+		case IMX_VPU_DEC_RETURN_CODE_INVALID_STRIDE:            return "invalid stride";
+		case IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE:       return "wrong call sequence";
+		case IMX_VPU_DEC_RETURN_CODE_TIMEOUT:                   return "timeout";
+		case IMX_VPU_DEC_RETURN_CODE_ALREADY_CALLED:            return "already called";
+		default: return "<unknown>";
+	}
+}
+
+
+char const *imx_vpu_enc_error_string(ImxVpuEncReturnCodes code)
+{
+	switch (code)
+	{
+		case IMX_VPU_ENC_RETURN_CODE_OK:                        return "ok";
+		case IMX_VPU_ENC_RETURN_CODE_ERROR:                     return "unspecified error";
+		case IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS:            return "invalid params";
+		case IMX_VPU_ENC_RETURN_CODE_INVALID_HANDLE:            return "invalid handle";
+		case IMX_VPU_ENC_RETURN_CODE_INVALID_FRAMEBUFFER:       return "invalid framebuffer";
+		case IMX_VPU_ENC_RETURN_CODE_INSUFFICIENT_FRAMEBUFFERS: return "insufficient framebuffers";
+		case IMX_VPU_ENC_RETURN_CODE_INVALID_STRIDE:            return "invalid stride";
+		case IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE:       return "wrong call sequence";
+		case IMX_VPU_ENC_RETURN_CODE_TIMEOUT:                   return "timeout";
+		case IMX_VPU_ENC_RETURN_CODE_WRITE_CALLBACK_FAILED:     return "write callback failed";
+		default: return "<unknown>";
+	}
+}
+
+
+char const *imx_vpu_color_format_string(ImxVpuColorFormat color_format)
+{
+	switch (color_format)
+	{
+		case IMX_VPU_COLOR_FORMAT_YUV420: return "YUV 4:2:0";
+		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL: return "YUV 4:2:2 horizontal";
+		case IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL: return "YUV 2:2:4 vertical";
+		case IMX_VPU_COLOR_FORMAT_YUV444: return "YUV 4:4:4";
+		case IMX_VPU_COLOR_FORMAT_YUV400: return "YUV 4:0:0 (8-bit grayscale)";
+		default:
+			return "<unknown>";
+	}
+}
+
+
+char const *imx_vpu_frame_type_string(ImxVpuFrameType frame_type)
+{
+	switch (frame_type)
+	{
+		case IMX_VPU_FRAME_TYPE_I: return "I";
+		case IMX_VPU_FRAME_TYPE_P: return "P";
+		case IMX_VPU_FRAME_TYPE_B: return "B";
+		case IMX_VPU_FRAME_TYPE_IDR: return "IDR";
+		case IMX_VPU_FRAME_TYPE_BI: return "BI";
+		case IMX_VPU_FRAME_TYPE_SKIP: return "SKIP";
+		default: return "<unknown>";
+	}
+}
+
+
+void imx_vpu_calc_framebuffer_sizes(ImxVpuColorFormat color_format, unsigned int frame_width, unsigned int frame_height, unsigned int framebuffer_alignment, int uses_interlacing, int chroma_interleave, ImxVpuFramebufferSizes *calculated_sizes)
+{
+	int alignment;
+
+	assert(calculated_sizes != NULL);
+	assert(frame_width > 0);
+	assert(frame_height > 0);
+
+	calculated_sizes->aligned_frame_width = IMX_VPU_ALIGN_VAL_TO(frame_width, IMX_VPU_FRAME_ALIGN);
+	if (uses_interlacing)
+		calculated_sizes->aligned_frame_height = IMX_VPU_ALIGN_VAL_TO(frame_height, (2 * IMX_VPU_FRAME_ALIGN));
+	else
+		calculated_sizes->aligned_frame_height = IMX_VPU_ALIGN_VAL_TO(frame_height, IMX_VPU_FRAME_ALIGN);
+
+	calculated_sizes->y_stride = calculated_sizes->aligned_frame_width;
+	calculated_sizes->y_size = calculated_sizes->y_stride * calculated_sizes->aligned_frame_height;
+
+	switch (color_format)
+	{
+		case IMX_VPU_COLOR_FORMAT_YUV420:
+			calculated_sizes->cbcr_stride = calculated_sizes->y_stride / 2;
+			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = calculated_sizes->y_size / 4;
+			break;
+		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL:
+		case IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL:
+			calculated_sizes->cbcr_stride = calculated_sizes->y_stride / 2;
+			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = calculated_sizes->y_size / 2;
+			break;
+		case IMX_VPU_COLOR_FORMAT_YUV444:
+			calculated_sizes->cbcr_stride = calculated_sizes->y_stride;
+			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = calculated_sizes->y_size;
+			break;
+		case IMX_VPU_COLOR_FORMAT_YUV400:
+			calculated_sizes->cbcr_stride = 0;
+			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = 0;
+			break;
+		default:
+			assert(0);
+	}
+
+	if (chroma_interleave)
+	{
+		/* chroma_interleave != 0 means the Cb and Cr values are interleaved
+		 * and share one plane. The stride values are doubled compared to
+		 * the chroma_interleave == 0 case because the interleaving happens
+		 * horizontally, meaning 2 bytes in the shared chroma plane for the
+		 * chroma information of one pixel. */
+
+		calculated_sizes->cbcr_stride *= 2;
+		calculated_sizes->cbcr_size *= 2;
+	}
+
+	alignment = framebuffer_alignment;
+	if (alignment > 1)
+	{
+		calculated_sizes->y_size = IMX_VPU_ALIGN_VAL_TO(calculated_sizes->y_size, alignment);
+		calculated_sizes->cbcr_size = IMX_VPU_ALIGN_VAL_TO(calculated_sizes->cbcr_size, alignment);
+		calculated_sizes->mvcol_size = IMX_VPU_ALIGN_VAL_TO(calculated_sizes->mvcol_size, alignment);
+	}
+
+	/* cbcr_size is added twice if chroma_interleave is 0, since in that case,
+	 * there are *two* separate planes for Cb and Cr, each one with cbcr_size bytes,
+	 * while in the chroma_interleave == 1 case, there is one shared chroma plane
+	 * for both Cb and Cr data, with cbcr_size bytes */
+	calculated_sizes->total_size = calculated_sizes->y_size
+	                             + (chroma_interleave ? calculated_sizes->cbcr_size : (calculated_sizes->cbcr_size * 2))
+	                             + calculated_sizes->mvcol_size
+	                             + alignment;
+
+	calculated_sizes->chroma_interleave = chroma_interleave;
+}
+
+
+void imx_vpu_fill_framebuffer_params(ImxVpuFramebuffer *framebuffer, ImxVpuFramebufferSizes *calculated_sizes, ImxVpuDMABuffer *fb_dma_buffer, void* context)
+{
+	assert(framebuffer != NULL);
+	assert(calculated_sizes != NULL);
+
+	framebuffer->dma_buffer = fb_dma_buffer;
+	framebuffer->context = context;
+	framebuffer->y_stride = calculated_sizes->y_stride;
+	framebuffer->cbcr_stride = calculated_sizes->cbcr_stride;
+	framebuffer->y_offset = 0;
+	framebuffer->cb_offset = calculated_sizes->y_size;
+	framebuffer->cr_offset = calculated_sizes->y_size + calculated_sizes->cbcr_size;
+	framebuffer->mvcol_offset = calculated_sizes->y_size + calculated_sizes->cbcr_size * (calculated_sizes->chroma_interleave ? 1 : 2);
+}
+
+
+int imx_vpu_get_framebuffer_plane_layout(ImxVpuFramebuffer const *framebuffer, ImxVpuColorFormat color_format, int chroma_interleave, unsigned int frame_width, unsigned int frame_height, ImxVpuFramebufferPlaneLayout *layout)
+{
+	assert(framebuffer != NULL);
+	assert(framebuffer->dma_buffer != NULL);
+	assert(layout != NULL);
+
+	memset(layout, 0, sizeof(ImxVpuFramebufferPlaneLayout));
+
+	/* The VPU's interleaved chroma plane is in CbCr order */
+	switch (color_format)
+	{
+		case IMX_VPU_COLOR_FORMAT_YUV420:
+			layout->fourcc = chroma_interleave ? IMX_VPU_FOURCC('N', 'V', '1', '2') : IMX_VPU_FOURCC('Y', 'U', '1', '2');
+			break;
+		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL:
+			layout->fourcc = chroma_interleave ? IMX_VPU_FOURCC('N', 'V', '1', '6') : IMX_VPU_FOURCC('Y', 'U', '1', '6');
+			break;
+		case IMX_VPU_COLOR_FORMAT_YUV444:
+			layout->fourcc = chroma_interleave ? IMX_VPU_FOURCC('N', 'V', '2', '4') : IMX_VPU_FOURCC('Y', 'U', '2', '4');
+			break;
+		case IMX_VPU_COLOR_FORMAT_YUV400:
+			layout->fourcc = IMX_VPU_FOURCC('R', '8', ' ', ' ');
+			break;
+		default:
+			IMX_VPU_ERROR("color format %s has no fourcc", imx_vpu_color_format_string(color_format));
+			return 0;
+	}
+
+	layout->width = frame_width;
+	layout->height = frame_height;
+	layout->fd = imx_vpu_dma_buffer_get_fd(framebuffer->dma_buffer);
+	layout->physical_address = imx_vpu_dma_buffer_get_physical_address(framebuffer->dma_buffer);
+
+	layout->offsets[0] = framebuffer->y_offset;
+	layout->pitches[0] = framebuffer->y_stride;
+
+	if (color_format == IMX_VPU_COLOR_FORMAT_YUV400)
+		layout->num_planes = 1;
+	else if (chroma_interleave)
+	{
+		/* cbcr_stride already covers both interleaved components */
+		layout->num_planes = 2;
+		layout->offsets[1] = framebuffer->cb_offset;
+		layout->pitches[1] = framebuffer->cbcr_stride;
+	}
+	else
+	{
+		layout->num_planes = 3;
+		layout->offsets[1] = framebuffer->cb_offset;
+		layout->pitches[1] = framebuffer->cbcr_stride;
+		layout->offsets[2] = framebuffer->cr_offset;
+		layout->pitches[2] = framebuffer->cbcr_stride;
+	}
+
+	return 1;
+}
+
+
+uint64_t imx_vpu_get_monotonic_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)(ts.tv_sec)) * 1000000 + ((uint64_t)(ts.tv_nsec)) / 1000;
+}
+
+
+void imx_vpu_add_frame_stats(ImxVpuStatsTotals *totals, ImxVpuFrameStats const *frame_stats)
+{
+	totals->num_frames++;
+	totals->num_wait_timeouts += frame_stats->num_wait_timeouts;
+	totals->num_bytes += frame_stats->num_bytes;
+
+	totals->push_time += frame_stats->push_time;
+	totals->start_time += frame_stats->start_time;
+	totals->wait_time += frame_stats->wait_time;
+	totals->output_time += frame_stats->output_time;
+	totals->total_time += frame_stats->total_time;
+
+	if (frame_stats->total_time > totals->max_total_time)
+		totals->max_total_time = frame_stats->total_time;
+}
+
+
+void imx_vpu_dec_add_step_stats(ImxVpuDecStats *stats, ImxVpuFrameStats const *frame_stats, unsigned int output_code)
+{
+	imx_vpu_add_frame_stats(&(stats->totals), frame_stats);
+	stats->last_frame = *frame_stats;
+
+	if (output_code & IMX_VPU_DEC_OUTPUT_CODE_DECODED_FRAME_AVAILABLE)
+		stats->num_decoded_frames++;
+	if (output_code & IMX_VPU_DEC_OUTPUT_CODE_DROPPED)
+		stats->num_dropped_frames++;
+}
+
+
+void imx_vpu_enc_add_step_stats(ImxVpuEncStats *stats, ImxVpuFrameStats const *frame_stats, unsigned int output_code)
+{
+	imx_vpu_add_frame_stats(&(stats->totals), frame_stats);
+	stats->last_frame = *frame_stats;
+
+	if (output_code & IMX_VPU_ENC_OUTPUT_CODE_ENCODED_FRAME_AVAILABLE)
+		stats->num_encoded_frames++;
+}
+
+
+void imx_vpu_dec_clear_stats(ImxVpuDecStats *stats)
+{
+	memset(&(stats->totals), 0, sizeof(ImxVpuStatsTotals));
+	stats->num_decoded_frames = 0;
+	stats->num_dropped_frames = 0;
+}
+
+
+void imx_vpu_enc_clear_stats(ImxVpuEncStats *stats)
+{
+	memset(&(stats->totals), 0, sizeof(ImxVpuStatsTotals));
+	stats->num_encoded_frames = 0;
+}
+
+
+int imx_vpu_index_return_queue_init(ImxVpuIndexReturnQueue *queue, unsigned int num_indices)
+{
+	memset(queue, 0, sizeof(ImxVpuIndexReturnQueue));
+
+	queue->next_indices = IMX_VPU_ALLOC(sizeof(int) * num_indices);
+	queue->queued_flags = IMX_VPU_ALLOC(sizeof(int) * num_indices);
+	if ((queue->next_indices == NULL) || (queue->queued_flags == NULL))
+	{
+		IMX_VPU_ERROR("allocating memory for index return queue failed");
+		imx_vpu_index_return_queue_cleanup(queue);
+		return 0;
+	}
+
+	memset(queue->next_indices, 0, sizeof(int) * num_indices);
+	memset((void *)(queue->queued_flags), 0, sizeof(int) * num_indices);
+	queue->num_indices = num_indices;
+
+	return 1;
+}
+
+
+void imx_vpu_index_return_queue_cleanup(ImxVpuIndexReturnQueue *queue)
+{
+	if (queue->next_indices != NULL)
+		IMX_VPU_FREE(queue->next_indices, sizeof(int) * queue->num_indices);
+	if (queue->queued_flags != NULL)
+		IMX_VPU_FREE((void *)(queue->queued_flags), sizeof(int) * queue->num_indices);
+
+	memset(queue, 0, sizeof(ImxVpuIndexReturnQueue));
+}
+
+
+int imx_vpu_index_return_queue_push(ImxVpuIndexReturnQueue *queue, unsigned int index)
+{
+	int old_head;
+
+	assert(index < queue->num_indices);
+
+	/* Atomically set the queued flag; if it was set already, the
+	 * index is in the queue, and pushing it again would create a loop */
+	if (__sync_lock_test_and_set(&(queue->queued_flags[index]), 1))
+		return 0;
+
+	/* Link the index to the current head, and make it the new head. If
+	 * another thread changed the head in between, try again. The CAS is
+	 * a full barrier, so the consumer sees next_indices[index]. */
+	do
+	{
+		old_head = queue->head;
+		queue->next_indices[index] = old_head - 1;
+	}
+	while (!__sync_bool_compare_and_swap(&(queue->head), old_head, (int)index + 1));
+
+	return 1;
+}
+
+
+int imx_vpu_index_return_queue_take_all(ImxVpuIndexReturnQueue *queue)
+{
+	/* Quick check without atomic operation, since this is called often,
+	 * and the queue is usually empty */
+	if (queue->head == 0)
+		return -1;
+
+	return __sync_lock_test_and_set(&(queue->head), 0) - 1;
+}
+
+
+int imx_vpu_index_return_queue_next(ImxVpuIndexReturnQueue *queue, int index)
+{
+	int next_index;
+
+	assert((index >= 0) && ((unsigned int)index < queue->num_indices));
+
+	/* Read the link before clearing the flag, since a producer
+	 * may push the index again (and overwrite the link) as soon
+	 * as the flag is cleared */
+	next_index = queue->next_indices[index];
+	__sync_lock_release(&(queue->queued_flags[index]));
+
+	return next_index;
+}
+
+
+static unsigned int imx_vpu_framebuffer_tracker_hash(ImxVpuFramebufferTracker *tracker, void const *address)
+{
+	/* Fibonacci hashing; the lowest bits are discarded first,
+	 * since addresses of structures are always aligned */
+	uint32_t value = (uint32_t)(((uintptr_t)address) >> 3);
+	return (unsigned int)((value * 2654435769u) & (tracker->num_address_slots - 1));
+}
+
+
+int imx_vpu_framebuffer_tracker_init(ImxVpuFramebufferTracker *tracker, unsigned int num_framebuffers)
+{
+	unsigned int i;
+
+	memset(tracker, 0, sizeof(ImxVpuFramebufferTracker));
+
+	tracker->num_free_mask_words = (num_framebuffers + 31) / 32;
+	tracker->num_address_slots = 1;
+	while (tracker->num_address_slots < num_framebuffers * 2)
+		tracker->num_address_slots <<= 1;
+
+	tracker->free_mask = IMX_VPU_ALLOC(sizeof(uint32_t) * tracker->num_free_mask_words);
+	tracker->address_slots = IMX_VPU_ALLOC(sizeof(ImxVpuFramebufferTrackerSlot) * tracker->num_address_slots);
+	if ((tracker->free_mask == NULL) || (tracker->address_slots == NULL))
+	{
+		IMX_VPU_ERROR("allocating memory for framebuffer tracker failed");
+		imx_vpu_framebuffer_tracker_cleanup(tracker);
+		return 0;
+	}
+
+	tracker->num_framebuffers = num_framebuffers;
+
+	/* Mark all framebuffers as free; unused bits in the last word stay cleared */
+	memset(tracker->free_mask, 0, sizeof(uint32_t) * tracker->num_free_mask_words);
+	for (i = 0; i < num_framebuffers; ++i)
+		tracker->free_mask[i / 32] |= (uint32_t)1 << (i % 32);
+
+	for (i = 0; i < tracker->num_address_slots; ++i)
+	{
+		tracker->address_slots[i].address = NULL;
+		tracker->address_slots[i].index = -1;
+	}
+
+	return 1;
+}
+
+
+void imx_vpu_framebuffer_tracker_cleanup(ImxVpuFramebufferTracker *tracker)
+{
+	if (tracker->free_mask != NULL)
+		IMX_VPU_FREE(tracker->free_mask, sizeof(uint32_t) * tracker->num_free_mask_words);
+	if (tracker->address_slots != NULL)
+		IMX_VPU_FREE(tracker->address_slots, sizeof(ImxVpuFramebufferTrackerSlot) * tracker->num_address_slots);
+
+	memset(tracker, 0, sizeof(ImxVpuFramebufferTracker));
+}
+
+
+void imx_vpu_framebuffer_tracker_set_free(ImxVpuFramebufferTracker *tracker, unsigned int index, int is_free)
+{
+	uint32_t bit = (uint32_t)1 << (index % 32);
+
+	assert(index < tracker->num_framebuffers);
+
+	if (is_free)
+		tracker->free_mask[index / 32] |= bit;
+	else
+		tracker->free_mask[index / 32] &= ~bit;
+}
+
+
+int imx_vpu_framebuffer_tracker_find_free(ImxVpuFramebufferTracker *tracker)
+{
+	unsigned int i;
+
+	for (i = 0; i < tracker->num_free_mask_words; ++i)
+	{
+		if (tracker->free_mask[i] != 0)
+			return (int)(i * 32 + __builtin_ctz(tracker->free_mask[i]));
+	}
+
+	return -1;
+}
+
+
+void imx_vpu_framebuffer_tracker_set_address(ImxVpuFramebufferTracker *tracker, unsigned int index, void const *address)
+{
+	unsigned int slot;
+
+	assert(index < tracker->num_framebuffers);
+	assert(address != NULL);
+
+	/* The table is always at most half full, so a free slot is always found */
+	slot = imx_vpu_framebuffer_tracker_hash(tracker, address);
+	while ((tracker->address_slots[slot].address != NULL) && (tracker->address_slots[slot].address != address))
+		slot = (slot + 1) & (tracker->num_address_slots - 1);
+
+	tracker->address_slots[slot].address = address;
+	tracker->address_slots[slot].index = (int)index;
+}
+
+
+int imx_vpu_framebuffer_tracker_lookup_address(ImxVpuFramebufferTracker *tracker, void const *address)
+{
+	unsigned int slot;
+
+	if ((address == NULL) || (tracker->num_address_slots == 0))
+		return -1;
+
+	slot = imx_vpu_framebuffer_tracker_hash(tracker, address);
+	while (tracker->address_slots[slot].address != NULL)
+	{
+		if (tracker->address_slots[slot].address == address)
+			return tracker->address_slots[slot].index;
+		slot = (slot + 1) & (tracker->num_address_slots - 1);
+	}
+
+	return -1;
+}
+
+
+
+/***************************************/
+/******* ENCODER RATE ADAPTATION *******/
+/***************************************/
+
+
+void imx_vpu_enc_set_default_rate_adaptation_params(ImxVpuEncRateAdaptationParams *params)
+{
+	assert(params != NULL);
+
+	memset(params, 0, sizeof(ImxVpuEncRateAdaptationParams));
+	params->buffer_delay = 500;
+	params->min_qp = -1;
+	params->max_qp = -1;
+	params->enable_frame_skipping = 1;
+	params->max_I_frame_delay = 15;
+}
+
+
+int imx_vpu_enc_rate_adapter_init(ImxVpuEncRateAdapter *adapter, ImxVpuEncRateAdaptationParams const *params, ImxVpuEncOpenParams const *open_params)
+{
+	unsigned int codec_min_qp, codec_max_qp;
+
+	memset(adapter, 0, sizeof(ImxVpuEncRateAdapter));
+
+	if (params == NULL)
+		return 1;
+
+	if (open_params->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
+	{
+		IMX_VPU_ERROR("rate adaptation is not available for motion JPEG");
+		return 0;
+	}
+
+	if (params->buffer_delay == 0)
+	{
+		IMX_VPU_ERROR("rate adaptation needs a nonzero buffer delay");
+		return 0;
+	}
+
+	if ((open_params->frame_rate_numerator == 0) || (open_params->frame_rate_denominator == 0))
+	{
+		IMX_VPU_ERROR("rate adaptation needs a valid frame rate");
+		return 0;
+	}
+
+	/* See the quant_param documentation in ImxVpuEncParams */
+	if (open_params->codec_format == IMX_VPU_CODEC_FORMAT_H264)
+	{
+		codec_min_qp = 0;
+		codec_max_qp = 51;
+	}
+	else
+	{
+		codec_min_qp = 1;
+		codec_max_qp = 31;
+	}
+
+	adapter->min_qp = (params->min_qp < 0) ? codec_min_qp : (unsigned int)(params->min_qp);
+	adapter->max_qp = (params->max_qp < 0) ? codec_max_qp : (unsigned int)(params->max_qp);
+	if ((adapter->min_qp < codec_min_qp) || (adapter->max_qp > codec_max_qp) || (adapter->min_qp > adapter->max_qp))
+	{
+		IMX_VPU_ERROR("invalid QP range %d-%d for rate adaptation", params->min_qp, params->max_qp);
+		return 0;
+	}
+
+	adapter->params = *params;
+	adapter->rate_control_enabled = (open_params->bitrate != 0);
+	adapter->frame_rate_numerator = open_params->frame_rate_numerator;
+	adapter->frame_rate_denominator = open_params->frame_rate_denominator;
+	adapter->target_bitrate = (params->initial_target_bitrate != 0) ? params->initial_target_bitrate : open_params->bitrate;
+	adapter->bitrate = open_params->bitrate;
+	/* kbps times milliseconds yields bits; this is computed with 64 bits,
+	 * since high bitrates and long delays overflow 32 bits */
+	adapter->buffer_size = ((uint64_t)(adapter->target_bitrate)) * params->buffer_delay;
+	adapter->enabled = 1;
+
+	IMX_VPU_DEBUG("enabled rate adaptation:  target bitrate: %u kbps  bucket size: %" PRIu64 " bit  %s", adapter->target_bitrate, adapter->buffer_size, adapter->rate_control_enabled ? "adapting bitrate" : "adapting QP");
+
+	return 1;
+}
+
+
+/* Number of bits the channel carries during one frame interval */
+static uint64_t imx_vpu_enc_rate_adapter_get_frame_bits(ImxVpuEncRateAdapter const *adapter)
+{
+	return ((uint64_t)(adapter->target_bitrate)) * 1000 * adapter->frame_rate_denominator / adapter->frame_rate_numerator;
+}
+
+
+unsigned int imx_vpu_enc_rate_adapter_begin_frame(ImxVpuEncRateAdapter *adapter, ImxVpuEncoder *encoder, ImxVpuEncParams *encoding_params)
+{
+	ImxVpuEncRateAdaptationFrameInfo *cur_frame = &(adapter->cur_frame);
+	uint64_t frame_bits;
+	unsigned int new_bitrate = 0;
+
+	if (!(adapter->enabled))
+		return 0;
+
+	if (adapter->params.target_bitrate_callback != NULL)
+	{
+		unsigned int target_bitrate = adapter->params.target_bitrate_callback(encoder, adapter->params.callback_user_data);
+		if ((target_bitrate != 0) && (target_bitrate != adapter->target_bitrate))
+		{
+			IMX_VPU_LOG("target bitrate changed from %u to %u kbps", adapter->target_bitrate, target_bitrate);
+			adapter->target_bitrate = target_bitrate;
+			adapter->buffer_size = ((uint64_t)target_bitrate) * adapter->params.buffer_delay;
+		}
+	}
+
+	memset(cur_frame, 0, sizeof(ImxVpuEncRateAdaptationFrameInfo));
+	cur_frame->target_bitrate = adapter->target_bitrate;
+
+	/* Without a target (possible in constant quality mode), there is
+	 * nothing to adapt to; frames are only recorded in the history */
+	if (adapter->target_bitrate == 0)
+		return 0;
+
+	frame_bits = imx_vpu_enc_rate_adapter_get_frame_bits(adapter);
+	cur_frame->target_size = frame_bits / 8;
+
+	/* Postpone I frames while the bucket is mostly full, since the large
+	 * I frame would add to the latency that is already there. Once the
+	 * fill level is low enough, or the maximum delay is reached, the
+	 * I frame is produced. */
+	if (encoding_params->force_I_frame || adapter->I_frame_postponed)
+	{
+		if ((adapter->buffer_fill_level > (adapter->buffer_size / 4 * 3)) && (adapter->num_postponing_frames < adapter->params.max_I_frame_delay))
+		{
+			if (!(adapter->I_frame_postponed))
+			{
+				IMX_VPU_LOG("postponing I frame; bucket fill level: %" PRIu64 " of %" PRIu64 " bit", adapter->buffer_fill_level, adapter->buffer_size);
+				adapter->I_frame_postponed = 1;
+				adapter->num_postponed_I_frames++;
+			}
+
+			adapter->num_postponing_frames++;
+			encoding_params->force_I_frame = 0;
+		}
+		else
+		{
+			cur_frame->postponed_I_frame = adapter->I_frame_postponed;
+			encoding_params->force_I_frame = 1;
+			adapter->I_frame_postponed = 0;
+			adapter->num_postponing_frames = 0;
+		}
+	}
+
+	/* Skip the frame if even a frame with the target size would overflow
+	 * the bucket. The first frame is never skipped, since a skipped frame
+	 * is a copy of the preceding one. */
+	if (adapter->params.enable_frame_skipping && !(encoding_params->force_I_frame) && (adapter->num_frames > 0) && ((adapter->buffer_fill_level + frame_bits) > adapter->buffer_size))
+	{
+		IMX_VPU_LOG("skipping frame; bucket fill level: %" PRIu64 " of %" PRIu64 " bit", adapter->buffer_fill_level, adapter->buffer_size);
+		encoding_params->skip_frame = 1;
+		cur_frame->skipped = 1;
+		adapter->num_skipped_frames++;
+	}
+
+	if (adapter->rate_control_enabled)
+	{
+		/* Aim for a bucket that is a quarter full. Deviations change the
+		 * bitrate proportionally: an empty bucket allows for 125% of the
+		 * target, a full one reduces the bitrate to 25% of the target. */
+		int64_t deviation = ((int64_t)(adapter->buffer_fill_level)) - (int64_t)(adapter->buffer_size / 4);
+		int64_t bitrate = ((int64_t)(adapter->target_bitrate)) - ((int64_t)(adapter->target_bitrate)) * deviation / (int64_t)(adapter->buffer_size);
+		unsigned int bitrate_change;
+
+		if ((adapter->params.max_bitrate != 0) && (bitrate > (int64_t)(adapter->params.max_bitrate)))
+			bitrate = adapter->params.max_bitrate;
+		if ((adapter->params.min_bitrate != 0) && (bitrate < (int64_t)(adapter->params.min_bitrate)))
+			bitrate = adapter->params.min_bitrate;
+		if (bitrate < 1)
+			bitrate = 1;
+
+		/* Do not reconfigure the VPU for changes below 1/16 of the current
+		 * bitrate, except when settling on the target */
+		bitrate_change = (bitrate > (int64_t)(adapter->bitrate)) ? (unsigned int)(bitrate - adapter->bitrate) : (unsigned int)(adapter->bitrate - bitrate);
+		if ((bitrate_change != 0) && ((bitrate_change >= (adapter->bitrate / 16)) || (bitrate == (int64_t)(adapter->target_bitrate))))
+		{
+			IMX_VPU_LOG("changing bitrate from %u to %u kbps", adapter->bitrate, (unsigned int)bitrate);
+			adapter->bitrate = bitrate;
+			new_bitrate = bitrate;
+		}
+
+		cur_frame->bitrate = adapter->bitrate;
+	}
+	else
+	{
+		/* In constant quality mode, step the QP up quickly while the bucket
+		 * fills, and down slowly while it is almost empty. The caller's
+		 * quant_param is the starting point. */
+		if (adapter->num_frames == 0)
+			adapter->quant_param = encoding_params->quant_param;
+		else if (adapter->buffer_fill_level > (adapter->buffer_size / 4 * 3))
+			adapter->quant_param += 2;
+		else if (adapter->buffer_fill_level > (adapter->buffer_size / 2))
+			adapter->quant_param += 1;
+		else if ((adapter->buffer_fill_level < (adapter->buffer_size / 8)) && (adapter->quant_param > 0))
+			adapter->quant_param -= 1;
+
+		if (adapter->quant_param < adapter->min_qp)
+			adapter->quant_param = adapter->min_qp;
+		if (adapter->quant_param > adapter->max_qp)
+			adapter->quant_param = adapter->max_qp;
+
+		encoding_params->quant_param = adapter->quant_param;
+		cur_frame->quant_param = adapter->quant_param;
+	}
+
+	return new_bitrate;
+}
+
+
+void imx_vpu_enc_rate_adapter_end_frame(ImxVpuEncRateAdapter *adapter, size_t encoded_size, ImxVpuFrameType frame_type)
+{
+	ImxVpuEncRateAdaptationFrameInfo *cur_frame = &(adapter->cur_frame);
+	uint64_t frame_bits;
+	unsigned int history_index;
+
+	if (!(adapter->enabled))
+		return;
+
+	frame_bits = (adapter->target_bitrate != 0) ? imx_vpu_enc_rate_adapter_get_frame_bits(adapter) : 0;
+
+	/* The frame's data enters the bucket, and one frame interval's worth
+	 * of data drains out of it */
+	adapter->buffer_fill_level += ((uint64_t)encoded_size) * 8;
+	adapter->buffer_fill_level = (adapter->buffer_fill_level > frame_bits) ? (adapter->buffer_fill_level - frame_bits) : 0;
+
+	cur_frame->size = encoded_size;
+	cur_frame->frame_type = frame_type;
+	cur_frame->buffer_fill_level = (adapter->buffer_fill_level > UINT_MAX) ? UINT_MAX : (unsigned int)(adapter->buffer_fill_level);
+
+	if (adapter->num_history_entries < IMX_VPU_ENC_RATE_ADAPTATION_HISTORY_LENGTH)
+	{
+		history_index = (adapter->history_start + adapter->num_history_entries) % IMX_VPU_ENC_RATE_ADAPTATION_HISTORY_LENGTH;
+		adapter->num_history_entries++;
+	}
+	else
+	{
+		history_index = adapter->history_start;
+		adapter->history_start = (adapter->history_start + 1) % IMX_VPU_ENC_RATE_ADAPTATION_HISTORY_LENGTH;
+	}
+	adapter->history[history_index] = *cur_frame;
+
+	adapter->num_frames++;
+}
+
+
+void imx_vpu_enc_rate_adapter_get_state(ImxVpuEncRateAdapter const *adapter, ImxVpuEncRateAdaptationState *state)
+{
+	unsigned int i;
+
+	assert(state != NULL);
+
+	memset(state, 0, sizeof(ImxVpuEncRateAdaptationState));
+
+	if (!(adapter->enabled))
+		return;
+
+	state->target_bitrate = adapter->target_bitrate;
+	state->bitrate = adapter->rate_control_enabled ? adapter->bitrate : 0;
+	state->quant_param = adapter->rate_control_enabled ? 0 : adapter->quant_param;
+	state->buffer_size = (adapter->buffer_size > UINT_MAX) ? UINT_MAX : (unsigned int)(adapter->buffer_size);
+	state->buffer_fill_level = (adapter->buffer_fill_level > UINT_MAX) ? UINT_MAX : (unsigned int)(adapter->buffer_fill_level);
+	state->num_skipped_frames = adapter->num_skipped_frames;
+	state->num_postponed_I_frames = adapter->num_postponed_I_frames;
+
+	for (i = 0; i < adapter->num_history_entries; ++i)
+		state->history[i] = adapter->history[(adapter->history_start + i) % IMX_VPU_ENC_RATE_ADAPTATION_HISTORY_LENGTH];
+	state->num_history_entries = adapter->num_history_entries;
+}
+
+
+
+/*******************************************/
+/******* ENCODER STATE SERIALIZATION *******/
+/*******************************************/
+
+
+/* The state blob consists of an ImxVpuEncStateHeader, followed by
+ * the header data, in the order of the header_sizes array. The
+ * ImxVpuEncOpenParams size is part of the header, to detect blobs
+ * from different libimxvpuapi versions. */
+
+#define IMX_VPU_ENC_STATE_MAGIC 0x53455649 /* "IVES" in little endian */
+#define IMX_VPU_ENC_STATE_VERSION 1
+#define IMX_VPU_ENC_STATE_MAX_NUM_HEADERS 3
+
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t open_params_size;
+	uint32_t num_headers;
+	uint32_t header_sizes[IMX_VPU_ENC_STATE_MAX_NUM_HEADERS];
+
+	ImxVpuEncOpenParams open_params;
+	ImxVpuEncInitialInfo initial_info;
+}
+ImxVpuEncStateHeader;
+
+
+static unsigned int imx_vpu_enc_get_state_header_types(ImxVpuCodecFormat codec_format, ImxVpuEncHeaderDataTypes *types)
+{
+	switch (codec_format)
+	{
+		case IMX_VPU_CODEC_FORMAT_H264:
+			types[0] = IMX_VPU_ENC_HEADER_DATA_TYPE_H264_SPS_RBSP;
+			types[1] = IMX_VPU_ENC_HEADER_DATA_TYPE_H264_PPS_RBSP;
+			return 2;
+
+		case IMX_VPU_CODEC_FORMAT_MPEG4:
+			types[0] = IMX_VPU_ENC_HEADER_DATA_TYPE_MPEG4_VOS;
+			types[1] = IMX_VPU_ENC_HEADER_DATA_TYPE_MPEG4_VIS;
+			types[2] = IMX_VPU_ENC_HEADER_DATA_TYPE_MPEG4_VOL;
+			return 3;
+
+		default:
+			/* Other formats have no out-of-band header data
+			 * (the MJPEG header is produced in imx_vpu_enc_open()) */
+			return 0;
+	}
+}
+
+
+static ImxVpuEncReturnCodes imx_vpu_enc_parse_state(void const *state, size_t state_size, ImxVpuEncStateHeader *header)
+{
+	ImxVpuEncHeaderDataTypes types[IMX_VPU_ENC_STATE_MAX_NUM_HEADERS];
+	size_t total_size;
+	unsigned int i;
+
+	if ((state == NULL) || (state_size < sizeof(ImxVpuEncStateHeader)))
+	{
+		IMX_VPU_ERROR("encoder state is too small");
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	/* The blob does not have to be aligned, so copy the header out of it */
+	memcpy(header, state, sizeof(ImxVpuEncStateHeader));
+
+	if ((header->magic != IMX_VPU_ENC_STATE_MAGIC) || (header->version != IMX_VPU_ENC_STATE_VERSION) || (header->open_params_size != sizeof(ImxVpuEncOpenParams)))
+	{
+		IMX_VPU_ERROR("encoder state has an invalid or incompatible format");
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	if (header->num_headers != imx_vpu_enc_get_state_header_types(header->open_params.codec_format, types))
+	{
+		IMX_VPU_ERROR("encoder state contains %u header(s), which does not match its codec format", (unsigned int)(header->num_headers));
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	total_size = sizeof(ImxVpuEncStateHeader);
+	for (i = 0; i < header->num_headers; ++i)
+	{
+		if (header->header_sizes[i] > (state_size - total_size))
+		{
+			IMX_VPU_ERROR("encoder state is truncated");
+			return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+		}
+		total_size += header->header_sizes[i];
+	}
+
+	header->open_params.additional_dmabuffers_allocator = NULL;
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
+
+
+ImxVpuEncReturnCodes imx_vpu_enc_save_state(ImxVpuEncoder *encoder, void *state, size_t *state_size)
+{
+	ImxVpuEncStateHeader header;
+	ImxVpuEncHeaderDataTypes types[IMX_VPU_ENC_STATE_MAX_NUM_HEADERS];
+	uint8_t const *header_data[IMX_VPU_ENC_STATE_MAX_NUM_HEADERS];
+	size_t total_size, header_data_size;
+	uint8_t *write_ptr;
+	unsigned int i;
+
+	assert(encoder != NULL);
+	assert(state_size != NULL);
+
+	memset(&header, 0, sizeof(header));
+
+	if (!imx_vpu_enc_get_state_params(encoder, &(header.open_params), &(header.initial_info)))
+	{
+		IMX_VPU_ERROR("cannot save encoder state before the initial info was retrieved");
+		return IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	header.magic = IMX_VPU_ENC_STATE_MAGIC;
+	header.version = IMX_VPU_ENC_STATE_VERSION;
+	header.open_params_size = sizeof(ImxVpuEncOpenParams);
+	header.num_headers = imx_vpu_enc_get_state_header_types(header.open_params.codec_format, types);
+	header.open_params.additional_dmabuffers_allocator = NULL;
+
+	total_size = sizeof(ImxVpuEncStateHeader);
+	for (i = 0; i < header.num_headers; ++i)
+	{
+		imx_vpu_enc_query_header_data(encoder, types[i], &(header_data[i]), &header_data_size);
+		if (header_data[i] == NULL)
+			header_data_size = 0;
+		header.header_sizes[i] = header_data_size;
+		total_size += header_data_size;
+	}
+
+	if (state == NULL)
+	{
+		*state_size = total_size;
+		return IMX_VPU_ENC_RETURN_CODE_OK;
+	}
+
+	if (*state_size < total_size)
+	{
+		IMX_VPU_ERROR("encoder state needs %zu byte, but only %zu byte are available", total_size, *state_size);
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	write_ptr = (uint8_t *)state;
+	memcpy(write_ptr, &header, sizeof(header));
+	write_ptr += sizeof(header);
+
+	for (i = 0; i < header.num_headers; ++i)
+	{
+		if (header.header_sizes[i] == 0)
+			continue;
+		memcpy(write_ptr, header_data[i], header.header_sizes[i]);
+		write_ptr += header.header_sizes[i];
+	}
+
+	*state_size = total_size;
+
+	IMX_VPU_DEBUG("saved encoder state with %u header(s) in %zu byte", (unsigned int)(header.num_headers), total_size);
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
+
+
+ImxVpuEncReturnCodes imx_vpu_enc_get_state_info(void const *state, size_t state_size, ImxVpuEncOpenParams *open_params, ImxVpuEncInitialInfo *initial_info, ImxVpuFramebufferSizes *framebuffer_sizes)
+{
+	ImxVpuEncReturnCodes ret;
+	ImxVpuEncStateHeader header;
+
+	if ((ret = imx_vpu_enc_parse_state(state, state_size, &header)) != IMX_VPU_ENC_RETURN_CODE_OK)
+		return ret;
+
+	if (open_params != NULL)
+		*open_params = header.open_params;
+	if (initial_info != NULL)
+		*initial_info = header.initial_info;
+
+	if (framebuffer_sizes != NULL)
+	{
+		/* With 90 and 270 degree rotations, the framebuffers
+		 * hold frames with width and height swapped */
+		int swap = (header.open_params.rotation == IMX_VPU_ROTATION_90) || (header.open_params.rotation == IMX_VPU_ROTATION_270);
+
+		imx_vpu_calc_framebuffer_sizes(
+			header.open_params.color_format,
+			swap ? header.open_params.frame_height : header.open_params.frame_width,
+			swap ? header.open_params.frame_width : header.open_params.frame_height,
+			header.initial_info.framebuffer_alignment,
+			0,
+			header.open_params.chroma_interleave,
+			framebuffer_sizes
+		);
+	}
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
+
+
+ImxVpuEncReturnCodes imx_vpu_enc_open_from_state(ImxVpuEncoder **encoder, void const *state, size_t state_size, ImxVpuDMABufferAllocator *additional_dmabuffers_allocator, ImxVpuDMABuffer *bitstream_buffer)
+{
+	ImxVpuEncReturnCodes ret;
+	ImxVpuEncStateHeader header;
+	ImxVpuEncHeaderDataTypes types[IMX_VPU_ENC_STATE_MAX_NUM_HEADERS];
+	uint8_t const *read_ptr;
+	unsigned int i;
+
+	assert(encoder != NULL);
+	assert(bitstream_buffer != NULL);
+
+	if ((ret = imx_vpu_enc_parse_state(state, state_size, &header)) != IMX_VPU_ENC_RETURN_CODE_OK)
+		return ret;
+
+	header.open_params.additional_dmabuffers_allocator = additional_dmabuffers_allocator;
+
+	if ((ret = imx_vpu_enc_open(encoder, &(header.open_params), bitstream_buffer)) != IMX_VPU_ENC_RETURN_CODE_OK)
+		return ret;
+
+	imx_vpu_enc_get_state_header_types(header.open_params.codec_format, types);
+
+	read_ptr = ((uint8_t const *)state) + sizeof(ImxVpuEncStateHeader);
+	for (i = 0; i < header.num_headers; ++i)
+	{
+		/* Empty headers were not generated when the state was saved;
+		 * imx_vpu_enc_set_header_data() does not accept these */
+		if (header.header_sizes[i] == 0)
+			continue;
+
+		if ((ret = imx_vpu_enc_set_header_data(*encoder, types[i], read_ptr, header.header_sizes[i])) != IMX_VPU_ENC_RETURN_CODE_OK)
+		{
+			IMX_VPU_ERROR("could not restore encoder header data");
+			imx_vpu_enc_close(*encoder);
+			*encoder = NULL;
+			return ret;
+		}
+
+		read_ptr += header.header_sizes[i];
+	}
+
+	imx_vpu_enc_set_headers_restored(*encoder);
+
+	IMX_VPU_DEBUG("opened encoder from state with %u header(s)", (unsigned int)(header.num_headers));
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
 }
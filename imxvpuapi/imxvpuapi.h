@@ -75,7 +75,13 @@ typedef enum
 	/* Map memory for CPU write access */
 	IMX_VPU_MAPPING_FLAG_WRITE   = (1UL << 0),
 	/* Map memory for CPU read access */
-	IMX_VPU_MAPPING_FLAG_READ    = (1UL << 1)
+	IMX_VPU_MAPPING_FLAG_READ    = (1UL << 1),
+	/* Do not perform cache maintenance for the entire buffer in map() and unmap().
+	 * Instead, the caller uses imx_vpu_dma_buffer_sync_for_cpu() and
+	 * imx_vpu_dma_buffer_sync_for_device() for the ranges it actually accesses.
+	 * This is useful for cached mappings that stay mapped for a long time, like
+	 * those of bitstream buffers. */
+	IMX_VPU_MAPPING_FLAG_MANUAL_SYNC = (1UL << 2)
 	/* XXX: When adding extra flags here, follow the pattern: IMX_VPU_MAPPING_FLAG_<NAME> = (1UL << <INDEX>) */
 }
 ImxVpuMappingFlags;
@@ -123,6 +129,9 @@ typedef struct _ImxVpuDMABufferAllocator ImxVpuDMABufferAllocator;
  *
  * get_size(): Returns the size of the buffer, in bytes.
  *
+ * Cache maintenance functions are not part of this structure, so allocators written for older versions
+ * of this API keep working. They can be registered separately with imx_vpu_dma_buffer_allocator_set_sync_funcs().
+ *
  * The vfuncs get_fd(), get_physical_address(), and get_size() can also be used while the buffer is mapped. */
 struct _ImxVpuDMABufferAllocator
 {
@@ -139,6 +148,29 @@ struct _ImxVpuDMABufferAllocator
 };
 
 
+/* ImxVpuDMABufferSyncFuncs:
+ *
+ * Optional cache maintenance functions of an allocator, for buffers that are mapped with
+ * IMX_VPU_MAPPING_FLAG_MANUAL_SYNC. They are registered with imx_vpu_dma_buffer_allocator_set_sync_funcs().
+ *
+ * sync_for_cpu(): Performs the cache maintenance necessary before the CPU reads data which the device wrote
+ *                 to the given range of the buffer (typically, this invalidates the cache lines of that range).
+ *                 "offset" and "length" are given in bytes. Allocators may sync a larger range than requested.
+ *
+ * sync_for_device(): Performs the cache maintenance necessary before the device reads data which the CPU wrote
+ *                    to the given range of the buffer (typically, this cleans the cache lines of that range).
+ *
+ * Each call is complete by itself; the two functions are not used as a begin/end pair. Either can be NULL if
+ * the allocator's mappings need no maintenance in that direction. They are only called while the buffer is
+ * mapped. */
+typedef struct
+{
+	void (*sync_for_cpu)(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length);
+	void (*sync_for_device)(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABuffer *buffer, size_t offset, size_t length);
+}
+ImxVpuDMABufferSyncFuncs;
+
+
 /* ImxVpuDMABuffer:
  *
  * Opaque object containing a DMA buffer. Its structure is defined by the allocator which created the object. */
@@ -182,12 +214,172 @@ void imx_vpu_dma_buffer_unmap(ImxVpuDMABuffer *buffer);
 int imx_vpu_dma_buffer_get_fd(ImxVpuDMABuffer *buffer);
 imx_vpu_phys_addr_t imx_vpu_dma_buffer_get_physical_address(ImxVpuDMABuffer *buffer);
 size_t imx_vpu_dma_buffer_get_size(ImxVpuDMABuffer *buffer);
+/* These call the sync functions registered for the buffer's allocator. They do nothing if no functions
+ * were registered, or if the corresponding function is NULL. */
+void imx_vpu_dma_buffer_sync_for_cpu(ImxVpuDMABuffer *buffer, size_t offset, size_t length);
+void imx_vpu_dma_buffer_sync_for_device(ImxVpuDMABuffer *buffer, size_t offset, size_t length);
+
+/* Registers cache maintenance functions for an allocator. sync_funcs is copied. Registering again replaces
+ * the previous functions. Passing NULL as sync_funcs unregisters them; this must be done before the allocator
+ * is destroyed. The allocators of this library (the DMA heap allocator, pools, and arenas) register their
+ * functions themselves. Registration is thread safe. Returns 0 if memory allocation failed, nonzero otherwise. */
+int imx_vpu_dma_buffer_allocator_set_sync_funcs(ImxVpuDMABufferAllocator *allocator, ImxVpuDMABufferSyncFuncs const *sync_funcs);
 
 /* Call for initializing wrapped DMA buffer structures.
  * Always call this before further using such a structure. */
 void imx_vpu_init_wrapped_dma_buffer(ImxVpuWrappedDMABuffer *buffer);
 
 
+/* ImxVpuDMABufferPool:
+ *
+ * Pooling DMA buffer allocator. It wraps a backing allocator (for example, the default allocator of the
+ * decoder or encoder). Deallocated buffers are not returned to the backing allocator right away. Instead,
+ * they are kept in free lists, and reused by subsequent allocations. This avoids going back to the kernel
+ * for every allocation, which is slow, and which fragments the physical memory over time. It is
+ * particularly useful if decoders and encoders are frequently closed and reopened.
+ *
+ * Buffers are grouped in size classes. The size of a class is the requested size, rounded up to whole
+ * pages, and then rounded up to the next of four steps between powers of two (for example, 5, 6, 7, 8,
+ * 10, 12, 14, 16 pages ...). This limits the memory wasted by rounding to 25%. A free buffer is reused
+ * if it is in the same size class, and if its alignment and allocation flags are compatible.
+ *
+ * Use imx_vpu_dma_buffer_pool_get_allocator() to get the ImxVpuDMABufferAllocator of the pool, and pass that
+ * allocator to the functions which allocate DMA buffers. The pool is not thread safe. */
+typedef struct _ImxVpuDMABufferPool ImxVpuDMABufferPool;
+
+/* Statistics about an ImxVpuDMABufferPool. All sizes are in bytes, and refer to the size of the memory
+ * blocks allocated by the backing allocator (that is, with the size class rounding applied). */
+typedef struct
+{
+	/* Total size of all buffers allocated with the backing allocator,
+	 * both in use and in the free lists. */
+	size_t allocated_size;
+	/* Total size of all buffers which are currently in use. */
+	size_t in_use_size;
+	/* Total size of all buffers in the free lists. */
+	size_t free_size;
+	/* Highest allocated_size value so far. */
+	size_t high_water_mark;
+
+	/* Number of allocations which were served from the free lists. */
+	unsigned long num_reused_allocations;
+	/* Number of allocations which required the backing allocator. */
+	unsigned long num_backing_allocations;
+}
+ImxVpuDMABufferPoolStats;
+
+/* Creates a new pool which allocates memory with backing_allocator. max_free_size is the maximum total
+ * size of buffers to keep in the free lists. Buffers which are deallocated when this limit is reached are
+ * returned to the backing allocator. 0 means that there is no limit. Returns NULL if memory allocation
+ * failed. */
+ImxVpuDMABufferPool* imx_vpu_dma_buffer_pool_create(ImxVpuDMABufferAllocator *backing_allocator, size_t max_free_size);
+/* Destroys the pool, and returns all buffers in the free lists to the backing allocator. All buffers that
+ * were allocated from the pool must have been deallocated before this is called. */
+void imx_vpu_dma_buffer_pool_destroy(ImxVpuDMABufferPool *pool);
+/* Returns the allocator of the pool. */
+ImxVpuDMABufferAllocator* imx_vpu_dma_buffer_pool_get_allocator(ImxVpuDMABufferPool *pool);
+/* Allocates num_buffers buffers with the backing allocator, and places them in the free lists. This is
+ * useful for reserving physical memory at startup, before it becomes fragmented. The max_free_size limit
+ * does not apply to this call. Returns 0 if an allocation failed, nonzero otherwise. */
+int imx_vpu_dma_buffer_pool_preallocate(ImxVpuDMABufferPool *pool, size_t size, unsigned int alignment, unsigned int flags, unsigned int num_buffers);
+/* Returns all buffers in the free lists to the backing allocator. */
+void imx_vpu_dma_buffer_pool_trim(ImxVpuDMABufferPool *pool);
+/* Retrieves statistics about the pool. stats must not be NULL. */
+void imx_vpu_dma_buffer_pool_get_stats(ImxVpuDMABufferPool *pool, ImxVpuDMABufferPoolStats *stats);
+
+
+/* ImxVpuDMABufferArena:
+ *
+ * DMA buffer allocator which splits one large DMA buffer (the arena) into smaller ones. This is intended
+ * for the bitstream buffers of many decoders (or encoders) with low bitrates and resolutions: instead of
+ * allocating one DMA buffer per instance, which wastes physical memory due to page granularity and per-buffer
+ * overhead, and fragments it over time, one arena is allocated at startup, and instances get sub-buffers of
+ * it. Sub-buffers sized with imx_vpu_dec_get_bitstream_buffer_info_with_hints() make this most effective.
+ *
+ * Space is allocated with a first-fit strategy. Deallocated sub-buffers are merged with adjacent free space.
+ * The VPU cannot move or resize a bitstream buffer while the instance that uses it is open, so sub-buffers
+ * keep their size until they are deallocated. To rebalance the space between streams, close the instance
+ * whose buffer shall change, deallocate its sub-buffer, and allocate a sub-buffer with the new size for the
+ * reopened instance. The other instances keep running in the meantime. imx_vpu_dma_buffer_arena_get_stats()
+ * reports the largest free block, which is the largest sub-buffer that can currently be allocated.
+ *
+ * The arena is mapped on demand, the first time a sub-buffer is mapped, and unmapped when no sub-buffer is
+ * mapped anymore. Sub-buffers are always mapped for reading and writing. Sub-buffers have physical addresses
+ * (if the arena has one), but no FDs, since an FD would refer to the entire arena; get_fd() returns -1 for
+ * them. The arena is not thread safe. */
+typedef struct _ImxVpuDMABufferArena ImxVpuDMABufferArena;
+
+/* Statistics about an ImxVpuDMABufferArena. All sizes are in bytes. */
+typedef struct
+{
+	/* Size of the arena. */
+	size_t size;
+	/* Total size of all sub-buffers which are currently allocated,
+	 * including padding for alignment. */
+	size_t in_use_size;
+	/* Size of the largest contiguous free block. */
+	size_t largest_free_block_size;
+	/* Highest in_use_size value so far. */
+	size_t high_water_mark;
+
+	/* Number of sub-buffers which are currently allocated. */
+	unsigned int num_sub_buffers;
+	/* Number of allocations which failed because no free block was large enough. */
+	unsigned long num_failed_allocations;
+}
+ImxVpuDMABufferArenaStats;
+
+/* Creates a new arena by allocating one DMA buffer with the given size, alignment, and flags from the
+ * backing allocator. The alignment is also the maximum alignment that sub-buffers can have. Returns NULL if
+ * allocation failed. */
+ImxVpuDMABufferArena* imx_vpu_dma_buffer_arena_create(ImxVpuDMABufferAllocator *backing_allocator, size_t size, unsigned int alignment, unsigned int flags);
+/* Destroys the arena, and deallocates its DMA buffer. All sub-buffers must have been deallocated before
+ * this is called. */
+void imx_vpu_dma_buffer_arena_destroy(ImxVpuDMABufferArena *arena);
+/* Returns the allocator of the arena. Its allocate vfunc ignores the flags argument, since the flags of
+ * the arena's DMA buffer apply to all sub-buffers. */
+ImxVpuDMABufferAllocator* imx_vpu_dma_buffer_arena_get_allocator(ImxVpuDMABufferArena *arena);
+/* Retrieves statistics about the arena. stats must not be NULL. */
+void imx_vpu_dma_buffer_arena_get_stats(ImxVpuDMABufferArena *arena, ImxVpuDMABufferArenaStats *stats);
+
+
+/* ImxVpuDMAHeapAllocator:
+ *
+ * DMA buffer allocator which allocates dma-buf buffers from a Linux DMA heap (for example, the CMA heap).
+ * Unlike the default allocators of the backends, its buffers have FDs, so decoded frames can be passed
+ * to the display, the IPU, the GPU (through EGL_EXT_image_dma_buf_import), or V4L2 devices without copying.
+ * Use imx_vpu_get_framebuffer_plane_layout() to describe the planes of a framebuffer to these importers.
+ *
+ * The VPU needs physical addresses. These are retrieved with the DMA_BUF_IOCTL_PHYS ioctl, which is an
+ * extension found in the NXP i.MX kernels. Allocation and import fail if the kernel does not support it.
+ *
+ * Buffers are mapped with mmap(). map() begins, and unmap() ends, a CPU access with DMA_BUF_IOCTL_SYNC,
+ * so the required cache maintenance is done even if the heap hands out cached memory. If the buffer is
+ * mapped with IMX_VPU_MAPPING_FLAG_MANUAL_SYNC, this is instead done by its sync functions (see
+ * ImxVpuDMABufferSyncFuncs). Each of these issues a complete START/END pair of DMA_BUF_IOCTL_SYNC calls.
+ * DMA_BUF_IOCTL_SYNC has no notion of ranges, so these always sync the entire buffer. The allocate
+ * vfunc ignores the flags argument; whether buffers are cached depends on the heap. With NXP kernels,
+ * the "linux,cma-uncached" heap provides uncached memory. The allocator is not thread safe. */
+typedef struct _ImxVpuDMAHeapAllocator ImxVpuDMAHeapAllocator;
+
+/* Default DMA heap device used by imx_vpu_dma_heap_allocator_create(). */
+#define IMX_VPU_DEFAULT_DMA_HEAP_DEVICE "/dev/dma_heap/linux,cma"
+
+/* Creates a new DMA heap allocator by opening the given heap device. If heap_device is NULL,
+ * IMX_VPU_DEFAULT_DMA_HEAP_DEVICE is used. Returns NULL if the device could not be opened. */
+ImxVpuDMAHeapAllocator* imx_vpu_dma_heap_allocator_create(char const *heap_device);
+/* Destroys the allocator. All buffers that were allocated or imported with it must have been
+ * deallocated before this is called. */
+void imx_vpu_dma_heap_allocator_destroy(ImxVpuDMAHeapAllocator *allocator);
+/* Returns the ImxVpuDMABufferAllocator of the DMA heap allocator. */
+ImxVpuDMABufferAllocator* imx_vpu_dma_heap_allocator_get_allocator(ImxVpuDMAHeapAllocator *allocator);
+/* Imports an existing dma-buf, for example one that was allocated by a display or capture driver, so it
+ * can be used as an ImxVpuDMABuffer (for instance, as a framebuffer to decode into). The FD is duplicated,
+ * so the caller keeps ownership of fd. Deallocate the returned buffer with imx_vpu_dma_buffer_deallocate().
+ * Returns NULL if the buffer has no physical address, or if the import failed otherwise. */
+ImxVpuDMABuffer* imx_vpu_dma_heap_allocator_import_fd(ImxVpuDMAHeapAllocator *allocator, int fd);
+
+
 /* Heap allocation function for virtual memory blocks internally allocated by imxvpuapi.
  * These have nothing to do with the DMA buffer allocation interface defined above.
  * By default, malloc/free are used. */
@@ -238,6 +430,93 @@ void imx_vpu_set_logging_threshold(ImxVpuLogLevel threshold);
  * If logging_fn is NULL, logging is disabled. This is the default value. */
 void imx_vpu_set_logging_function(ImxVpuLoggingFunc logging_fn);
 
+/* NOTE: Log levels can also be removed at compile time, with the --max-log-level configure
+ * option. Logs with a lower priority than the level given there are not compiled in, so they
+ * cost nothing, and cannot be enabled with imx_vpu_set_logging_threshold(). */
+
+
+
+
+/***********************/
+/******* TRACING *******/
+/***********************/
+
+
+/* Tracing records what decoders and encoders do as a sequence of binary events. Each decoder
+ * and encoder instance has its own fixed-size ring buffer for these events. Recording an event
+ * only reads a clock and stores a few integers, so unlike logging at IMX_VPU_LOG_LEVEL_LOG,
+ * tracing can stay enabled on live systems. This is useful for finding out why a pipeline
+ * stalls: the ring always contains the most recent events. Once it is full, new events
+ * overwrite the oldest ones.
+ *
+ * The events can be retrieved with imx_vpu_dec_get_trace_events() and
+ * imx_vpu_enc_get_trace_events(), and then be written out or converted to the formats of
+ * other tracing tools. The timestamps use the same clock as ImxVpuFrameStats.
+ *
+ * Tracing is only compiled in if the library was configured with the --enable-tracing
+ * option. Otherwise, no events are recorded, and the functions for retrieving them return
+ * no events. */
+
+
+/* Number of events the ring buffer of each decoder and encoder can hold. */
+#define IMX_VPU_TRACE_RING_SIZE 256
+
+/* Number of integer arguments each event has. Unused arguments are set to 0. */
+#define IMX_VPU_TRACE_EVENT_NUM_ARGS 3
+
+
+/* Trace event IDs. The comments describe the arguments of each event. */
+typedef enum
+{
+	/* A decoding step began. Args: number of input bytes. */
+	IMX_VPU_TRACE_EVENT_DEC_STEP_BEGIN = 0,
+	/* Input data (including any inserted headers) was written to the bitstream buffer.
+	 * Args: number of bytes, offset in the bitstream buffer where writing began. */
+	IMX_VPU_TRACE_EVENT_DEC_PUSH_INPUT,
+	/* The VPU was started. */
+	IMX_VPU_TRACE_EVENT_DEC_VPU_START,
+	/* Waiting for the VPU timed out. Args: number of timeouts in this step so far. */
+	IMX_VPU_TRACE_EVENT_DEC_WAIT_TIMEOUT,
+	/* A decoding step ended. Args: return code, output code, number of input bytes. */
+	IMX_VPU_TRACE_EVENT_DEC_STEP_END,
+	/* A framebuffer was marked as displayed. Args: framebuffer index. */
+	IMX_VPU_TRACE_EVENT_DEC_FRAMEBUFFER_DISPLAYED,
+	/* The decoder was flushed. */
+	IMX_VPU_TRACE_EVENT_DEC_FLUSH,
+
+	/* An encoding step began. Args: PTS of the raw frame. */
+	IMX_VPU_TRACE_EVENT_ENC_STEP_BEGIN,
+	/* The VPU was started. */
+	IMX_VPU_TRACE_EVENT_ENC_VPU_START,
+	/* Waiting for the VPU timed out. Args: number of timeouts in this step so far. */
+	IMX_VPU_TRACE_EVENT_ENC_WAIT_TIMEOUT,
+	/* An encoding step ended. Args: return code, output code, number of encoded bytes. */
+	IMX_VPU_TRACE_EVENT_ENC_STEP_END,
+	/* The encoder was flushed. */
+	IMX_VPU_TRACE_EVENT_ENC_FLUSH,
+
+	IMX_VPU_NUM_TRACE_EVENT_IDS
+}
+ImxVpuTraceEventID;
+
+
+/* One recorded trace event. */
+typedef struct
+{
+	/* Time of the event, in microseconds, from a monotonic clock */
+	uint64_t timestamp;
+	ImxVpuTraceEventID id;
+	uint64_t args[IMX_VPU_TRACE_EVENT_NUM_ARGS];
+}
+ImxVpuTraceEvent;
+
+
+/* Returns nonzero if the library was built with tracing support. */
+int imx_vpu_trace_is_available(void);
+
+/* Returns a short human-readable name for the event ID, like "dec_step_begin". */
+char const * imx_vpu_trace_event_name(ImxVpuTraceEventID id);
+
 
 
 
@@ -395,6 +674,33 @@ typedef enum
 ImxVpuColorFormat;
 
 
+/* Rotation angles for the VPU's rotator. The rotation is counterclockwise.
+ * With 90 and 270 degrees, the width and height of the rotated frames are
+ * swapped. */
+typedef enum
+{
+	IMX_VPU_ROTATION_NONE = 0,
+	IMX_VPU_ROTATION_90   = 90,
+	IMX_VPU_ROTATION_180  = 180,
+	IMX_VPU_ROTATION_270  = 270
+}
+ImxVpuRotation;
+
+
+/* Mirror directions for the VPU's rotator. Mirroring is applied after rotation. */
+typedef enum
+{
+	IMX_VPU_MIRROR_NONE       = 0,
+	/* Flip the frame upside down */
+	IMX_VPU_MIRROR_VERTICAL   = 1,
+	/* Flip the frame left to right */
+	IMX_VPU_MIRROR_HORIZONTAL = 2,
+	/* Both of the above; the same as a 180 degree rotation */
+	IMX_VPU_MIRROR_BOTH       = 3
+}
+ImxVpuMirrorDirection;
+
+
 /* Framebuffers are frame containers, and are used both for en- and decoding. */
 typedef struct
 {
@@ -556,12 +862,122 @@ void imx_vpu_calc_framebuffer_sizes(ImxVpuColorFormat color_format, unsigned int
  * The specified DMA buffer and context pointer are also set. */
 void imx_vpu_fill_framebuffer_params(ImxVpuFramebuffer *framebuffer, ImxVpuFramebufferSizes *calculated_sizes, ImxVpuDMABuffer *fb_dma_buffer, void* context);
 
+/* Creates a fourcc code. The fourcc codes used by imxvpuapi are the DRM ones from drm_fourcc.h,
+ * which are also used by KMS and by EGL_EXT_image_dma_buf_import. */
+#define IMX_VPU_FOURCC(a, b, c, d) \
+	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define IMX_VPU_MAX_NUM_FRAME_PLANES 3
+
+/* Description of the planes of a framebuffer, in the form dma-buf importers expect. */
+typedef struct
+{
+	/* DRM fourcc of the pixel format, for example DRM_FORMAT_NV12 for
+	 * YUV420 frames with chroma interleave. */
+	uint32_t fourcc;
+	/* Visible frame width and height, in pixels. */
+	unsigned int width, height;
+
+	/* FD of the framebuffer's DMA buffer, or -1 if the DMA buffer has no FD.
+	 * All planes are located in this one buffer. */
+	int fd;
+	/* Physical address of the start of the DMA buffer, or 0 if it has none. */
+	imx_vpu_phys_addr_t physical_address;
+
+	/* Number of planes, and the offset (relative to the start of the DMA
+	 * buffer) and pitch of each plane, in bytes. */
+	unsigned int num_planes;
+	size_t offsets[IMX_VPU_MAX_NUM_FRAME_PLANES];
+	unsigned int pitches[IMX_VPU_MAX_NUM_FRAME_PLANES];
+}
+ImxVpuFramebufferPlaneLayout;
+
+/* Convenience function which describes the planes of a framebuffer, for example the one of a decoded
+ * ImxVpuRawFrame, as dma-buf planes with offsets, pitches, and a fourcc. color_format, chroma_interleave,
+ * frame_width, and frame_height must be the values the framebuffer was set up with (when decoding, these
+ * are found in ImxVpuDecInitialInfo and ImxVpuDecOpenParams). Together with an FD from a dma-buf backed
+ * allocator like ImxVpuDMAHeapAllocator, this is enough to import the frame into the display, the IPU, or
+ * the GPU without copying. Returns 0 if the color format has no fourcc (this is the case with
+ * IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL), nonzero otherwise. */
+int imx_vpu_get_framebuffer_plane_layout(ImxVpuFramebuffer const *framebuffer, ImxVpuColorFormat color_format, int chroma_interleave, unsigned int frame_width, unsigned int frame_height, ImxVpuFramebufferPlaneLayout *layout);
+
+/* Structure used together with imx_vpu_dec_get_bitstream_buffer_info_with_hints() and
+ * imx_vpu_enc_get_bitstream_buffer_info_with_hints(). It describes the stream the
+ * bitstream buffer will be used for, so that smaller buffers can be used for
+ * streams with low resolutions. */
+typedef struct
+{
+	/* Codec format of the stream. */
+	ImxVpuCodecFormat codec_format;
+
+	/* Maximum width and height of the frames in the stream, in pixels.
+	 * If either of them is 0, 1920x1088 is assumed. */
+	unsigned int max_frame_width, max_frame_height;
+
+	/* Maximum bitrate of the stream, in kbps, or 0 if unknown. This is only
+	 * used by the decoder, to make sure its bitstream buffer can absorb
+	 * bitrate peaks. */
+	unsigned int max_bitrate;
+}
+ImxVpuBitstreamBufferHints;
+
 /* Returns a human-readable description of the given color format. Useful for logging. */
 char const *imx_vpu_color_format_string(ImxVpuColorFormat color_format);
 /* Returns a human-readable description of the given frame type. Useful for logging. */
 char const *imx_vpu_frame_type_string(ImxVpuFrameType frame_type);
 
 
+/* Statistics about one decoding or encoding step (one imx_vpu_dec_decode() / imx_vpu_enc_encode()
+ * call, or one start/finish pair of the asynchronous API). All times are in microseconds, measured
+ * with a monotonic clock. Which stages can be measured separately depends on the backend; with the
+ * fslwrapper backend, start_time is always 0, push_time contains the time before the VPU wrapper's
+ * decode/encode call (which includes any input copying the wrapper does internally), and wait_time
+ * contains the time spent in that call. */
+typedef struct
+{
+	/* Time spent before the VPU is started: copying input data into the bitstream buffer and
+	 * inserting frame headers (decoder), or setting up the input frame and headers (encoder). */
+	uint64_t push_time;
+	/* Time spent in the VPU library's call for starting the frame. */
+	uint64_t start_time;
+	/* Time spent waiting for the VPU to finish the frame. With the asynchronous API, this
+	 * includes time spent waiting in the poll functions, but not the time between calls. */
+	uint64_t wait_time;
+	/* Time spent retrieving the output information and processing the output. */
+	uint64_t output_time;
+	/* Time from the beginning of the decoding/encoding call to the end of the finish call.
+	 * With the asynchronous API, this also includes the time between the calls. */
+	uint64_t total_time;
+
+	/* Number of times the VPU did not respond within the internal timeout interval. If this
+	 * reaches the internal maximum, the step returns a timeout error. */
+	unsigned int num_wait_timeouts;
+
+	/* Number of encoded bytes: input bytes for decoders, output bytes for encoders. */
+	size_t num_bytes;
+
+	/* Number of bytes in the decoder's bitstream buffer right before the VPU was started.
+	 * Always 0 for encoders and for motion JPEG. */
+	size_t bitstream_buffer_fill_level;
+}
+ImxVpuFrameStats;
+
+
+/* Accumulated statistics of all steps since the decoder/encoder was opened, or since the
+ * last reset. Times are sums of the values in ImxVpuFrameStats. */
+typedef struct
+{
+	unsigned long num_frames;
+	unsigned long num_wait_timeouts;
+	uint64_t num_bytes;
+
+	uint64_t push_time, start_time, wait_time, output_time, total_time;
+	/* Largest total_time of a single step */
+	uint64_t max_total_time;
+}
+ImxVpuStatsTotals;
+
+
 
 
 /************************************************/
@@ -593,6 +1009,9 @@ char const *imx_vpu_frame_type_string(ImxVpuFrameType frame_type);
  * 1. Call imx_vpu_dec_get_bitstream_buffer_info(), and allocate a DMA buffer
  *    with the given size and alignment. This is the minimum required size.
  *    The buffer can be larger, but must not be smaller than the given size.
+ *    If the codec format and maximum frame size are known in advance,
+ *    imx_vpu_dec_get_bitstream_buffer_info_with_hints() can be used instead
+ *    to get a smaller size.
  * 2. Fill an instance of ImxVpuDecOpenParams with the values specific to the
  *    input data. Check the documentation of ImxVpuDecOpenParams for details
  *    about its fields.
@@ -636,6 +1055,8 @@ char const *imx_vpu_frame_type_string(ImxVpuFrameType frame_type);
  *     Note that any internal context/PTS/DTS values from the encoded and raw frames will be thrown
  *     away after this call; if for example the context is an index, the system that hands
  *     out the indices should be informed that any previously handed out index is now unused.
+ *     If the new position is not a keyframe, call imx_vpu_dec_enable_keyframe_search() after
+ *     flushing; the decoder then drops all frames until the next keyframe (see below).
  * 12. When there is no more incoming data, and pending decoded frames need to be retrieved
  *     from the decoder, enable drain mode with imx_vpu_dec_enable_drain_mode(). This is
  *     typically necessary when the data source reached its end, playback is finishing, and
@@ -669,6 +1090,12 @@ char const *imx_vpu_frame_type_string(ImxVpuFrameType frame_type);
  * that is initially cleared, and raised in the initial info callback; it is pointless to
  * call imx_vpu_dec_check_if_can_decode() before the callback was executed.)
  *
+ * Alternatively, the display thread can return framebuffers with imx_vpu_dec_return_framebuffer()
+ * instead of imx_vpu_dec_mark_framebuffer_as_displayed(). That function is thread safe, so it
+ * does not need to lock the mutex, and never has to wait for an ongoing decoding step. The
+ * returned framebuffers are marked as displayed by the decoding thread in its next
+ * imx_vpu_dec_check_if_can_decode() or imx_vpu_dec_decode() call.
+ *
  * If any video sequence parameters (like frame width and height) in the input data change,
  * the output code from imx_vpu_dec_decode() calls in step 10 will contain the
  * IMX_VPU_DEC_OUTPUT_CODE_VIDEO_PARAMS_CHANGED flag. (This will never happen in step 5.)
@@ -786,6 +1213,22 @@ typedef enum
 ImxVpuDecOutputCodes;
 
 
+/* Frame skip modes, used by imx_vpu_dec_set_skip_mode(). */
+typedef enum
+{
+	/* Decode all frames. This is the default mode. */
+	IMX_VPU_DEC_SKIP_MODE_NONE = 0,
+	/* Skip frames which are not used as reference by other
+	 * frames (typically B frames). Suitable for moderate
+	 * fast-forward speeds. */
+	IMX_VPU_DEC_SKIP_MODE_NON_REFERENCE_FRAMES,
+	/* Skip all frames except intra (I/IDR) frames. Suitable
+	 * for high fast-forward speeds. */
+	IMX_VPU_DEC_SKIP_MODE_NON_INTRA_FRAMES
+}
+ImxVpuDecSkipMode;
+
+
 /* Structure used together with imx_vpu_dec_open() */
 typedef struct
 {
@@ -805,6 +1248,32 @@ typedef struct
 	 * plane, otherwise they are separated in their own planes.
 	 * See the ImxVpuColorFormat documentation for the consequences of this. */
 	int chroma_interleave;
+
+	/* Rotation and mirroring to apply to the decoded frames. These are done by
+	 * the VPU while it writes the decoded frame into the framebuffer, so they
+	 * take no extra time. With 90 and 270 degree rotations, the frame width and
+	 * height in ImxVpuDecInitialInfo are swapped (so the framebuffers are
+	 * allocated for the rotated frames), as are the 4:2:2 horizontal and vertical
+	 * color formats. Currently, this is only supported with motion JPEG. Other
+	 * codec formats return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS in
+	 * imx_vpu_dec_open() if these are not set to NONE. */
+	ImxVpuRotation rotation;
+	ImxVpuMirrorDirection mirror;
+
+	/* Maximum frame width and height the caller expects in the stream. If both
+	 * are nonzero, and the frame size or color format changes, the decoder keeps
+	 * using the already registered framebuffers as long as the new frame size does
+	 * not exceed this maximum and the framebuffers' DMA buffers are large enough
+	 * for the new frames. It then recalculates the strides and offsets of the
+	 * registered ImxVpuFramebuffer structures in place (like imx_vpu_calc_framebuffer_sizes()
+	 * and imx_vpu_fill_framebuffer_params() would), and sets framebuffers_reused in
+	 * the ImxVpuDecInitialInfo passed to the initial info callback. To make use of
+	 * this, allocate the framebuffers' DMA buffers with the total_size calculated for
+	 * the maximum frame size. Only new frames are written with the new layout; frames
+	 * the caller still holds are not converted. Currently, this is only supported with
+	 * motion JPEG, since with other formats, parameter changes require reopening the
+	 * decoder. It is ignored otherwise. Set both to 0 to always reallocate. */
+	unsigned int max_frame_width, max_frame_height;
 }
 ImxVpuDecOpenParams;
 
@@ -837,6 +1306,12 @@ typedef struct
 
 	/* Physical framebuffer addresses must be aligned to this value. */
 	unsigned int framebuffer_alignment;
+
+	/* If nonzero, the registered framebuffers were large enough for the new
+	 * parameters, and were adapted to them in place (see max_frame_width and
+	 * max_frame_height in ImxVpuDecOpenParams). In this case, the callback must
+	 * not allocate and register new framebuffers. */
+	int framebuffers_reused;
 }
 ImxVpuDecInitialInfo;
 
@@ -845,13 +1320,28 @@ ImxVpuDecInitialInfo;
  * information about the bitstream becomes available. output_code can be useful
  * to check why this callback was invoked. IMX_VPU_DEC_OUTPUT_CODE_INITIAL_INFO_AVAILABLE
  * is always set. Every time this callback gets called, new framebuffers should be
- * allocated and registered with imx_vpu_dec_register_framebuffers().
+ * allocated and registered with imx_vpu_dec_register_framebuffers(), unless
+ * framebuffers_reused is set in new_initial_info.
  * user_data is a user-defined pointer that is passed to this callback. It has the same
  * value as the callback_user_data pointer from the imx_vpu_dec_open() call.
  * The callback returns 0 if something failed, nonzero if successful. */
 typedef int (*imx_vpu_dec_new_initial_info_callback)(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *new_initial_info, unsigned int output_code, void *user_data);
 
 
+/* Structure used together with imx_vpu_dec_reserve_input_space(). It describes
+ * where in the decoder's bitstream buffer the caller can write encoded data to.
+ * The bitstream buffer is a ring buffer, so a reserved space may wrap around its
+ * end. In that case, the first region_sizes[0] bytes must be written to regions[0],
+ * and the remaining region_sizes[1] bytes to regions[1]. If the space does not
+ * wrap around, regions[1] is NULL and region_sizes[1] is 0. */
+typedef struct
+{
+	uint8_t *regions[2];
+	size_t region_sizes[2];
+}
+ImxVpuDecInputSpace;
+
+
 /* Returns a human-readable description of the error code.
  * Useful for logging. */
 char const * imx_vpu_dec_error_string(ImxVpuDecReturnCodes code);
@@ -875,11 +1365,22 @@ ImxVpuDMABufferAllocator* imx_vpu_dec_get_default_allocator(void);
  * must be aligned according to the alignment value. */
 void imx_vpu_dec_get_bitstream_buffer_info(size_t *size, unsigned int *alignment);
 
+/* Like imx_vpu_dec_get_bitstream_buffer_info(), except that the size is chosen based on
+ * the given hints. The returned size is never larger than the one from
+ * imx_vpu_dec_get_bitstream_buffer_info(), and can be considerably smaller for streams
+ * with low resolutions. When such a smaller buffer is passed to imx_vpu_dec_open(), the
+ * codec_format and either max_frame_width & max_frame_height or frame_width & frame_height
+ * in the open params must match the hints, since the decoder uses them for splitting the
+ * buffer into its areas. The bitstream buffer size is then also the upper limit for the
+ * size of motion JPEG frames. */
+void imx_vpu_dec_get_bitstream_buffer_info_with_hints(ImxVpuBitstreamBufferHints const *hints, size_t *size, unsigned int *alignment);
+
 /* Opens a new decoder instance. "open_params", "bitstream_buffer", and "new_initial_info"
  * must not be NULL. "callback_user_data" is a user-defined pointer that is passed on to
  * the callback when it is invoked. The bitstream buffer must use the alignment and size
- * that imx_vpu_dec_get_bitstream_buffer_info() specifies (it can also be larger, but must
- * not be smaller than the size this function gives). */
+ * that imx_vpu_dec_get_bitstream_buffer_info() or imx_vpu_dec_get_bitstream_buffer_info_with_hints()
+ * specify (it can also be larger, but must not be smaller than the size these functions give).
+ * If it is too small, IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS is returned. */
 ImxVpuDecReturnCodes imx_vpu_dec_open(ImxVpuDecoder **decoder, ImxVpuDecOpenParams *open_params, ImxVpuDMABuffer *bitstream_buffer, imx_vpu_dec_new_initial_info_callback new_initial_info_callback, void *callback_user_data);
 
 /* Closes a decoder instance. Trying to close the same instance multiple times results in undefined behavior. */
@@ -896,6 +1397,33 @@ ImxVpuDecReturnCodes imx_vpu_dec_enable_drain_mode(ImxVpuDecoder *decoder, int e
 /* Checks if drain mode is enabled. 1 = enabled. 0 = disabled. */
 int imx_vpu_dec_is_drain_mode_enabled(ImxVpuDecoder *decoder);
 
+/* Sets the frame skip mode, for trick play like fast-forward. The VPU skips the frames
+ * which are not covered by the mode without decoding them. Skipped frames are reported
+ * with the IMX_VPU_DEC_OUTPUT_CODE_DROPPED output code, so their context/PTS/DTS values can
+ * be retrieved with imx_vpu_dec_get_dropped_frame_info(). The mode takes effect with the next
+ * imx_vpu_dec_decode() call; it cannot be changed while a decoding started with
+ * imx_vpu_dec_decode_start() is in progress (IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE is
+ * returned then). Skip modes have no effect with motion JPEG, since all of its frames are
+ * intra frames. */
+ImxVpuDecReturnCodes imx_vpu_dec_set_skip_mode(ImxVpuDecoder *decoder, ImxVpuDecSkipMode skip_mode);
+
+/* Returns the current frame skip mode. */
+ImxVpuDecSkipMode imx_vpu_dec_get_skip_mode(ImxVpuDecoder *decoder);
+
+/* Enables/disables the keyframe search. While it is enabled, the VPU skips all frames until it finds
+ * a keyframe (an IDR frame with h.264, an I frame otherwise), which it then decodes as usual. Afterwards,
+ * the search is disabled automatically, and the skip mode set by imx_vpu_dec_set_skip_mode() applies again.
+ * Like with the skip modes, skipped frames are reported with the IMX_VPU_DEC_OUTPUT_CODE_DROPPED
+ * output code. This is intended for seeking: after the imx_vpu_dec_flush() call, enabling the search
+ * makes sure that no frames which refer to discarded reference frames are decoded (these would show
+ * corrupted pictures), without the caller having to find the keyframe in the input data.
+ * Just like imx_vpu_dec_set_skip_mode(), this cannot be called while a decoding is in progress,
+ * and has no effect with motion JPEG. */
+ImxVpuDecReturnCodes imx_vpu_dec_enable_keyframe_search(ImxVpuDecoder *decoder, int enabled);
+
+/* Checks if the keyframe search is enabled. 1 = enabled. 0 = disabled. */
+int imx_vpu_dec_is_keyframe_search_enabled(ImxVpuDecoder *decoder);
+
 /* Flushes the decoder. Any internal undecoded or queued frames are discarded. */
 ImxVpuDecReturnCodes imx_vpu_dec_flush(ImxVpuDecoder *decoder);
 
@@ -935,6 +1463,75 @@ void imx_vpu_dec_set_codec_data(ImxVpuDecoder *decoder, uint8_t const *codec_dat
  * and the decoder should be closed. See the notes below step-by-step guide above for details about this. */
 ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, unsigned int *output_code);
 
+/* Asynchronous variant of imx_vpu_dec_decode(). imx_vpu_dec_decode_start() pushes the encoded frame into
+ * the bitstream buffer and starts the VPU, but does not wait for the VPU to finish. This allows the calling
+ * thread to do other work in the meantime, like preparing the next input frame (with
+ * imx_vpu_dec_reserve_input_space() for example) or servicing other decoder/encoder instances. Note that the
+ * VPU itself can only process one frame at a time, no matter how many instances exist. Its completion interrupt
+ * is shared by all instances, so only one frame may be in flight at a time, across all decoder and encoder
+ * instances. While a frame is in flight, start calls of other instances (including the synchronous
+ * imx_vpu_dec_decode() and imx_vpu_enc_encode(), which start frames as well) wait until that frame is
+ * finished. Poll calls of other instances return 0 during that time. This means that instances used by
+ * different threads are serialized automatically. A thread which has a frame in flight must finish it
+ * before starting a frame with another instance, however; since that frame could never finish while the
+ * thread waits, such start calls return the WRONG_CALL_SEQUENCE return code. To interleave multiple
+ * instances in one thread, use the scheduler (imxvpuapi_scheduler.h).
+ * (The fslwrapper backend processes each frame completely within one call, and lets the VPU wrapper
+ * serialize these calls, so it has no such restriction.)
+ *
+ * imx_vpu_dec_decode_poll() checks if the VPU is done, waiting for up to timeout_ms milliseconds. A timeout
+ * of 0 makes this function return immediately. It returns 1 if the VPU is done (or if no decoding is in
+ * progress), 0 otherwise.
+ *
+ * imx_vpu_dec_decode_finish() waits for the VPU to finish (if it isn't done already), and processes the
+ * result. output_code is the same as with imx_vpu_dec_decode(). It must be called exactly once after each
+ * successful imx_vpu_dec_decode_start() call; calling it without a preceding imx_vpu_dec_decode_start()
+ * call returns IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE. The same is returned by imx_vpu_dec_decode(),
+ * imx_vpu_dec_decode_start(), and imx_vpu_dec_flush() if a decoding is in progress.
+ *
+ * imx_vpu_dec_decode() is equivalent to a start call followed by a finish call. */
+ImxVpuDecReturnCodes imx_vpu_dec_decode_start(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame);
+int imx_vpu_dec_decode_poll(ImxVpuDecoder *decoder, unsigned int timeout_ms);
+ImxVpuDecReturnCodes imx_vpu_dec_decode_finish(ImxVpuDecoder *decoder, unsigned int *output_code);
+
+/* Decodes an encoded input frame which is stored in a DMA buffer. This works just like imx_vpu_dec_decode(),
+ * except that the encoded data is read from input_dma_buffer, starting at input_offset bytes. The data
+ * pointer in encoded_frame is ignored; its data_size, context, pts, and dts fields are used as usual.
+ * With motion JPEG, the VPU reads the frame directly from input_dma_buffer, so no copy of the data is made.
+ * The DMA buffer must have a physical address in this case, and input_offset must be chosen such that
+ * (physical address + input_offset) is aligned to the bitstream buffer alignment (see
+ * imx_vpu_dec_get_bitstream_buffer_info()). The buffer must not be modified until this function returns.
+ * All other codec formats use the bitstream buffer as a ring buffer, so the data still has to be copied
+ * into it. For these, imx_vpu_dec_reserve_input_space() and imx_vpu_dec_commit_input_space() avoid the
+ * extra copy. */
+ImxVpuDecReturnCodes imx_vpu_dec_decode_dma_buffer(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, ImxVpuDMABuffer *input_dma_buffer, size_t input_offset, unsigned int *output_code);
+
+/* Reserves "size" bytes in the decoder's bitstream buffer, allowing the caller to write encoded data
+ * directly into it instead of passing it to imx_vpu_dec_decode(), which would copy the data. The regions
+ * that the caller can write to are stored in input_space, which must not be NULL. Any necessary extra
+ * frame headers (and codec data) are written into the bitstream buffer by this function already; they
+ * are handed to the VPU together with the data when it is committed.
+ * After the data has been written, imx_vpu_dec_commit_input_space() must be called. Only one space can
+ * be reserved at a time; reserving again before committing returns IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE.
+ * This is also returned if drain mode is enabled. In drain mode, use imx_vpu_dec_decode() as usual.
+ * If the bitstream buffer does not have enough free space, IMX_VPU_DEC_RETURN_CODE_ERROR is returned.
+ *
+ * NOTE: With WVC1, imx_vpu_dec_decode() inserts a frame start code if the input data doesn't start with
+ * one. Since the data is not known yet when reserving, this is not possible here; the written data must
+ * contain the frame start code.
+ * Flushing the decoder discards a reserved space that hasn't been committed yet.
+ * Space can be reserved while the VPU is decoding a frame that was started with imx_vpu_dec_decode_start(),
+ * except for motion JPEG, where IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE is returned in that case. */
+ImxVpuDecReturnCodes imx_vpu_dec_reserve_input_space(ImxVpuDecoder *decoder, size_t size, ImxVpuDecInputSpace *input_space);
+
+/* Commits the data that has been written to the space which was reserved by imx_vpu_dec_reserve_input_space(),
+ * and decodes it. Other than that, this behaves like imx_vpu_dec_decode(). The data pointer in encoded_frame
+ * is ignored; data_size contains the number of bytes that have actually been written, and must not be larger
+ * than the reserved size. With WMV3 and VP8, it must be equal to the reserved size, since the frame headers that
+ * were inserted by imx_vpu_dec_reserve_input_space() contain the frame size. Calling this without a prior imx_vpu_dec_reserve_input_space() call returns
+ * IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE. */
+ImxVpuDecReturnCodes imx_vpu_dec_commit_input_space(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, unsigned int *output_code);
+
 /* Retrieves a decoded frame. The structure referred to by "decoded_frame" will be filled with data about
  * the decoded frame. "decoded_frame" must not be NULL.
  *
@@ -969,6 +1566,73 @@ int imx_vpu_dec_check_if_can_decode(ImxVpuDecoder *decoder);
  * It is safe to mark a framebuffer multiple times. The library will simply ignore the subsequent calls. */
 ImxVpuDecReturnCodes imx_vpu_dec_mark_framebuffer_as_displayed(ImxVpuDecoder *decoder, ImxVpuFramebuffer *framebuffer);
 
+/* Returns a framebuffer to the decoder from another thread. This has the same effect as
+ * imx_vpu_dec_mark_framebuffer_as_displayed(), but unlike that function (and all other decoder functions),
+ * it can be called from any thread, concurrently with the thread that is decoding. This is useful if decoded
+ * frames are displayed or consumed in a different thread, since then, no mutex is needed around the decoder
+ * calls, and displaying never has to wait for the decoding to finish.
+ *
+ * The framebuffer is not marked as displayed right away. Instead, it is placed in a lock-free queue. The
+ * decoder takes the framebuffers out of this queue and marks them as displayed in the decoding thread, at
+ * the beginning of each decoding step (imx_vpu_dec_decode(), imx_vpu_dec_decode_start(),
+ * imx_vpu_dec_decode_dma_buffer(), imx_vpu_dec_commit_input_space()), and in imx_vpu_dec_check_if_can_decode()
+ * and imx_vpu_dec_flush(). Neither this function nor the decoding thread ever block on the queue.
+ *
+ * Each decoded framebuffer must be returned only once, either with this function or with
+ * imx_vpu_dec_mark_framebuffer_as_displayed(). If it is returned again while it is still in the queue,
+ * IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS is returned. This function must not be called concurrently with
+ * imx_vpu_dec_register_framebuffers() or imx_vpu_dec_close(). */
+ImxVpuDecReturnCodes imx_vpu_dec_return_framebuffer(ImxVpuDecoder *decoder, ImxVpuFramebuffer *framebuffer);
+
+
+/* Decoder statistics. See imx_vpu_dec_get_stats(). */
+typedef struct
+{
+	ImxVpuStatsTotals totals;
+	/* Statistics of the most recently finished step */
+	ImxVpuFrameStats last_frame;
+
+	/* Number of steps which produced a decoded frame, and which dropped a frame */
+	unsigned long num_decoded_frames, num_dropped_frames;
+
+	/* Current fill level of the bitstream buffer, and its size. This is the value at the time
+	 * the VPU was started most recently, since it cannot be queried while the VPU is busy. */
+	size_t bitstream_buffer_fill_level, bitstream_buffer_size;
+
+	/* Number of registered framebuffers, and how many of these currently hold decoded frames
+	 * which have not been marked as displayed yet */
+	unsigned int num_framebuffers, num_used_framebuffers;
+}
+ImxVpuDecStats;
+
+
+/* Function pointer type for per-step statistics callbacks. It is invoked at the end of each
+ * decoding step, including steps that failed with an error (like timeouts). ret and output_code
+ * are the values the step returned. frame_stats is only valid during the callback. This callback
+ * must not call decoder functions other than imx_vpu_dec_get_stats(). */
+typedef void (*ImxVpuDecFrameStatsCallback)(ImxVpuDecoder *decoder, ImxVpuDecReturnCodes ret, unsigned int output_code, ImxVpuFrameStats const *frame_stats, void *user_data);
+
+/* Retrieves the decoder statistics. stats must not be NULL. Collecting statistics costs a
+ * few clock reads per step, so it is always enabled. */
+void imx_vpu_dec_get_stats(ImxVpuDecoder *decoder, ImxVpuDecStats *stats);
+
+/* Resets the accumulated statistics (totals, decoded and dropped frame counters) to zero. */
+void imx_vpu_dec_reset_stats(ImxVpuDecoder *decoder);
+
+/* Sets a callback which is invoked after each decoding step. Set callback to NULL to disable it. */
+void imx_vpu_dec_set_frame_stats_callback(ImxVpuDecoder *decoder, ImxVpuDecFrameStatsCallback callback, void *user_data);
+
+
+/* Copies the most recently recorded trace events of the decoder into events, oldest first.
+ * At most max_events events are copied; if more are recorded, the older ones are left out.
+ * Returns the number of copied events. The ring buffer keeps IMX_VPU_TRACE_RING_SIZE events,
+ * so an array of that size can hold all of them. This function must not be called concurrently
+ * with other decoder functions. If the library was built without tracing support, 0 is returned. */
+unsigned int imx_vpu_dec_get_trace_events(ImxVpuDecoder *decoder, ImxVpuTraceEvent *events, unsigned int max_events);
+
+/* Discards all trace events that have been recorded so far. */
+void imx_vpu_dec_clear_trace_events(ImxVpuDecoder *decoder);
+
 
 
 
@@ -1001,6 +1665,8 @@ ImxVpuDecReturnCodes imx_vpu_dec_mark_framebuffer_as_displayed(ImxVpuDecoder *de
  * 1. Call imx_vpu_enc_get_bitstream_buffer_info(), and allocate a DMA buffer
  *    with the given size and alignment. This is the minimum required size.
  *    The buffer can be larger, but must not be smaller than the given size.
+ *    imx_vpu_enc_get_bitstream_buffer_info_with_hints() can be used instead
+ *    to get a smaller size for low resolutions.
  * 2. Fill an instance of ImxVpuEncOpenParams with the values specific to the
  *    input data. Check the documentation of ImxVpuEncOpenParams for details
  *    about its fields. It is recommended to set default values by calling
@@ -1416,6 +2082,38 @@ typedef struct
 	 * planes for the fake YUV400 encoding (when MJPEG is not the codec format).
 	 * If this is NULL, imx_vpu_enc_get_default_allocator() is used. */
 	ImxVpuDMABufferAllocator *additional_dmabuffers_allocator;
+
+	/* Rotation and mirroring to apply to the input frames before encoding.
+	 * These are done by the VPU while it reads the input frames. frame_width
+	 * and frame_height above are the size of the input frames. With 90 and
+	 * 270 degree rotations, the encoded frames have the width and height
+	 * swapped, and the framebuffers which are registered with
+	 * imx_vpu_enc_register_framebuffers() must be allocated for that swapped
+	 * size. Default values are IMX_VPU_ROTATION_NONE and IMX_VPU_MIRROR_NONE. */
+	ImxVpuRotation rotation;
+	ImxVpuMirrorDirection mirror;
+
+	/* If this is 1, encoded data is passed to the write_output_data function
+	 * (see ImxVpuEncParams) while the VPU is still encoding the rest of the
+	 * frame, instead of all at once after the frame is done. This reduces the
+	 * latency by up to one frame encoding interval, which is useful for
+	 * applications like remote control video links. It works best together
+	 * with multiple slices per frame (see slice_mode), since the VPU writes
+	 * out each slice as soon as it is encoded. Internally, this switches the
+	 * bitstream buffer to ring buffer mode, and the encoder polls it for new
+	 * data during encoding. The data passed to write_output_data does not
+	 * necessarily end at slice boundaries.
+	 * In this mode, write_output_data must be set in the encoding params,
+	 * and write_output_segments must be NULL; otherwise,
+	 * IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS is returned by the encode calls.
+	 * The data_size field of the encoded frame is 0 during the
+	 * write_output_data calls; the size of the frame is known only after
+	 * encoding finished. Since data is only retrieved from the bitstream
+	 * buffer by imx_vpu_enc_encode() and imx_vpu_enc_encode_finish(), the
+	 * VPU stalls if the buffer fills up while imx_vpu_enc_encode_poll() is
+	 * used for waiting. Motion JPEG does not support this mode.
+	 * Default value is 0. */
+	int enable_slice_output;
 }
 ImxVpuEncOpenParams;
 
@@ -1469,6 +2167,28 @@ typedef void (*ImxVpuEncFinishOutputBuffer)(void *context, void *acquired_handle
  * Returns 1 if writing succeeded, 0 otherwise.
  * */
 typedef int (*ImxVpuWriteOutputData)(void *context, uint8_t const *data, uint32_t size, ImxVpuEncodedFrame *encoded_frame);
+/* One contiguous segment of encoded output data. */
+typedef struct
+{
+	uint8_t const *data;
+	size_t size;
+}
+ImxVpuEncOutputSegment;
+/* Maximum number of segments an ImxVpuWriteOutputSegments call can receive. */
+#define IMX_VPU_ENC_MAX_OUTPUT_SEGMENTS 5
+/* Function pointer used during encoding for passing the output encoded data
+ * to the user in scatter/gather style. If this function is not NULL, it is
+ * used instead of all of the other output functions above. It is called
+ * exactly once per encoded frame, with an array of num_segments segments.
+ * Concatenated, these make up the encoded frame (AUD, header data, and
+ * the encoded frame payload, in that order). The segments point directly
+ * to the encoder's internal header copies and to the encoded data inside
+ * the bitstream buffer, so no data is copied. The segments are only valid
+ * until this function returns; typically, they are passed to writev() or
+ * sendmsg() right away. encoded_frame contains valid pts, dts, context,
+ * frame type, and size (the sum of all segment sizes).
+ * Returns 1 if writing succeeded, 0 otherwise. */
+typedef int (*ImxVpuWriteOutputSegments)(void *context, ImxVpuEncOutputSegment const *segments, unsigned int num_segments, ImxVpuEncodedFrame *encoded_frame);
 
 
 typedef struct
@@ -1525,6 +2245,14 @@ typedef struct
 	 * NOTE: since this parameter is codec specific, no default value
 	 * is set by imx_vpu_enc_set_default_encoding_params(). */
 	unsigned int quant_param;
+
+	/* Function for passing the output data to the user as a list
+	 * of segments, without copying it. If this is set, it takes
+	 * precedence over write_output_data, acquire_output_buffer, and
+	 * finish_output_buffer. See the typedef documentation above
+	 * for details. This is placed after all other fields to keep
+	 * the offsets of those fields the same as in older versions. */
+	ImxVpuWriteOutputSegments write_output_segments;
 }
 ImxVpuEncParams;
 
@@ -1552,11 +2280,30 @@ ImxVpuDMABufferAllocator* imx_vpu_enc_get_default_allocator(void);
  * must be aligned according to the alignment value. */
 void imx_vpu_enc_get_bitstream_buffer_info(size_t *size, unsigned int *alignment);
 
+/* Like imx_vpu_enc_get_bitstream_buffer_info(), except that the size is chosen based on
+ * the given hints. The returned size is never larger than the one from
+ * imx_vpu_enc_get_bitstream_buffer_info(), and can be considerably smaller for low
+ * resolutions. The codec format and frame size given to imx_vpu_enc_open() must not
+ * exceed the hints. */
+void imx_vpu_enc_get_bitstream_buffer_info_with_hints(ImxVpuBitstreamBufferHints const *hints, size_t *size, unsigned int *alignment);
+
+/* Precomputes the MJPEG quantization tables for the given quality factor, color format,
+ * and frame size, and stores them in a small process-wide cache, which is used by
+ * imx_vpu_enc_open(). The JPEG header for this combination is added to the cache by
+ * the first encoder instance which uses it. Calling this at startup for a few quality
+ * presets makes switching between them cheaper. Only the least recently used entries
+ * are kept if more than 8 combinations are in use. Like imx_vpu_enc_load(), this
+ * function is not thread safe. */
+ImxVpuEncReturnCodes imx_vpu_enc_preload_mjpeg_tables(unsigned int quality_factor, ImxVpuColorFormat color_format, unsigned int frame_width, unsigned int frame_height);
+
 /* Set the fields in "open_params" to valid defaults
  * Useful if the caller wants to modify only a few fields (or none at all) */
 void imx_vpu_enc_set_default_open_params(ImxVpuCodecFormat codec_format, ImxVpuEncOpenParams *open_params);
 
-/* Opens a new encoder instance. "open_params" and "bitstream_buffer" must not be NULL. */
+/* Opens a new encoder instance. "open_params" and "bitstream_buffer" must not be NULL.
+ * If the bitstream buffer is smaller than the size imx_vpu_enc_get_bitstream_buffer_info()
+ * or imx_vpu_enc_get_bitstream_buffer_info_with_hints() specify, IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS
+ * is returned. */
 ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenParams *open_params, ImxVpuDMABuffer *bitstream_buffer);
 
 /* Closes a encoder instance. Trying to close the same instance multiple times results in undefined behavior. */
@@ -1597,6 +2344,37 @@ void imx_vpu_enc_query_header_data(ImxVpuEncoder *encoder, ImxVpuEncHeaderDataTy
  * data will be overwritten. */
 ImxVpuEncReturnCodes imx_vpu_enc_set_header_data(ImxVpuEncoder *encoder, ImxVpuEncHeaderDataTypes header_data_type, uint8_t const *header_data, size_t header_data_size);
 
+/* Saves the encoder's state in a blob: the parameters it was opened with, its initial info, and
+ * the header data (SPS/PPS RBSP for h.264, VOS/VIS/VOL headers for MPEG-4). The blob can be stored
+ * (for example in a file), and later be used to open an encoder with imx_vpu_enc_open_from_state().
+ * This makes the encoder startup faster, since the header data does not have to be generated by
+ * the VPU again. Header data changed with imx_vpu_enc_set_header_data() is saved as well.
+ *
+ * If state is NULL, the required size of the blob is written to state_size. Otherwise, state_size
+ * must contain the size of the memory block state points to; if it is too small,
+ * IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS is returned. On success, the actual size of the blob is
+ * written to state_size. The state can only be saved after imx_vpu_enc_get_initial_info() was called;
+ * otherwise, IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE is returned.
+ *
+ * The blob is only valid for the libimxvpuapi version which created it, and must not be used on
+ * machines with a different architecture. */
+ImxVpuEncReturnCodes imx_vpu_enc_save_state(ImxVpuEncoder *encoder, void *state, size_t *state_size);
+
+/* Retrieves information from an encoder state blob without opening an encoder. Any of the open_params,
+ * initial_info, and framebuffer_sizes arguments can be NULL. framebuffer_sizes is filled with the sizes
+ * that imx_vpu_calc_framebuffer_sizes() calculates for the encoder's framebuffers (taking the rotation
+ * into account). This allows for allocating the framebuffers before (or while) the encoder is opened.
+ * The additional_dmabuffers_allocator field of open_params is set to NULL, since pointers cannot be
+ * saved. Returns IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS if the blob is invalid. */
+ImxVpuEncReturnCodes imx_vpu_enc_get_state_info(void const *state, size_t state_size, ImxVpuEncOpenParams *open_params, ImxVpuEncInitialInfo *initial_info, ImxVpuFramebufferSizes *framebuffer_sizes);
+
+/* Opens a new encoder instance with the parameters and header data from an encoder state blob that
+ * was created by imx_vpu_enc_save_state(). additional_dmabuffers_allocator is used like the field with
+ * the same name in ImxVpuEncOpenParams. Afterwards, continue as with an encoder opened by
+ * imx_vpu_enc_open(); imx_vpu_enc_get_initial_info() must still be called, but does not generate the
+ * header data again. Returns IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS if the blob is invalid. */
+ImxVpuEncReturnCodes imx_vpu_enc_open_from_state(ImxVpuEncoder **encoder, void const *state, size_t state_size, ImxVpuDMABufferAllocator *additional_dmabuffers_allocator, ImxVpuDMABuffer *bitstream_buffer);
+
 /* Set the fields in "encoding_params" to valid defaults
  * Useful if the caller wants to modify only a few fields (or none at all) */
 void imx_vpu_enc_set_default_encoding_params(ImxVpuEncoder *encoder, ImxVpuEncParams *encoding_params);
@@ -1648,7 +2426,10 @@ void imx_vpu_enc_configure_gop_size(ImxVpuEncoder *encoder, unsigned int gop_siz
  * alternative, a write-callback-style mode of operation can be used. This alternative mode is active if
  * the write_output_data function pointer in encoding_params is not NULL. In this mode, neither
  * acquire_output_buffer() nor finish_output_buffer() are called. Instead, whenever the encoder needs to
- * write out data, it calls write_output_data().
+ * write out data, it calls write_output_data(). A third mode is active if the write_output_segments function
+ * pointer is not NULL. In this mode, the encoder calls write_output_segments() once per frame, passing a list
+ * of segments which refer to the header data and to the encoded data inside the bitstream buffer. None of the
+ * encoded data is copied in this mode.
  *
  * The other fields in encoding_params specify additional encoding parameters, which can vary from frame to
  * frame.
@@ -1658,6 +2439,204 @@ void imx_vpu_enc_configure_gop_size(ImxVpuEncoder *encoder, unsigned int gop_siz
  * None of the arguments may be NULL. */
 ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame const *raw_frame, ImxVpuEncodedFrame *encoded_frame, ImxVpuEncParams *encoding_params,  unsigned int *output_code);
 
+/* Asynchronous variant of imx_vpu_enc_encode(). imx_vpu_enc_encode_start() starts encoding the raw frame,
+ * but does not wait for the VPU to finish. The encoding_params are copied, so they do not have to remain
+ * valid after this call, but the raw frame's framebuffer must not be modified until the encoding is finished,
+ * since the VPU reads from it.
+ *
+ * imx_vpu_enc_encode_poll() checks if the VPU is done, waiting for up to timeout_ms milliseconds. A timeout
+ * of 0 makes this function return immediately. It returns 1 if the VPU is done (or if no encoding is in
+ * progress), 0 otherwise.
+ *
+ * imx_vpu_enc_encode_finish() waits for the VPU to finish (if it isn't done already), and writes the encoded
+ * data out, just like imx_vpu_enc_encode() does. encoded_frame and output_code are the same as with
+ * imx_vpu_enc_encode(). It must be called exactly once after each successful imx_vpu_enc_encode_start() call.
+ * Calling it without a preceding start call, or calling imx_vpu_enc_encode_start() or imx_vpu_enc_encode()
+ * while an encoding is in progress, returns IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE.
+ *
+ * Only one frame may be in flight at a time across all decoder and encoder instances; see the notes about
+ * imx_vpu_dec_decode_start() for details.
+ *
+ * imx_vpu_enc_encode() is equivalent to a start call followed by a finish call. */
+ImxVpuEncReturnCodes imx_vpu_enc_encode_start(ImxVpuEncoder *encoder, ImxVpuRawFrame const *raw_frame, ImxVpuEncParams *encoding_params);
+int imx_vpu_enc_encode_poll(ImxVpuEncoder *encoder, unsigned int timeout_ms);
+ImxVpuEncReturnCodes imx_vpu_enc_encode_finish(ImxVpuEncoder *encoder, ImxVpuEncodedFrame *encoded_frame, unsigned int *output_code);
+
+
+/* Encoder statistics. See imx_vpu_enc_get_stats(). */
+typedef struct
+{
+	ImxVpuStatsTotals totals;
+	/* Statistics of the most recently finished step */
+	ImxVpuFrameStats last_frame;
+
+	/* Number of steps which produced encoded data */
+	unsigned long num_encoded_frames;
+
+	/* Size of the part of the bitstream buffer that receives encoded frames. Together with
+	 * last_frame.num_bytes, this shows how close the encoded frames come to its limit. */
+	size_t bitstream_buffer_size;
+
+	/* Number of registered framebuffers */
+	unsigned int num_framebuffers;
+}
+ImxVpuEncStats;
+
+
+/* Function pointer type for per-step statistics callbacks. Other than being called for
+ * encoding steps, this is the same as ImxVpuDecFrameStatsCallback. */
+typedef void (*ImxVpuEncFrameStatsCallback)(ImxVpuEncoder *encoder, ImxVpuEncReturnCodes ret, unsigned int output_code, ImxVpuFrameStats const *frame_stats, void *user_data);
+
+/* Encoder counterparts of imx_vpu_dec_get_stats(), imx_vpu_dec_reset_stats(),
+ * and imx_vpu_dec_set_frame_stats_callback(). */
+void imx_vpu_enc_get_stats(ImxVpuEncoder *encoder, ImxVpuEncStats *stats);
+void imx_vpu_enc_reset_stats(ImxVpuEncoder *encoder);
+void imx_vpu_enc_set_frame_stats_callback(ImxVpuEncoder *encoder, ImxVpuEncFrameStatsCallback callback, void *user_data);
+
+/* Encoder counterparts of imx_vpu_dec_get_trace_events() and imx_vpu_dec_clear_trace_events(). */
+unsigned int imx_vpu_enc_get_trace_events(ImxVpuEncoder *encoder, ImxVpuTraceEvent *events, unsigned int max_events);
+void imx_vpu_enc_clear_trace_events(ImxVpuEncoder *encoder);
+
+
+/* Rate adaptation adjusts the encoding to a channel whose bandwidth changes over time, like a
+ * cellular uplink. A user-supplied callback reports the bitrate the channel can currently carry
+ * (the target bitrate). The encoder models the channel as a leaky bucket: each encoded frame adds
+ * its size to the bucket, and each frame interval drains the amount of data the channel carries
+ * at the target bitrate during that interval. The bucket's fill level corresponds to the VBV
+ * occupancy, and to the latency the sender's queue adds. Its capacity is buffer_delay
+ * milliseconds at the target bitrate.
+ *
+ * At the beginning of each encoding step, the encoder calls the callback, and adjusts the frame's
+ * encoding based on the target and the fill level:
+ *
+ * - If rate control is enabled (= the bitrate in ImxVpuEncOpenParams is nonzero), the bitrate of
+ *   the VPU's rate control is set to the target bitrate, reduced while the bucket is more than a
+ *   quarter full, and increased while it is less full. In constant quality mode, the quant_param
+ *   of the encoding parameters is raised or lowered instead; the caller's quant_param value is
+ *   used as the starting point.
+ * - If even a frame with the target size would overflow the bucket, the frame is encoded as
+ *   a skipped frame (see skip_frame in ImxVpuEncParams), unless an I frame was requested.
+ * - I frames requested with force_I_frame are postponed by up to max_I_frame_delay frames while
+ *   the bucket is more than three quarters full, since such a frame would cause a latency spike.
+ *
+ * The sizes of the most recent frames, their types, and the fill level after each of them can
+ * be retrieved with imx_vpu_enc_get_rate_adaptation_state(). Rate adaptation is not available
+ * for motion JPEG. Bitrates set with imx_vpu_enc_configure_bitrate() are overridden by rate
+ * adaptation while it is enabled. */
+
+/* Function pointer type for the target bitrate callback. It is called during each encoding step,
+ * right before the frame is passed to the VPU, and returns the
+ * bitrate the channel can currently carry, in kbps; typically, this is the estimate of a
+ * congestion controller. 0 means the target bitrate is unchanged. This callback must not call
+ * encoder functions other than imx_vpu_enc_get_rate_adaptation_state(). */
+typedef unsigned int (*ImxVpuEncTargetBitrateCallback)(ImxVpuEncoder *encoder, void *user_data);
+
+
+/* Structure used together with imx_vpu_enc_enable_rate_adaptation(). */
+typedef struct
+{
+	/* Callback for the target bitrate. If this is NULL, the target bitrate
+	 * stays at initial_target_bitrate. Default value is NULL. */
+	ImxVpuEncTargetBitrateCallback target_bitrate_callback;
+	void *callback_user_data;
+
+	/* Target bitrate to use until the callback returns a nonzero value, in
+	 * kbps. 0 means the bitrate from ImxVpuEncOpenParams is used. Default
+	 * value is 0. */
+	unsigned int initial_target_bitrate;
+
+	/* Lower and upper limits for the bitrate that is set for the VPU's rate
+	 * control, in kbps. 0 means no limit. Not used in constant quality mode.
+	 * Default values are 0. */
+	unsigned int min_bitrate, max_bitrate;
+
+	/* Capacity of the leaky bucket, in milliseconds at the target bitrate.
+	 * Lower values keep the latency low, but make the adaptation react more
+	 * strongly to single large frames. Must be nonzero. Default value is 500. */
+	unsigned int buffer_delay;
+
+	/* Lower and upper limits for quant_param in constant quality mode. -1 means
+	 * the limit of the codec format's valid range (see quant_param in
+	 * ImxVpuEncParams). Default values are -1. */
+	int min_qp, max_qp;
+
+	/* If set to 1, frames that would overflow the bucket are encoded as skipped
+	 * frames. 0 disables this. Default value is 1. */
+	int enable_frame_skipping;
+
+	/* Maximum number of frames by which a requested I frame can be postponed.
+	 * 0 disables postponing. Default value is 15. */
+	unsigned int max_I_frame_delay;
+}
+ImxVpuEncRateAdaptationParams;
+
+
+/* Information about one frame encoded with rate adaptation. */
+typedef struct
+{
+	/* Size of the encoded frame, in bytes */
+	size_t size;
+	/* Size a frame would have at the target bitrate, in bytes */
+	size_t target_size;
+	ImxVpuFrameType frame_type;
+	/* 1 if rate adaptation made the encoder skip this frame */
+	int skipped;
+	/* 1 if this frame was a postponed I frame */
+	int postponed_I_frame;
+	/* Target bitrate, and the bitrate that was set for the VPU's rate control,
+	 * in kbps. The latter is 0 in constant quality mode. */
+	unsigned int target_bitrate, bitrate;
+	/* quant_param that was used in constant quality mode, 0 otherwise */
+	unsigned int quant_param;
+	/* Fill level of the bucket after this frame, in bits */
+	unsigned int buffer_fill_level;
+}
+ImxVpuEncRateAdaptationFrameInfo;
+
+
+/* Number of frames in the history of ImxVpuEncRateAdaptationState */
+#define IMX_VPU_ENC_RATE_ADAPTATION_HISTORY_LENGTH 32
+
+
+/* State of the rate adaptation. See imx_vpu_enc_get_rate_adaptation_state(). */
+typedef struct
+{
+	/* Current target bitrate, and the bitrate that is currently set for the
+	 * VPU's rate control, in kbps. The latter is 0 in constant quality mode. */
+	unsigned int target_bitrate, bitrate;
+	/* quant_param for the next frame in constant quality mode, 0 otherwise */
+	unsigned int quant_param;
+
+	/* Capacity and current fill level of the bucket, in bits */
+	unsigned int buffer_size, buffer_fill_level;
+
+	/* Number of frames rate adaptation made the encoder skip, and number of
+	 * I frames it postponed */
+	unsigned long num_skipped_frames, num_postponed_I_frames;
+
+	/* The most recent frames, oldest first. Only the first num_history_entries
+	 * entries are valid. */
+	ImxVpuEncRateAdaptationFrameInfo history[IMX_VPU_ENC_RATE_ADAPTATION_HISTORY_LENGTH];
+	unsigned int num_history_entries;
+}
+ImxVpuEncRateAdaptationState;
+
+
+/* Set the fields in "params" to valid defaults. */
+void imx_vpu_enc_set_default_rate_adaptation_params(ImxVpuEncRateAdaptationParams *params);
+
+/* Enables rate adaptation with the given parameters, or disables it if params is NULL. Enabling it
+ * again resets the bucket and the history. Disabling it leaves the most recently set bitrate in place.
+ * It is disabled by default. The parameters are copied. Returns IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS
+ * if the encoder uses motion JPEG, or if the parameters are invalid, and
+ * IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE if an encoding started by imx_vpu_enc_encode_start()
+ * is in progress. */
+ImxVpuEncReturnCodes imx_vpu_enc_enable_rate_adaptation(ImxVpuEncoder *encoder, ImxVpuEncRateAdaptationParams const *params);
+
+/* Retrieves the state of the rate adaptation. If it is disabled, all fields are set to 0. state must
+ * not be NULL. */
+void imx_vpu_enc_get_rate_adaptation_state(ImxVpuEncoder *encoder, ImxVpuEncRateAdaptationState *state);
+
 
 
 
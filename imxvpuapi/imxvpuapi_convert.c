@@ -0,0 +1,621 @@
+/* Pixel format conversions between system memory images and VPU framebuffers
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+#include <assert.h>
+#include <string.h>
+#include "imxvpuapi_convert.h"
+#include "imxvpuapi_priv.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IMX_VPU_CONVERT_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+/* The row functions below first process as many pixels as possible with NEON
+ * (if available and enabled), and then the remaining ones with scalar code.
+ * The scalar code uses the exact same arithmetic as the NEON code (including
+ * rounding), so the results do not depend on which code path was taken. */
+
+
+/* BT.601 limited range RGB -> YCbCr coefficients, scaled by 256:
+ * Y  = ( 66 R + 129 G +  25 B + 128) / 256 + 16
+ * Cb = (-38 R -  74 G + 112 B + 128) / 256 + 128
+ * Cr = (112 R -  94 G -  18 B + 128) / 256 + 128
+ * For Cb and Cr, the 128 offset is folded into the rounding constant
+ * (128 + 128 * 256 = 32896). This keeps all intermediate values positive
+ * (between 4336 and 61456), so they fit in unsigned 16-bit lanes. */
+#define CHROMA_ROUNDING_CONSTANT 32896
+
+
+static int simd_enabled = 1;
+
+
+
+
+/*************************************/
+/******* ROW CONVERSION KERNELS ******/
+/*************************************/
+
+
+static void interleave_chroma_row(uint8_t *dest, uint8_t const *cb, uint8_t const *cr, unsigned int chroma_width)
+{
+	unsigned int i = 0;
+
+#ifdef IMX_VPU_CONVERT_HAVE_NEON
+	if (simd_enabled)
+	{
+		for (; (i + 16) <= chroma_width; i += 16)
+		{
+			uint8x16x2_t cbcr;
+			cbcr.val[0] = vld1q_u8(cb + i);
+			cbcr.val[1] = vld1q_u8(cr + i);
+			vst2q_u8(dest + i * 2, cbcr);
+		}
+	}
+#endif
+
+	for (; i < chroma_width; ++i)
+	{
+		dest[i * 2 + 0] = cb[i];
+		dest[i * 2 + 1] = cr[i];
+	}
+}
+
+
+static void deinterleave_chroma_row(uint8_t *cb, uint8_t *cr, uint8_t const *src, unsigned int chroma_width)
+{
+	unsigned int i = 0;
+
+#ifdef IMX_VPU_CONVERT_HAVE_NEON
+	if (simd_enabled)
+	{
+		for (; (i + 16) <= chroma_width; i += 16)
+		{
+			uint8x16x2_t cbcr = vld2q_u8(src + i * 2);
+			vst1q_u8(cb + i, cbcr.val[0]);
+			vst1q_u8(cr + i, cbcr.val[1]);
+		}
+	}
+#endif
+
+	for (; i < chroma_width; ++i)
+	{
+		cb[i] = src[i * 2 + 0];
+		cr[i] = src[i * 2 + 1];
+	}
+}
+
+
+static void yuyv_to_luma_row(uint8_t *dest, uint8_t const *src, unsigned int width)
+{
+	unsigned int i = 0;
+
+#ifdef IMX_VPU_CONVERT_HAVE_NEON
+	if (simd_enabled)
+	{
+		for (; (i + 16) <= width; i += 16)
+		{
+			uint8x16x2_t pixels = vld2q_u8(src + i * 2);
+			vst1q_u8(dest + i, pixels.val[0]);
+		}
+	}
+#endif
+
+	for (; i < width; ++i)
+		dest[i] = src[i * 2];
+}
+
+
+/* Averages the chroma samples of two YUYV rows. src0 and src1 can be the same
+ * row (this is done for the last row of images with an odd height). If interleave
+ * is nonzero, the samples are written to cb as CbCr pairs, and cr is unused. */
+static void yuyv_to_chroma_row(uint8_t *cb, uint8_t *cr, int interleave, uint8_t const *src0, uint8_t const *src1, unsigned int chroma_width)
+{
+	unsigned int i = 0;
+
+#ifdef IMX_VPU_CONVERT_HAVE_NEON
+	if (simd_enabled)
+	{
+		for (; (i + 16) <= chroma_width; i += 16)
+		{
+			uint8x16x4_t pixels0 = vld4q_u8(src0 + i * 4);
+			uint8x16x4_t pixels1 = vld4q_u8(src1 + i * 4);
+			uint8x16_t cb_values = vrhaddq_u8(pixels0.val[1], pixels1.val[1]);
+			uint8x16_t cr_values = vrhaddq_u8(pixels0.val[3], pixels1.val[3]);
+
+			if (interleave)
+			{
+				uint8x16x2_t cbcr;
+				cbcr.val[0] = cb_values;
+				cbcr.val[1] = cr_values;
+				vst2q_u8(cb + i * 2, cbcr);
+			}
+			else
+			{
+				vst1q_u8(cb + i, cb_values);
+				vst1q_u8(cr + i, cr_values);
+			}
+		}
+	}
+#endif
+
+	for (; i < chroma_width; ++i)
+	{
+		uint8_t cb_value = (src0[i * 4 + 1] + src1[i * 4 + 1] + 1) >> 1;
+		uint8_t cr_value = (src0[i * 4 + 3] + src1[i * 4 + 3] + 1) >> 1;
+
+		if (interleave)
+		{
+			cb[i * 2 + 0] = cb_value;
+			cb[i * 2 + 1] = cr_value;
+		}
+		else
+		{
+			cb[i] = cb_value;
+			cr[i] = cr_value;
+		}
+	}
+}
+
+
+/* bytes_per_pixel is 3 for RGB24 and 4 for RGBA32 */
+static void rgb_to_luma_row(uint8_t *dest, uint8_t const *src, unsigned int width, unsigned int bytes_per_pixel)
+{
+	unsigned int i = 0;
+
+#ifdef IMX_VPU_CONVERT_HAVE_NEON
+	if (simd_enabled)
+	{
+		for (; (i + 16) <= width; i += 16)
+		{
+			uint8x16_t r, g, b;
+			uint16x8_t y_low, y_high;
+
+			if (bytes_per_pixel == 3)
+			{
+				uint8x16x3_t pixels = vld3q_u8(src + i * 3);
+				r = pixels.val[0]; g = pixels.val[1]; b = pixels.val[2];
+			}
+			else
+			{
+				uint8x16x4_t pixels = vld4q_u8(src + i * 4);
+				r = pixels.val[0]; g = pixels.val[1]; b = pixels.val[2];
+			}
+
+			y_low = vmull_u8(vget_low_u8(r), vdup_n_u8(66));
+			y_low = vmlal_u8(y_low, vget_low_u8(g), vdup_n_u8(129));
+			y_low = vmlal_u8(y_low, vget_low_u8(b), vdup_n_u8(25));
+			y_high = vmull_u8(vget_high_u8(r), vdup_n_u8(66));
+			y_high = vmlal_u8(y_high, vget_high_u8(g), vdup_n_u8(129));
+			y_high = vmlal_u8(y_high, vget_high_u8(b), vdup_n_u8(25));
+
+			vst1q_u8(dest + i, vaddq_u8(vcombine_u8(vrshrn_n_u16(y_low, 8), vrshrn_n_u16(y_high, 8)), vdupq_n_u8(16)));
+		}
+	}
+#endif
+
+	for (; i < width; ++i)
+	{
+		uint8_t const *pixel = src + i * bytes_per_pixel;
+		dest[i] = ((66 * pixel[0] + 129 * pixel[1] + 25 * pixel[2] + 128) >> 8) + 16;
+	}
+}
+
+
+/* Computes the chroma samples of two RGB rows, using the average of each 2x2
+ * pixel block. src0 and src1 can be the same row, and with odd widths, the last
+ * pixel of a row is used twice. interleave works like in yuyv_to_chroma_row(). */
+static void rgb_to_chroma_row(uint8_t *cb, uint8_t *cr, int interleave, uint8_t const *src0, uint8_t const *src1, unsigned int width, unsigned int bytes_per_pixel)
+{
+	unsigned int i = 0;
+	unsigned int chroma_width = (width + 1) / 2;
+
+#ifdef IMX_VPU_CONVERT_HAVE_NEON
+	if (simd_enabled)
+	{
+		for (; (i * 2 + 16) <= width; i += 8)
+		{
+			uint8x16_t r0, g0, b0, r1, g1, b1;
+			uint16x8_t r, g, b, cb_values, cr_values;
+
+			if (bytes_per_pixel == 3)
+			{
+				uint8x16x3_t pixels0 = vld3q_u8(src0 + i * 2 * 3);
+				uint8x16x3_t pixels1 = vld3q_u8(src1 + i * 2 * 3);
+				r0 = pixels0.val[0]; g0 = pixels0.val[1]; b0 = pixels0.val[2];
+				r1 = pixels1.val[0]; g1 = pixels1.val[1]; b1 = pixels1.val[2];
+			}
+			else
+			{
+				uint8x16x4_t pixels0 = vld4q_u8(src0 + i * 2 * 4);
+				uint8x16x4_t pixels1 = vld4q_u8(src1 + i * 2 * 4);
+				r0 = pixels0.val[0]; g0 = pixels0.val[1]; b0 = pixels0.val[2];
+				r1 = pixels1.val[0]; g1 = pixels1.val[1]; b1 = pixels1.val[2];
+			}
+
+			/* Sum up horizontal pixel pairs, then the two rows, and
+			 * divide by 4 with rounding to get the 2x2 block average */
+			r = vrshrq_n_u16(vaddq_u16(vpaddlq_u8(r0), vpaddlq_u8(r1)), 2);
+			g = vrshrq_n_u16(vaddq_u16(vpaddlq_u8(g0), vpaddlq_u8(g1)), 2);
+			b = vrshrq_n_u16(vaddq_u16(vpaddlq_u8(b0), vpaddlq_u8(b1)), 2);
+
+			cb_values = vmlaq_n_u16(vdupq_n_u16(CHROMA_ROUNDING_CONSTANT), b, 112);
+			cb_values = vmlsq_n_u16(cb_values, r, 38);
+			cb_values = vmlsq_n_u16(cb_values, g, 74);
+			cr_values = vmlaq_n_u16(vdupq_n_u16(CHROMA_ROUNDING_CONSTANT), r, 112);
+			cr_values = vmlsq_n_u16(cr_values, g, 94);
+			cr_values = vmlsq_n_u16(cr_values, b, 18);
+
+			if (interleave)
+			{
+				uint8x8x2_t cbcr;
+				cbcr.val[0] = vshrn_n_u16(cb_values, 8);
+				cbcr.val[1] = vshrn_n_u16(cr_values, 8);
+				vst2_u8(cb + i * 2, cbcr);
+			}
+			else
+			{
+				vst1_u8(cb + i, vshrn_n_u16(cb_values, 8));
+				vst1_u8(cr + i, vshrn_n_u16(cr_values, 8));
+			}
+		}
+	}
+#endif
+
+	for (; i < chroma_width; ++i)
+	{
+		unsigned int x0 = i * 2;
+		unsigned int x1 = ((x0 + 1) < width) ? (x0 + 1) : x0;
+		uint8_t const *p00 = src0 + x0 * bytes_per_pixel, *p01 = src0 + x1 * bytes_per_pixel;
+		uint8_t const *p10 = src1 + x0 * bytes_per_pixel, *p11 = src1 + x1 * bytes_per_pixel;
+		unsigned int r = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+		unsigned int g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+		unsigned int b = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+		uint8_t cb_value = (CHROMA_ROUNDING_CONSTANT + 112 * b - 38 * r - 74 * g) >> 8;
+		uint8_t cr_value = (CHROMA_ROUNDING_CONSTANT + 112 * r - 94 * g - 18 * b) >> 8;
+
+		if (interleave)
+		{
+			cb[i * 2 + 0] = cb_value;
+			cb[i * 2 + 1] = cr_value;
+		}
+		else
+		{
+			cb[i] = cb_value;
+			cr[i] = cr_value;
+		}
+	}
+}
+
+
+/* Averages two rows of a 4:2:2 chroma plane into one 4:2:0 chroma row. If
+ * src_interleave is nonzero, the source rows contain CbCr pairs, and src_cr0
+ * and src_cr1 are unused; dest_interleave works the same way for the
+ * destination. Both rows can be the same (this is done for the last row of
+ * images with an odd height). */
+static void average_chroma_rows(uint8_t *dest_cb, uint8_t *dest_cr, int dest_interleave, uint8_t const *src_cb0, uint8_t const *src_cr0, uint8_t const *src_cb1, uint8_t const *src_cr1, int src_interleave, unsigned int chroma_width)
+{
+	unsigned int i;
+
+	for (i = 0; i < chroma_width; ++i)
+	{
+		uint8_t cb_value, cr_value;
+
+		if (src_interleave)
+		{
+			cb_value = (src_cb0[i * 2 + 0] + src_cb1[i * 2 + 0] + 1) >> 1;
+			cr_value = (src_cb0[i * 2 + 1] + src_cb1[i * 2 + 1] + 1) >> 1;
+		}
+		else
+		{
+			cb_value = (src_cb0[i] + src_cb1[i] + 1) >> 1;
+			cr_value = (src_cr0[i] + src_cr1[i] + 1) >> 1;
+		}
+
+		if (dest_interleave)
+		{
+			dest_cb[i * 2 + 0] = cb_value;
+			dest_cb[i * 2 + 1] = cr_value;
+		}
+		else
+		{
+			dest_cb[i] = cb_value;
+			dest_cr[i] = cr_value;
+		}
+	}
+}
+
+
+static void copy_plane(uint8_t *dest, unsigned int dest_stride, uint8_t const *src, unsigned int src_stride, unsigned int row_size, unsigned int num_rows)
+{
+	unsigned int y;
+
+	if ((dest_stride == src_stride) && (row_size == src_stride))
+	{
+		memcpy(dest, src, (size_t)row_size * num_rows);
+		return;
+	}
+
+	for (y = 0; y < num_rows; ++y)
+		memcpy(dest + (size_t)y * dest_stride, src + (size_t)y * src_stride, row_size);
+}
+
+
+
+
+/*********************************************/
+/******* FRAMEBUFFER CONVERSION FUNCTIONS ****/
+/*********************************************/
+
+
+static int check_image_size(ImxVpuImage const *image, ImxVpuFramebufferSizes const *calculated_sizes)
+{
+	if ((image->width == 0) || (image->height == 0))
+	{
+		IMX_VPU_ERROR("image width and height must be nonzero");
+		return 0;
+	}
+
+	if ((image->width > calculated_sizes->aligned_frame_width) || (image->height > calculated_sizes->aligned_frame_height))
+	{
+		IMX_VPU_ERROR("image size %ux%u exceeds the framebuffer size %ux%u", image->width, image->height, calculated_sizes->aligned_frame_width, calculated_sizes->aligned_frame_height);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+int imx_vpu_convert_to_framebuffer(ImxVpuImage const *src, ImxVpuFramebuffer const *framebuffer, ImxVpuFramebufferSizes const *calculated_sizes, ImxVpuColorFormat color_format, uint8_t *framebuffer_virtual_address)
+{
+	unsigned int y, width, height, chroma_width, chroma_height, bytes_per_pixel;
+	int interleave, vertical_subsampling;
+	uint8_t *fb_y, *fb_cb, *fb_cr;
+
+	assert(src != NULL);
+	assert(framebuffer != NULL);
+	assert(calculated_sizes != NULL);
+	assert(framebuffer_virtual_address != NULL);
+
+	if (!check_image_size(src, calculated_sizes))
+		return 0;
+
+	width = src->width;
+	height = src->height;
+	interleave = calculated_sizes->chroma_interleave;
+
+	fb_y = framebuffer_virtual_address + framebuffer->y_offset;
+	fb_cb = framebuffer_virtual_address + framebuffer->cb_offset;
+	fb_cr = framebuffer_virtual_address + framebuffer->cr_offset;
+
+	switch (color_format)
+	{
+		case IMX_VPU_COLOR_FORMAT_YUV420:
+			vertical_subsampling = 1;
+			break;
+
+		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL:
+			/* The I420 and NV12 chroma planes have half the height
+			 * of the 4:2:2 ones, and are not upsampled */
+			if ((src->format == IMX_VPU_IMAGE_FORMAT_I420) || (src->format == IMX_VPU_IMAGE_FORMAT_NV12))
+			{
+				IMX_VPU_ERROR("cannot convert 4:2:0 source image into %s framebuffer", imx_vpu_color_format_string(color_format));
+				return 0;
+			}
+			vertical_subsampling = 0;
+			break;
+
+		case IMX_VPU_COLOR_FORMAT_YUV400:
+			/* Only the Y plane exists */
+			vertical_subsampling = 1;
+			break;
+
+		default:
+			IMX_VPU_ERROR("unsupported framebuffer color format %s", imx_vpu_color_format_string(color_format));
+			return 0;
+	}
+
+	chroma_width = (width + 1) / 2;
+	chroma_height = vertical_subsampling ? ((height + 1) / 2) : height;
+
+	switch (src->format)
+	{
+		case IMX_VPU_IMAGE_FORMAT_I420:
+			copy_plane(fb_y, framebuffer->y_stride, src->planes[0], src->strides[0], width, height);
+			if (color_format == IMX_VPU_COLOR_FORMAT_YUV400)
+				break;
+			if (interleave)
+			{
+				for (y = 0; y < chroma_height; ++y)
+					interleave_chroma_row(fb_cb + y * framebuffer->cbcr_stride, src->planes[1] + y * src->strides[1], src->planes[2] + y * src->strides[2], chroma_width);
+			}
+			else
+			{
+				copy_plane(fb_cb, framebuffer->cbcr_stride, src->planes[1], src->strides[1], chroma_width, chroma_height);
+				copy_plane(fb_cr, framebuffer->cbcr_stride, src->planes[2], src->strides[2], chroma_width, chroma_height);
+			}
+			break;
+
+		case IMX_VPU_IMAGE_FORMAT_NV12:
+			copy_plane(fb_y, framebuffer->y_stride, src->planes[0], src->strides[0], width, height);
+			if (color_format == IMX_VPU_COLOR_FORMAT_YUV400)
+				break;
+			if (interleave)
+				copy_plane(fb_cb, framebuffer->cbcr_stride, src->planes[1], src->strides[1], chroma_width * 2, chroma_height);
+			else
+			{
+				for (y = 0; y < chroma_height; ++y)
+					deinterleave_chroma_row(fb_cb + y * framebuffer->cbcr_stride, fb_cr + y * framebuffer->cbcr_stride, src->planes[1] + y * src->strides[1], chroma_width);
+			}
+			break;
+
+		case IMX_VPU_IMAGE_FORMAT_YUYV:
+			for (y = 0; y < height; ++y)
+				yuyv_to_luma_row(fb_y + y * framebuffer->y_stride, src->planes[0] + y * src->strides[0], width);
+			if (color_format == IMX_VPU_COLOR_FORMAT_YUV400)
+				break;
+			/* Without vertical subsampling, each chroma row is computed
+			 * from one source row, by passing that row twice */
+			for (y = 0; y < chroma_height; ++y)
+			{
+				uint8_t const *src0 = src->planes[0] + (vertical_subsampling ? (y * 2) : y) * src->strides[0];
+				uint8_t const *src1 = (vertical_subsampling && ((y * 2 + 1) < height)) ? (src0 + src->strides[0]) : src0;
+				yuyv_to_chroma_row(fb_cb + y * framebuffer->cbcr_stride, fb_cr + y * framebuffer->cbcr_stride, interleave, src0, src1, chroma_width);
+			}
+			break;
+
+		case IMX_VPU_IMAGE_FORMAT_RGB24:
+		case IMX_VPU_IMAGE_FORMAT_RGBA32:
+			bytes_per_pixel = (src->format == IMX_VPU_IMAGE_FORMAT_RGB24) ? 3 : 4;
+			for (y = 0; y < height; ++y)
+				rgb_to_luma_row(fb_y + y * framebuffer->y_stride, src->planes[0] + y * src->strides[0], width, bytes_per_pixel);
+			if (color_format == IMX_VPU_COLOR_FORMAT_YUV400)
+				break;
+			for (y = 0; y < chroma_height; ++y)
+			{
+				uint8_t const *src0 = src->planes[0] + (vertical_subsampling ? (y * 2) : y) * src->strides[0];
+				uint8_t const *src1 = (vertical_subsampling && ((y * 2 + 1) < height)) ? (src0 + src->strides[0]) : src0;
+				rgb_to_chroma_row(fb_cb + y * framebuffer->cbcr_stride, fb_cr + y * framebuffer->cbcr_stride, interleave, src0, src1, width, bytes_per_pixel);
+			}
+			break;
+
+		default:
+			IMX_VPU_ERROR("unsupported source image format %d", (int)(src->format));
+			return 0;
+	}
+
+	return 1;
+}
+
+
+int imx_vpu_convert_from_framebuffer(ImxVpuFramebuffer const *framebuffer, ImxVpuFramebufferSizes const *calculated_sizes, ImxVpuColorFormat color_format, uint8_t const *framebuffer_virtual_address, ImxVpuImage *dest)
+{
+	unsigned int y, width, height, chroma_width, chroma_height;
+	int interleave, dest_interleave;
+	uint8_t const *fb_y, *fb_cb, *fb_cr;
+
+	assert(framebuffer != NULL);
+	assert(calculated_sizes != NULL);
+	assert(framebuffer_virtual_address != NULL);
+	assert(dest != NULL);
+
+	if (!check_image_size(dest, calculated_sizes))
+		return 0;
+
+	if ((dest->format != IMX_VPU_IMAGE_FORMAT_I420) && (dest->format != IMX_VPU_IMAGE_FORMAT_NV12))
+	{
+		IMX_VPU_ERROR("unsupported destination image format %d", (int)(dest->format));
+		return 0;
+	}
+
+	width = dest->width;
+	height = dest->height;
+	chroma_width = (width + 1) / 2;
+	chroma_height = (height + 1) / 2;
+	interleave = calculated_sizes->chroma_interleave;
+	dest_interleave = (dest->format == IMX_VPU_IMAGE_FORMAT_NV12);
+
+	fb_y = framebuffer_virtual_address + framebuffer->y_offset;
+	fb_cb = framebuffer_virtual_address + framebuffer->cb_offset;
+	fb_cr = framebuffer_virtual_address + framebuffer->cr_offset;
+
+	copy_plane(dest->planes[0], dest->strides[0], fb_y, framebuffer->y_stride, width, height);
+
+	switch (color_format)
+	{
+		case IMX_VPU_COLOR_FORMAT_YUV420:
+			if (dest_interleave && interleave)
+				copy_plane(dest->planes[1], dest->strides[1], fb_cb, framebuffer->cbcr_stride, chroma_width * 2, chroma_height);
+			else if (dest_interleave)
+			{
+				for (y = 0; y < chroma_height; ++y)
+					interleave_chroma_row(dest->planes[1] + y * dest->strides[1], fb_cb + y * framebuffer->cbcr_stride, fb_cr + y * framebuffer->cbcr_stride, chroma_width);
+			}
+			else if (interleave)
+			{
+				for (y = 0; y < chroma_height; ++y)
+					deinterleave_chroma_row(dest->planes[1] + y * dest->strides[1], dest->planes[2] + y * dest->strides[2], fb_cb + y * framebuffer->cbcr_stride, chroma_width);
+			}
+			else
+			{
+				copy_plane(dest->planes[1], dest->strides[1], fb_cb, framebuffer->cbcr_stride, chroma_width, chroma_height);
+				copy_plane(dest->planes[2], dest->strides[2], fb_cr, framebuffer->cbcr_stride, chroma_width, chroma_height);
+			}
+			break;
+
+		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL:
+			/* Each 4:2:0 chroma row is the average of two 4:2:2 rows */
+			for (y = 0; y < chroma_height; ++y)
+			{
+				unsigned int row0 = y * 2;
+				unsigned int row1 = ((row0 + 1) < height) ? (row0 + 1) : row0;
+
+				average_chroma_rows(
+					dest->planes[1] + y * dest->strides[1],
+					dest_interleave ? NULL : (dest->planes[2] + y * dest->strides[2]),
+					dest_interleave,
+					fb_cb + row0 * framebuffer->cbcr_stride,
+					fb_cr + row0 * framebuffer->cbcr_stride,
+					fb_cb + row1 * framebuffer->cbcr_stride,
+					fb_cr + row1 * framebuffer->cbcr_stride,
+					interleave,
+					chroma_width
+				);
+			}
+			break;
+
+		case IMX_VPU_COLOR_FORMAT_YUV400:
+			/* There is no chroma; fill in neutral gray */
+			for (y = 0; y < chroma_height; ++y)
+			{
+				if (dest_interleave)
+					memset(dest->planes[1] + y * dest->strides[1], 128, chroma_width * 2);
+				else
+				{
+					memset(dest->planes[1] + y * dest->strides[1], 128, chroma_width);
+					memset(dest->planes[2] + y * dest->strides[2], 128, chroma_width);
+				}
+			}
+			break;
+
+		default:
+			IMX_VPU_ERROR("unsupported framebuffer color format %s", imx_vpu_color_format_string(color_format));
+			return 0;
+	}
+
+	return 1;
+}
+
+
+int imx_vpu_convert_has_simd(void)
+{
+#ifdef IMX_VPU_CONVERT_HAVE_NEON
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
+void imx_vpu_convert_enable_simd(int enabled)
+{
+	simd_enabled = enabled;
+}
@@ -0,0 +1,126 @@
+/* Pixel format conversions between system memory images and VPU framebuffers
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+/* The VPU expects frames in its own layout: planar YUV with either separate
+ * Cb and Cr planes, or one interleaved CbCr plane (if chroma_interleave is
+ * set), with the strides and plane offsets that imx_vpu_calc_framebuffer_sizes()
+ * and imx_vpu_fill_framebuffer_params() define. The chroma subsampling depends
+ * on the color format the sizes were calculated with. It is 4:2:0 for all
+ * codecs except motion JPEG, which can also use 4:2:2, 4:4:4, and 4:0:0
+ * (grayscale) framebuffers. Camera and application frames
+ * are often in other formats, like packed YUYV or RGB. The functions here
+ * convert such images into VPU framebuffers (for encoding), and decoded
+ * framebuffers back into planar or semi-planar images.
+ *
+ * On ARM CPUs with NEON, the conversions use NEON instructions; elsewhere,
+ * or if SIMD is disabled with imx_vpu_convert_enable_simd(), scalar code is
+ * used. Both produce identical results. RGB is converted to YUV with the
+ * ITU-R BT.601 matrix, using limited range (Y: 16-235, CbCr: 16-240). Chroma
+ * samples are the average of the corresponding 2x2 block of pixels (2x1 for
+ * horizontally subsampled 4:2:2 framebuffers).
+ *
+ * Only the visible area of the framebuffer (the image's width and height) is
+ * written; the padding up to the aligned frame size is left untouched.
+ *
+ * The framebuffer's DMA buffer must be mapped by the caller, and its virtual
+ * address passed to the functions. This way, a mapping can be reused for many
+ * frames. If the mapping uses IMX_VPU_MAPPING_FLAG_MANUAL_SYNC, the caller
+ * must also sync the buffer (imx_vpu_dma_buffer_sync_for_device() after
+ * writing, imx_vpu_dma_buffer_sync_for_cpu() before reading). */
+
+
+#ifndef IMXVPUAPI_CONVERT_H
+#define IMXVPUAPI_CONVERT_H
+
+#include "imxvpuapi.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Formats of images in system memory. */
+typedef enum
+{
+	/* 4:2:0 with three planes: Y, Cb, Cr */
+	IMX_VPU_IMAGE_FORMAT_I420 = 0,
+	/* 4:2:0 with two planes: Y, and interleaved CbCr */
+	IMX_VPU_IMAGE_FORMAT_NV12,
+	/* 4:2:2 packed, one plane, byte order Y0 Cb Y1 Cr */
+	IMX_VPU_IMAGE_FORMAT_YUYV,
+	/* One plane, byte order R G B */
+	IMX_VPU_IMAGE_FORMAT_RGB24,
+	/* One plane, byte order R G B A; alpha is ignored */
+	IMX_VPU_IMAGE_FORMAT_RGBA32
+}
+ImxVpuImageFormat;
+
+
+/* An image in system memory. The number of planes used depends on the format
+ * (3 for I420, 2 for NV12, 1 for the others). Strides are given in bytes. */
+typedef struct
+{
+	ImxVpuImageFormat format;
+	unsigned int width, height;
+	uint8_t *planes[3];
+	unsigned int strides[3];
+}
+ImxVpuImage;
+
+
+/* Converts src into the framebuffer. I420, NV12, YUYV, RGB24, and RGBA32 images
+ * are supported. framebuffer and calculated_sizes must be the ones the framebuffer
+ * was set up with, and color_format must be the one that was passed to
+ * imx_vpu_calc_framebuffer_sizes(); calculated_sizes->chroma_interleave selects
+ * the planar or interleaved layout. Supported color formats are
+ * IMX_VPU_COLOR_FORMAT_YUV420, IMX_VPU_COLOR_FORMAT_YUV400 (only the Y plane is
+ * written), and IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL (only for YUYV and RGB
+ * images, since I420 and NV12 lack the chroma rows). framebuffer_virtual_address
+ * is the mapped address of the framebuffer's DMA buffer. The image must not be
+ * larger than the aligned frame size. Returns nonzero on success, 0 if the image
+ * format, color format, or size is not supported. */
+int imx_vpu_convert_to_framebuffer(ImxVpuImage const *src, ImxVpuFramebuffer const *framebuffer, ImxVpuFramebufferSizes const *calculated_sizes, ImxVpuColorFormat color_format, uint8_t *framebuffer_virtual_address);
+
+/* Converts the framebuffer into dest, which must be an I420 or NV12 image.
+ * dest's width and height define the area of the framebuffer that is converted.
+ * Supported color formats are IMX_VPU_COLOR_FORMAT_YUV420,
+ * IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL (each pair of chroma rows is averaged),
+ * and IMX_VPU_COLOR_FORMAT_YUV400 (the chroma planes are filled with 128). The
+ * other arguments are the same as in imx_vpu_convert_to_framebuffer(). Returns
+ * nonzero on success, 0 if the image format, color format, or size is not
+ * supported. */
+int imx_vpu_convert_from_framebuffer(ImxVpuFramebuffer const *framebuffer, ImxVpuFramebufferSizes const *calculated_sizes, ImxVpuColorFormat color_format, uint8_t const *framebuffer_virtual_address, ImxVpuImage *dest);
+
+/* Returns nonzero if the library was built with SIMD (NEON) conversion code. */
+int imx_vpu_convert_has_simd(void);
+
+/* Enables or disables the SIMD conversion code. It is enabled by default. Disabling
+ * it is mainly useful for comparing SIMD and scalar performance. This setting is
+ * global, and must not be changed while conversions are running in other threads. */
+void imx_vpu_convert_enable_simd(int enabled);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,618 @@
+/* imxvpuapi encoder input queue, with framebuffer recycling and backpressure
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+/* Necessary for the pthread functions in C99 mode */
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include "imxvpuapi_enc_queue.h"
+#include "imxvpuapi_priv.h"
+
+
+
+
+typedef enum
+{
+	IMX_VPU_ENC_QUEUE_FRAMEBUFFER_FREE = 0,
+	/* Owned by a producer */
+	IMX_VPU_ENC_QUEUE_FRAMEBUFFER_ACQUIRED,
+	/* Part of a queued frame */
+	IMX_VPU_ENC_QUEUE_FRAMEBUFFER_QUEUED,
+	/* Being read by the VPU */
+	IMX_VPU_ENC_QUEUE_FRAMEBUFFER_ENCODING
+}
+ImxVpuEncQueueFramebufferState;
+
+
+typedef struct
+{
+	ImxVpuRawFrame raw_frame;
+	ImxVpuEncParams encoding_params;
+}
+ImxVpuEncQueueFrame;
+
+
+struct _ImxVpuEncQueue
+{
+	ImxVpuEncQueueParams params;
+	unsigned int skip_threshold;
+
+	pthread_t worker_thread;
+
+	/* Protects all of the fields below */
+	pthread_mutex_t mutex;
+	/* Signaled when a frame is queued, and when the queue is destroyed */
+	pthread_cond_t frame_queued_cond;
+	/* Signaled when a framebuffer is freed, and when the queue is destroyed */
+	pthread_cond_t framebuffer_freed_cond;
+	/* Signaled when num_active_calls drops to zero during destruction */
+	pthread_cond_t no_active_calls_cond;
+
+	/* Number of threads inside the queue's API functions. The queue can
+	 * only be freed once all of them are out. This is incremented atomically,
+	 * before the mutex is locked, and decremented with the mutex locked. */
+	unsigned int num_active_calls;
+
+	/* State of each framebuffer, in the same order as params.framebuffers */
+	ImxVpuEncQueueFramebufferState *framebuffer_states;
+
+	/* Indices of the free framebuffers; this is a stack */
+	unsigned int *free_framebuffer_indices;
+	unsigned int num_free_framebuffers;
+
+	/* Queued frames; this is a ring buffer. Each queued frame holds one
+	 * framebuffer, so num_framebuffers entries are always enough. */
+	ImxVpuEncQueueFrame *frames;
+	unsigned int first_frame_idx, num_queued_frames;
+
+	int shutting_down;
+	int drain;
+
+	unsigned int max_num_queued_frames;
+	unsigned long num_encoded_frames;
+	unsigned long num_failed_frames;
+	unsigned long num_skipped_frames;
+	unsigned long num_dropped_frames;
+	unsigned long num_blocked_acquires;
+};
+
+
+static void* imx_vpu_enc_queue_worker(void *arg);
+static int imx_vpu_enc_queue_get_framebuffer_index(ImxVpuEncQueue *queue, ImxVpuFramebuffer const *framebuffer, unsigned int *index);
+static void imx_vpu_enc_queue_pop_frame(ImxVpuEncQueue *queue, ImxVpuEncQueueFrame *frame, unsigned int *index);
+static void imx_vpu_enc_queue_free_framebuffer(ImxVpuEncQueue *queue, unsigned int index);
+static void imx_vpu_enc_queue_enter_call(ImxVpuEncQueue *queue);
+static void imx_vpu_enc_queue_leave_call(ImxVpuEncQueue *queue);
+
+
+
+
+void imx_vpu_enc_queue_set_default_params(ImxVpuEncoder *encoder, ImxVpuEncQueueParams *params)
+{
+	assert(params != NULL);
+
+	memset(params, 0, sizeof(ImxVpuEncQueueParams));
+	params->encoder = encoder;
+	params->overflow_policy = IMX_VPU_ENC_QUEUE_OVERFLOW_POLICY_BLOCK;
+	imx_vpu_enc_set_default_encoding_params(encoder, &(params->encoding_params));
+}
+
+
+ImxVpuEncQueue* imx_vpu_enc_queue_create(ImxVpuEncQueueParams const *params)
+{
+	unsigned int i, num_framebuffers;
+	int mutex_initialized = 0, frame_queued_cond_initialized = 0, framebuffer_freed_cond_initialized = 0, no_active_calls_cond_initialized = 0;
+	ImxVpuEncQueue *queue;
+	ImxVpuEncOpenParams enc_open_params;
+	ImxVpuEncInitialInfo enc_initial_info;
+
+	assert(params != NULL);
+
+	if ((params->encoder == NULL) || (params->framebuffers == NULL) || (params->num_framebuffers == 0))
+	{
+		IMX_VPU_ERROR("encoder and framebuffers must be set");
+		return NULL;
+	}
+
+	if (params->encoded_frame_callback == NULL)
+	{
+		IMX_VPU_ERROR("encoded frame callback must be set");
+		return NULL;
+	}
+
+	/* Skipped frames are copies of the preceding frame, which motion JPEG
+	 * frames cannot reference. The encoder's initial info is available at
+	 * this point, since its framebuffers are registered. */
+	if (params->overflow_policy == IMX_VPU_ENC_QUEUE_OVERFLOW_POLICY_SKIP_FRAMES)
+	{
+		if (!imx_vpu_enc_get_state_params(params->encoder, &enc_open_params, &enc_initial_info))
+		{
+			IMX_VPU_ERROR("encoder must be fully set up before creating a queue");
+			return NULL;
+		}
+
+		if (enc_open_params.codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
+		{
+			IMX_VPU_ERROR("the skip frames overflow policy is not supported with motion JPEG");
+			return NULL;
+		}
+	}
+
+	num_framebuffers = params->num_framebuffers;
+
+	queue = IMX_VPU_ALLOC(sizeof(ImxVpuEncQueue));
+	if (queue == NULL)
+	{
+		IMX_VPU_ERROR("allocating memory for encoder queue failed");
+		return NULL;
+	}
+
+	memset(queue, 0, sizeof(ImxVpuEncQueue));
+	queue->params = *params;
+
+	queue->skip_threshold = params->skip_threshold;
+	if (queue->skip_threshold == 0)
+		queue->skip_threshold = (num_framebuffers > 1) ? (num_framebuffers / 2) : 1;
+	else if (queue->skip_threshold > num_framebuffers)
+		queue->skip_threshold = num_framebuffers;
+
+	queue->framebuffer_states = IMX_VPU_ALLOC(sizeof(ImxVpuEncQueueFramebufferState) * num_framebuffers);
+	queue->free_framebuffer_indices = IMX_VPU_ALLOC(sizeof(unsigned int) * num_framebuffers);
+	queue->frames = IMX_VPU_ALLOC(sizeof(ImxVpuEncQueueFrame) * num_framebuffers);
+	if ((queue->framebuffer_states == NULL) || (queue->free_framebuffer_indices == NULL) || (queue->frames == NULL))
+	{
+		IMX_VPU_ERROR("allocating memory for encoder queue framebuffer states failed");
+		goto cleanup;
+	}
+
+	/* The stack is filled in reverse, so the first framebuffer is acquired first */
+	for (i = 0; i < num_framebuffers; ++i)
+	{
+		queue->framebuffer_states[i] = IMX_VPU_ENC_QUEUE_FRAMEBUFFER_FREE;
+		queue->free_framebuffer_indices[i] = num_framebuffers - 1 - i;
+	}
+	queue->num_free_framebuffers = num_framebuffers;
+
+	if (pthread_mutex_init(&(queue->mutex), NULL) != 0)
+	{
+		IMX_VPU_ERROR("initializing encoder queue mutex failed");
+		goto cleanup;
+	}
+	mutex_initialized = 1;
+
+	if (pthread_cond_init(&(queue->frame_queued_cond), NULL) != 0)
+	{
+		IMX_VPU_ERROR("initializing encoder queue condition variable failed");
+		goto cleanup;
+	}
+	frame_queued_cond_initialized = 1;
+
+	if (pthread_cond_init(&(queue->framebuffer_freed_cond), NULL) != 0)
+	{
+		IMX_VPU_ERROR("initializing encoder queue condition variable failed");
+		goto cleanup;
+	}
+	framebuffer_freed_cond_initialized = 1;
+
+	if (pthread_cond_init(&(queue->no_active_calls_cond), NULL) != 0)
+	{
+		IMX_VPU_ERROR("initializing encoder queue condition variable failed");
+		goto cleanup;
+	}
+	no_active_calls_cond_initialized = 1;
+
+	if (pthread_create(&(queue->worker_thread), NULL, imx_vpu_enc_queue_worker, queue) != 0)
+	{
+		IMX_VPU_ERROR("starting encoder queue worker thread failed");
+		goto cleanup;
+	}
+
+	IMX_VPU_DEBUG("created encoder queue with %u framebuffers, overflow policy %d", num_framebuffers, (int)(params->overflow_policy));
+
+	return queue;
+
+cleanup:
+	if (no_active_calls_cond_initialized)
+		pthread_cond_destroy(&(queue->no_active_calls_cond));
+	if (framebuffer_freed_cond_initialized)
+		pthread_cond_destroy(&(queue->framebuffer_freed_cond));
+	if (frame_queued_cond_initialized)
+		pthread_cond_destroy(&(queue->frame_queued_cond));
+	if (mutex_initialized)
+		pthread_mutex_destroy(&(queue->mutex));
+
+	if (queue->frames != NULL)
+		IMX_VPU_FREE(queue->frames, sizeof(ImxVpuEncQueueFrame) * num_framebuffers);
+	if (queue->free_framebuffer_indices != NULL)
+		IMX_VPU_FREE(queue->free_framebuffer_indices, sizeof(unsigned int) * num_framebuffers);
+	if (queue->framebuffer_states != NULL)
+		IMX_VPU_FREE(queue->framebuffer_states, sizeof(ImxVpuEncQueueFramebufferState) * num_framebuffers);
+	IMX_VPU_FREE(queue, sizeof(ImxVpuEncQueue));
+
+	return NULL;
+}
+
+
+void imx_vpu_enc_queue_destroy(ImxVpuEncQueue *queue, int drain)
+{
+	unsigned int num_framebuffers;
+
+	if (queue == NULL)
+		return;
+
+	num_framebuffers = queue->params.num_framebuffers;
+
+	pthread_mutex_lock(&(queue->mutex));
+	queue->shutting_down = 1;
+	queue->drain = drain;
+	pthread_cond_broadcast(&(queue->frame_queued_cond));
+	pthread_cond_broadcast(&(queue->framebuffer_freed_cond));
+
+	/* Wait until the other threads are out of the queue's functions. Woken
+	 * producers still need the mutex to return, so freeing the queue before
+	 * they are done would pull it out from under them. */
+	while (__sync_add_and_fetch(&(queue->num_active_calls), 0) > 0)
+		pthread_cond_wait(&(queue->no_active_calls_cond), &(queue->mutex));
+
+	pthread_mutex_unlock(&(queue->mutex));
+
+	pthread_join(queue->worker_thread, NULL);
+
+	/* The worker thread is gone, and the other threads must not use the
+	 * queue any more, so the remaining frames can be dropped without
+	 * holding the mutex */
+	while (queue->num_queued_frames > 0)
+	{
+		ImxVpuEncQueueFrame frame;
+		unsigned int index;
+
+		imx_vpu_enc_queue_pop_frame(queue, &frame, &index);
+		imx_vpu_enc_queue_free_framebuffer(queue, index);
+		queue->num_dropped_frames++;
+
+		if (queue->params.framebuffer_released_callback != NULL)
+			queue->params.framebuffer_released_callback(queue, &(frame.raw_frame), 1, queue->params.callback_user_data);
+	}
+
+	IMX_VPU_DEBUG("destroying encoder queue; encoded frames: %lu  failed: %lu  skipped: %lu  dropped: %lu", queue->num_encoded_frames, queue->num_failed_frames, queue->num_skipped_frames, queue->num_dropped_frames);
+
+	pthread_cond_destroy(&(queue->no_active_calls_cond));
+	pthread_cond_destroy(&(queue->framebuffer_freed_cond));
+	pthread_cond_destroy(&(queue->frame_queued_cond));
+	pthread_mutex_destroy(&(queue->mutex));
+
+	IMX_VPU_FREE(queue->frames, sizeof(ImxVpuEncQueueFrame) * num_framebuffers);
+	IMX_VPU_FREE(queue->free_framebuffer_indices, sizeof(unsigned int) * num_framebuffers);
+	IMX_VPU_FREE(queue->framebuffer_states, sizeof(ImxVpuEncQueueFramebufferState) * num_framebuffers);
+	IMX_VPU_FREE(queue, sizeof(ImxVpuEncQueue));
+}
+
+
+ImxVpuFramebuffer* imx_vpu_enc_queue_acquire_framebuffer(ImxVpuEncQueue *queue, int can_block)
+{
+	unsigned int index;
+	int blocked = 0;
+
+	assert(queue != NULL);
+
+	imx_vpu_enc_queue_enter_call(queue);
+	pthread_mutex_lock(&(queue->mutex));
+
+	while (queue->num_free_framebuffers == 0)
+	{
+		if (queue->shutting_down)
+			break;
+
+		if ((queue->params.overflow_policy == IMX_VPU_ENC_QUEUE_OVERFLOW_POLICY_DROP_OLDEST) && (queue->num_queued_frames > 0))
+		{
+			ImxVpuEncQueueFrame frame;
+
+			/* Take over the framebuffer of the oldest queued frame directly,
+			 * instead of freeing it, so no other producer can grab it */
+			imx_vpu_enc_queue_pop_frame(queue, &frame, &index);
+			queue->framebuffer_states[index] = IMX_VPU_ENC_QUEUE_FRAMEBUFFER_ACQUIRED;
+			queue->num_dropped_frames++;
+
+			pthread_mutex_unlock(&(queue->mutex));
+
+			IMX_VPU_LOG("dropped oldest queued frame to free framebuffer %u", index);
+
+			if (queue->params.framebuffer_released_callback != NULL)
+				queue->params.framebuffer_released_callback(queue, &(frame.raw_frame), 1, queue->params.callback_user_data);
+
+			/* The call is only over once the callback returned */
+			pthread_mutex_lock(&(queue->mutex));
+			imx_vpu_enc_queue_leave_call(queue);
+			pthread_mutex_unlock(&(queue->mutex));
+
+			return &(queue->params.framebuffers[index]);
+		}
+
+		if (!can_block)
+			break;
+
+		if (!blocked)
+		{
+			blocked = 1;
+			queue->num_blocked_acquires++;
+		}
+
+		pthread_cond_wait(&(queue->framebuffer_freed_cond), &(queue->mutex));
+	}
+
+	if (queue->shutting_down || (queue->num_free_framebuffers == 0))
+	{
+		imx_vpu_enc_queue_leave_call(queue);
+		pthread_mutex_unlock(&(queue->mutex));
+		return NULL;
+	}
+
+	queue->num_free_framebuffers--;
+	index = queue->free_framebuffer_indices[queue->num_free_framebuffers];
+	queue->framebuffer_states[index] = IMX_VPU_ENC_QUEUE_FRAMEBUFFER_ACQUIRED;
+
+	imx_vpu_enc_queue_leave_call(queue);
+	pthread_mutex_unlock(&(queue->mutex));
+
+	return &(queue->params.framebuffers[index]);
+}
+
+
+int imx_vpu_enc_queue_submit(ImxVpuEncQueue *queue, ImxVpuRawFrame const *raw_frame, ImxVpuEncParams const *encoding_params)
+{
+	unsigned int index;
+	ImxVpuEncQueueFrame *frame;
+
+	assert(queue != NULL);
+	assert(raw_frame != NULL);
+
+	imx_vpu_enc_queue_enter_call(queue);
+	pthread_mutex_lock(&(queue->mutex));
+
+	if (!imx_vpu_enc_queue_get_framebuffer_index(queue, raw_frame->framebuffer, &index))
+	{
+		IMX_VPU_ERROR("framebuffer %p is not one of the queue's framebuffers", (void *)(raw_frame->framebuffer));
+		imx_vpu_enc_queue_leave_call(queue);
+		pthread_mutex_unlock(&(queue->mutex));
+		return 0;
+	}
+
+	if (queue->framebuffer_states[index] != IMX_VPU_ENC_QUEUE_FRAMEBUFFER_ACQUIRED)
+	{
+		IMX_VPU_ERROR("framebuffer %u was not acquired", index);
+		imx_vpu_enc_queue_leave_call(queue);
+		pthread_mutex_unlock(&(queue->mutex));
+		return 0;
+	}
+
+	if (queue->shutting_down)
+	{
+		imx_vpu_enc_queue_free_framebuffer(queue, index);
+		IMX_VPU_DEBUG("encoder queue is being destroyed; not queuing frame");
+		imx_vpu_enc_queue_leave_call(queue);
+		pthread_mutex_unlock(&(queue->mutex));
+		return 0;
+	}
+
+	frame = &(queue->frames[(queue->first_frame_idx + queue->num_queued_frames) % queue->params.num_framebuffers]);
+	frame->raw_frame = *raw_frame;
+	frame->encoding_params = (encoding_params != NULL) ? *encoding_params : queue->params.encoding_params;
+
+	queue->framebuffer_states[index] = IMX_VPU_ENC_QUEUE_FRAMEBUFFER_QUEUED;
+	queue->num_queued_frames++;
+	if (queue->num_queued_frames > queue->max_num_queued_frames)
+		queue->max_num_queued_frames = queue->num_queued_frames;
+
+	pthread_cond_signal(&(queue->frame_queued_cond));
+	/* Producers waiting for a framebuffer can now drop this frame */
+	if (queue->params.overflow_policy == IMX_VPU_ENC_QUEUE_OVERFLOW_POLICY_DROP_OLDEST)
+		pthread_cond_signal(&(queue->framebuffer_freed_cond));
+
+	imx_vpu_enc_queue_leave_call(queue);
+	pthread_mutex_unlock(&(queue->mutex));
+
+	return 1;
+}
+
+
+void imx_vpu_enc_queue_return_framebuffer(ImxVpuEncQueue *queue, ImxVpuFramebuffer *framebuffer)
+{
+	unsigned int index;
+
+	assert(queue != NULL);
+
+	imx_vpu_enc_queue_enter_call(queue);
+	pthread_mutex_lock(&(queue->mutex));
+
+	if (!imx_vpu_enc_queue_get_framebuffer_index(queue, framebuffer, &index))
+		IMX_VPU_ERROR("framebuffer %p is not one of the queue's framebuffers", (void *)framebuffer);
+	else if (queue->framebuffer_states[index] == IMX_VPU_ENC_QUEUE_FRAMEBUFFER_ACQUIRED)
+		imx_vpu_enc_queue_free_framebuffer(queue, index);
+	else
+		IMX_VPU_ERROR("framebuffer %u was not acquired", index);
+
+	imx_vpu_enc_queue_leave_call(queue);
+	pthread_mutex_unlock(&(queue->mutex));
+}
+
+
+void imx_vpu_enc_queue_get_stats(ImxVpuEncQueue *queue, ImxVpuEncQueueStats *stats)
+{
+	assert(queue != NULL);
+	assert(stats != NULL);
+
+	imx_vpu_enc_queue_enter_call(queue);
+	pthread_mutex_lock(&(queue->mutex));
+
+	stats->num_queued_frames = queue->num_queued_frames;
+	stats->max_num_queued_frames = queue->max_num_queued_frames;
+	stats->num_free_framebuffers = queue->num_free_framebuffers;
+	stats->num_encoded_frames = queue->num_encoded_frames;
+	stats->num_failed_frames = queue->num_failed_frames;
+	stats->num_skipped_frames = queue->num_skipped_frames;
+	stats->num_dropped_frames = queue->num_dropped_frames;
+	stats->num_blocked_acquires = queue->num_blocked_acquires;
+
+	imx_vpu_enc_queue_leave_call(queue);
+	pthread_mutex_unlock(&(queue->mutex));
+}
+
+
+ImxVpuEncoder* imx_vpu_enc_queue_get_encoder(ImxVpuEncQueue *queue)
+{
+	assert(queue != NULL);
+	return queue->params.encoder;
+}
+
+
+
+
+static void* imx_vpu_enc_queue_worker(void *arg)
+{
+	ImxVpuEncQueue *queue = (ImxVpuEncQueue *)arg;
+
+	pthread_mutex_lock(&(queue->mutex));
+
+	for (;;)
+	{
+		ImxVpuEncQueueFrame frame;
+		ImxVpuEncodedFrame encoded_frame;
+		ImxVpuEncReturnCodes ret;
+		unsigned int index, output_code = 0;
+		unsigned int num_queued_frames;
+		int skip_frame = 0;
+
+		while ((queue->num_queued_frames == 0) && !(queue->shutting_down))
+			pthread_cond_wait(&(queue->frame_queued_cond), &(queue->mutex));
+
+		/* Without draining, frames which are still queued are dropped
+		 * by imx_vpu_enc_queue_destroy() */
+		if (queue->shutting_down && ((queue->num_queued_frames == 0) || !(queue->drain)))
+			break;
+
+		num_queued_frames = queue->num_queued_frames;
+		imx_vpu_enc_queue_pop_frame(queue, &frame, &index);
+		queue->framebuffer_states[index] = IMX_VPU_ENC_QUEUE_FRAMEBUFFER_ENCODING;
+
+		if (queue->params.overflow_policy == IMX_VPU_ENC_QUEUE_OVERFLOW_POLICY_SKIP_FRAMES)
+		{
+			frame.encoding_params.enable_autoskip = 1;
+
+			/* The first frame must be an I frame, so no frame is skipped
+			 * until one was encoded successfully */
+			if ((num_queued_frames >= queue->skip_threshold) && !(frame.encoding_params.force_I_frame) && (queue->num_encoded_frames > 0))
+			{
+				frame.encoding_params.skip_frame = 1;
+				skip_frame = 1;
+			}
+		}
+
+		pthread_mutex_unlock(&(queue->mutex));
+
+		memset(&encoded_frame, 0, sizeof(encoded_frame));
+		ret = imx_vpu_enc_encode(queue->params.encoder, &(frame.raw_frame), &encoded_frame, &(frame.encoding_params), &output_code);
+		if (ret != IMX_VPU_ENC_RETURN_CODE_OK)
+			IMX_VPU_ERROR("could not encode queued frame: %s", imx_vpu_enc_error_string(ret));
+
+		/* The VPU is done reading the framebuffer at this point */
+		pthread_mutex_lock(&(queue->mutex));
+		imx_vpu_enc_queue_free_framebuffer(queue, index);
+		if (ret == IMX_VPU_ENC_RETURN_CODE_OK)
+		{
+			queue->num_encoded_frames++;
+			if (skip_frame)
+				queue->num_skipped_frames++;
+		}
+		else
+			queue->num_failed_frames++;
+		pthread_mutex_unlock(&(queue->mutex));
+
+		if (queue->params.framebuffer_released_callback != NULL)
+			queue->params.framebuffer_released_callback(queue, &(frame.raw_frame), 0, queue->params.callback_user_data);
+
+		queue->params.encoded_frame_callback(queue, ret, &encoded_frame, output_code, queue->params.callback_user_data);
+
+		pthread_mutex_lock(&(queue->mutex));
+	}
+
+	pthread_mutex_unlock(&(queue->mutex));
+
+	return NULL;
+}
+
+
+static int imx_vpu_enc_queue_get_framebuffer_index(ImxVpuEncQueue *queue, ImxVpuFramebuffer const *framebuffer, unsigned int *index)
+{
+	ImxVpuFramebuffer const *first = queue->params.framebuffers;
+
+	if ((framebuffer < first) || (framebuffer >= (first + queue->params.num_framebuffers)))
+		return 0;
+
+	*index = (unsigned int)(framebuffer - first);
+	return 1;
+}
+
+
+/* Must be called with the mutex locked. The frame's framebuffer state
+ * is not changed; the caller has to set it. */
+static void imx_vpu_enc_queue_pop_frame(ImxVpuEncQueue *queue, ImxVpuEncQueueFrame *frame, unsigned int *index)
+{
+	int valid_index;
+
+	assert(queue->num_queued_frames > 0);
+
+	*frame = queue->frames[queue->first_frame_idx];
+	queue->first_frame_idx = (queue->first_frame_idx + 1) % queue->params.num_framebuffers;
+	queue->num_queued_frames--;
+
+	valid_index = imx_vpu_enc_queue_get_framebuffer_index(queue, frame->raw_frame.framebuffer, index);
+	assert(valid_index);
+	IMXVPUAPI_UNUSED_PARAM(valid_index);
+}
+
+
+/* Must be called with the mutex locked. */
+static void imx_vpu_enc_queue_free_framebuffer(ImxVpuEncQueue *queue, unsigned int index)
+{
+	queue->framebuffer_states[index] = IMX_VPU_ENC_QUEUE_FRAMEBUFFER_FREE;
+	queue->free_framebuffer_indices[queue->num_free_framebuffers] = index;
+	queue->num_free_framebuffers++;
+
+	pthread_cond_signal(&(queue->framebuffer_freed_cond));
+}
+
+
+/* Must be called before the mutex is locked, so that
+ * imx_vpu_enc_queue_destroy() also waits for threads
+ * which are still waiting for the mutex. */
+static void imx_vpu_enc_queue_enter_call(ImxVpuEncQueue *queue)
+{
+	__sync_fetch_and_add(&(queue->num_active_calls), 1);
+}
+
+
+/* Must be called with the mutex locked. */
+static void imx_vpu_enc_queue_leave_call(ImxVpuEncQueue *queue)
+{
+	if ((__sync_sub_and_fetch(&(queue->num_active_calls), 1) == 0) && queue->shutting_down)
+		pthread_cond_broadcast(&(queue->no_active_calls_cond));
+}
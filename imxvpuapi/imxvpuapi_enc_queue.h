@@ -0,0 +1,238 @@
+/* imxvpuapi encoder input queue, with framebuffer recycling and backpressure
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+/* The encoder queue decouples producers of raw frames (like camera capture
+ * threads) from the encoder. It manages a fixed set of input framebuffers,
+ * which are allocated by the caller. Producers acquire a free framebuffer
+ * with imx_vpu_enc_queue_acquire_framebuffer(), fill it, and submit it with
+ * imx_vpu_enc_queue_submit(). A worker thread owned by the queue encodes the
+ * submitted frames in order, and writes the encoded data out with the output
+ * functions of the frame's ImxVpuEncParams. Once the VPU is done reading a
+ * framebuffer, the queue returns it to the set of free framebuffers, and
+ * invokes the framebuffer released callback. Producers therefore never have
+ * to keep track of which framebuffers are still in use by the VPU.
+ *
+ * If frames are submitted faster than they can be encoded, all framebuffers
+ * eventually end up in the queue. What happens then is defined by the
+ * overflow policy (see ImxVpuEncQueueOverflowPolicy).
+ *
+ * Acquiring, submitting, and returning framebuffers is thread safe; these
+ * functions can be called from any number of threads. The callbacks are
+ * invoked without any internal lock held. The encoder itself is only used
+ * by the worker thread. It must not be used directly while the queue exists,
+ * except for functions which do not access the VPU, like imx_vpu_enc_get_stats().
+ * It must not be added to a scheduler either.
+ *
+ * The worker thread uses the blocking imx_vpu_enc_encode(). Other VPU instances
+ * (including other queues) can be used by other threads at the same time; the
+ * VPU processes one frame at a time, so the worker then waits until the other
+ * instances' frames are done (see imx_vpu_dec_decode_start()). This waiting
+ * time reduces the queue's throughput, but does not make frames fail.
+ *
+ * The queue needs POSIX threads; applications which use it must link against
+ * the pthread library (the pkg-config file takes care of this). */
+
+#ifndef IMXVPUAPI_ENC_QUEUE_H
+#define IMXVPUAPI_ENC_QUEUE_H
+
+#include "imxvpuapi.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct _ImxVpuEncQueue ImxVpuEncQueue;
+
+
+/* What to do if a framebuffer is requested while all of them are in use. */
+typedef enum
+{
+	/* imx_vpu_enc_queue_acquire_framebuffer() waits until the worker thread
+	 * releases a framebuffer. No frames are lost, but producers are slowed
+	 * down to the encoding speed. */
+	IMX_VPU_ENC_QUEUE_OVERFLOW_POLICY_BLOCK = 0,
+	/* The oldest frame that is queued and not being encoded yet is dropped,
+	 * and its framebuffer is handed to the caller. The framebuffer released
+	 * callback is invoked for the dropped frame, with dropped set to 1. If
+	 * no queued frame can be dropped (because the remaining framebuffers are
+	 * held by producers or by the VPU), this waits like the block policy. */
+	IMX_VPU_ENC_QUEUE_OVERFLOW_POLICY_DROP_OLDEST,
+	/* Like the block policy, but as soon as the number of queued frames
+	 * reaches skip_threshold, frames are encoded with skip_frame set. The
+	 * VPU does not read the source of such frames, so the queue drains
+	 * quickly, while the stream's timing is preserved. enable_autoskip is
+	 * set for all frames, so rate control can skip frames on its own as
+	 * well. Frames with force_I_frame set, and all frames until one was
+	 * encoded successfully, are never skipped. Not supported with motion
+	 * JPEG; imx_vpu_enc_queue_create() fails in that case. */
+	IMX_VPU_ENC_QUEUE_OVERFLOW_POLICY_SKIP_FRAMES
+}
+ImxVpuEncQueueOverflowPolicy;
+
+
+/* Callback for encoded frames. ret, encoded_frame, and output_code are the
+ * values imx_vpu_enc_encode() produced. encoded_frame is only valid during
+ * this callback. Its context, pts, and dts fields are the ones of the
+ * submitted raw frame. If acquire_output_buffer was used, the callback is
+ * responsible for the acquired_handle. This is invoked by the worker thread.
+ * user_data is the callback_user_data value from ImxVpuEncQueueParams. */
+typedef void (*ImxVpuEncQueueEncodedFrameCallback)(ImxVpuEncQueue *queue, ImxVpuEncReturnCodes ret, ImxVpuEncodedFrame *encoded_frame, unsigned int output_code, void *user_data);
+
+/* Callback for framebuffers the queue is done with. raw_frame is the
+ * submitted frame; it is only valid during this callback. If dropped is 0,
+ * the frame was encoded (or skipped), and the framebuffer is now free again;
+ * this is invoked by the worker thread, right after the VPU finished reading
+ * the framebuffer, and before the encoded frame callback. If dropped is 1, the
+ * frame was discarded without encoding it, either because of the drop oldest
+ * policy, or because the queue was destroyed without draining it. In the
+ * first case, the framebuffer is then handed to the producer whose
+ * imx_vpu_enc_queue_acquire_framebuffer() call caused the drop, and which
+ * invokes this callback. Typically, this callback is used to clean up the
+ * frame's context. */
+typedef void (*ImxVpuEncQueueFramebufferReleasedCallback)(ImxVpuEncQueue *queue, ImxVpuRawFrame const *raw_frame, int dropped, void *user_data);
+
+
+/* Structure used together with imx_vpu_enc_queue_create(). */
+typedef struct
+{
+	/* Encoder to use. It must be open, and its framebuffers must already
+	 * be registered with imx_vpu_enc_register_framebuffers(). */
+	ImxVpuEncoder *encoder;
+
+	/* Input framebuffers. These are the framebuffers producers write their
+	 * frames into; they are not the ones registered with the encoder. The
+	 * array is not copied, and must remain valid until the queue is
+	 * destroyed. num_framebuffers must be at least 1. */
+	ImxVpuFramebuffer *framebuffers;
+	unsigned int num_framebuffers;
+
+	ImxVpuEncQueueOverflowPolicy overflow_policy;
+
+	/* Number of queued frames at which frames start to get skipped. Only
+	 * used by the skip frames policy. If this is 0, half of
+	 * num_framebuffers (at least 1) is used. Default value is 0. */
+	unsigned int skip_threshold;
+
+	/* Encoding parameters for frames that are submitted without their own.
+	 * The output functions must be set. */
+	ImxVpuEncParams encoding_params;
+
+	/* Invoked for each encoded frame. Must not be NULL. */
+	ImxVpuEncQueueEncodedFrameCallback encoded_frame_callback;
+	/* Invoked for each framebuffer the queue is done with. Can be NULL. */
+	ImxVpuEncQueueFramebufferReleasedCallback framebuffer_released_callback;
+	void *callback_user_data;
+}
+ImxVpuEncQueueParams;
+
+
+/* Statistics about the queue. See imx_vpu_enc_queue_get_stats(). */
+typedef struct
+{
+	/* Number of frames that are queued and not being encoded yet. */
+	unsigned int num_queued_frames;
+	/* Highest number of queued frames seen so far. */
+	unsigned int max_num_queued_frames;
+	/* Number of framebuffers that can be acquired right now. */
+	unsigned int num_free_framebuffers;
+
+	/* Number of frames that were encoded successfully, including
+	 * skipped ones. */
+	unsigned long num_encoded_frames;
+	/* Number of frames imx_vpu_enc_encode() failed for. These are not
+	 * included in num_encoded_frames. */
+	unsigned long num_failed_frames;
+	/* Number of frames that were encoded successfully with skip_frame
+	 * set by the skip frames policy. These are included in
+	 * num_encoded_frames. */
+	unsigned long num_skipped_frames;
+	/* Number of frames that were dropped without encoding them. */
+	unsigned long num_dropped_frames;
+	/* Number of imx_vpu_enc_queue_acquire_framebuffer() calls which
+	 * had to wait for a free framebuffer. */
+	unsigned long num_blocked_acquires;
+}
+ImxVpuEncQueueStats;
+
+
+/* Fills params with default values. encoder is stored in the params, and the
+ * encoding parameters are set with imx_vpu_enc_set_default_encoding_params().
+ * The framebuffers, the output functions, and the callbacks still have to be
+ * set afterwards. */
+void imx_vpu_enc_queue_set_default_params(ImxVpuEncoder *encoder, ImxVpuEncQueueParams *params);
+
+/* Creates a new queue, and starts its worker thread. params is copied. Returns
+ * NULL if the parameters are invalid (this includes the skip frames policy
+ * with a motion JPEG encoder), memory allocation failed, or the thread could
+ * not be started. */
+ImxVpuEncQueue* imx_vpu_enc_queue_create(ImxVpuEncQueueParams const *params);
+
+/* Destroys the queue. If drain is nonzero, this waits until all queued frames
+ * are encoded. Otherwise, only the frame that is currently being encoded is
+ * finished; the other queued frames are dropped (the framebuffer released
+ * callback is invoked for them, with dropped set to 1). Pending and future
+ * imx_vpu_enc_queue_acquire_framebuffer() calls return NULL once this was
+ * called, and imx_vpu_enc_queue_submit() calls return 0. Before the queue is
+ * freed, this waits until all other threads have left the queue's functions,
+ * including callbacks invoked by them, so producers that are blocked or
+ * running concurrently are safe. The worker thread is stopped afterwards. The
+ * encoder is not closed. No thread may call any of the queue's functions once
+ * this function returns, so producers must stop themselves before that, for
+ * example once acquiring a framebuffer returns NULL. */
+void imx_vpu_enc_queue_destroy(ImxVpuEncQueue *queue, int drain);
+
+/* Returns a free framebuffer. If none is free, the overflow policy defines what
+ * happens. If can_block is 0, this never waits, and returns NULL instead. Also
+ * returns NULL if the queue is being destroyed. The framebuffer is owned by the
+ * caller until it is passed to imx_vpu_enc_queue_submit() or
+ * imx_vpu_enc_queue_return_framebuffer(). */
+ImxVpuFramebuffer* imx_vpu_enc_queue_acquire_framebuffer(ImxVpuEncQueue *queue, int can_block);
+
+/* Queues a frame for encoding. raw_frame->framebuffer must have been acquired
+ * with imx_vpu_enc_queue_acquire_framebuffer(). raw_frame is copied;
+ * its context, pts, and dts are passed on to the encoded frame. encoding_params
+ * are copied as well; if it is NULL, the encoding parameters from
+ * ImxVpuEncQueueParams are used. Framebuffers that were written to by the CPU
+ * must be synced before this call (see imx_vpu_dma_buffer_sync_for_device()).
+ * Returns 0 if the framebuffer was not acquired from this queue, or if the
+ * queue is being destroyed (the framebuffer is returned in that case), nonzero
+ * otherwise. */
+int imx_vpu_enc_queue_submit(ImxVpuEncQueue *queue, ImxVpuRawFrame const *raw_frame, ImxVpuEncParams const *encoding_params);
+
+/* Returns an acquired framebuffer to the queue without encoding it, for example
+ * if capturing the frame failed. The framebuffer released callback is not
+ * invoked. */
+void imx_vpu_enc_queue_return_framebuffer(ImxVpuEncQueue *queue, ImxVpuFramebuffer *framebuffer);
+
+/* Retrieves statistics about the queue. stats must not be NULL. */
+void imx_vpu_enc_queue_get_stats(ImxVpuEncQueue *queue, ImxVpuEncQueueStats *stats);
+
+/* Returns the queue's encoder. */
+ImxVpuEncoder* imx_vpu_enc_queue_get_encoder(ImxVpuEncQueue *queue);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -260,104 +260,6 @@ size_t default_dmabufalloc_get_size(ImxVpuDMABufferAllocator *allocator, ImxVpuD
 
 
 
-/******************************************************/
-/******* MISCELLANEOUS STRUCTURES AND FUNCTIONS *******/
-/******************************************************/
-
-
-#define FRAME_ALIGN 16
-
-
-void imx_vpu_calc_framebuffer_sizes(ImxVpuColorFormat color_format, unsigned int frame_width, unsigned int frame_height, unsigned int framebuffer_alignment, int uses_interlacing, int chroma_interleave, ImxVpuFramebufferSizes *calculated_sizes)
-{
-	int alignment;
-
-	assert(calculated_sizes != NULL);
-	assert(frame_width > 0);
-	assert(frame_height > 0);
-
-	calculated_sizes->aligned_frame_width = IMX_VPU_ALIGN_VAL_TO(frame_width, FRAME_ALIGN);
-	if (uses_interlacing)
-		calculated_sizes->aligned_frame_height = IMX_VPU_ALIGN_VAL_TO(frame_height, (2 * FRAME_ALIGN));
-	else
-		calculated_sizes->aligned_frame_height = IMX_VPU_ALIGN_VAL_TO(frame_height, FRAME_ALIGN);
-
-	calculated_sizes->y_stride = calculated_sizes->aligned_frame_width;
-	calculated_sizes->y_size = calculated_sizes->y_stride * calculated_sizes->aligned_frame_height;
-
-	switch (color_format)
-	{
-		case IMX_VPU_COLOR_FORMAT_YUV420:
-			calculated_sizes->cbcr_stride = calculated_sizes->y_stride / 2;
-			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = calculated_sizes->y_size / 4;
-			break;
-		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL:
-			calculated_sizes->cbcr_stride = calculated_sizes->y_stride / 2;
-			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = calculated_sizes->y_size / 2;
-			break;
-		case IMX_VPU_COLOR_FORMAT_YUV444:
-			calculated_sizes->cbcr_stride = calculated_sizes->y_stride;
-			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = calculated_sizes->y_size;
-			break;
-		case IMX_VPU_COLOR_FORMAT_YUV400:
-			calculated_sizes->cbcr_stride = 0;
-			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = 0;
-			break;
-		default:
-			assert(FALSE);
-	}
-
-	if (chroma_interleave)
-	{
-		/* chroma_interleave != 0 means the Cb and Cr values are interleaved
-		 * and share one plane. The stride values are doubled compared to
-		 * the chroma_interleave == 0 case because the interleaving happens
-		 * horizontally, meaning 2 bytes in the shared chroma plane for the
-		 * chroma information of one pixel. */
-
-		calculated_sizes->cbcr_stride *= 2;
-		calculated_sizes->cbcr_size *= 2;
-	}
-
-	alignment = framebuffer_alignment;
-	if (alignment > 1)
-	{
-		calculated_sizes->y_size = IMX_VPU_ALIGN_VAL_TO(calculated_sizes->y_size, alignment);
-		calculated_sizes->cbcr_size = IMX_VPU_ALIGN_VAL_TO(calculated_sizes->cbcr_size, alignment);
-		calculated_sizes->mvcol_size = IMX_VPU_ALIGN_VAL_TO(calculated_sizes->mvcol_size, alignment);
-	}
-
-	/* cbcr_size is added twice if chroma_interleave is 0, since in that case,
-	 * there are *two* separate planes for Cb and Cr, each one with cbcr_size bytes,
-	 * while in the chroma_interleave == 1 case, there is one shared chroma plane
-	 * for both Cb and Cr data, with cbcr_size bytes */
-	calculated_sizes->total_size = calculated_sizes->y_size
-	                             + (chroma_interleave ? calculated_sizes->cbcr_size : (calculated_sizes->cbcr_size * 2))
-	                             + calculated_sizes->mvcol_size
-	                             + alignment;
-
-	calculated_sizes->chroma_interleave = chroma_interleave;
-}
-
-
-void imx_vpu_fill_framebuffer_params(ImxVpuFramebuffer *framebuffer, ImxVpuFramebufferSizes *calculated_sizes, ImxVpuDMABuffer *fb_dma_buffer, void* context)
-{
-	assert(framebuffer != NULL);
-	assert(calculated_sizes != NULL);
-
-	framebuffer->dma_buffer = fb_dma_buffer;
-	framebuffer->context = context;
-	framebuffer->y_stride = calculated_sizes->y_stride;
-	framebuffer->cbcr_stride = calculated_sizes->cbcr_stride;
-	framebuffer->y_offset = 0;
-	framebuffer->cb_offset = calculated_sizes->y_size;
-	framebuffer->cr_offset = calculated_sizes->y_size + calculated_sizes->cbcr_size;
-	framebuffer->mvcol_offset = calculated_sizes->y_size + calculated_sizes->cbcr_size * (calculated_sizes->chroma_interleave ? 1 : 2);
-}
-
-
-
-
 /************************************************/
 /******* DECODER STRUCTURES AND FUNCTIONS *******/
 /************************************************/
@@ -366,14 +268,6 @@ void imx_vpu_fill_framebuffer_params(ImxVpuFramebuffer *framebuffer, ImxVpuFrame
 #define MIN_NUM_FREE_FB_REQUIRED 5
 
 
-typedef struct
-{
-	void *context;
-	uint64_t pts, dts;
-}
-ImxVpuDecFrameEntry;
-
-
 struct _ImxVpuDecoder
 {
 	VpuDecHandle handle;
@@ -390,18 +284,41 @@ struct _ImxVpuDecoder
 
 	unsigned int num_framebuffers;
 	VpuFrameBuffer **wrapper_framebuffers;
+	/* Maps wrapper framebuffer addresses to indices */
+	ImxVpuFramebufferTracker framebuffer_tracker;
 	ImxVpuFramebuffer *framebuffers;
 	ImxVpuDecFrameEntry *frame_entries;
 	ImxVpuDecFrameEntry pending_entry;
 	ImxVpuDecFrameEntry dropped_frame_entry;
 	int num_context;
 
+	/* Framebuffers returned by imx_vpu_dec_return_framebuffer() from other
+	 * threads; these are marked as displayed by
+	 * dec_process_returned_framebuffers() */
+	ImxVpuIndexReturnQueue returned_framebuffers;
+
 	BOOL output_info_available;
 	BOOL consumption_info_available;
 	BOOL flush_vpu_upon_reset;
 
 	BOOL drain_mode_enabled;
 
+	/* Trick play settings; see imx_vpu_dec_set_skip_mode() and
+	 * imx_vpu_dec_enable_keyframe_search() */
+	ImxVpuDecSkipMode skip_mode;
+	BOOL keyframe_search_enabled;
+
+	/* Used by imx_vpu_dec_reserve_input_space() and
+	 * imx_vpu_dec_commit_input_space() */
+	uint8_t *staging_input_buffer;
+	size_t staging_input_buffer_size;
+	size_t reserved_input_space_size;
+	BOOL input_space_reserved;
+
+	/* Used by imx_vpu_dec_decode_start() and imx_vpu_dec_decode_finish() */
+	BOOL decoding_pending;
+	unsigned int pending_output_code;
+
 	BOOL recalculate_num_avail_framebuffers;
 	int num_available_framebuffers;
 	int num_times_counter_decremented;
@@ -409,6 +326,19 @@ struct _ImxVpuDecoder
 
 	imx_vpu_dec_new_initial_info_callback initial_info_callback;
 	void *callback_user_data;
+
+	/* Statistics. The VPU wrapper performs all decoding stages in one
+	 * call, so only the time before it (push_time), the time spent inside
+	 * it (wait_time), and the rest (output_time) can be measured. */
+	ImxVpuDecStats stats;
+	ImxVpuFrameStats cur_frame_stats;
+	uint64_t cur_frame_begin_time;
+	ImxVpuDecFrameStatsCallback frame_stats_callback;
+	void *frame_stats_callback_user_data;
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	ImxVpuTraceRing trace_ring;
+#endif
 };
 
 
@@ -472,39 +402,15 @@ static void dec_convert_from_wrapper_initial_info(VpuDecInitInfo *wrapper_info,
 	info->interlacing = wrapper_info->nInterlace;
 
 	info->framebuffer_alignment = wrapper_info->nAddressAlignment;
-}
-
-
-static int dec_get_wrapper_framebuffer_index(ImxVpuDecoder *decoder, VpuFrameBuffer *wrapper_fb)
-{
-	unsigned int i;
 
-	// TODO: do something faster, like a hash table
-	for (i = 0; i < decoder->num_framebuffers; ++i)
-	{
-		if (wrapper_fb == decoder->wrapper_framebuffers[i])
-			return (int)i;
-	}
-	return -1;
+	/* The VPU wrapper always requires new framebuffers */
+	info->framebuffers_reused = 0;
 }
 
 
-char const * imx_vpu_dec_error_string(ImxVpuDecReturnCodes code)
+static int dec_get_wrapper_framebuffer_index(ImxVpuDecoder *decoder, VpuFrameBuffer *wrapper_fb)
 {
-	switch (code)
-	{
-		case IMX_VPU_DEC_RETURN_CODE_OK:                        return "ok";
-		case IMX_VPU_DEC_RETURN_CODE_ERROR:                     return "unspecified error";
-		case IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS:            return "invalid params";
-		case IMX_VPU_DEC_RETURN_CODE_INVALID_HANDLE:            return "invalid handle";
-		case IMX_VPU_DEC_RETURN_CODE_INVALID_FRAMEBUFFER:       return "invalid framebuffer";
-		case IMX_VPU_DEC_RETURN_CODE_INSUFFICIENT_FRAMEBUFFERS: return "insufficient_framebuffers";
-		case IMX_VPU_DEC_RETURN_CODE_INVALID_STRIDE:            return "invalid stride";
-		case IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE:       return "wrong call sequence";
-		case IMX_VPU_DEC_RETURN_CODE_TIMEOUT:                   return "timeout";
-		case IMX_VPU_DEC_RETURN_CODE_ALREADY_CALLED:            return "already called";
-		default: return "<unknown>";
-	}
+	return imx_vpu_framebuffer_tracker_lookup_address(&(decoder->framebuffer_tracker), wrapper_fb);
 }
 
 
@@ -613,6 +519,15 @@ void imx_vpu_dec_get_bitstream_buffer_info(size_t *size, unsigned int *alignment
 }
 
 
+void imx_vpu_dec_get_bitstream_buffer_info_with_hints(ImxVpuBitstreamBufferHints const *hints, size_t *size, unsigned int *alignment)
+{
+	/* The VPU wrapper determines the size of its bitstream
+	 * buffer on its own, so the hints cannot be used here */
+	IMXVPUAPI_UNUSED_PARAM(hints);
+	imx_vpu_dec_get_bitstream_buffer_info(size, alignment);
+}
+
+
 ImxVpuDecReturnCodes imx_vpu_dec_open(ImxVpuDecoder **decoder, ImxVpuDecOpenParams *open_params, ImxVpuDMABuffer *bitstream_buffer, imx_vpu_dec_new_initial_info_callback new_initial_info_callback, void *callback_user_data)
 {
 	int config_param;
@@ -626,6 +541,13 @@ ImxVpuDecReturnCodes imx_vpu_dec_open(ImxVpuDecoder **decoder, ImxVpuDecOpenPara
 	assert(open_params != NULL);
 	assert(bitstream_buffer != NULL);
 
+	/* The VPU wrapper does not expose the decoder's rotator */
+	if ((open_params->rotation != IMX_VPU_ROTATION_NONE) || (open_params->mirror != IMX_VPU_MIRROR_NONE))
+	{
+		IMX_VPU_ERROR("rotation and mirroring are not supported by the decoder in this backend");
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
 	*decoder = IMX_VPU_ALLOC(sizeof(ImxVpuDecoder));
 	if ((*decoder) == NULL)
 	{
@@ -808,8 +730,12 @@ ImxVpuDecReturnCodes imx_vpu_dec_close(ImxVpuDecoder *decoder)
 		IMX_VPU_FREE(decoder->frame_entries, sizeof(ImxVpuDecFrameEntry) * decoder->num_framebuffers);
 	if (decoder->wrapper_framebuffers != NULL)
 		IMX_VPU_FREE(decoder->wrapper_framebuffers, sizeof(VpuFrameBuffer*) * decoder->num_framebuffers);
+	imx_vpu_index_return_queue_cleanup(&(decoder->returned_framebuffers));
+	imx_vpu_framebuffer_tracker_cleanup(&(decoder->framebuffer_tracker));
 	if (decoder->virt_mem_sub_block != NULL)
 		IMX_VPU_FREE(decoder->virt_mem_sub_block, decoder->virt_mem_sub_block_size);
+	if (decoder->staging_input_buffer != NULL)
+		IMX_VPU_FREE(decoder->staging_input_buffer, decoder->staging_input_buffer_size);
 	IMX_VPU_FREE(decoder, sizeof(ImxVpuDecoder));
 
 	IMX_VPU_TRACE("closed decoder");
@@ -856,12 +782,118 @@ int imx_vpu_dec_is_drain_mode_enabled(ImxVpuDecoder *decoder)
 }
 
 
+static ImxVpuDecReturnCodes dec_apply_skip_mode(ImxVpuDecoder *decoder)
+{
+	int config_param;
+	VpuDecRetCode ret;
+
+	/* The VPU wrapper has one skip mode setting, which also covers
+	 * the iframe search; the search takes precedence */
+	if (decoder->keyframe_search_enabled)
+		config_param = VPU_DEC_ISEARCH;
+	else
+	{
+		switch (decoder->skip_mode)
+		{
+			case IMX_VPU_DEC_SKIP_MODE_NON_REFERENCE_FRAMES: config_param = VPU_DEC_SKIPB; break;
+			case IMX_VPU_DEC_SKIP_MODE_NON_INTRA_FRAMES: config_param = VPU_DEC_SKIPPB; break;
+			default: config_param = VPU_DEC_SKIPNONE;
+		}
+	}
+
+	ret = VPU_DecConfig(decoder->handle, VPU_DEC_CONF_SKIPMODE, &config_param);
+	if (ret != VPU_DEC_RET_SUCCESS)
+		IMX_VPU_ERROR("setting skipmode failed: %s", imx_vpu_dec_error_string(dec_convert_retcode(ret)));
+
+	return dec_convert_retcode(ret);
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_set_skip_mode(ImxVpuDecoder *decoder, ImxVpuDecSkipMode skip_mode)
+{
+	ImxVpuDecReturnCodes ret;
+
+	assert(decoder != NULL);
+
+	if (decoder->decoding_pending)
+	{
+		IMX_VPU_ERROR("cannot change skip mode while a decoding is in progress");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	decoder->skip_mode = skip_mode;
+
+	if ((ret = dec_apply_skip_mode(decoder)) == IMX_VPU_DEC_RETURN_CODE_OK)
+		IMX_VPU_INFO("set decoder skip mode to %d", (int)skip_mode);
+
+	return ret;
+}
+
+
+ImxVpuDecSkipMode imx_vpu_dec_get_skip_mode(ImxVpuDecoder *decoder)
+{
+	assert(decoder != NULL);
+
+	return decoder->skip_mode;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_enable_keyframe_search(ImxVpuDecoder *decoder, int enabled)
+{
+	ImxVpuDecReturnCodes ret;
+
+	assert(decoder != NULL);
+
+	if (decoder->decoding_pending)
+	{
+		IMX_VPU_ERROR("cannot change keyframe search while a decoding is in progress");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	decoder->keyframe_search_enabled = !!enabled;
+
+	if ((ret = dec_apply_skip_mode(decoder)) == IMX_VPU_DEC_RETURN_CODE_OK)
+		IMX_VPU_INFO("set decoder keyframe search to %d", enabled);
+
+	return ret;
+}
+
+
+int imx_vpu_dec_is_keyframe_search_enabled(ImxVpuDecoder *decoder)
+{
+	assert(decoder != NULL);
+
+	return decoder->keyframe_search_enabled;
+}
+
+
+static void dec_process_returned_framebuffers(ImxVpuDecoder *decoder)
+{
+	int idx;
+
+	if (decoder->returned_framebuffers.num_indices == 0)
+		return;
+
+	idx = imx_vpu_index_return_queue_take_all(&(decoder->returned_framebuffers));
+	while (idx >= 0)
+	{
+		int next_idx = imx_vpu_index_return_queue_next(&(decoder->returned_framebuffers), idx);
+		imx_vpu_dec_mark_framebuffer_as_displayed(decoder, &(decoder->framebuffers[idx]));
+		idx = next_idx;
+	}
+}
+
+
 ImxVpuDecReturnCodes imx_vpu_dec_flush(ImxVpuDecoder *decoder)
 {
 	VpuDecRetCode ret = VPU_DEC_RET_SUCCESS;
 
 	assert(decoder != NULL);
 
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_FLUSH, 0, 0, 0);
+
+	dec_process_returned_framebuffers(decoder);
+
 	if (decoder->flush_vpu_upon_reset)
 	{
 		ret = VPU_DecFlushAll(decoder->handle);
@@ -886,6 +918,8 @@ ImxVpuDecReturnCodes imx_vpu_dec_flush(ImxVpuDecoder *decoder)
 		IMX_VPU_FREE(decoder->frame_entries, sizeof(ImxVpuDecFrameEntry) * decoder->num_framebuffers);
 	decoder->num_context = 0;
 
+	decoder->input_space_reserved = FALSE;
+
 	return dec_convert_retcode(ret);
 }
 
@@ -968,6 +1002,24 @@ ImxVpuDecReturnCodes imx_vpu_dec_register_framebuffers(ImxVpuDecoder *decoder, I
 		return IMX_VPU_DEC_RETURN_CODE_ERROR;
 	}
 
+	imx_vpu_index_return_queue_cleanup(&(decoder->returned_framebuffers));
+	imx_vpu_framebuffer_tracker_cleanup(&(decoder->framebuffer_tracker));
+	if (!imx_vpu_index_return_queue_init(&(decoder->returned_framebuffers), num_framebuffers) || !imx_vpu_framebuffer_tracker_init(&(decoder->framebuffer_tracker), num_framebuffers))
+	{
+		imx_vpu_index_return_queue_cleanup(&(decoder->returned_framebuffers));
+		IMX_VPU_FREE(decoder->frame_entries, sizeof(ImxVpuDecFrameEntry) * num_framebuffers);
+		IMX_VPU_FREE(decoder->wrapper_framebuffers, sizeof(VpuFrameBuffer*) * num_framebuffers);
+		decoder->frame_entries = NULL;
+		decoder->wrapper_framebuffers = NULL;
+		return IMX_VPU_DEC_RETURN_CODE_ERROR;
+	}
+
+	for (i = 0; i < num_framebuffers; ++i)
+	{
+		if (decoder->wrapper_framebuffers[i] != NULL)
+			imx_vpu_framebuffer_tracker_set_address(&(decoder->framebuffer_tracker), i, decoder->wrapper_framebuffers[i]);
+	}
+
 	decoder->framebuffers = framebuffers;
 	decoder->num_framebuffers = num_framebuffers;
 	decoder->num_available_framebuffers = num_framebuffers;
@@ -987,7 +1039,31 @@ void imx_vpu_dec_set_codec_data(ImxVpuDecoder *decoder, uint8_t const *codec_dat
 }
 
 
-ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, unsigned int *output_code)
+static VpuDecRetCode dec_decode_buf(ImxVpuDecoder *decoder, VpuBufferNode *node, int *buf_ret_code)
+{
+	VpuDecRetCode ret;
+	uint64_t begin_time = imx_vpu_get_monotonic_time();
+
+	/* Everything before the first VPU_DecDecodeBuf() call of
+	 * the step is input handling; see imx_vpu_dec_decode() */
+	if (decoder->cur_frame_stats.push_time == 0)
+		decoder->cur_frame_stats.push_time = begin_time - decoder->cur_frame_begin_time;
+
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_VPU_START, 0, 0, 0);
+	ret = VPU_DecDecodeBuf(decoder->handle, node, buf_ret_code);
+
+	decoder->cur_frame_stats.wait_time += imx_vpu_get_monotonic_time() - begin_time;
+	if (ret == VPU_DEC_RET_FAILURE_TIMEOUT)
+	{
+		decoder->cur_frame_stats.num_wait_timeouts++;
+		IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_WAIT_TIMEOUT, decoder->cur_frame_stats.num_wait_timeouts, 0, 0);
+	}
+
+	return ret;
+}
+
+
+static ImxVpuDecReturnCodes dec_decode_frame(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, unsigned int *output_code)
 {
 	VpuDecRetCode ret;
 	VpuBufferNode node;
@@ -998,6 +1074,10 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 	assert(output_code != NULL);
 	assert(decoder->drain_mode_enabled || (encoded_frame->data != NULL));
 
+	/* Mark framebuffers returned by other threads as displayed
+	 * before the VPU wrapper picks a framebuffer to decode into */
+	dec_process_returned_framebuffers(decoder);
+
 	node.pVirAddr = encoded_frame->data;
 	node.pPhyAddr = 0; /* encoded data is always read from a regular memory block, not a DMA buffer */
 	node.nSize = encoded_frame->data_size;
@@ -1009,7 +1089,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 	decoder->pending_entry.pts = encoded_frame->pts;
 	decoder->pending_entry.dts = encoded_frame->dts;
 
-	ret = VPU_DecDecodeBuf(decoder->handle, &node, &buf_ret_code);
+	ret = dec_decode_buf(decoder, &node, &buf_ret_code);
 	IMX_VPU_LOG("VPU_DecDecodeBuf buf ret code: 0x%x", buf_ret_code);
 
 	*output_code = dec_convert_outcode(buf_ret_code);
@@ -1083,7 +1163,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 		imx_vpu_dec_enable_drain_mode(decoder, TRUE);
 
 		/* Decode the frame */
-		ret = VPU_DecDecodeBuf(decoder->handle, &drain_node, &buf_ret_code);
+		ret = dec_decode_buf(decoder, &drain_node, &buf_ret_code);
 		*output_code = dec_convert_outcode(buf_ret_code);
 		IMX_VPU_LOG("VPU_DecDecodeBuf buf ret code: 0x%x", buf_ret_code);
 		if (ret != VPU_DEC_RET_SUCCESS)
@@ -1289,6 +1369,15 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 		*output_code |= IMX_VPU_DEC_OUTPUT_CODE_DROPPED;
 	}
 
+	/* A frame was decoded, so the keyframe search is done; switch
+	 * the VPU wrapper back to the regular skip mode */
+	if (decoder->keyframe_search_enabled && (buf_ret_code & (VPU_DEC_ONE_FRM_CONSUMED | VPU_DEC_OUTPUT_DIS)) && !(buf_ret_code & VPU_DEC_OUTPUT_DROPPED))
+	{
+		IMX_VPU_DEBUG("keyframe found; disabling keyframe search");
+		decoder->keyframe_search_enabled = FALSE;
+		dec_apply_skip_mode(decoder);
+	}
+
 	if (*output_code & IMX_VPU_DEC_OUTPUT_CODE_DECODED_FRAME_AVAILABLE)
 		decoder->output_info_available = TRUE;
 
@@ -1296,6 +1385,206 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 }
 
 
+ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, unsigned int *output_code)
+{
+	ImxVpuDecReturnCodes ret;
+
+	assert(decoder != NULL);
+	assert(encoded_frame != NULL);
+	assert(output_code != NULL);
+
+	*output_code = 0;
+	memset(&(decoder->cur_frame_stats), 0, sizeof(ImxVpuFrameStats));
+	decoder->cur_frame_stats.num_bytes = decoder->drain_mode_enabled ? 0 : encoded_frame->data_size;
+
+	decoder->cur_frame_begin_time = imx_vpu_get_monotonic_time();
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_STEP_BEGIN, decoder->cur_frame_stats.num_bytes, 0, 0);
+	ret = dec_decode_frame(decoder, encoded_frame, output_code);
+	decoder->cur_frame_stats.total_time = imx_vpu_get_monotonic_time() - decoder->cur_frame_begin_time;
+	decoder->cur_frame_stats.output_time = decoder->cur_frame_stats.total_time - decoder->cur_frame_stats.push_time - decoder->cur_frame_stats.wait_time;
+
+	imx_vpu_dec_add_step_stats(&(decoder->stats), &(decoder->cur_frame_stats), *output_code);
+
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_STEP_END, ret, *output_code, decoder->cur_frame_stats.num_bytes);
+
+	if (decoder->frame_stats_callback != NULL)
+		decoder->frame_stats_callback(decoder, ret, *output_code, &(decoder->cur_frame_stats), decoder->frame_stats_callback_user_data);
+
+	return ret;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_decode_start(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame)
+{
+	ImxVpuDecReturnCodes ret;
+
+	assert(decoder != NULL);
+
+	/* VPU_DecDecodeBuf() always blocks until the VPU is done, so the
+	 * frame is fully decoded here, and the output code is stored until
+	 * imx_vpu_dec_decode_finish() is called */
+
+	if (decoder->decoding_pending)
+	{
+		IMX_VPU_ERROR("cannot start decoding; previous decoding was not finished yet");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	ret = imx_vpu_dec_decode(decoder, encoded_frame, &(decoder->pending_output_code));
+	if (ret == IMX_VPU_DEC_RETURN_CODE_OK)
+		decoder->decoding_pending = TRUE;
+
+	return ret;
+}
+
+
+int imx_vpu_dec_decode_poll(ImxVpuDecoder *decoder, unsigned int timeout_ms)
+{
+	assert(decoder != NULL);
+	IMXVPUAPI_UNUSED_PARAM(timeout_ms);
+
+	/* Decoding is always complete after imx_vpu_dec_decode_start() */
+	return 1;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_decode_finish(ImxVpuDecoder *decoder, unsigned int *output_code)
+{
+	assert(decoder != NULL);
+	assert(output_code != NULL);
+
+	if (!(decoder->decoding_pending))
+	{
+		IMX_VPU_ERROR("cannot finish decoding; decoding was not started");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	decoder->decoding_pending = FALSE;
+	*output_code = decoder->pending_output_code;
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_decode_dma_buffer(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, ImxVpuDMABuffer *input_dma_buffer, size_t input_offset, unsigned int *output_code)
+{
+	ImxVpuDecReturnCodes ret;
+	ImxVpuEncodedFrame mapped_encoded_frame;
+	uint8_t *input_virtual_address;
+
+	assert(decoder != NULL);
+	assert(encoded_frame != NULL);
+	assert(input_dma_buffer != NULL);
+	assert(output_code != NULL);
+
+	/* The VPU wrapper always copies the encoded data into its own bitstream
+	 * buffer, so the input DMA buffer is only mapped and passed on as
+	 * regular memory block */
+
+	if (decoder->drain_mode_enabled)
+		return imx_vpu_dec_decode(decoder, encoded_frame, output_code);
+
+	if ((input_offset + encoded_frame->data_size) > imx_vpu_dma_buffer_get_size(input_dma_buffer))
+	{
+		IMX_VPU_ERROR("input offset %zu and data size %zu exceed the size of the input DMA buffer", input_offset, encoded_frame->data_size);
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	input_virtual_address = imx_vpu_dma_buffer_map(input_dma_buffer, IMX_VPU_MAPPING_FLAG_READ);
+	if (input_virtual_address == NULL)
+	{
+		IMX_VPU_ERROR("could not map input DMA buffer");
+		return IMX_VPU_DEC_RETURN_CODE_ERROR;
+	}
+
+	mapped_encoded_frame = *encoded_frame;
+	mapped_encoded_frame.data = input_virtual_address + input_offset;
+	ret = imx_vpu_dec_decode(decoder, &mapped_encoded_frame, output_code);
+
+	imx_vpu_dma_buffer_unmap(input_dma_buffer);
+
+	return ret;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_reserve_input_space(ImxVpuDecoder *decoder, size_t size, ImxVpuDecInputSpace *input_space)
+{
+	assert(decoder != NULL);
+	assert(input_space != NULL);
+
+	/* The VPU wrapper does not provide access to its bitstream buffer.
+	 * The reserved space is therefore a staging buffer, which is passed to
+	 * imx_vpu_dec_decode() when committing. */
+
+	if (decoder->drain_mode_enabled)
+	{
+		IMX_VPU_ERROR("cannot reserve input space in drain mode");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	if (decoder->input_space_reserved)
+	{
+		IMX_VPU_ERROR("input space is already reserved");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	if (decoder->staging_input_buffer_size < size)
+	{
+		if (decoder->staging_input_buffer != NULL)
+			IMX_VPU_FREE(decoder->staging_input_buffer, decoder->staging_input_buffer_size);
+
+		decoder->staging_input_buffer = IMX_VPU_ALLOC(size);
+		if (decoder->staging_input_buffer == NULL)
+		{
+			IMX_VPU_ERROR("allocating memory for staging input buffer failed");
+			decoder->staging_input_buffer_size = 0;
+			return IMX_VPU_DEC_RETURN_CODE_ERROR;
+		}
+
+		decoder->staging_input_buffer_size = size;
+	}
+
+	input_space->regions[0] = decoder->staging_input_buffer;
+	input_space->region_sizes[0] = size;
+	input_space->regions[1] = NULL;
+	input_space->region_sizes[1] = 0;
+
+	decoder->reserved_input_space_size = size;
+	decoder->input_space_reserved = TRUE;
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_commit_input_space(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, unsigned int *output_code)
+{
+	ImxVpuEncodedFrame staged_encoded_frame;
+
+	assert(decoder != NULL);
+	assert(encoded_frame != NULL);
+	assert(output_code != NULL);
+
+	if (!(decoder->input_space_reserved))
+	{
+		IMX_VPU_ERROR("no input space was reserved");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	if (encoded_frame->data_size > decoder->reserved_input_space_size)
+	{
+		IMX_VPU_ERROR("data size %zu is larger than the reserved input space size %zu", encoded_frame->data_size, decoder->reserved_input_space_size);
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	decoder->input_space_reserved = FALSE;
+
+	staged_encoded_frame = *encoded_frame;
+	staged_encoded_frame.data = decoder->staging_input_buffer;
+
+	return imx_vpu_dec_decode(decoder, &staged_encoded_frame, output_code);
+}
+
+
 ImxVpuDecReturnCodes imx_vpu_dec_get_decoded_frame(ImxVpuDecoder *decoder, ImxVpuRawFrame *decoded_frame)
 {
 	VpuDecRetCode ret;
@@ -1385,6 +1674,7 @@ void imx_vpu_dec_get_dropped_frame_info(ImxVpuDecoder *decoder, void **context,
 int imx_vpu_dec_check_if_can_decode(ImxVpuDecoder *decoder)
 {
 	assert(decoder != NULL);
+	dec_process_returned_framebuffers(decoder);
 	return decoder->num_available_framebuffers >= MIN_NUM_FREE_FB_REQUIRED;
 }
 
@@ -1411,6 +1701,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_mark_framebuffer_as_displayed(ImxVpuDecoder *de
 	}
 
 	IMX_VPU_LOG("marked framebuffer %p with DMA buffer %p as displayed", (void *)framebuffer, framebuffer->dma_buffer);
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_FRAMEBUFFER_DISPLAYED, framebuffer - decoder->framebuffers, 0, 0);
 
 	if (decoder->num_times_counter_decremented > 0)
 	{
@@ -1427,6 +1718,83 @@ ImxVpuDecReturnCodes imx_vpu_dec_mark_framebuffer_as_displayed(ImxVpuDecoder *de
 }
 
 
+ImxVpuDecReturnCodes imx_vpu_dec_return_framebuffer(ImxVpuDecoder *decoder, ImxVpuFramebuffer *framebuffer)
+{
+	int idx;
+
+	assert(decoder != NULL);
+	assert(framebuffer != NULL);
+
+	/* framebuffer->internal points to the VPU wrapper's framebuffer
+	 * structure, so the index is derived from the array position */
+	idx = framebuffer - decoder->framebuffers;
+	assert((idx >= 0) && (idx < (int)(decoder->num_framebuffers)));
+
+	if (!imx_vpu_index_return_queue_push(&(decoder->returned_framebuffers), idx))
+	{
+		IMX_VPU_ERROR("framebuffer with index #%d has already been returned", idx);
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+void imx_vpu_dec_get_stats(ImxVpuDecoder *decoder, ImxVpuDecStats *stats)
+{
+	assert(decoder != NULL);
+	assert(stats != NULL);
+
+	/* The VPU wrapper does not expose its bitstream buffer fill level */
+	*stats = decoder->stats;
+	stats->bitstream_buffer_fill_level = 0;
+	stats->bitstream_buffer_size = imx_vpu_dma_buffer_get_size(decoder->bitstream_buffer);
+	stats->num_framebuffers = decoder->num_framebuffers;
+	stats->num_used_framebuffers = decoder->num_framebuffers_in_use;
+}
+
+
+void imx_vpu_dec_reset_stats(ImxVpuDecoder *decoder)
+{
+	assert(decoder != NULL);
+
+	imx_vpu_dec_clear_stats(&(decoder->stats));
+}
+
+
+void imx_vpu_dec_set_frame_stats_callback(ImxVpuDecoder *decoder, ImxVpuDecFrameStatsCallback callback, void *user_data)
+{
+	assert(decoder != NULL);
+
+	decoder->frame_stats_callback = callback;
+	decoder->frame_stats_callback_user_data = user_data;
+}
+
+
+unsigned int imx_vpu_dec_get_trace_events(ImxVpuDecoder *decoder, ImxVpuTraceEvent *events, unsigned int max_events)
+{
+	assert(decoder != NULL);
+	assert(events != NULL);
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	return imx_vpu_trace_ring_get_events(&(decoder->trace_ring), events, max_events);
+#else
+	IMXVPUAPI_UNUSED_PARAM(max_events);
+	return 0;
+#endif
+}
+
+
+void imx_vpu_dec_clear_trace_events(ImxVpuDecoder *decoder)
+{
+	assert(decoder != NULL);
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	imx_vpu_trace_ring_clear(&(decoder->trace_ring));
+#endif
+}
+
+
 
 
 /************************************************/
@@ -1452,6 +1820,30 @@ struct _ImxVpuEncoder
 
 	unsigned int num_framebuffers;
 	ImxVpuFramebuffer *framebuffers;
+
+	/* Copies of the open params and the initial info, for
+	 * imx_vpu_enc_save_state() */
+	ImxVpuEncOpenParams open_params;
+	ImxVpuEncInitialInfo initial_info;
+	BOOL initial_info_available;
+
+	/* Used by imx_vpu_enc_encode_start() and imx_vpu_enc_encode_finish() */
+	BOOL encoding_pending;
+	ImxVpuRawFrame pending_raw_frame;
+	ImxVpuEncParams pending_encoding_params;
+
+	/* Statistics; the same as in the decoder */
+	ImxVpuEncStats stats;
+	ImxVpuFrameStats cur_frame_stats;
+	uint64_t cur_frame_begin_time;
+	ImxVpuEncFrameStatsCallback frame_stats_callback;
+	void *frame_stats_callback_user_data;
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	ImxVpuTraceRing trace_ring;
+#endif
+
+	ImxVpuEncRateAdapter rate_adapter;
 };
 
 
@@ -1474,6 +1866,18 @@ static ImxVpuEncReturnCodes enc_convert_retcode(VpuEncRetCode code)
 }
 
 
+static VpuEncMirrorDirection convert_to_wrapper_mirror_direction(ImxVpuMirrorDirection mirror)
+{
+	switch (mirror)
+	{
+		case IMX_VPU_MIRROR_VERTICAL:   return VPU_ENC_MIRDIR_VER;
+		case IMX_VPU_MIRROR_HORIZONTAL: return VPU_ENC_MIRDIR_HOR;
+		case IMX_VPU_MIRROR_BOTH:       return VPU_ENC_MIRDIR_HOR_VER;
+		default: return VPU_ENC_MIRDIR_NONE;
+	}
+}
+
+
 static int enc_convert_to_wrapper_open_param(ImxVpuEncOpenParams *open_params, VpuEncOpenParam *wrapper_open_param)
 {
 	memset(wrapper_open_param, 0, sizeof(VpuEncOpenParam));
@@ -1481,12 +1885,12 @@ static int enc_convert_to_wrapper_open_param(ImxVpuEncOpenParams *open_params, V
 	wrapper_open_param->eFormat = convert_to_wrapper_codec_std(open_params->codec_format);
 	wrapper_open_param->nPicWidth = open_params->frame_width;
 	wrapper_open_param->nPicHeight = open_params->frame_height;
-	wrapper_open_param->nRotAngle = 0;
+	wrapper_open_param->nRotAngle = (int)(open_params->rotation);
 	wrapper_open_param->nFrameRate = (open_params->frame_rate_numerator & 0xffffUL) | (((open_params->frame_rate_denominator - 1) & 0xffffUL) << 16);
 	wrapper_open_param->nBitRate = open_params->bitrate;
 	wrapper_open_param->nGOPSize = open_params->gop_size;
 	wrapper_open_param->nChromaInterleave = open_params->chroma_interleave;
-	wrapper_open_param->sMirror = VPU_ENC_MIRDIR_NONE;
+	wrapper_open_param->sMirror = convert_to_wrapper_mirror_direction(open_params->mirror);
 	wrapper_open_param->nMapType = 0;
 	wrapper_open_param->nLinear2TiledEnable = 1;
 	wrapper_open_param->eColorFormat = convert_to_wrapper_color_format(open_params->color_format);
@@ -1580,24 +1984,6 @@ static void enc_convert_from_wrapper_initial_info(VpuEncInitInfo *wrapper_info,
 }
 
 
-char const * imx_vpu_enc_error_string(ImxVpuEncReturnCodes code)
-{
-	switch (code)
-	{
-		case IMX_VPU_ENC_RETURN_CODE_OK:                        return "ok";
-		case IMX_VPU_ENC_RETURN_CODE_ERROR:                     return "unspecified error";
-		case IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS:            return "invalid params";
-		case IMX_VPU_ENC_RETURN_CODE_INVALID_HANDLE:            return "invalid handle";
-		case IMX_VPU_ENC_RETURN_CODE_INVALID_FRAMEBUFFER:       return "invalid framebuffer";
-		case IMX_VPU_ENC_RETURN_CODE_INSUFFICIENT_FRAMEBUFFERS: return "insufficient_framebuffers";
-		case IMX_VPU_ENC_RETURN_CODE_INVALID_STRIDE:            return "invalid stride";
-		case IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE:       return "wrong call sequence";
-		case IMX_VPU_ENC_RETURN_CODE_TIMEOUT:                   return "timeout";
-		default: return "<unknown>";
-	}
-}
-
-
 static unsigned long vpu_enc_load_inst_counter = 0;
 static DefaultDMABufferAllocator default_enc_dma_buffer_allocator =
 {
@@ -1699,6 +2085,27 @@ void imx_vpu_enc_get_bitstream_buffer_info(size_t *size, unsigned int *alignment
 }
 
 
+void imx_vpu_enc_get_bitstream_buffer_info_with_hints(ImxVpuBitstreamBufferHints const *hints, size_t *size, unsigned int *alignment)
+{
+	/* The VPU wrapper determines the size of its bitstream
+	 * buffer on its own, so the hints cannot be used here */
+	IMXVPUAPI_UNUSED_PARAM(hints);
+	imx_vpu_enc_get_bitstream_buffer_info(size, alignment);
+}
+
+
+ImxVpuEncReturnCodes imx_vpu_enc_preload_mjpeg_tables(unsigned int quality_factor, ImxVpuColorFormat color_format, unsigned int frame_width, unsigned int frame_height)
+{
+	/* The VPU wrapper generates its MJPEG tables internally,
+	 * so there is nothing to preload */
+	IMXVPUAPI_UNUSED_PARAM(quality_factor);
+	IMXVPUAPI_UNUSED_PARAM(color_format);
+	IMXVPUAPI_UNUSED_PARAM(frame_width);
+	IMXVPUAPI_UNUSED_PARAM(frame_height);
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
+
+
 void imx_vpu_enc_set_default_open_params(ImxVpuCodecFormat codec_format, ImxVpuEncOpenParams *open_params)
 {
 	assert(open_params != NULL);
@@ -1727,6 +2134,9 @@ void imx_vpu_enc_set_default_open_params(ImxVpuCodecFormat codec_format, ImxVpuE
 	open_params->use_me_zero_pmv = 0;
 	open_params->additional_intra_cost_weight = 0;
 	open_params->chroma_interleave = 0;
+	open_params->rotation = IMX_VPU_ROTATION_NONE;
+	open_params->mirror = IMX_VPU_MIRROR_NONE;
+	open_params->enable_slice_output = 0;
 
 	switch (codec_format)
 	{
@@ -1786,6 +2196,10 @@ ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenPara
 	}
 
 	memset(*encoder, 0, sizeof(ImxVpuEncoder));
+	(*encoder)->open_params = *open_params;
+
+	if (open_params->enable_slice_output)
+		IMX_VPU_WARNING("slice output is not supported by this backend; encoded frames are output once they are complete");
 
 	(*encoder)->temp_enc_data_buffer = IMX_VPU_ALLOC(bitstream_buffer_size);
 	if ((*encoder)->temp_enc_data_buffer == NULL)
@@ -1934,6 +2348,8 @@ ImxVpuEncReturnCodes imx_vpu_enc_flush(ImxVpuEncoder *encoder)
 {
 	IMXVPUAPI_UNUSED_PARAM(encoder);
 
+	IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_FLUSH, 0, 0, 0);
+
 	/* The VPU wrapper does not have any VPU encoder flushing functions */
 	return IMX_VPU_ENC_RETURN_CODE_OK;
 }
@@ -2010,10 +2426,37 @@ ImxVpuEncReturnCodes imx_vpu_enc_get_initial_info(ImxVpuEncoder *encoder, ImxVpu
 	ret = VPU_EncGetInitialInfo(encoder->handle, &init_info);
 	IMX_VPU_LOG("VPU_EncGetInitialInfo: min num framebuffers required: %d", init_info.nMinFrameBufferCount);
 	enc_convert_from_wrapper_initial_info(&init_info, info);
+
+	if (ret == VPU_ENC_RET_SUCCESS)
+	{
+		encoder->initial_info = *info;
+		encoder->initial_info_available = TRUE;
+	}
+
 	return enc_convert_retcode(ret);
 }
 
 
+int imx_vpu_enc_get_state_params(ImxVpuEncoder *encoder, ImxVpuEncOpenParams *open_params, ImxVpuEncInitialInfo *initial_info)
+{
+	if (!(encoder->initial_info_available))
+		return 0;
+
+	*open_params = encoder->open_params;
+	*initial_info = encoder->initial_info;
+
+	return 1;
+}
+
+
+void imx_vpu_enc_set_headers_restored(ImxVpuEncoder *encoder)
+{
+	/* The VPU wrapper produces the headers in-band,
+	 * so there is nothing to restore */
+	IMXVPUAPI_UNUSED_PARAM(encoder);
+}
+
+
 void imx_vpu_enc_query_header_data(ImxVpuEncoder *encoder, ImxVpuEncHeaderDataTypes header_data_type, uint8_t const **header_data, size_t *header_data_size)
 {
 	assert(header_data != NULL);
@@ -2079,9 +2522,34 @@ void imx_vpu_enc_configure_intra_qp(ImxVpuEncoder *encoder, int intra_qp)
 }
 
 
-ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame const *raw_frame, ImxVpuEncodedFrame *encoded_frame, ImxVpuEncParams *encoding_params,  unsigned int *output_code)
+ImxVpuEncReturnCodes imx_vpu_enc_enable_rate_adaptation(ImxVpuEncoder *encoder, ImxVpuEncRateAdaptationParams const *params)
+{
+	assert(encoder != NULL);
+
+	if (encoder->encoding_pending)
+	{
+		IMX_VPU_ERROR("cannot change rate adaptation while an encoding is in progress");
+		return IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	if (!imx_vpu_enc_rate_adapter_init(&(encoder->rate_adapter), params, &(encoder->open_params)))
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
+
+
+void imx_vpu_enc_get_rate_adaptation_state(ImxVpuEncoder *encoder, ImxVpuEncRateAdaptationState *state)
+{
+	assert(encoder != NULL);
+	imx_vpu_enc_rate_adapter_get_state(&(encoder->rate_adapter), state);
+}
+
+
+static ImxVpuEncReturnCodes enc_encode_frame(ImxVpuEncoder *encoder, ImxVpuRawFrame const *raw_frame, ImxVpuEncodedFrame *encoded_frame, ImxVpuEncParams *encoding_params,  unsigned int *output_code)
 {
 	VpuEncRetCode ret;
+	uint64_t wait_begin_time;
 	VpuEncEncParam enc_enc_param;
 	VpuFrameBuffer in_framebuffer;
 	imx_vpu_phys_addr_t raw_frame_phys_addr;
@@ -2152,7 +2620,19 @@ ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame c
 		enc_enc_param.nInVirtOutput = (unsigned int)write_ptr;
 		enc_enc_param.nInOutputBufLen = encoder->bitstream_buffer_size - num_written_bytes;
 
+		wait_begin_time = imx_vpu_get_monotonic_time();
+		if (encoder->cur_frame_stats.push_time == 0)
+			encoder->cur_frame_stats.push_time = wait_begin_time - encoder->cur_frame_begin_time;
+
+		IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_VPU_START, 0, 0, 0);
 		ret = VPU_EncEncodeFrame(encoder->handle, &enc_enc_param);
+		encoder->cur_frame_stats.wait_time += imx_vpu_get_monotonic_time() - wait_begin_time;
+		if (ret == VPU_ENC_RET_FAILURE_TIMEOUT)
+		{
+			encoder->cur_frame_stats.num_wait_timeouts++;
+			IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_WAIT_TIMEOUT, encoder->cur_frame_stats.num_wait_timeouts, 0, 0);
+		}
+
 		IMX_VPU_LOG("VPU_EncEncodeFrame out ret code: 0x%x size: %d", enc_enc_param.eOutRetCode, enc_enc_param.nOutOutputSize);
 
 		if (ret != VPU_ENC_RET_SUCCESS)
@@ -2177,8 +2657,46 @@ ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame c
 		}
 	}
 
-	/* Acquire an output buffer and Transfer the encoded data to it */
+	/* Since the encoder does not perform any kind of delay
+	 * or reordering, this is appropriate, because in that
+	 * case, one input frame always immediately leads to
+	 * one output frame */
+	encoded_frame->context = raw_frame->context;
+	encoded_frame->pts = raw_frame->pts;
+	encoded_frame->dts = raw_frame->dts;
 	encoded_frame->data_size = encoded_data_size;
+
+	/* In scatter/gather mode, pass the temporary buffer directly; the
+	 * VPU wrapper already wrote all of the output data into it */
+	if (encoding_params->write_output_segments != NULL)
+	{
+		ImxVpuEncOutputSegment segment;
+		segment.data = encoder->temp_enc_data_buffer;
+		segment.size = encoded_data_size;
+
+		if (encoding_params->write_output_segments(encoding_params->output_buffer_context, &segment, 1, encoded_frame) == 0)
+		{
+			IMX_VPU_ERROR("could not output encoded data with %zu byte: write callback reported failure", encoded_data_size);
+			return IMX_VPU_ENC_RETURN_CODE_WRITE_CALLBACK_FAILED;
+		}
+
+		return IMX_VPU_ENC_RETURN_CODE_OK;
+	}
+
+	/* In write-callback mode, pass the temporary buffer directly as well,
+	 * instead of copying the data into an acquired buffer */
+	if (encoding_params->write_output_data != NULL)
+	{
+		if (encoding_params->write_output_data(encoding_params->output_buffer_context, encoder->temp_enc_data_buffer, encoded_data_size, encoded_frame) == 0)
+		{
+			IMX_VPU_ERROR("could not output encoded data with %zu byte: write callback reported failure", encoded_data_size);
+			return IMX_VPU_ENC_RETURN_CODE_WRITE_CALLBACK_FAILED;
+		}
+
+		return IMX_VPU_ENC_RETURN_CODE_OK;
+	}
+
+	/* Acquire an output buffer and Transfer the encoded data to it */
 	output_buffer_ptr = encoding_params->acquire_output_buffer(encoding_params->output_buffer_context, encoded_data_size, &(encoded_frame->acquired_handle));
 	if (output_buffer_ptr == NULL)
 	{
@@ -2188,11 +2706,150 @@ ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame c
 	memcpy(output_buffer_ptr, encoder->temp_enc_data_buffer, encoded_data_size);
 	encoding_params->finish_output_buffer(encoding_params->output_buffer_context, encoded_frame->acquired_handle);
 
-	/* Since the encoder does not perform any kind of delay
-	 * or reordering, this is appropriate, because in that
-	 * case, one input frame always immediately leads to
-	 * one output frame */
-	encoded_frame->context = raw_frame->context;
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
 
-	return IMX_VPU_DEC_RETURN_CODE_OK;
+
+ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame const *raw_frame, ImxVpuEncodedFrame *encoded_frame, ImxVpuEncParams *encoding_params,  unsigned int *output_code)
+{
+	ImxVpuEncReturnCodes ret;
+	ImxVpuEncParams adapted_encoding_params;
+	unsigned int new_bitrate;
+
+	assert(encoder != NULL);
+	assert(encoded_frame != NULL);
+	assert(encoding_params != NULL);
+	assert(output_code != NULL);
+
+	*output_code = 0;
+	memset(&(encoder->cur_frame_stats), 0, sizeof(ImxVpuFrameStats));
+
+	encoder->cur_frame_begin_time = imx_vpu_get_monotonic_time();
+	IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_STEP_BEGIN, raw_frame->pts, 0, 0);
+
+	/* Rate adaptation may modify the encoding parameters, so use a copy */
+	adapted_encoding_params = *encoding_params;
+	new_bitrate = imx_vpu_enc_rate_adapter_begin_frame(&(encoder->rate_adapter), encoder, &adapted_encoding_params);
+	if (new_bitrate != 0)
+		imx_vpu_enc_configure_bitrate(encoder, new_bitrate);
+
+	ret = enc_encode_frame(encoder, raw_frame, encoded_frame, &adapted_encoding_params, output_code);
+	encoder->cur_frame_stats.total_time = imx_vpu_get_monotonic_time() - encoder->cur_frame_begin_time;
+	encoder->cur_frame_stats.output_time = encoder->cur_frame_stats.total_time - encoder->cur_frame_stats.push_time - encoder->cur_frame_stats.wait_time;
+
+	/* The VPU wrapper does not report the types of encoded frames */
+	imx_vpu_enc_rate_adapter_end_frame(&(encoder->rate_adapter), (*output_code & IMX_VPU_ENC_OUTPUT_CODE_ENCODED_FRAME_AVAILABLE) ? encoded_frame->data_size : 0, IMX_VPU_FRAME_TYPE_UNKNOWN);
+
+	if (*output_code & IMX_VPU_ENC_OUTPUT_CODE_ENCODED_FRAME_AVAILABLE)
+		encoder->cur_frame_stats.num_bytes = encoded_frame->data_size;
+
+	imx_vpu_enc_add_step_stats(&(encoder->stats), &(encoder->cur_frame_stats), *output_code);
+
+	IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_STEP_END, ret, *output_code, encoder->cur_frame_stats.num_bytes);
+
+	if (encoder->frame_stats_callback != NULL)
+		encoder->frame_stats_callback(encoder, ret, *output_code, &(encoder->cur_frame_stats), encoder->frame_stats_callback_user_data);
+
+	return ret;
+}
+
+
+ImxVpuEncReturnCodes imx_vpu_enc_encode_start(ImxVpuEncoder *encoder, ImxVpuRawFrame const *raw_frame, ImxVpuEncParams *encoding_params)
+{
+	assert(encoder != NULL);
+	assert(raw_frame != NULL);
+	assert(encoding_params != NULL);
+
+	/* VPU_EncEncodeFrame() always blocks until the VPU is done, and
+	 * needs the encoded_frame immediately, so the actual encoding
+	 * is done in imx_vpu_enc_encode_finish() */
+
+	if (encoder->encoding_pending)
+	{
+		IMX_VPU_ERROR("cannot start encoding; previous encoding was not finished yet");
+		return IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	encoder->pending_raw_frame = *raw_frame;
+	encoder->pending_encoding_params = *encoding_params;
+	encoder->encoding_pending = TRUE;
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
+
+
+int imx_vpu_enc_encode_poll(ImxVpuEncoder *encoder, unsigned int timeout_ms)
+{
+	assert(encoder != NULL);
+	IMXVPUAPI_UNUSED_PARAM(timeout_ms);
+
+	return 1;
+}
+
+
+ImxVpuEncReturnCodes imx_vpu_enc_encode_finish(ImxVpuEncoder *encoder, ImxVpuEncodedFrame *encoded_frame, unsigned int *output_code)
+{
+	assert(encoder != NULL);
+
+	if (!(encoder->encoding_pending))
+	{
+		IMX_VPU_ERROR("cannot finish encoding; encoding was not started");
+		return IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	encoder->encoding_pending = FALSE;
+
+	return imx_vpu_enc_encode(encoder, &(encoder->pending_raw_frame), encoded_frame, &(encoder->pending_encoding_params), output_code);
+}
+
+
+void imx_vpu_enc_get_stats(ImxVpuEncoder *encoder, ImxVpuEncStats *stats)
+{
+	assert(encoder != NULL);
+	assert(stats != NULL);
+
+	*stats = encoder->stats;
+	stats->bitstream_buffer_size = encoder->bitstream_buffer_size;
+	stats->num_framebuffers = encoder->num_framebuffers;
+}
+
+
+void imx_vpu_enc_reset_stats(ImxVpuEncoder *encoder)
+{
+	assert(encoder != NULL);
+
+	imx_vpu_enc_clear_stats(&(encoder->stats));
+}
+
+
+void imx_vpu_enc_set_frame_stats_callback(ImxVpuEncoder *encoder, ImxVpuEncFrameStatsCallback callback, void *user_data)
+{
+	assert(encoder != NULL);
+
+	encoder->frame_stats_callback = callback;
+	encoder->frame_stats_callback_user_data = user_data;
+}
+
+
+unsigned int imx_vpu_enc_get_trace_events(ImxVpuEncoder *encoder, ImxVpuTraceEvent *events, unsigned int max_events)
+{
+	assert(encoder != NULL);
+	assert(events != NULL);
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	return imx_vpu_trace_ring_get_events(&(encoder->trace_ring), events, max_events);
+#else
+	IMXVPUAPI_UNUSED_PARAM(max_events);
+	return 0;
+#endif
+}
+
+
+void imx_vpu_enc_clear_trace_events(ImxVpuEncoder *encoder)
+{
+	assert(encoder != NULL);
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	imx_vpu_trace_ring_clear(&(encoder->trace_ring));
+#endif
 }
@@ -19,8 +19,10 @@
 
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include "imxvpuapi_jpeg.h"
+#include "imxvpuapi_parse_jpeg.h"
 #include "imxvpuapi_priv.h"
 
 
@@ -62,12 +64,18 @@ struct _ImxVpuJPEGDecoder
 	unsigned int num_framebuffers, num_extra_framebuffers;
 	ImxVpuFramebufferSizes calculated_sizes;
 
+	/* Size and alignment the framebuffer DMA buffers were allocated with.
+	 * If a new frame size still fits, the DMA buffers are reused. */
+	size_t fb_dmabuffer_size;
+	unsigned int fb_dmabuffer_alignment;
+
 	ImxVpuRawFrame raw_frame;
 };
 
 
 static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *new_initial_info, unsigned int output_code, void *user_data);
 static void imx_vpu_jpeg_dec_deallocate_framebuffers(ImxVpuJPEGDecoder *jpeg_decoder);
+static void imx_vpu_jpeg_dec_fill_info(ImxVpuJPEGDecoder *jpeg_decoder, ImxVpuFramebuffer *framebuffer, ImxVpuJPEGDecInfo *info);
 
 
 static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *new_initial_info, unsigned int output_code, void *user_data)
@@ -76,11 +84,12 @@ static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *n
 	ImxVpuDecReturnCodes ret;
 	ImxVpuJPEGDecoder *jpeg_decoder = (ImxVpuJPEGDecoder *)user_data;
 
+	unsigned int num_framebuffers;
+	int reuse_framebuffers;
+
 	IMXVPUAPI_UNUSED_PARAM(decoder);
 	IMXVPUAPI_UNUSED_PARAM(output_code);
 
-	imx_vpu_jpeg_dec_deallocate_framebuffers(jpeg_decoder);
-
 	jpeg_decoder->initial_info = *new_initial_info;
 	IMX_VPU_DEBUG(
 		"initial info:  size: %ux%u pixel  rate: %u/%u  min num required framebuffers: %u  interlacing: %d  framebuffer alignment: %u  color format: %s",
@@ -94,7 +103,7 @@ static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *n
 		imx_vpu_color_format_string(new_initial_info->color_format)
 	);
 
-	jpeg_decoder->num_framebuffers = new_initial_info->min_num_required_framebuffers + jpeg_decoder->num_extra_framebuffers;
+	num_framebuffers = new_initial_info->min_num_required_framebuffers + jpeg_decoder->num_extra_framebuffers;
 
 	imx_vpu_calc_framebuffer_sizes(new_initial_info->color_format, new_initial_info->frame_width, new_initial_info->frame_height, new_initial_info->framebuffer_alignment, new_initial_info->interlacing, 0, &(jpeg_decoder->calculated_sizes));
 	IMX_VPU_DEBUG(
@@ -105,22 +114,46 @@ static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *n
 		jpeg_decoder->calculated_sizes.total_size
 	);
 
-	jpeg_decoder->framebuffers = IMX_VPU_ALLOC(sizeof(ImxVpuFramebuffer) * jpeg_decoder->num_framebuffers);
-	jpeg_decoder->fb_dmabuffers = IMX_VPU_ALLOC(sizeof(ImxVpuDMABuffer *) * jpeg_decoder->num_framebuffers);
+	/* If the existing DMA buffers are large enough for the new frame size,
+	 * reuse them instead of reallocating. This is for example the case if a
+	 * smaller JPEG follows a larger one. */
+	reuse_framebuffers = (jpeg_decoder->fb_dmabuffers != NULL)
+	                  && (jpeg_decoder->num_framebuffers == num_framebuffers)
+	                  && (jpeg_decoder->fb_dmabuffer_size >= jpeg_decoder->calculated_sizes.total_size)
+	                  && ((new_initial_info->framebuffer_alignment <= 1) || ((jpeg_decoder->fb_dmabuffer_alignment % new_initial_info->framebuffer_alignment) == 0));
 
-	memset(jpeg_decoder->framebuffers, 0, sizeof(ImxVpuFramebuffer) * jpeg_decoder->num_framebuffers);
-	memset(jpeg_decoder->fb_dmabuffers, 0, sizeof(ImxVpuDMABuffer *) * jpeg_decoder->num_framebuffers);
+	if (reuse_framebuffers)
+	{
+		IMX_VPU_DEBUG("reusing %u framebuffers with %zu byte each", num_framebuffers, jpeg_decoder->fb_dmabuffer_size);
 
-	for (i = 0; i < jpeg_decoder->num_framebuffers; ++i)
+		for (i = 0; i < jpeg_decoder->num_framebuffers; ++i)
+			imx_vpu_fill_framebuffer_params(&(jpeg_decoder->framebuffers[i]), &(jpeg_decoder->calculated_sizes), jpeg_decoder->fb_dmabuffers[i], 0);
+	}
+	else
 	{
-		jpeg_decoder->fb_dmabuffers[i] = imx_vpu_dma_buffer_allocate(jpeg_decoder->dma_buffer_allocator, jpeg_decoder->calculated_sizes.total_size, jpeg_decoder->initial_info.framebuffer_alignment, 0);
-		if (jpeg_decoder->fb_dmabuffers[i] == NULL)
+		imx_vpu_jpeg_dec_deallocate_framebuffers(jpeg_decoder);
+
+		jpeg_decoder->num_framebuffers = num_framebuffers;
+		jpeg_decoder->fb_dmabuffer_size = jpeg_decoder->calculated_sizes.total_size;
+		jpeg_decoder->fb_dmabuffer_alignment = new_initial_info->framebuffer_alignment;
+
+		jpeg_decoder->framebuffers = IMX_VPU_ALLOC(sizeof(ImxVpuFramebuffer) * jpeg_decoder->num_framebuffers);
+		jpeg_decoder->fb_dmabuffers = IMX_VPU_ALLOC(sizeof(ImxVpuDMABuffer *) * jpeg_decoder->num_framebuffers);
+
+		memset(jpeg_decoder->framebuffers, 0, sizeof(ImxVpuFramebuffer) * jpeg_decoder->num_framebuffers);
+		memset(jpeg_decoder->fb_dmabuffers, 0, sizeof(ImxVpuDMABuffer *) * jpeg_decoder->num_framebuffers);
+
+		for (i = 0; i < jpeg_decoder->num_framebuffers; ++i)
 		{
-			IMX_VPU_ERROR("could not allocate DMA buffer for framebuffer #%u", i);
-			goto error;
+			jpeg_decoder->fb_dmabuffers[i] = imx_vpu_dma_buffer_allocate(jpeg_decoder->dma_buffer_allocator, jpeg_decoder->fb_dmabuffer_size, jpeg_decoder->fb_dmabuffer_alignment, 0);
+			if (jpeg_decoder->fb_dmabuffers[i] == NULL)
+			{
+				IMX_VPU_ERROR("could not allocate DMA buffer for framebuffer #%u", i);
+				goto error;
+			}
+
+			imx_vpu_fill_framebuffer_params(&(jpeg_decoder->framebuffers[i]), &(jpeg_decoder->calculated_sizes), jpeg_decoder->fb_dmabuffers[i], 0);
 		}
-
-		imx_vpu_fill_framebuffer_params(&(jpeg_decoder->framebuffers[i]), &(jpeg_decoder->calculated_sizes), jpeg_decoder->fb_dmabuffers[i], 0);
 	}
 
 	if ((ret = imx_vpu_dec_register_framebuffers(jpeg_decoder->decoder, jpeg_decoder->framebuffers, jpeg_decoder->num_framebuffers)) != IMX_VPU_DEC_RETURN_CODE_OK)
@@ -132,12 +165,18 @@ static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *n
 	return 1;
 
 error:
-	imx_vpu_jpeg_deallocate_dma_buffers(jpeg_decoder->fb_dmabuffers, jpeg_decoder->num_framebuffers);
+	imx_vpu_jpeg_dec_deallocate_framebuffers(jpeg_decoder);
 	return 0;
 }
 
 
 ImxVpuDecReturnCodes imx_vpu_jpeg_dec_open(ImxVpuJPEGDecoder **jpeg_decoder, ImxVpuDMABufferAllocator *dma_buffer_allocator, unsigned int num_extra_framebuffers)
+{
+	return imx_vpu_jpeg_dec_open_rotated(jpeg_decoder, dma_buffer_allocator, num_extra_framebuffers, IMX_VPU_ROTATION_NONE, IMX_VPU_MIRROR_NONE);
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_jpeg_dec_open_rotated(ImxVpuJPEGDecoder **jpeg_decoder, ImxVpuDMABufferAllocator *dma_buffer_allocator, unsigned int num_extra_framebuffers, ImxVpuRotation rotation, ImxVpuMirrorDirection mirror)
 {
 	ImxVpuDecOpenParams open_params;
 	ImxVpuDecReturnCodes ret = IMX_VPU_DEC_RETURN_CODE_OK;
@@ -164,6 +203,8 @@ ImxVpuDecReturnCodes imx_vpu_jpeg_dec_open(ImxVpuJPEGDecoder **jpeg_decoder, Imx
 	open_params.codec_format = IMX_VPU_CODEC_FORMAT_MJPEG;
 	open_params.frame_width = 0;
 	open_params.frame_height = 0;
+	open_params.rotation = rotation;
+	open_params.mirror = mirror;
 
 	imx_vpu_dec_get_bitstream_buffer_info(&(jpegdec->bitstream_buffer_size), &(jpegdec->bitstream_buffer_alignment));
 	jpegdec->bitstream_buffer = imx_vpu_dma_buffer_allocate(jpegdec->dma_buffer_allocator, jpegdec->bitstream_buffer_size, jpegdec->bitstream_buffer_alignment, 0);
@@ -275,6 +316,12 @@ void imx_vpu_jpeg_dec_get_info(ImxVpuJPEGDecoder *jpeg_decoder, ImxVpuJPEGDecInf
 	assert(jpeg_decoder->framebuffers != NULL);
 	assert(info != NULL);
 
+	imx_vpu_jpeg_dec_fill_info(jpeg_decoder, jpeg_decoder->raw_frame.framebuffer, info);
+}
+
+
+static void imx_vpu_jpeg_dec_fill_info(ImxVpuJPEGDecoder *jpeg_decoder, ImxVpuFramebuffer *framebuffer, ImxVpuJPEGDecInfo *info)
+{
 	info->aligned_frame_width = jpeg_decoder->calculated_sizes.aligned_frame_width;
 	info->aligned_frame_height = jpeg_decoder->calculated_sizes.aligned_frame_height;
 
@@ -291,7 +338,7 @@ void imx_vpu_jpeg_dec_get_info(ImxVpuJPEGDecoder *jpeg_decoder, ImxVpuJPEGDecInf
 	info->cb_offset = jpeg_decoder->framebuffers[0].cb_offset;
 	info->cr_offset = jpeg_decoder->framebuffers[0].cr_offset;
 
-	info->framebuffer = jpeg_decoder->raw_frame.framebuffer;
+	info->framebuffer = framebuffer;
 
 	info->color_format = jpeg_decoder->initial_info.color_format;
 }
@@ -307,6 +354,177 @@ ImxVpuDecReturnCodes imx_vpu_jpeg_dec_frame_finished(ImxVpuJPEGDecoder *jpeg_dec
 }
 
 
+typedef struct
+{
+	unsigned int index;
+	int valid;
+	unsigned int width, height;
+	ImxVpuColorFormat color_format;
+}
+ImxVpuJPEGDecBatchEntry;
+
+
+static int imx_vpu_jpeg_dec_compare_batch_entries(void const *first, void const *second)
+{
+	ImxVpuJPEGDecBatchEntry const *a = (ImxVpuJPEGDecBatchEntry const *)first;
+	ImxVpuJPEGDecBatchEntry const *b = (ImxVpuJPEGDecBatchEntry const *)second;
+	unsigned long area_a = (unsigned long)(a->width) * a->height;
+	unsigned long area_b = (unsigned long)(b->width) * b->height;
+
+	/* Invalid entries go first, since they are only reported as errors.
+	 * Valid entries are sorted by descending area, then grouped by width,
+	 * height, and color format. The index is the final criterion, to keep
+	 * images with identical parameters in their original order. */
+	if (a->valid != b->valid)
+		return a->valid ? 1 : -1;
+	if (area_a != area_b)
+		return (area_a > area_b) ? -1 : 1;
+	if (a->width != b->width)
+		return (a->width > b->width) ? -1 : 1;
+	if (a->height != b->height)
+		return (a->height > b->height) ? -1 : 1;
+	if (a->color_format != b->color_format)
+		return ((int)(a->color_format) < (int)(b->color_format)) ? -1 : 1;
+	return (a->index < b->index) ? -1 : ((a->index > b->index) ? 1 : 0);
+}
+
+
+static void imx_vpu_jpeg_dec_deliver_batch_frame(ImxVpuJPEGDecoder *jpeg_decoder, unsigned int index, ImxVpuFramebuffer *framebuffer, ImxVpuJPEGDecBatchCallback callback, void *user_data)
+{
+	ImxVpuJPEGDecInfo info;
+
+	imx_vpu_jpeg_dec_fill_info(jpeg_decoder, framebuffer, &info);
+	callback(jpeg_decoder, index, IMX_VPU_DEC_RETURN_CODE_OK, &info, user_data);
+	imx_vpu_dec_mark_framebuffer_as_displayed(jpeg_decoder->decoder, framebuffer);
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_jpeg_dec_decode_batch(ImxVpuJPEGDecoder *jpeg_decoder, ImxVpuJPEGDecBatchItem const *items, unsigned int num_items, ImxVpuJPEGDecBatchCallback callback, void *user_data)
+{
+	unsigned int i;
+	ImxVpuJPEGDecBatchEntry *entries;
+	/* The frame that was decoded, but not delivered to the callback yet */
+	ImxVpuJPEGDecBatchEntry const *pending_entry = NULL;
+	ImxVpuFramebuffer *pending_framebuffer = NULL;
+
+	assert(jpeg_decoder != NULL);
+	assert(jpeg_decoder->decoder != NULL);
+	assert(items != NULL);
+	assert(callback != NULL);
+
+	if (num_items == 0)
+		return IMX_VPU_DEC_RETURN_CODE_OK;
+
+	entries = IMX_VPU_ALLOC(sizeof(ImxVpuJPEGDecBatchEntry) * num_items);
+	if (entries == NULL)
+	{
+		IMX_VPU_ERROR("allocating memory for %u batch entries failed", num_items);
+		return IMX_VPU_DEC_RETURN_CODE_ERROR;
+	}
+
+
+	/* Parse all headers in advance, and sort the images by size and format */
+
+	for (i = 0; i < num_items; ++i)
+	{
+		ImxVpuJPEGDecBatchEntry *entry = &(entries[i]);
+
+		entry->index = i;
+		entry->valid = (items[i].data != NULL) && (items[i].data_size > 0) && imx_vpu_parse_jpeg_header((void *)(items[i].data), items[i].data_size, &(entry->width), &(entry->height), &(entry->color_format));
+		if (!(entry->valid))
+		{
+			entry->width = entry->height = 0;
+			entry->color_format = IMX_VPU_COLOR_FORMAT_YUV420;
+		}
+	}
+
+	qsort(entries, num_items, sizeof(ImxVpuJPEGDecBatchEntry), imx_vpu_jpeg_dec_compare_batch_entries);
+
+
+	/* Decode the images. If an image has the same size and format as the
+	 * previous one, no framebuffer reallocation can happen (see
+	 * initial_info_callback()), so the previous image can be delivered
+	 * to the callback while the VPU is decoding the current one. */
+
+	for (i = 0; i < num_items; ++i)
+	{
+		ImxVpuJPEGDecBatchEntry const *entry = &(entries[i]);
+		ImxVpuEncodedFrame encoded_frame;
+		ImxVpuRawFrame raw_frame;
+		ImxVpuDecReturnCodes ret;
+		unsigned int output_code = 0;
+		int overlap;
+
+		if (!(entry->valid))
+		{
+			IMX_VPU_ERROR("batch item #%u is not valid JPEG data", entry->index);
+			callback(jpeg_decoder, entry->index, IMX_VPU_DEC_RETURN_CODE_ERROR, NULL, user_data);
+			continue;
+		}
+
+		overlap = (pending_entry != NULL)
+		       && (pending_entry->width == entry->width)
+		       && (pending_entry->height == entry->height)
+		       && (pending_entry->color_format == entry->color_format)
+		       && imx_vpu_dec_check_if_can_decode(jpeg_decoder->decoder);
+
+		if (!overlap && (pending_entry != NULL))
+		{
+			imx_vpu_jpeg_dec_deliver_batch_frame(jpeg_decoder, pending_entry->index, pending_framebuffer, callback, user_data);
+			pending_entry = NULL;
+		}
+
+		memset(&encoded_frame, 0, sizeof(encoded_frame));
+		encoded_frame.data = (uint8_t *)(items[entry->index].data);
+		encoded_frame.data_size = items[entry->index].data_size;
+
+		ret = imx_vpu_dec_decode_start(jpeg_decoder->decoder, &encoded_frame);
+
+		if (pending_entry != NULL)
+		{
+			imx_vpu_jpeg_dec_deliver_batch_frame(jpeg_decoder, pending_entry->index, pending_framebuffer, callback, user_data);
+			pending_entry = NULL;
+		}
+
+		if (ret == IMX_VPU_DEC_RETURN_CODE_OK)
+			ret = imx_vpu_dec_decode_finish(jpeg_decoder->decoder, &output_code);
+
+		if ((ret == IMX_VPU_DEC_RETURN_CODE_OK) && (output_code & IMX_VPU_DEC_OUTPUT_CODE_DECODED_FRAME_AVAILABLE))
+			ret = imx_vpu_dec_get_decoded_frame(jpeg_decoder->decoder, &raw_frame);
+		else if (ret == IMX_VPU_DEC_RETURN_CODE_OK)
+		{
+			IMX_VPU_ERROR("batch item #%u did not produce a decoded frame", entry->index);
+			ret = IMX_VPU_DEC_RETURN_CODE_ERROR;
+		}
+
+		if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
+		{
+			callback(jpeg_decoder, entry->index, ret, NULL, user_data);
+			continue;
+		}
+
+		pending_entry = entry;
+		pending_framebuffer = raw_frame.framebuffer;
+	}
+
+	if (pending_entry != NULL)
+		imx_vpu_jpeg_dec_deliver_batch_frame(jpeg_decoder, pending_entry->index, pending_framebuffer, callback, user_data);
+
+	IMX_VPU_FREE(entries, sizeof(ImxVpuJPEGDecBatchEntry) * num_items);
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+int imx_vpu_jpeg_parse_header(uint8_t const *jpeg_data, size_t jpeg_data_size, ImxVpuJPEGHeaderInfo *info)
+{
+	assert(jpeg_data != NULL);
+	assert(info != NULL);
+
+	return imx_vpu_parse_jpeg_header_info(jpeg_data, jpeg_data_size, 1, info);
+}
+
+
 
 
 /******************
@@ -332,14 +550,24 @@ struct _ImxVpuJPEGEncoder
 	unsigned int num_framebuffers;
 	ImxVpuFramebufferSizes calculated_sizes;
 
+	/* Size and alignment the framebuffer DMA buffers were allocated with.
+	 * These are used for checking if the DMA buffers can be reused after
+	 * the parameters changed. */
+	size_t fb_dmabuffer_size;
+	unsigned int fb_dmabuffer_alignment;
+
 	unsigned int quality_factor;
 
 	ImxVpuColorFormat color_format;
+
+	ImxVpuRotation rotation;
+	ImxVpuMirrorDirection mirror;
 };
 
 
 static ImxVpuEncReturnCodes imx_vpu_jpeg_enc_open_internal(ImxVpuJPEGEncoder *jpeg_encoder);
 static ImxVpuEncReturnCodes imx_vpu_jpeg_enc_close_internal(ImxVpuJPEGEncoder *jpeg_encoder);
+static int imx_vpu_jpeg_enc_can_reuse_framebuffers(ImxVpuJPEGEncoder *jpeg_encoder);
 static void imx_vpu_jpeg_enc_deallocate_framebuffers(ImxVpuJPEGEncoder *jpeg_encoder);
 
 
@@ -359,6 +587,8 @@ static ImxVpuEncReturnCodes imx_vpu_jpeg_enc_open_internal(ImxVpuJPEGEncoder *jp
 	open_params.frame_height = jpeg_encoder->frame_height;
 	open_params.color_format = jpeg_encoder->color_format;
 	open_params.codec_params.mjpeg_params.quality_factor = jpeg_encoder->quality_factor;
+	open_params.rotation = jpeg_encoder->rotation;
+	open_params.mirror = jpeg_encoder->mirror;
 
 	if ((ret = imx_vpu_enc_open(&(jpeg_encoder->encoder), &open_params, jpeg_encoder->bitstream_buffer)) != IMX_VPU_ENC_RETURN_CODE_OK)
 		goto error;
@@ -366,26 +596,48 @@ static ImxVpuEncReturnCodes imx_vpu_jpeg_enc_open_internal(ImxVpuJPEGEncoder *jp
 	if ((ret = imx_vpu_enc_get_initial_info(jpeg_encoder->encoder, &(jpeg_encoder->initial_info))) != IMX_VPU_ENC_RETURN_CODE_OK)
 		goto error;
 
-	jpeg_encoder->num_framebuffers = jpeg_encoder->initial_info.min_num_required_framebuffers;
-	jpeg_encoder->framebuffers = IMX_VPU_ALLOC(sizeof(ImxVpuFramebuffer) * jpeg_encoder->num_framebuffers);
-	jpeg_encoder->fb_dmabuffers = IMX_VPU_ALLOC(sizeof(ImxVpuDMABuffer *) * jpeg_encoder->num_framebuffers);
-
-	memset(jpeg_encoder->framebuffers, 0, sizeof(ImxVpuFramebuffer) * jpeg_encoder->num_framebuffers);
-	memset(jpeg_encoder->fb_dmabuffers, 0, sizeof(ImxVpuDMABuffer *) * jpeg_encoder->num_framebuffers);
+	/* The framebuffers hold the rotated frames, so with 90 and 270 degree
+	 * rotations, their width and height are swapped */
+	if ((jpeg_encoder->rotation == IMX_VPU_ROTATION_90) || (jpeg_encoder->rotation == IMX_VPU_ROTATION_270))
+		imx_vpu_calc_framebuffer_sizes(jpeg_encoder->color_format, jpeg_encoder->frame_height, jpeg_encoder->frame_width, jpeg_encoder->initial_info.framebuffer_alignment, 0, 0, &(jpeg_encoder->calculated_sizes));
+	else
+		imx_vpu_calc_framebuffer_sizes(jpeg_encoder->color_format, jpeg_encoder->frame_width, jpeg_encoder->frame_height, jpeg_encoder->initial_info.framebuffer_alignment, 0, 0, &(jpeg_encoder->calculated_sizes));
 
-	imx_vpu_calc_framebuffer_sizes(jpeg_encoder->color_format, jpeg_encoder->frame_width, jpeg_encoder->frame_height, jpeg_encoder->initial_info.framebuffer_alignment, 0, 0, &(jpeg_encoder->calculated_sizes));
+	if (imx_vpu_jpeg_enc_can_reuse_framebuffers(jpeg_encoder))
+	{
+		/* The existing DMA buffers are large enough for the new parameters.
+		 * Only the framebuffer strides and offsets need to be updated. */
+		IMX_VPU_DEBUG("reusing %u framebuffers with %zu byte each", jpeg_encoder->num_framebuffers, jpeg_encoder->fb_dmabuffer_size);
 
-	for (i = 0; i < jpeg_encoder->num_framebuffers; ++i)
+		for (i = 0; i < jpeg_encoder->num_framebuffers; ++i)
+			imx_vpu_fill_framebuffer_params(&(jpeg_encoder->framebuffers[i]), &(jpeg_encoder->calculated_sizes), jpeg_encoder->fb_dmabuffers[i], 0);
+	}
+	else
 	{
-		jpeg_encoder->fb_dmabuffers[i] = imx_vpu_dma_buffer_allocate(jpeg_encoder->dma_buffer_allocator, jpeg_encoder->calculated_sizes.total_size, jpeg_encoder->initial_info.framebuffer_alignment, 0);
-		if (jpeg_encoder->fb_dmabuffers[i] == NULL)
+		imx_vpu_jpeg_enc_deallocate_framebuffers(jpeg_encoder);
+
+		jpeg_encoder->num_framebuffers = jpeg_encoder->initial_info.min_num_required_framebuffers;
+		jpeg_encoder->framebuffers = IMX_VPU_ALLOC(sizeof(ImxVpuFramebuffer) * jpeg_encoder->num_framebuffers);
+		jpeg_encoder->fb_dmabuffers = IMX_VPU_ALLOC(sizeof(ImxVpuDMABuffer *) * jpeg_encoder->num_framebuffers);
+
+		memset(jpeg_encoder->framebuffers, 0, sizeof(ImxVpuFramebuffer) * jpeg_encoder->num_framebuffers);
+		memset(jpeg_encoder->fb_dmabuffers, 0, sizeof(ImxVpuDMABuffer *) * jpeg_encoder->num_framebuffers);
+
+		jpeg_encoder->fb_dmabuffer_size = jpeg_encoder->calculated_sizes.total_size;
+		jpeg_encoder->fb_dmabuffer_alignment = jpeg_encoder->initial_info.framebuffer_alignment;
+
+		for (i = 0; i < jpeg_encoder->num_framebuffers; ++i)
 		{
-			IMX_VPU_ERROR("could not allocate DMA buffer for framebuffer #%u", i);
-			ret = IMX_VPU_ENC_RETURN_CODE_ERROR;
-			goto error;
+			jpeg_encoder->fb_dmabuffers[i] = imx_vpu_dma_buffer_allocate(jpeg_encoder->dma_buffer_allocator, jpeg_encoder->fb_dmabuffer_size, jpeg_encoder->fb_dmabuffer_alignment, 0);
+			if (jpeg_encoder->fb_dmabuffers[i] == NULL)
+			{
+				IMX_VPU_ERROR("could not allocate DMA buffer for framebuffer #%u", i);
+				ret = IMX_VPU_ENC_RETURN_CODE_ERROR;
+				goto error;
+			}
+
+			imx_vpu_fill_framebuffer_params(&(jpeg_encoder->framebuffers[i]), &(jpeg_encoder->calculated_sizes), jpeg_encoder->fb_dmabuffers[i], 0);
 		}
-
-		imx_vpu_fill_framebuffer_params(&(jpeg_encoder->framebuffers[i]), &(jpeg_encoder->calculated_sizes), jpeg_encoder->fb_dmabuffers[i], 0);
 	}
 
 	if ((ret = imx_vpu_enc_register_framebuffers(jpeg_encoder->encoder, jpeg_encoder->framebuffers, jpeg_encoder->num_framebuffers)) != IMX_VPU_ENC_RETURN_CODE_OK)
@@ -398,6 +650,7 @@ static ImxVpuEncReturnCodes imx_vpu_jpeg_enc_open_internal(ImxVpuJPEGEncoder *jp
 
 error:
 	imx_vpu_jpeg_enc_close_internal(jpeg_encoder);
+	imx_vpu_jpeg_enc_deallocate_framebuffers(jpeg_encoder);
 
 	return ret;
 }
@@ -407,18 +660,34 @@ static ImxVpuEncReturnCodes imx_vpu_jpeg_enc_close_internal(ImxVpuJPEGEncoder *j
 {
 	assert(jpeg_encoder != NULL);
 
+	/* Only the encoder instance is closed here. The framebuffers are kept,
+	 * since they may be reusable by the next instance (see
+	 * imx_vpu_jpeg_enc_can_reuse_framebuffers()). */
+
 	if (jpeg_encoder->encoder != NULL)
 	{
 		imx_vpu_enc_close(jpeg_encoder->encoder);
 		jpeg_encoder->encoder = NULL;
 	}
 
-	imx_vpu_jpeg_enc_deallocate_framebuffers(jpeg_encoder);
-
 	return IMX_VPU_ENC_RETURN_CODE_OK;
 }
 
 
+static int imx_vpu_jpeg_enc_can_reuse_framebuffers(ImxVpuJPEGEncoder *jpeg_encoder)
+{
+	if (jpeg_encoder->fb_dmabuffers == NULL)
+		return 0;
+
+	/* The DMA buffers can be reused if there are as many as the new instance
+	 * requires, and if they are big enough and suitably aligned for the new
+	 * frame size and color format */
+	return (jpeg_encoder->num_framebuffers == jpeg_encoder->initial_info.min_num_required_framebuffers)
+	    && (jpeg_encoder->fb_dmabuffer_size >= jpeg_encoder->calculated_sizes.total_size)
+	    && ((jpeg_encoder->initial_info.framebuffer_alignment <= 1) || ((jpeg_encoder->fb_dmabuffer_alignment % jpeg_encoder->initial_info.framebuffer_alignment) == 0));
+}
+
+
 static void imx_vpu_jpeg_enc_deallocate_framebuffers(ImxVpuJPEGEncoder *jpeg_encoder)
 {
 	assert(jpeg_encoder != NULL);
@@ -491,6 +760,7 @@ ImxVpuEncReturnCodes imx_vpu_jpeg_enc_close(ImxVpuJPEGEncoder *jpeg_encoder)
 	assert(jpeg_encoder != NULL);
 
 	imx_vpu_jpeg_enc_close_internal(jpeg_encoder);
+	imx_vpu_jpeg_enc_deallocate_framebuffers(jpeg_encoder);
 
 	if (jpeg_encoder->bitstream_buffer != NULL)
 		imx_vpu_dma_buffer_deallocate(jpeg_encoder->bitstream_buffer);
@@ -518,11 +788,19 @@ ImxVpuEncReturnCodes imx_vpu_jpeg_enc_encode(ImxVpuJPEGEncoder *jpeg_encoder, Im
 	if (acquired_handle != NULL)
 		*acquired_handle = NULL;
 
+	/* The VPU library provides no way to replace the frame size or the
+	 * quantization tables of an open MJPEG encoder instance, so the instance
+	 * has to be reopened if these change. This is comparatively cheap, since
+	 * the bitstream buffer is kept, and the framebuffers are reused if they
+	 * are large enough for the new frame size (which is the case if the
+	 * frame size shrinks or only the quality factor changes). */
 	if ((jpeg_encoder->encoder == NULL)
 	 || (jpeg_encoder->frame_width != params->frame_width)
 	 || (jpeg_encoder->frame_height != params->frame_height)
 	 || (jpeg_encoder->quality_factor != params->quality_factor)
 	 || (jpeg_encoder->color_format != params->color_format)
+	 || (jpeg_encoder->rotation != params->rotation)
+	 || (jpeg_encoder->mirror != params->mirror)
 	)
 	{
 		imx_vpu_jpeg_enc_close_internal(jpeg_encoder);
@@ -531,6 +809,8 @@ ImxVpuEncReturnCodes imx_vpu_jpeg_enc_encode(ImxVpuJPEGEncoder *jpeg_encoder, Im
 		jpeg_encoder->frame_height = params->frame_height;
 		jpeg_encoder->quality_factor = params->quality_factor;
 		jpeg_encoder->color_format = params->color_format;
+		jpeg_encoder->rotation = params->rotation;
+		jpeg_encoder->mirror = params->mirror;
 
 		if ((ret = imx_vpu_jpeg_enc_open_internal(jpeg_encoder)) != IMX_VPU_ENC_RETURN_CODE_OK)
 			return ret;
@@ -79,6 +79,16 @@ typedef struct _ImxVpuJPEGDecoder ImxVpuJPEGDecoder;
  * If unsure, keep this to zero. */
 ImxVpuDecReturnCodes imx_vpu_jpeg_dec_open(ImxVpuJPEGDecoder **jpeg_decoder, ImxVpuDMABufferAllocator *dma_buffer_allocator, unsigned int num_extra_framebuffers);
 
+/* Opens a new VPU JPEG decoder instance which rotates and/or mirrors the decoded frames.
+ *
+ * This is the same as imx_vpu_jpeg_dec_open(), except that the VPU's rotator is set
+ * up with the given rotation and mirror direction. The rotation is performed by the VPU
+ * while it writes the decoded pixels, so it does not slow down decoding. With 90 and 270
+ * degree rotations, the width and height in ImxVpuJPEGInfo are the ones of the rotated
+ * frames. Only the vpulib backend supports this; the fslwrapper backend returns
+ * IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS if rotation or mirror are not NONE. */
+ImxVpuDecReturnCodes imx_vpu_jpeg_dec_open_rotated(ImxVpuJPEGDecoder **jpeg_decoder, ImxVpuDMABufferAllocator *dma_buffer_allocator, unsigned int num_extra_framebuffers, ImxVpuRotation rotation, ImxVpuMirrorDirection mirror);
+
 /* Closes a JPEG decoder instance. Trying to close the same instance multiple times results in undefined behavior. */
 ImxVpuDecReturnCodes imx_vpu_jpeg_dec_close(ImxVpuJPEGDecoder *jpeg_decoder);
 
@@ -135,6 +145,114 @@ void imx_vpu_jpeg_dec_get_info(ImxVpuJPEGDecoder *jpeg_decoder, ImxVpuJPEGDecInf
  * framebuffers to decode into. */
 ImxVpuDecReturnCodes imx_vpu_jpeg_dec_frame_finished(ImxVpuJPEGDecoder *jpeg_decoder, ImxVpuFramebuffer *framebuffer);
 
+/* One JPEG image for imx_vpu_jpeg_dec_decode_batch(). */
+typedef struct
+{
+	/* Memory block containing the encoded JPEG data, and its size in bytes. */
+	uint8_t const *data;
+	size_t data_size;
+}
+ImxVpuJPEGDecBatchItem;
+
+/* Callback for imx_vpu_jpeg_dec_decode_batch(). index is the index of the image in
+ * the items array that was passed to imx_vpu_jpeg_dec_decode_batch(). If the image
+ * was decoded successfully, ret is IMX_VPU_DEC_RETURN_CODE_OK, and info describes
+ * the decoded frame, just like the info retrieved by imx_vpu_jpeg_dec_get_info().
+ * The framebuffer in info is only valid during the callback; it is returned to the
+ * decoder automatically afterwards, so the pixels must be copied or consumed inside
+ * the callback. If the image could not be decoded, ret is an error code, and info
+ * is NULL. */
+typedef void (*ImxVpuJPEGDecBatchCallback)(ImxVpuJPEGDecoder *jpeg_decoder, unsigned int index, ImxVpuDecReturnCodes ret, ImxVpuJPEGDecInfo const *info, void *user_data);
+
+/* Decodes many JPEG images at once.
+ *
+ * This is faster than calling imx_vpu_jpeg_dec_decode() for each image, for two reasons.
+ * First, all JPEG headers are parsed in advance, and the images are decoded in order of
+ * descending frame size, with images of the same size and color format grouped together.
+ * This way, the framebuffers which are allocated for the first image can be reused for
+ * all following ones, instead of being reallocated every time the size changes. Second,
+ * while the VPU decodes an image, the callback for the previous one is invoked, so the
+ * VPU does not stay idle while the caller consumes decoded frames. For this overlap, the
+ * decoder needs one extra framebuffer, so open it with num_extra_framebuffers set to at
+ * least 1. Without an extra framebuffer, the images are decoded one after the other.
+ *
+ * Because of the reordering, the callback is not invoked in the order of the items array.
+ * Images which cannot be decoded are reported to the callback with an error code, and
+ * do not abort the batch. The return value is IMX_VPU_DEC_RETURN_CODE_OK unless the
+ * batch could not be processed at all (for example, because memory allocation failed).
+ *
+ * Framebuffers previously obtained with imx_vpu_jpeg_dec_get_info() must have been returned
+ * with imx_vpu_jpeg_dec_frame_finished() before calling this function. */
+ImxVpuDecReturnCodes imx_vpu_jpeg_dec_decode_batch(ImxVpuJPEGDecoder *jpeg_decoder, ImxVpuJPEGDecBatchItem const *items, unsigned int num_items, ImxVpuJPEGDecBatchCallback callback, void *user_data);
+
+/* JPEG coding processes, as defined by the SOF marker type. */
+typedef enum
+{
+	/* SOF0; the only process the VPU can decode */
+	IMX_VPU_JPEG_CODING_PROCESS_BASELINE = 0,
+	/* SOF1; extended sequential DCT, Huffman coding */
+	IMX_VPU_JPEG_CODING_PROCESS_EXTENDED,
+	/* SOF2; progressive DCT, Huffman coding */
+	IMX_VPU_JPEG_CODING_PROCESS_PROGRESSIVE,
+	/* SOF3; lossless, Huffman coding */
+	IMX_VPU_JPEG_CODING_PROCESS_LOSSLESS,
+	/* Hierarchical or arithmetic coded JPEGs */
+	IMX_VPU_JPEG_CODING_PROCESS_OTHER
+}
+ImxVpuJPEGCodingProcess;
+
+/* Information about a JPEG image, filled by imx_vpu_jpeg_parse_header(). */
+typedef struct
+{
+	/* Frame size in pixels, as stored in the SOF segment. */
+	unsigned int width, height;
+	/* Color format derived from the sampling factors of the components. */
+	ImxVpuColorFormat color_format;
+	unsigned int num_components;
+	/* Sample precision in bits. */
+	unsigned int precision;
+	ImxVpuJPEGCodingProcess coding_process;
+
+	/* Number of MCUs between restart markers, or 0 if restart markers are not used. */
+	unsigned int restart_interval;
+
+	/* EXIF orientation tag value (1-8), or 0 if the image has no EXIF orientation.
+	 * rotation and mirror contain the transformation which must be applied to
+	 * display the image upright; they can be passed directly to
+	 * imx_vpu_jpeg_dec_open_rotated(). */
+	unsigned int exif_orientation;
+	ImxVpuRotation rotation;
+	ImxVpuMirrorDirection mirror;
+
+	/* Number of scans in the image. Progressive JPEGs have more than one. */
+	unsigned int num_scans;
+	/* Size of the image in bytes, up to and including the EOI marker, or 0 if
+	 * no EOI marker was found. This makes it possible to locate the end of
+	 * one image inside a larger buffer, like a concatenation of JPEGs. */
+	size_t image_size;
+
+	/* 1 if the VPU can decode this image (baseline, 8 bit precision, 1 or 3
+	 * components, at most 8192x8192 pixels). If this is 0, the image needs
+	 * to be decoded in software instead. */
+	int vpu_compatible;
+}
+ImxVpuJPEGHeaderInfo;
+
+/* Parses the headers of the JPEG image in jpeg_data, and fills info.
+ *
+ * This does not communicate with the VPU, so it can be called without an open
+ * decoder. It is meant for deciding in advance how to handle an image: for
+ * example, progressive JPEGs can be sent to a software decoder, and the EXIF
+ * orientation can be used to set up the VPU's rotator. Segments are skipped
+ * using their length fields, and every read is checked against jpeg_data_size,
+ * so truncated or corrupted data is handled safely. The entropy-coded data is
+ * scanned up to the EOI marker to count the scans and determine image_size.
+ *
+ * Returns a nonzero value if a SOF segment was found and info was filled, and
+ * zero if the data is not a valid JPEG. If the data is truncated or corrupted
+ * after the SOF segment, the function still succeeds, but image_size is 0. */
+int imx_vpu_jpeg_parse_header(uint8_t const *jpeg_data, size_t jpeg_data_size, ImxVpuJPEGHeaderInfo *info);
+
 
 
 
@@ -157,6 +275,14 @@ typedef struct
 	ImxVpuEncAcquireOutputBuffer acquire_output_buffer;
 	ImxVpuEncFinishOutputBuffer finish_output_buffer;
 	void *output_buffer_context;
+
+	/* Rotation and mirroring to apply to the input frame. With 90 and 270 degree
+	 * rotations, the encoded JPEG has the frame width and height swapped.
+	 * Set these to IMX_VPU_ROTATION_NONE and IMX_VPU_MIRROR_NONE (= 0) if no
+	 * rotation and mirroring is needed. These are placed after all other fields
+	 * to keep the offsets of those fields the same as in older versions. */
+	ImxVpuRotation rotation;
+	ImxVpuMirrorDirection mirror;
 }
 ImxVpuJPEGEncParams;
 
@@ -194,6 +320,11 @@ ImxVpuEncReturnCodes imx_vpu_jpeg_enc_close(ImxVpuJPEGEncoder *jpeg_encoder);
  * case *acquired_handle will be set to NULL). If output_buffer_size is non-NULL, the
  * size value it points to will be set to the number of bytes of the encoded JPEG data.
  *
+ * If the frame size, quality factor, color format, rotation, or mirror direction in params differ from the ones used in the
+ * previous call, the encoder is internally reconfigured. The internal framebuffers are kept if they
+ * are large enough for the new parameters, so changing the quality factor or reducing the frame size
+ * does not cause DMA memory reallocations.
+ *
  * The VPU encoder only produces baseline JPEG data. Progressive encoding is not supported. */
 ImxVpuEncReturnCodes imx_vpu_jpeg_enc_encode(ImxVpuJPEGEncoder *jpeg_encoder, ImxVpuFramebuffer const *framebuffer, ImxVpuJPEGEncParams const *params, void **acquired_handle, size_t *output_buffer_size);
 
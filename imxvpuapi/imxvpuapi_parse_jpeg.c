@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <string.h>
 #include "imxvpuapi_parse_jpeg.h"
 #include "imxvpuapi_priv.h"
 
@@ -62,134 +63,336 @@
 
 
 
-int imx_vpu_parse_jpeg_header(void *jpeg_data, size_t jpeg_data_size, unsigned int *width, unsigned int *height, ImxVpuColorFormat *color_format)
+/* EXIF tag containing the image orientation */
+#define EXIF_TAG_ORIENTATION  0x0112
+/* TIFF field type for 16-bit unsigned integers */
+#define TIFF_TYPE_SHORT       3
+
+/* Largest frame size the VPU's JPEG decoder can handle */
+#define MAX_JPEG_FRAME_SIZE   8192
+
+
+static inline unsigned int read_uint16_be(uint8_t const *data)
+{
+	return (((unsigned int)(data[0])) << 8) | ((unsigned int)(data[1]));
+}
+
+
+static inline unsigned int read_tiff_uint16(uint8_t const *data, int little_endian)
+{
+	return little_endian ? ((((unsigned int)(data[1])) << 8) | ((unsigned int)(data[0]))) : read_uint16_be(data);
+}
+
+
+static inline uint32_t read_tiff_uint32(uint8_t const *data, int little_endian)
+{
+	if (little_endian)
+		return (((uint32_t)(data[3])) << 24) | (((uint32_t)(data[2])) << 16) | (((uint32_t)(data[1])) << 8) | ((uint32_t)(data[0]));
+	else
+		return (((uint32_t)(data[0])) << 24) | (((uint32_t)(data[1])) << 16) | (((uint32_t)(data[2])) << 8) | ((uint32_t)(data[3]));
+}
+
+
+/* Looks for the orientation tag in the first IFD of an APP1 EXIF segment.
+ * Returns the orientation (1-8), or 0 if the segment is not an EXIF segment
+ * or contains no valid orientation tag. Every read is checked against the
+ * segment size, since EXIF data from cameras is often malformed. */
+static unsigned int parse_exif_orientation(uint8_t const *segment, size_t segment_size)
+{
+	uint8_t const *tiff;
+	size_t tiff_size;
+	int little_endian;
+	uint32_t ifd_offset;
+	unsigned int num_entries, i;
+
+	/* 6 bytes EXIF identifier, 8 bytes TIFF header */
+	if ((segment_size < (6 + 8)) || (memcmp(segment, "Exif\0\0", 6) != 0))
+		return 0;
+
+	tiff = segment + 6;
+	tiff_size = segment_size - 6;
+
+	if ((tiff[0] == 'I') && (tiff[1] == 'I'))
+		little_endian = 1;
+	else if ((tiff[0] == 'M') && (tiff[1] == 'M'))
+		little_endian = 0;
+	else
+		return 0;
+
+	if (read_tiff_uint16(tiff + 2, little_endian) != 42)
+		return 0;
+
+	ifd_offset = read_tiff_uint32(tiff + 4, little_endian);
+	if ((ifd_offset < 8) || (ifd_offset > (tiff_size - 2)))
+		return 0;
+
+	num_entries = read_tiff_uint16(tiff + ifd_offset, little_endian);
+
+	for (i = 0; i < num_entries; ++i)
+	{
+		/* Each IFD entry is 12 bytes long: tag, type, count, value/offset */
+		size_t entry_offset = (size_t)ifd_offset + 2 + (size_t)i * 12;
+		uint8_t const *entry = tiff + entry_offset;
+		unsigned int value;
+
+		if ((entry_offset + 12) > tiff_size)
+			break;
+
+		if (read_tiff_uint16(entry, little_endian) != EXIF_TAG_ORIENTATION)
+			continue;
+
+		if (read_tiff_uint16(entry + 2, little_endian) != TIFF_TYPE_SHORT)
+			return 0;
+
+		/* SHORT values are stored left-aligned in the 4-byte value field */
+		value = read_tiff_uint16(entry + 8, little_endian);
+		return ((value >= 1) && (value <= 8)) ? value : 0;
+	}
+
+	return 0;
+}
+
+
+static void set_rotation_from_exif_orientation(ImxVpuJPEGHeaderInfo *info)
+{
+	/* The EXIF orientation describes how the stored image must be transformed
+	 * to be displayed upright. The VPU rotates counterclockwise, and mirrors
+	 * after rotating, so the transposed orientations (5 and 7) are a 90 degree
+	 * rotation followed by a flip. */
+	switch (info->exif_orientation)
+	{
+		case 2: info->rotation = IMX_VPU_ROTATION_NONE; info->mirror = IMX_VPU_MIRROR_HORIZONTAL; break;
+		case 3: info->rotation = IMX_VPU_ROTATION_180;  info->mirror = IMX_VPU_MIRROR_NONE;       break;
+		case 4: info->rotation = IMX_VPU_ROTATION_NONE; info->mirror = IMX_VPU_MIRROR_VERTICAL;   break;
+		case 5: info->rotation = IMX_VPU_ROTATION_90;   info->mirror = IMX_VPU_MIRROR_VERTICAL;   break;
+		case 6: info->rotation = IMX_VPU_ROTATION_270;  info->mirror = IMX_VPU_MIRROR_NONE;       break;
+		case 7: info->rotation = IMX_VPU_ROTATION_90;   info->mirror = IMX_VPU_MIRROR_HORIZONTAL; break;
+		case 8: info->rotation = IMX_VPU_ROTATION_90;   info->mirror = IMX_VPU_MIRROR_NONE;       break;
+		default: info->rotation = IMX_VPU_ROTATION_NONE; info->mirror = IMX_VPU_MIRROR_NONE;      break;
+	}
+}
+
+
+static int parse_sof(uint8_t marker, uint8_t const *segment, size_t segment_size, ImxVpuJPEGHeaderInfo *info)
 {
-	uint8_t *jpeg_data_start = jpeg_data;
-	uint8_t *jpeg_data_end = jpeg_data_start + jpeg_data_size;
-	uint8_t *jpeg_data_cur = jpeg_data_start;
+	unsigned int i;
+	unsigned int block_width[3], block_height[3];
+
+	if (segment_size < 6)
+	{
+		IMX_VPU_ERROR("SOF segment is too short");
+		return 0;
+	}
+
+	switch (marker)
+	{
+		case SOF0: info->coding_process = IMX_VPU_JPEG_CODING_PROCESS_BASELINE; break;
+		case SOF1: info->coding_process = IMX_VPU_JPEG_CODING_PROCESS_EXTENDED; break;
+		case SOF2: info->coding_process = IMX_VPU_JPEG_CODING_PROCESS_PROGRESSIVE; break;
+		case SOF3: info->coding_process = IMX_VPU_JPEG_CODING_PROCESS_LOSSLESS; break;
+		default: info->coding_process = IMX_VPU_JPEG_CODING_PROCESS_OTHER;
+	}
+
+	info->precision = segment[0];
+	info->height = read_uint16_be(segment + 1);
+	info->width = read_uint16_be(segment + 3);
+	info->num_components = segment[5];
+
+	IMX_VPU_LOG("SOF marker: %#lx  width: %u  height: %u  precision: %u  number of components: %u", (unsigned long)marker, info->width, info->height, info->precision, info->num_components);
+
+	if (segment_size < (6 + (size_t)(info->num_components) * 3))
+	{
+		IMX_VPU_ERROR("SOF segment is too short for %u components", info->num_components);
+		return 0;
+	}
+
+	/* Each component entry consists of ID, sampling factors, and quantization table index */
+	for (i = 0; (i < info->num_components) && (i < 3); ++i)
+	{
+		uint8_t b = segment[6 + i * 3 + 1];
+		block_width[i] = (b & 0xf0) >> 4;
+		block_height[i] = (b & 0x0f);
+	}
+
+	if ((info->num_components == 3) && ((block_width[1] * block_height[1]) != 0))
+	{
+		unsigned int temp = (block_width[0] * block_height[0]) / (block_width[1] * block_height[1]);
+
+		if ((temp == 4) && (block_height[0] == 2))
+			info->color_format = IMX_VPU_COLOR_FORMAT_YUV420;
+		else if ((temp == 2) && (block_height[0] == 1))
+			info->color_format = IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL;
+		else if ((temp == 2) && (block_height[0] == 2))
+			info->color_format = IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL;
+		else if ((temp == 1) && (block_height[0] == 1))
+			info->color_format = IMX_VPU_COLOR_FORMAT_YUV444;
+		else
+			info->color_format = IMX_VPU_COLOR_FORMAT_YUV420;
+	}
+	else if (info->num_components == 1)
+		info->color_format = IMX_VPU_COLOR_FORMAT_YUV400;
+
+	return 1;
+}
+
+
+/* Finds the end of entropy-coded data that starts at cur. Inside entropy-coded
+ * data, 0xFF bytes are either followed by a stuffed 0x00 byte, a restart marker,
+ * or fill bytes; any other byte after 0xFF marks the start of the next segment.
+ * memchr() is used to jump directly from one 0xFF byte to the next, which is
+ * much faster than looking at each byte individually. Returns a pointer to the
+ * 0xFF byte of the next marker, or end if no marker follows. */
+static uint8_t const * skip_entropy_coded_data(uint8_t const *cur, uint8_t const *end)
+{
+	while (cur < end)
+	{
+		uint8_t next;
+
+		cur = memchr(cur, 0xff, end - cur);
+		if ((cur == NULL) || ((cur + 1) >= end))
+			return end;
+
+		next = cur[1];
+		if (next == 0xff)
+			cur += 1;
+		else if ((next == 0x00) || ((next >= RST0) && (next <= RST7)))
+			cur += 2;
+		else
+			return cur;
+	}
+
+	return end;
+}
+
+
+int imx_vpu_parse_jpeg_header_info(uint8_t const *jpeg_data, size_t jpeg_data_size, int scan_entropy_coded_data, ImxVpuJPEGHeaderInfo *info)
+{
+	uint8_t const *jpeg_data_start = jpeg_data;
+	uint8_t const *jpeg_data_end = jpeg_data_start + jpeg_data_size;
+	uint8_t const *jpeg_data_cur = jpeg_data_start;
 	int found_info = 0;
 
-#define READ_UINT8(value) do \
-	{ \
-		(value) = *jpeg_data_cur; \
-		++jpeg_data_cur; \
-	} \
-	while (0)
-#define READ_UINT16(value) do \
-	{ \
-		uint16_t w = *((uint16_t *)jpeg_data_cur); \
-		jpeg_data_cur += 2; \
-		(value) = ( ((w & 0xff) << 8) | ((w & 0xff00) >> 8) ); \
-	} \
-	while (0)
+	memset(info, 0, sizeof(ImxVpuJPEGHeaderInfo));
+	info->color_format = IMX_VPU_COLOR_FORMAT_YUV420;
 
 	while (jpeg_data_cur < jpeg_data_end)
 	{
 		uint8_t marker;
+		uint8_t const *segment;
+		size_t length, segment_size;
 
-		/* Marker is preceded by byte 0xFF */
-		if (*(jpeg_data_cur++) != 0xff)
+		/* Marker is preceded by byte 0xFF; any number of 0xFF fill bytes may appear */
+		if (*jpeg_data_cur != 0xff)
 			break;
+		while ((jpeg_data_cur < jpeg_data_end) && (*jpeg_data_cur == 0xff))
+			++jpeg_data_cur;
+		if (jpeg_data_cur >= jpeg_data_end)
+			break;
+
+		marker = *(jpeg_data_cur++);
 
-		READ_UINT8(marker);
-		if (marker == SOS)
+		/* Standalone markers without a length field */
+		if ((marker == SOI) || (marker == TEM) || ((marker >= RST0) && (marker <= RST7)))
+			continue;
+
+		if (marker == EOI)
+		{
+			info->image_size = jpeg_data_cur - jpeg_data_start;
 			break;
+		}
+
+		if ((jpeg_data_end - jpeg_data_cur) < 2)
+		{
+			IMX_VPU_ERROR("JPEG data ends inside the length field of marker %#lx", (unsigned long)marker);
+			goto finish;
+		}
+
+		length = read_uint16_be(jpeg_data_cur);
+		if ((length < 2) || (length > (size_t)(jpeg_data_end - jpeg_data_cur)))
+		{
+			IMX_VPU_ERROR("invalid length %u of JPEG segment with marker %#lx", (unsigned int)length, (unsigned long)marker);
+			goto finish;
+		}
+
+		segment = jpeg_data_cur + 2;
+		segment_size = length - 2;
+		jpeg_data_cur += length;
+
+		IMX_VPU_LOG("marker: %#lx length: %u", (unsigned long)marker, (unsigned int)segment_size);
 
 		switch (marker)
 		{
-			case SOI:
+			case SOF0: case SOF1: case SOF2: case SOF3:
+			case SOF5: case SOF6: case SOF7:
+			case SOF9: case SOF10: case SOF11:
+			case SOF13: case SOF14: case SOF15:
+				if (!parse_sof(marker, segment, segment_size, info))
+					return 0;
+				found_info = 1;
 				break;
+
 			case DRI:
-				jpeg_data_cur += 4;
+				if (segment_size >= 2)
+					info->restart_interval = read_uint16_be(segment);
 				break;
 
-			case SOF2:
-			{
-				IMX_VPU_ERROR("progressive JPEGs are not supported");
-				return 0;
-			}
-
-			case SOF0:
-			{
-				uint16_t length;
-				uint8_t num_components;
-				uint8_t block_width[3], block_height[3];
-
-				READ_UINT16(length);
-				length -= 2;
-				IMX_VPU_LOG("marker: %#lx length: %u", (unsigned long)marker, length);
-
-				jpeg_data_cur++;
-				READ_UINT16(*height);
-				READ_UINT16(*width);
-
-				if ((*width) > 8192)
-				{
-					IMX_VPU_ERROR("width of %u pixels exceeds the maximum of 8192", *width);
-					return 0;
-				}
-
-				if ((*height) > 8192)
-				{
-					IMX_VPU_ERROR("height of %u pixels exceeds the maximum of 8192", *height);
-					return 0;
-				}
-
-				READ_UINT8(num_components);
-
-				if (num_components <= 3)
-				{
-					for (int i = 0; i < num_components; ++i)
-					{
-						uint8_t b;
-						++jpeg_data_cur;
-						READ_UINT8(b);
-						block_width[i] = (b & 0xf0) >> 4;
-						block_height[i] = (b & 0x0f);
-						++jpeg_data_cur;
-					}
-				}
-
-				if (num_components > 3)
-				{
-					IMX_VPU_ERROR("JPEGs with %d components are not supported", (int)num_components);
-					return 0;
-				}
-				if (num_components == 3)
-				{
-					int temp = (block_width[0] * block_height[0]) / (block_width[1] * block_height[1]);
-
-					if ((temp == 4) && (block_height[0] == 2))
-						*color_format = IMX_VPU_COLOR_FORMAT_YUV420;
-					else if ((temp == 2) && (block_height[0] == 1))
-						*color_format = IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL;
-					else if ((temp == 2) && (block_height[0] == 2))
-						*color_format = IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL;
-					else if ((temp == 1) && (block_height[0] == 1))
-						*color_format = IMX_VPU_COLOR_FORMAT_YUV444;
-					else
-						*color_format = IMX_VPU_COLOR_FORMAT_YUV420;
-				}
-				else
-					*color_format = IMX_VPU_COLOR_FORMAT_YUV400;
-
-				IMX_VPU_LOG("width: %u  height: %u  number of components: %d", *width, *height, (int)num_components);
-
-				found_info = 1;
+			case APP1:
+				/* Only the first orientation found is used; XMP data also uses APP1 */
+				if (info->exif_orientation == 0)
+					info->exif_orientation = parse_exif_orientation(segment, segment_size);
+				break;
 
+			case SOS:
+				info->num_scans++;
+				/* Everything needed from the header is known once the first scan
+				 * starts, unless the caller wants the full image size */
+				if (!scan_entropy_coded_data)
+					goto finish;
+				jpeg_data_cur = skip_entropy_coded_data(jpeg_data_cur, jpeg_data_end);
 				break;
-			}
 
 			default:
-			{
-				uint16_t length;
-				READ_UINT16(length);
-				length -= 2;
-				IMX_VPU_LOG("marker: %#lx length: %u", (unsigned long)marker, length);
-				jpeg_data_cur += length;
-			}
+				break;
 		}
 	}
 
+finish:
+	set_rotation_from_exif_orientation(info);
+
+	info->vpu_compatible = found_info
+	                    && (info->coding_process == IMX_VPU_JPEG_CODING_PROCESS_BASELINE)
+	                    && (info->precision == 8)
+	                    && ((info->num_components == 1) || (info->num_components == 3))
+	                    && (info->width > 0) && (info->width <= MAX_JPEG_FRAME_SIZE)
+	                    && (info->height > 0) && (info->height <= MAX_JPEG_FRAME_SIZE);
+
 	return found_info;
 }
+
+
+int imx_vpu_parse_jpeg_header(void *jpeg_data, size_t jpeg_data_size, unsigned int *width, unsigned int *height, ImxVpuColorFormat *color_format)
+{
+	ImxVpuJPEGHeaderInfo info;
+
+	if (!imx_vpu_parse_jpeg_header_info(jpeg_data, jpeg_data_size, 0, &info))
+		return 0;
+
+	if (!info.vpu_compatible)
+	{
+		if (info.coding_process == IMX_VPU_JPEG_CODING_PROCESS_PROGRESSIVE)
+			IMX_VPU_ERROR("progressive JPEGs are not supported");
+		else if (info.coding_process != IMX_VPU_JPEG_CODING_PROCESS_BASELINE)
+			IMX_VPU_ERROR("only baseline JPEGs are supported");
+		else if ((info.width > MAX_JPEG_FRAME_SIZE) || (info.height > MAX_JPEG_FRAME_SIZE))
+			IMX_VPU_ERROR("frame size %ux%u exceeds the maximum of %ux%u", info.width, info.height, MAX_JPEG_FRAME_SIZE, MAX_JPEG_FRAME_SIZE);
+		else
+			IMX_VPU_ERROR("unsupported JPEG: %u components, %u bits precision, frame size %ux%u", info.num_components, info.precision, info.width, info.height);
+		return 0;
+	}
+
+	*width = info.width;
+	*height = info.height;
+	*color_format = info.color_format;
+
+	return 1;
+}
@@ -2,6 +2,7 @@
 #define IMXVPUAPI_PARSE_JPEG_H
 
 #include "imxvpuapi.h"
+#include "imxvpuapi_jpeg.h"
 
 
 #ifdef __cplusplus
@@ -9,6 +10,12 @@ extern "C" {
 #endif
 
 
+/* Bounds-checked single-pass parser behind imx_vpu_jpeg_parse_header(). If
+ * scan_entropy_coded_data is 0, parsing stops at the first SOS marker, and
+ * the image_size and num_scans fields are not fully filled in. */
+int imx_vpu_parse_jpeg_header_info(uint8_t const *jpeg_data, size_t jpeg_data_size, int scan_entropy_coded_data, ImxVpuJPEGHeaderInfo *info);
+
+/* Convenience wrapper which only succeeds for JPEGs the VPU can decode. */
 int imx_vpu_parse_jpeg_header(void *jpeg_data, size_t jpeg_data_size, unsigned int *width, unsigned int *height, ImxVpuColorFormat *color_format);
 
 
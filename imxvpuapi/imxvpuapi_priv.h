@@ -21,6 +21,10 @@
 #ifndef IMXVPUAPI_PRIV_H
 #define IMXVPUAPI_PRIV_H
 
+/* The config header is included here, since the logging and tracing
+ * macros below depend on configure options, and must behave the same
+ * in all source files */
+#include <config.h>
 #include "imxvpuapi.h"
 
 
@@ -32,6 +36,11 @@ extern "C" {
 #define IMXVPUAPI_UNUSED_PARAM(x) ((void)(x))
 
 
+/* Frame widths and heights are aligned to this value (heights of interlaced
+ * frames to twice this value). See imx_vpu_calc_framebuffer_sizes(). */
+#define IMX_VPU_FRAME_ALIGN 16
+
+
 #define IMX_VPU_ALIGN_VAL_TO(LENGTH, ALIGN_SIZE)  ( ((uintptr_t)(((uint8_t*)(LENGTH)) + (ALIGN_SIZE) - 1) / (ALIGN_SIZE)) * (ALIGN_SIZE) )
 
 
@@ -43,12 +52,20 @@ extern ImxVpuHeapAllocFunc imx_vpu_cur_heap_alloc_fn;
 extern ImxVpuHeapFreeFunc imx_vpu_cur_heap_free_fn;
 
 
-#define IMX_VPU_ERROR_FULL(FILE_, LINE_, FUNCTION_, ...)   do { if (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_ERROR)   { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_ERROR,   FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
-#define IMX_VPU_WARNING_FULL(FILE_, LINE_, FUNCTION_, ...) do { if (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_WARNING) { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_WARNING, FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
-#define IMX_VPU_INFO_FULL(FILE_, LINE_, FUNCTION_, ...)    do { if (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_INFO)    { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_INFO,    FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
-#define IMX_VPU_DEBUG_FULL(FILE_, LINE_, FUNCTION_, ...)   do { if (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_DEBUG)   { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_DEBUG,   FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
-#define IMX_VPU_LOG_FULL(FILE_, LINE_, FUNCTION_, ...)     do { if (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_LOG)     { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_LOG,     FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
-#define IMX_VPU_TRACE_FULL(FILE_, LINE_, FUNCTION_, ...)   do { if (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_TRACE)   { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_TRACE,   FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
+/* Logs with a lower priority than this level are compiled out. The
+ * configure script's --max-log-level option sets it in config.h. Since
+ * the check is a constant expression, the compiler removes the calls. */
+#ifndef IMXVPUAPI_MAX_LOG_LEVEL
+#define IMXVPUAPI_MAX_LOG_LEVEL IMX_VPU_LOG_LEVEL_TRACE
+#endif
+
+
+#define IMX_VPU_ERROR_FULL(FILE_, LINE_, FUNCTION_, ...)   do { if ((IMXVPUAPI_MAX_LOG_LEVEL >= IMX_VPU_LOG_LEVEL_ERROR)   && (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_ERROR))   { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_ERROR,   FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
+#define IMX_VPU_WARNING_FULL(FILE_, LINE_, FUNCTION_, ...) do { if ((IMXVPUAPI_MAX_LOG_LEVEL >= IMX_VPU_LOG_LEVEL_WARNING) && (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_WARNING)) { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_WARNING, FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
+#define IMX_VPU_INFO_FULL(FILE_, LINE_, FUNCTION_, ...)    do { if ((IMXVPUAPI_MAX_LOG_LEVEL >= IMX_VPU_LOG_LEVEL_INFO)    && (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_INFO))    { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_INFO,    FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
+#define IMX_VPU_DEBUG_FULL(FILE_, LINE_, FUNCTION_, ...)   do { if ((IMXVPUAPI_MAX_LOG_LEVEL >= IMX_VPU_LOG_LEVEL_DEBUG)   && (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_DEBUG))   { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_DEBUG,   FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
+#define IMX_VPU_LOG_FULL(FILE_, LINE_, FUNCTION_, ...)     do { if ((IMXVPUAPI_MAX_LOG_LEVEL >= IMX_VPU_LOG_LEVEL_LOG)     && (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_LOG))     { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_LOG,     FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
+#define IMX_VPU_TRACE_FULL(FILE_, LINE_, FUNCTION_, ...)   do { if ((IMXVPUAPI_MAX_LOG_LEVEL >= IMX_VPU_LOG_LEVEL_TRACE)   && (imx_vpu_cur_log_level_threshold >= IMX_VPU_LOG_LEVEL_TRACE))   { imx_vpu_cur_logging_fn(IMX_VPU_LOG_LEVEL_TRACE,   FILE_, LINE_, FUNCTION_, __VA_ARGS__); } } while(0)
 
 
 #define IMX_VPU_ERROR(...)    IMX_VPU_ERROR_FULL  (__FILE__, __LINE__, __func__, __VA_ARGS__)
@@ -63,6 +80,198 @@ extern ImxVpuLogLevel imx_vpu_cur_log_level_threshold;
 extern ImxVpuLoggingFunc imx_vpu_cur_logging_fn;
 
 
+/* Ring buffer for trace events. Each decoder and encoder has one, which is only
+ * accessed by the thread that uses the decoder/encoder. num_recorded_events counts
+ * all events ever recorded; the next one is stored in
+ * events[num_recorded_events % IMX_VPU_TRACE_RING_SIZE]. A zero-filled ring is empty.
+ * Events are recorded with the IMX_VPU_TRACE_EVENT macro, which expands to nothing
+ * if tracing is disabled (the ring itself does not exist then; backends put it
+ * into their structures only if IMXVPUAPI_ENABLE_TRACING is defined). */
+typedef struct
+{
+	ImxVpuTraceEvent events[IMX_VPU_TRACE_RING_SIZE];
+	unsigned long num_recorded_events;
+}
+ImxVpuTraceRing;
+
+void imx_vpu_trace_ring_add(ImxVpuTraceRing *ring, ImxVpuTraceEventID id, uint64_t arg0, uint64_t arg1, uint64_t arg2);
+/* Copies the newest events (at most max_events) into events, oldest first,
+ * and returns the number of copied events */
+unsigned int imx_vpu_trace_ring_get_events(ImxVpuTraceRing const *ring, ImxVpuTraceEvent *events, unsigned int max_events);
+void imx_vpu_trace_ring_clear(ImxVpuTraceRing *ring);
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+#define IMX_VPU_TRACE_EVENT(RING, ID, ARG0, ARG1, ARG2)  imx_vpu_trace_ring_add((RING), (ID), (ARG0), (ARG1), (ARG2))
+#else
+#define IMX_VPU_TRACE_EVENT(RING, ID, ARG0, ARG1, ARG2)  do { } while (0)
+#endif
+
+
+/* Returns the current time of a monotonic clock, in microseconds */
+uint64_t imx_vpu_get_monotonic_time(void);
+
+/* Adds the values of one frame's statistics to the totals */
+void imx_vpu_add_frame_stats(ImxVpuStatsTotals *totals, ImxVpuFrameStats const *frame_stats);
+
+/* Adds one decoding/encoding step's statistics to the decoder/encoder statistics. This
+ * updates the totals, last_frame, and the frame counters which depend on output_code. */
+void imx_vpu_dec_add_step_stats(ImxVpuDecStats *stats, ImxVpuFrameStats const *frame_stats, unsigned int output_code);
+void imx_vpu_enc_add_step_stats(ImxVpuEncStats *stats, ImxVpuFrameStats const *frame_stats, unsigned int output_code);
+
+/* Reset the accumulated values of the decoder/encoder statistics. The other values
+ * describe the current state, and are filled in by the get_stats functions. */
+void imx_vpu_dec_clear_stats(ImxVpuDecStats *stats);
+void imx_vpu_enc_clear_stats(ImxVpuEncStats *stats);
+
+
+/* Information about the frame in a framebuffer that is only needed when the
+ * frame is decoded and when it is retrieved. The backends keep one entry per
+ * framebuffer. Backends which get the frame types and interlacing mode only
+ * together with the decoded frame do not use these fields. */
+typedef struct
+{
+	void *context;
+	uint64_t pts, dts;
+	ImxVpuFrameType frame_types[2];
+	ImxVpuInterlacingMode interlacing_mode;
+}
+ImxVpuDecFrameEntry;
+
+
+/* Lock-free queue for returning indices (of framebuffers) from multiple producer
+ * threads to one consumer thread. Internally, it is a linked stack: head contains
+ * the most recently pushed index plus 1 (0 means the queue is empty), and
+ * next_indices links each queued index to the one pushed before it. The consumer
+ * always takes all queued indices at once, which avoids the ABA problem. Each
+ * index can be queued only once at the same time; queued_flags tracks that.
+ * The atomic operations use the GCC __sync builtins. */
+typedef struct
+{
+	volatile int head;
+	int *next_indices;
+	volatile int *queued_flags;
+	unsigned int num_indices;
+}
+ImxVpuIndexReturnQueue;
+
+/* Allocates the queue's arrays for indices 0 .. (num_indices-1). Returns 0 if
+ * allocation failed, nonzero otherwise. */
+int imx_vpu_index_return_queue_init(ImxVpuIndexReturnQueue *queue, unsigned int num_indices);
+/* Frees the queue's arrays. Safe to call if the queue was never initialized,
+ * provided that it was zeroed. */
+void imx_vpu_index_return_queue_cleanup(ImxVpuIndexReturnQueue *queue);
+/* Pushes an index into the queue. Can be called from any thread. Returns 0 if
+ * the index is already queued, nonzero otherwise. */
+int imx_vpu_index_return_queue_push(ImxVpuIndexReturnQueue *queue, unsigned int index);
+/* Takes all queued indices out of the queue. Must only be called by the consumer.
+ * Returns the first index, or -1 if the queue is empty. The remaining indices are
+ * retrieved with imx_vpu_index_return_queue_next(). */
+int imx_vpu_index_return_queue_take_all(ImxVpuIndexReturnQueue *queue);
+/* Returns the index that follows the given one (-1 if there is none), and marks
+ * the given index as no longer queued, so it can be pushed again. */
+int imx_vpu_index_return_queue_next(ImxVpuIndexReturnQueue *queue, int index);
+
+
+/* Keeps track of which framebuffers are free, and maps addresses (for example,
+ * of backend-specific framebuffer structures) to framebuffer indices. Free
+ * framebuffers are stored as set bits in free_mask, so finding one only needs
+ * to look at one 32-bit word per 32 framebuffers. The addresses are stored in
+ * an open addressing hash table with linear probing; its size is a power of 2
+ * and at least twice the number of framebuffers, so lookups practically never
+ * have to probe more than one or two slots. */
+typedef struct
+{
+	void const *address;
+	int index;
+}
+ImxVpuFramebufferTrackerSlot;
+
+typedef struct
+{
+	uint32_t *free_mask;
+	unsigned int num_free_mask_words;
+
+	ImxVpuFramebufferTrackerSlot *address_slots;
+	unsigned int num_address_slots;
+
+	unsigned int num_framebuffers;
+}
+ImxVpuFramebufferTracker;
+
+/* Allocates the tracker's arrays. Initially, all framebuffers are marked as free,
+ * and no addresses are associated. Returns 0 if allocation failed, nonzero otherwise. */
+int imx_vpu_framebuffer_tracker_init(ImxVpuFramebufferTracker *tracker, unsigned int num_framebuffers);
+/* Frees the tracker's arrays. Safe to call if the tracker was never initialized,
+ * provided that it was zeroed. */
+void imx_vpu_framebuffer_tracker_cleanup(ImxVpuFramebufferTracker *tracker);
+/* Marks the framebuffer with the given index as free or as used. */
+void imx_vpu_framebuffer_tracker_set_free(ImxVpuFramebufferTracker *tracker, unsigned int index, int is_free);
+/* Returns the index of a free framebuffer (the lowest one), or -1 if all are in use. */
+int imx_vpu_framebuffer_tracker_find_free(ImxVpuFramebufferTracker *tracker);
+/* Associates an address with the framebuffer index. Each address must be unique. */
+void imx_vpu_framebuffer_tracker_set_address(ImxVpuFramebufferTracker *tracker, unsigned int index, void const *address);
+/* Returns the index associated with the address, or -1 if there is none. */
+int imx_vpu_framebuffer_tracker_lookup_address(ImxVpuFramebufferTracker *tracker, void const *address);
+
+
+/* Rate adaptation engine, shared by the backends (see imx_vpu_enc_enable_rate_adaptation()).
+ * The backends store one adapter in their encoder structure, call begin_frame before starting
+ * the VPU, and end_frame once the frame is done. */
+typedef struct
+{
+	int enabled;
+	ImxVpuEncRateAdaptationParams params;
+
+	/* Nonzero if the encoder was opened with a nonzero bitrate */
+	int rate_control_enabled;
+	unsigned int frame_rate_numerator, frame_rate_denominator;
+	/* QP limits, with the -1 values of params replaced by the codec format's limits */
+	unsigned int min_qp, max_qp;
+
+	unsigned int target_bitrate, bitrate, quant_param;
+	/* Both in bits */
+	uint64_t buffer_size, buffer_fill_level;
+
+	/* I frame request that is being postponed, and for how many frames so far */
+	int I_frame_postponed;
+	unsigned int num_postponing_frames;
+
+	unsigned long num_frames, num_skipped_frames, num_postponed_I_frames;
+
+	/* Frame that is currently being encoded */
+	ImxVpuEncRateAdaptationFrameInfo cur_frame;
+
+	/* Ring buffer with the most recent frames */
+	ImxVpuEncRateAdaptationFrameInfo history[IMX_VPU_ENC_RATE_ADAPTATION_HISTORY_LENGTH];
+	unsigned int history_start, num_history_entries;
+}
+ImxVpuEncRateAdapter;
+
+/* Sets up the adapter for an encoder opened with open_params. If params is NULL, the adapter
+ * is disabled. Returns 0 if the codec format or the parameters are not supported, nonzero
+ * otherwise. */
+int imx_vpu_enc_rate_adapter_init(ImxVpuEncRateAdapter *adapter, ImxVpuEncRateAdaptationParams const *params, ImxVpuEncOpenParams const *open_params);
+/* Calls the target bitrate callback, and modifies encoding_params for the next frame. If the
+ * bitrate of the VPU's rate control needs to change, it returns the new bitrate, which the
+ * backend then sets like imx_vpu_enc_configure_bitrate() does. Otherwise, it returns 0. */
+unsigned int imx_vpu_enc_rate_adapter_begin_frame(ImxVpuEncRateAdapter *adapter, ImxVpuEncoder *encoder, ImxVpuEncParams *encoding_params);
+/* Updates the bucket and the history with the result of the frame. encoded_size is 0 if the
+ * frame failed or produced no data. */
+void imx_vpu_enc_rate_adapter_end_frame(ImxVpuEncRateAdapter *adapter, size_t encoded_size, ImxVpuFrameType frame_type);
+/* Fills state; used for imx_vpu_enc_get_rate_adaptation_state(). */
+void imx_vpu_enc_rate_adapter_get_state(ImxVpuEncRateAdapter const *adapter, ImxVpuEncRateAdaptationState *state);
+
+
+/* Backend functions used by the encoder state code in imxvpuapi.c (see
+ * imx_vpu_enc_save_state()). imx_vpu_enc_get_state_params() copies the
+ * parameters the encoder was opened with and its initial info. It returns 0
+ * if the initial info is not available yet, nonzero otherwise.
+ * imx_vpu_enc_set_headers_restored() informs the encoder that its header data
+ * was restored, so it does not have to generate it in imx_vpu_enc_get_initial_info(). */
+int imx_vpu_enc_get_state_params(ImxVpuEncoder *encoder, ImxVpuEncOpenParams *open_params, ImxVpuEncInitialInfo *initial_info);
+void imx_vpu_enc_set_headers_restored(ImxVpuEncoder *encoder);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,534 @@
+/* Scheduler for sharing the Freescale i.MX VPU among multiple en- and decoders
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+#include <assert.h>
+#include <string.h>
+#include "imxvpuapi_scheduler.h"
+#include "imxvpuapi_priv.h"
+
+
+/* Weighted VPU times are scaled by this factor to retain
+ * precision when dividing them by the priority */
+#define WEIGHTED_TIME_SCALE 256
+
+
+
+
+typedef struct
+{
+	void *job_context;
+	uint64_t deadline;
+
+	union
+	{
+		ImxVpuEncodedFrame encoded_frame;
+
+		struct
+		{
+			ImxVpuRawFrame raw_frame;
+			ImxVpuEncParams encoding_params;
+		}
+		encode;
+	}
+	input;
+}
+ImxVpuSchedulerJob;
+
+
+struct _ImxVpuSchedulerInstance
+{
+	ImxVpuScheduler *scheduler;
+	ImxVpuSchedulerInstance *next;
+
+	/* Exactly one of these is non-NULL */
+	ImxVpuDecoder *decoder;
+	ImxVpuEncoder *encoder;
+
+	imx_vpu_scheduler_decode_done_callback decode_done_callback;
+	imx_vpu_scheduler_encode_done_callback encode_done_callback;
+	void *user_data;
+
+	unsigned int priority;
+
+	/* Job queue; this is a ring buffer */
+	ImxVpuSchedulerJob *jobs;
+	unsigned int max_num_jobs, first_job_idx, num_jobs;
+
+	/* VPU time divided by the priority, scaled by WEIGHTED_TIME_SCALE */
+	uint64_t weighted_vpu_time;
+
+	unsigned long num_finished_jobs;
+	unsigned long num_missed_deadlines;
+	uint64_t vpu_time;
+	uint64_t time_added;
+};
+
+
+struct _ImxVpuScheduler
+{
+	/* Singly linked list of instances, in the order they were added */
+	ImxVpuSchedulerInstance *first_instance;
+
+	/* Instance whose job is currently being processed by the VPU. NULL
+	 * if the VPU is idle. running_job_vpu_done is nonzero if the VPU
+	 * finished the job, but imx_vpu_*_finish() was not called yet. */
+	ImxVpuSchedulerInstance *running_instance;
+	ImxVpuSchedulerJob running_job;
+	uint64_t running_job_start_time;
+	int running_job_vpu_done;
+
+	/* Weighted VPU time of the most recently started instance.
+	 * Instances which are added, or which were idle, start from
+	 * this value. Otherwise, they would accumulate "credit" while
+	 * idle, which they would then use to starve other instances. */
+	uint64_t weighted_vpu_time_floor;
+};
+
+
+static ImxVpuSchedulerInstance* imx_vpu_scheduler_add_instance(ImxVpuScheduler *scheduler, unsigned int priority, unsigned int max_num_queued_jobs, void *user_data);
+static ImxVpuSchedulerJob* imx_vpu_scheduler_push_job(ImxVpuSchedulerInstance *instance, uint64_t deadline, void *job_context);
+static ImxVpuSchedulerInstance* imx_vpu_scheduler_pick_next_instance(ImxVpuScheduler *scheduler);
+static void imx_vpu_scheduler_start_next_job(ImxVpuScheduler *scheduler);
+static int imx_vpu_scheduler_poll_running_job(ImxVpuScheduler *scheduler, unsigned int timeout_ms);
+static void imx_vpu_scheduler_account_vpu_time(ImxVpuScheduler *scheduler);
+static void imx_vpu_scheduler_finish_running_job(ImxVpuScheduler *scheduler);
+
+
+
+
+ImxVpuScheduler* imx_vpu_scheduler_create(void)
+{
+	ImxVpuScheduler *scheduler = IMX_VPU_ALLOC(sizeof(ImxVpuScheduler));
+	if (scheduler == NULL)
+	{
+		IMX_VPU_ERROR("allocating memory for scheduler failed");
+		return NULL;
+	}
+
+	memset(scheduler, 0, sizeof(ImxVpuScheduler));
+
+	return scheduler;
+}
+
+
+void imx_vpu_scheduler_destroy(ImxVpuScheduler *scheduler)
+{
+	if (scheduler == NULL)
+		return;
+
+	while (scheduler->first_instance != NULL)
+		imx_vpu_scheduler_remove_instance(scheduler, scheduler->first_instance);
+
+	IMX_VPU_FREE(scheduler, sizeof(ImxVpuScheduler));
+}
+
+
+ImxVpuSchedulerInstance* imx_vpu_scheduler_add_decoder(ImxVpuScheduler *scheduler, ImxVpuDecoder *decoder, unsigned int priority, unsigned int max_num_queued_jobs, imx_vpu_scheduler_decode_done_callback callback, void *user_data)
+{
+	ImxVpuSchedulerInstance *instance;
+
+	assert(decoder != NULL);
+	assert(callback != NULL);
+
+	instance = imx_vpu_scheduler_add_instance(scheduler, priority, max_num_queued_jobs, user_data);
+	if (instance == NULL)
+		return NULL;
+
+	instance->decoder = decoder;
+	instance->decode_done_callback = callback;
+
+	return instance;
+}
+
+
+ImxVpuSchedulerInstance* imx_vpu_scheduler_add_encoder(ImxVpuScheduler *scheduler, ImxVpuEncoder *encoder, unsigned int priority, unsigned int max_num_queued_jobs, imx_vpu_scheduler_encode_done_callback callback, void *user_data)
+{
+	ImxVpuSchedulerInstance *instance;
+
+	assert(encoder != NULL);
+	assert(callback != NULL);
+
+	instance = imx_vpu_scheduler_add_instance(scheduler, priority, max_num_queued_jobs, user_data);
+	if (instance == NULL)
+		return NULL;
+
+	instance->encoder = encoder;
+	instance->encode_done_callback = callback;
+
+	return instance;
+}
+
+
+void imx_vpu_scheduler_remove_instance(ImxVpuScheduler *scheduler, ImxVpuSchedulerInstance *instance)
+{
+	ImxVpuSchedulerInstance **link;
+
+	assert(scheduler != NULL);
+	assert(instance != NULL);
+	assert(instance->scheduler == scheduler);
+
+	/* The running job has to be finished, otherwise, the
+	 * en/decoder would be left in an inconsistent state */
+	if (scheduler->running_instance == instance)
+		imx_vpu_scheduler_finish_running_job(scheduler);
+
+	for (link = &(scheduler->first_instance); *link != NULL; link = &((*link)->next))
+	{
+		if (*link == instance)
+		{
+			*link = instance->next;
+			break;
+		}
+	}
+
+	if (instance->num_jobs > 0)
+		IMX_VPU_DEBUG("discarding %u queued job(s) of removed instance %p", instance->num_jobs, (void *)instance);
+
+	IMX_VPU_FREE(instance->jobs, sizeof(ImxVpuSchedulerJob) * instance->max_num_jobs);
+	IMX_VPU_FREE(instance, sizeof(ImxVpuSchedulerInstance));
+}
+
+
+void imx_vpu_scheduler_set_priority(ImxVpuSchedulerInstance *instance, unsigned int priority)
+{
+	assert(instance != NULL);
+	assert(priority >= 1);
+
+	instance->priority = priority;
+}
+
+
+void imx_vpu_scheduler_get_instance_stats(ImxVpuSchedulerInstance *instance, ImxVpuSchedulerInstanceStats *stats)
+{
+	assert(instance != NULL);
+	assert(stats != NULL);
+
+	stats->num_queued_jobs = instance->num_jobs;
+	stats->num_finished_jobs = instance->num_finished_jobs;
+	stats->num_missed_deadlines = instance->num_missed_deadlines;
+	stats->vpu_time = instance->vpu_time;
+	stats->elapsed_time = imx_vpu_scheduler_get_time() - instance->time_added;
+}
+
+
+int imx_vpu_scheduler_submit_decode_job(ImxVpuSchedulerInstance *instance, ImxVpuEncodedFrame const *encoded_frame, uint64_t deadline, void *job_context)
+{
+	ImxVpuSchedulerJob *job;
+
+	assert(instance != NULL);
+	assert(instance->decoder != NULL);
+	assert(encoded_frame != NULL);
+
+	job = imx_vpu_scheduler_push_job(instance, deadline, job_context);
+	if (job == NULL)
+		return 0;
+
+	job->input.encoded_frame = *encoded_frame;
+
+	return 1;
+}
+
+
+int imx_vpu_scheduler_submit_encode_job(ImxVpuSchedulerInstance *instance, ImxVpuRawFrame const *raw_frame, ImxVpuEncParams const *encoding_params, uint64_t deadline, void *job_context)
+{
+	ImxVpuSchedulerJob *job;
+
+	assert(instance != NULL);
+	assert(instance->encoder != NULL);
+	assert(raw_frame != NULL);
+	assert(encoding_params != NULL);
+
+	job = imx_vpu_scheduler_push_job(instance, deadline, job_context);
+	if (job == NULL)
+		return 0;
+
+	job->input.encode.raw_frame = *raw_frame;
+	job->input.encode.encoding_params = *encoding_params;
+
+	return 1;
+}
+
+
+unsigned int imx_vpu_scheduler_process(ImxVpuScheduler *scheduler, unsigned int timeout_ms)
+{
+	unsigned int num_finished_jobs = 0;
+
+	assert(scheduler != NULL);
+
+	if (scheduler->running_instance == NULL)
+		imx_vpu_scheduler_start_next_job(scheduler);
+
+	/* Only the first poll may block. Subsequent jobs are just started,
+	 * unless they finish right away (this happens for example when the
+	 * decoder needs more input data before it can actually decode). */
+	while ((scheduler->running_instance != NULL) && imx_vpu_scheduler_poll_running_job(scheduler, timeout_ms))
+	{
+		imx_vpu_scheduler_finish_running_job(scheduler);
+		++num_finished_jobs;
+
+		imx_vpu_scheduler_start_next_job(scheduler);
+		timeout_ms = 0;
+	}
+
+	return num_finished_jobs;
+}
+
+
+int imx_vpu_scheduler_has_jobs(ImxVpuScheduler *scheduler)
+{
+	ImxVpuSchedulerInstance *instance;
+
+	assert(scheduler != NULL);
+
+	if (scheduler->running_instance != NULL)
+		return 1;
+
+	for (instance = scheduler->first_instance; instance != NULL; instance = instance->next)
+	{
+		if (instance->num_jobs > 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+uint64_t imx_vpu_scheduler_get_time(void)
+{
+	return imx_vpu_get_monotonic_time();
+}
+
+
+static ImxVpuSchedulerInstance* imx_vpu_scheduler_add_instance(ImxVpuScheduler *scheduler, unsigned int priority, unsigned int max_num_queued_jobs, void *user_data)
+{
+	ImxVpuSchedulerInstance *instance, **link;
+
+	assert(scheduler != NULL);
+	assert(priority >= 1);
+	assert(max_num_queued_jobs >= 1);
+
+	instance = IMX_VPU_ALLOC(sizeof(ImxVpuSchedulerInstance));
+	if (instance == NULL)
+	{
+		IMX_VPU_ERROR("allocating memory for scheduler instance failed");
+		return NULL;
+	}
+
+	memset(instance, 0, sizeof(ImxVpuSchedulerInstance));
+
+	instance->jobs = IMX_VPU_ALLOC(sizeof(ImxVpuSchedulerJob) * max_num_queued_jobs);
+	if (instance->jobs == NULL)
+	{
+		IMX_VPU_ERROR("allocating memory for scheduler job queue failed");
+		IMX_VPU_FREE(instance, sizeof(ImxVpuSchedulerInstance));
+		return NULL;
+	}
+
+	instance->scheduler = scheduler;
+	instance->user_data = user_data;
+	instance->priority = priority;
+	instance->max_num_jobs = max_num_queued_jobs;
+	instance->weighted_vpu_time = scheduler->weighted_vpu_time_floor;
+	instance->time_added = imx_vpu_scheduler_get_time();
+
+	/* Append the instance, to let the add order decide in case of ties */
+	for (link = &(scheduler->first_instance); *link != NULL; link = &((*link)->next))
+		;
+	*link = instance;
+
+	return instance;
+}
+
+
+static ImxVpuSchedulerJob* imx_vpu_scheduler_push_job(ImxVpuSchedulerInstance *instance, uint64_t deadline, void *job_context)
+{
+	ImxVpuSchedulerJob *job;
+	ImxVpuScheduler *scheduler = instance->scheduler;
+
+	if (instance->num_jobs >= instance->max_num_jobs)
+	{
+		IMX_VPU_DEBUG("job queue of instance %p is full", (void *)instance);
+		return NULL;
+	}
+
+	/* An instance that was idle must not have accumulated credit
+	 * in the meantime (see weighted_vpu_time_floor) */
+	if ((instance->num_jobs == 0) && (scheduler->running_instance != instance) && (instance->weighted_vpu_time < scheduler->weighted_vpu_time_floor))
+		instance->weighted_vpu_time = scheduler->weighted_vpu_time_floor;
+
+	job = &(instance->jobs[(instance->first_job_idx + instance->num_jobs) % instance->max_num_jobs]);
+	memset(job, 0, sizeof(ImxVpuSchedulerJob));
+	job->deadline = deadline;
+	job->job_context = job_context;
+
+	instance->num_jobs++;
+
+	return job;
+}
+
+
+static ImxVpuSchedulerInstance* imx_vpu_scheduler_pick_next_instance(ImxVpuScheduler *scheduler)
+{
+	ImxVpuSchedulerInstance *instance;
+	ImxVpuSchedulerInstance *earliest_deadline_instance = NULL;
+	ImxVpuSchedulerInstance *least_vpu_time_instance = NULL;
+	uint64_t earliest_deadline = 0;
+
+	for (instance = scheduler->first_instance; instance != NULL; instance = instance->next)
+	{
+		ImxVpuSchedulerJob *job;
+
+		if (instance->num_jobs == 0)
+			continue;
+
+		job = &(instance->jobs[instance->first_job_idx]);
+
+		if ((job->deadline != IMX_VPU_SCHEDULER_NO_DEADLINE) && ((earliest_deadline_instance == NULL) || (job->deadline < earliest_deadline)))
+		{
+			earliest_deadline_instance = instance;
+			earliest_deadline = job->deadline;
+		}
+
+		if ((least_vpu_time_instance == NULL) || (instance->weighted_vpu_time < least_vpu_time_instance->weighted_vpu_time))
+			least_vpu_time_instance = instance;
+	}
+
+	return (earliest_deadline_instance != NULL) ? earliest_deadline_instance : least_vpu_time_instance;
+}
+
+
+static void imx_vpu_scheduler_start_next_job(ImxVpuScheduler *scheduler)
+{
+	ImxVpuSchedulerInstance *instance;
+
+	assert(scheduler->running_instance == NULL);
+
+	/* Loop until a job could be started, or there are no more jobs.
+	 * Jobs that fail to start are reported to their callbacks right away. */
+	while ((instance = imx_vpu_scheduler_pick_next_instance(scheduler)) != NULL)
+	{
+		ImxVpuSchedulerJob *job = &(scheduler->running_job);
+
+		*job = instance->jobs[instance->first_job_idx];
+		instance->first_job_idx = (instance->first_job_idx + 1) % instance->max_num_jobs;
+		instance->num_jobs--;
+
+		if (instance->weighted_vpu_time > scheduler->weighted_vpu_time_floor)
+			scheduler->weighted_vpu_time_floor = instance->weighted_vpu_time;
+
+		scheduler->running_job_start_time = imx_vpu_scheduler_get_time();
+		scheduler->running_job_vpu_done = 0;
+
+		if (instance->decoder != NULL)
+		{
+			ImxVpuDecReturnCodes ret = imx_vpu_dec_decode_start(instance->decoder, &(job->input.encoded_frame));
+			if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
+			{
+				IMX_VPU_ERROR("could not start decoding job: %s", imx_vpu_dec_error_string(ret));
+				instance->decode_done_callback(instance, ret, 0, job->job_context, instance->user_data);
+				continue;
+			}
+		}
+		else
+		{
+			ImxVpuEncReturnCodes ret = imx_vpu_enc_encode_start(instance->encoder, &(job->input.encode.raw_frame), &(job->input.encode.encoding_params));
+			if (ret != IMX_VPU_ENC_RETURN_CODE_OK)
+			{
+				ImxVpuEncodedFrame encoded_frame;
+				memset(&encoded_frame, 0, sizeof(encoded_frame));
+				IMX_VPU_ERROR("could not start encoding job: %s", imx_vpu_enc_error_string(ret));
+				instance->encode_done_callback(instance, ret, &encoded_frame, 0, job->job_context, instance->user_data);
+				continue;
+			}
+		}
+
+		IMX_VPU_LOG("started job of instance %p", (void *)instance);
+		scheduler->running_instance = instance;
+		break;
+	}
+}
+
+
+static int imx_vpu_scheduler_poll_running_job(ImxVpuScheduler *scheduler, unsigned int timeout_ms)
+{
+	ImxVpuSchedulerInstance *instance = scheduler->running_instance;
+	int done;
+
+	if (scheduler->running_job_vpu_done)
+		return 1;
+
+	if (instance->decoder != NULL)
+		done = imx_vpu_dec_decode_poll(instance->decoder, timeout_ms);
+	else
+		done = imx_vpu_enc_encode_poll(instance->encoder, timeout_ms);
+
+	if (done)
+		imx_vpu_scheduler_account_vpu_time(scheduler);
+
+	return done;
+}
+
+
+static void imx_vpu_scheduler_account_vpu_time(ImxVpuScheduler *scheduler)
+{
+	ImxVpuSchedulerInstance *instance = scheduler->running_instance;
+	uint64_t vpu_time = imx_vpu_scheduler_get_time() - scheduler->running_job_start_time;
+
+	instance->vpu_time += vpu_time;
+	instance->weighted_vpu_time += vpu_time * WEIGHTED_TIME_SCALE / instance->priority;
+	scheduler->running_job_vpu_done = 1;
+}
+
+
+static void imx_vpu_scheduler_finish_running_job(ImxVpuScheduler *scheduler)
+{
+	ImxVpuSchedulerInstance *instance = scheduler->running_instance;
+	ImxVpuSchedulerJob *job = &(scheduler->running_job);
+	unsigned int output_code = 0;
+	ImxVpuDecReturnCodes dec_ret = IMX_VPU_DEC_RETURN_CODE_OK;
+	ImxVpuEncReturnCodes enc_ret = IMX_VPU_ENC_RETURN_CODE_OK;
+	ImxVpuEncodedFrame encoded_frame;
+
+	assert(instance != NULL);
+
+	/* If the completion wasn't detected by a poll yet, the
+	 * finish calls block until the VPU is done */
+	memset(&encoded_frame, 0, sizeof(encoded_frame));
+	if (instance->decoder != NULL)
+		dec_ret = imx_vpu_dec_decode_finish(instance->decoder, &output_code);
+	else
+		enc_ret = imx_vpu_enc_encode_finish(instance->encoder, &encoded_frame, &output_code);
+
+	if (!(scheduler->running_job_vpu_done))
+		imx_vpu_scheduler_account_vpu_time(scheduler);
+
+	instance->num_finished_jobs++;
+	if ((job->deadline != IMX_VPU_SCHEDULER_NO_DEADLINE) && (imx_vpu_scheduler_get_time() > job->deadline))
+		instance->num_missed_deadlines++;
+
+	/* Clear this before invoking the callback, to allow for
+	 * submitting jobs and removing instances from inside it */
+	scheduler->running_instance = NULL;
+
+	if (instance->decoder != NULL)
+		instance->decode_done_callback(instance, dec_ret, output_code, job->job_context, instance->user_data);
+	else
+		instance->encode_done_callback(instance, enc_ret, &encoded_frame, output_code, job->job_context, instance->user_data);
+}
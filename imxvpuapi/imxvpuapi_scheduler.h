@@ -0,0 +1,171 @@
+/* Scheduler for sharing the Freescale i.MX VPU among multiple en- and decoders
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+/* The VPU is one hardware core which is shared by all decoder and encoder
+ * instances. It can only process one frame at a time. If multiple instances
+ * are used by different threads, these compete for the VPU, with no control
+ * over which instance gets to use it next. The scheduler solves this by
+ * queuing frame jobs from many instances, and running them one after the
+ * other, using the asynchronous start/poll/finish functions. As soon as one
+ * job finishes, the next one is started, so the VPU does not stay idle
+ * between jobs.
+ *
+ * The next job is picked as follows:
+ *
+ * 1. If the first queued job of any instance has a deadline, the job with the
+ *    earliest deadline is picked.
+ * 2. Otherwise, the job of the instance with the smallest weighted VPU time is
+ *    picked. The weighted VPU time is the total time the VPU spent on the
+ *    instance's jobs, divided by the instance's priority. An instance with
+ *    priority 2 therefore gets twice as much VPU time as an instance with
+ *    priority 1. This way, an instance with large frames cannot starve
+ *    instances with small ones.
+ *
+ * Jobs of the same instance are always run in the order they were submitted.
+ *
+ * The scheduler is not thread safe. It, and the en- and decoders that were
+ * added to it, must be used from one thread only. Typically, this is an
+ * event loop thread which calls imx_vpu_scheduler_process() repeatedly. The
+ * added en- and decoders must not be used directly while they are part of
+ * the scheduler (except for functions which do not access the VPU, like
+ * imx_vpu_dec_get_decoded_frame() and imx_vpu_dec_mark_framebuffer_as_displayed()).
+ */
+
+#ifndef IMXVPUAPI_SCHEDULER_H
+#define IMXVPUAPI_SCHEDULER_H
+
+#include "imxvpuapi.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct _ImxVpuScheduler ImxVpuScheduler;
+typedef struct _ImxVpuSchedulerInstance ImxVpuSchedulerInstance;
+
+
+/* Deadline value for jobs which have no deadline. */
+#define IMX_VPU_SCHEDULER_NO_DEADLINE 0
+
+
+/* Callback for finished decoding jobs. ret and output_code are the values
+ * imx_vpu_dec_decode_finish() returned. job_context is the value that was passed to
+ * imx_vpu_scheduler_submit_decode_job(). user_data is the value that was passed to
+ * imx_vpu_scheduler_add_decoder(). Decoded frames can be retrieved from inside the
+ * callback with imx_vpu_dec_get_decoded_frame(). */
+typedef void (*imx_vpu_scheduler_decode_done_callback)(ImxVpuSchedulerInstance *instance, ImxVpuDecReturnCodes ret, unsigned int output_code, void *job_context, void *user_data);
+
+/* Callback for finished encoding jobs. ret, encoded_frame, and output_code are the
+ * values imx_vpu_enc_encode_finish() produced. encoded_frame is only valid during this
+ * callback. job_context is the value that was passed to imx_vpu_scheduler_submit_encode_job().
+ * user_data is the value that was passed to imx_vpu_scheduler_add_encoder(). */
+typedef void (*imx_vpu_scheduler_encode_done_callback)(ImxVpuSchedulerInstance *instance, ImxVpuEncReturnCodes ret, ImxVpuEncodedFrame *encoded_frame, unsigned int output_code, void *job_context, void *user_data);
+
+
+/* Statistics about an instance. Times are in microseconds. */
+typedef struct
+{
+	/* Number of jobs that are queued and not started yet. */
+	unsigned int num_queued_jobs;
+	/* Number of jobs that have been finished so far. */
+	unsigned long num_finished_jobs;
+	/* Number of jobs that were finished after their deadline. */
+	unsigned long num_missed_deadlines;
+
+	/* Time the VPU spent on this instance's jobs. */
+	uint64_t vpu_time;
+	/* Time since the instance was added to the scheduler. The VPU
+	 * utilization by this instance is vpu_time / elapsed_time. */
+	uint64_t elapsed_time;
+}
+ImxVpuSchedulerInstanceStats;
+
+
+/* Creates a new scheduler. Returns NULL if memory allocation failed. */
+ImxVpuScheduler* imx_vpu_scheduler_create(void);
+
+/* Destroys the scheduler. All instances which are still part of it are removed
+ * (see imx_vpu_scheduler_remove_instance()). The en- and decoders themselves are
+ * not closed. */
+void imx_vpu_scheduler_destroy(ImxVpuScheduler *scheduler);
+
+/* Adds a decoder to the scheduler. The decoder must already be open. priority
+ * must be at least 1 (see the description at the top for how it is used).
+ * max_num_queued_jobs is the maximum number of jobs that can be queued for this
+ * decoder at the same time. callback is invoked for each finished job, and must
+ * not be NULL. Returns NULL if memory allocation failed. */
+ImxVpuSchedulerInstance* imx_vpu_scheduler_add_decoder(ImxVpuScheduler *scheduler, ImxVpuDecoder *decoder, unsigned int priority, unsigned int max_num_queued_jobs, imx_vpu_scheduler_decode_done_callback callback, void *user_data);
+
+/* Adds an encoder to the scheduler. Other than that, this is the same as
+ * imx_vpu_scheduler_add_decoder(). */
+ImxVpuSchedulerInstance* imx_vpu_scheduler_add_encoder(ImxVpuScheduler *scheduler, ImxVpuEncoder *encoder, unsigned int priority, unsigned int max_num_queued_jobs, imx_vpu_scheduler_encode_done_callback callback, void *user_data);
+
+/* Removes an instance from the scheduler. If one of its jobs is currently being
+ * processed by the VPU, this function waits until it is finished, and invokes its
+ * callback. Queued jobs which haven't been started yet are discarded, and their
+ * callbacks are not invoked. After this call, the instance pointer is invalid. */
+void imx_vpu_scheduler_remove_instance(ImxVpuScheduler *scheduler, ImxVpuSchedulerInstance *instance);
+
+/* Changes the priority of an instance. priority must be at least 1. */
+void imx_vpu_scheduler_set_priority(ImxVpuSchedulerInstance *instance, unsigned int priority);
+
+/* Retrieves statistics about an instance. stats must not be NULL. */
+void imx_vpu_scheduler_get_instance_stats(ImxVpuSchedulerInstance *instance, ImxVpuSchedulerInstanceStats *stats);
+
+/* Queues a decoding job. encoded_frame is copied, but the memory block its data
+ * pointer refers to must remain valid until the job's callback is invoked.
+ * deadline is an absolute time in microseconds, using the same clock as
+ * imx_vpu_scheduler_get_time(), or IMX_VPU_SCHEDULER_NO_DEADLINE. job_context
+ * is passed to the callback. Returns 0 if the instance's job queue is full,
+ * nonzero otherwise.
+ *
+ * Note that the decoder may run out of free framebuffers if too many jobs are
+ * queued, since the scheduler does not know when decoded frames are returned
+ * with imx_vpu_dec_mark_framebuffer_as_displayed(). Use imx_vpu_dec_check_if_can_decode()
+ * before submitting jobs, just like before imx_vpu_dec_decode() calls. */
+int imx_vpu_scheduler_submit_decode_job(ImxVpuSchedulerInstance *instance, ImxVpuEncodedFrame const *encoded_frame, uint64_t deadline, void *job_context);
+
+/* Queues an encoding job. raw_frame and encoding_params are copied, but the raw
+ * frame's framebuffer must not be modified until the job's callback is invoked.
+ * Other than that, this is the same as imx_vpu_scheduler_submit_decode_job(). */
+int imx_vpu_scheduler_submit_encode_job(ImxVpuSchedulerInstance *instance, ImxVpuRawFrame const *raw_frame, ImxVpuEncParams const *encoding_params, uint64_t deadline, void *job_context);
+
+/* Runs the scheduler. If the VPU is processing a job, this waits for up to timeout_ms
+ * milliseconds for it to finish. Finished jobs get their callbacks invoked, and the
+ * next job is started right away. If timeout_ms is 0, this function never blocks.
+ * Returns the number of jobs that were finished during this call. */
+unsigned int imx_vpu_scheduler_process(ImxVpuScheduler *scheduler, unsigned int timeout_ms);
+
+/* Returns nonzero if a job is being processed or queued. */
+int imx_vpu_scheduler_has_jobs(ImxVpuScheduler *scheduler);
+
+/* Returns the current time of the clock used for deadlines, in microseconds.
+ * This is a monotonic clock. */
+uint64_t imx_vpu_scheduler_get_time(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,627 @@
+/* imxvpuapi transcoder, passing decoded frames directly into an encoder
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+#include <assert.h>
+#include <string.h>
+#include "imxvpuapi_transcoder.h"
+#include "imxvpuapi_priv.h"
+
+
+/* One decoder framebuffer is held by the encoding that is in progress,
+ * so the decoder needs one more than its minimum to keep decoding */
+#define NUM_PIPELINE_FRAMEBUFFERS 1
+
+
+
+
+typedef struct
+{
+	ImxVpuFramebuffer *framebuffers;
+	ImxVpuDMABuffer **dmabuffers;
+	unsigned int num_framebuffers;
+	ImxVpuFramebufferSizes calculated_sizes;
+}
+ImxVpuTranscoderFramebufferSet;
+
+
+struct _ImxVpuTranscoder
+{
+	ImxVpuDecoder *decoder;
+	ImxVpuEncoder *encoder;
+
+	ImxVpuDMABufferAllocator *dma_buffer_allocator;
+
+	ImxVpuDMABuffer *dec_bitstream_buffer;
+	ImxVpuDMABuffer *enc_bitstream_buffer;
+
+	ImxVpuEncOpenParams enc_open_params;
+	int chroma_interleave;
+	unsigned int num_extra_framebuffers;
+
+	ImxVpuTranscoderEncodedFrameCallback encoded_frame_callback;
+	void *callback_user_data;
+
+	/* The decoder's framebuffers, which are also the encoder's input frames,
+	 * and the encoder's own framebuffers (for reconstructed and reference frames) */
+	ImxVpuTranscoderFramebufferSet dec_framebuffers;
+	ImxVpuTranscoderFramebufferSet enc_framebuffers;
+
+	/* If nonzero, the decoded frames are 4:2:2 with horizontal subsampling,
+	 * and the encoder reads every second chroma row */
+	int skip_chroma_rows;
+
+	/* State of the encoding that is in progress. encoder_input_framebuffer
+	 * is the framebuffer the encoder reads from. It is a copy of the decoded
+	 * framebuffer, with a doubled chroma stride if skip_chroma_rows is set. */
+	int encoding_pending;
+	ImxVpuFramebuffer *pending_dec_framebuffer;
+	ImxVpuFramebuffer encoder_input_framebuffer;
+};
+
+
+static unsigned int imx_vpu_transcoder_lcm(unsigned int a, unsigned int b);
+static int imx_vpu_transcoder_allocate_framebuffers(ImxVpuTranscoder *transcoder, ImxVpuTranscoderFramebufferSet *set, unsigned int num_framebuffers, unsigned int alignment);
+static void imx_vpu_transcoder_deallocate_framebuffers(ImxVpuTranscoderFramebufferSet *set);
+static void imx_vpu_transcoder_close_encoder(ImxVpuTranscoder *transcoder);
+static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *new_initial_info, unsigned int output_code, void *user_data);
+static ImxVpuDecReturnCodes imx_vpu_transcoder_finish_encoding(ImxVpuTranscoder *transcoder);
+static ImxVpuDecReturnCodes imx_vpu_transcoder_start_encoding(ImxVpuTranscoder *transcoder, unsigned int dec_output_code, ImxVpuEncParams *encoding_params);
+
+
+
+
+/*************************************/
+/******* FRAMEBUFFER MANAGEMENT ******/
+/*************************************/
+
+
+static unsigned int imx_vpu_transcoder_lcm(unsigned int a, unsigned int b)
+{
+	unsigned int x, y;
+
+	a = (a > 1) ? a : 1;
+	b = (b > 1) ? b : 1;
+
+	/* Euclid's algorithm for the greatest common divisor */
+	for (x = a, y = b; y != 0;)
+	{
+		unsigned int r = x % y;
+		x = y;
+		y = r;
+	}
+
+	return a / x * b;
+}
+
+
+static int imx_vpu_transcoder_allocate_framebuffers(ImxVpuTranscoder *transcoder, ImxVpuTranscoderFramebufferSet *set, unsigned int num_framebuffers, unsigned int alignment)
+{
+	unsigned int i;
+
+	assert(set->framebuffers == NULL);
+
+	set->framebuffers = IMX_VPU_ALLOC(sizeof(ImxVpuFramebuffer) * num_framebuffers);
+	set->dmabuffers = IMX_VPU_ALLOC(sizeof(ImxVpuDMABuffer *) * num_framebuffers);
+	set->num_framebuffers = num_framebuffers;
+
+	if ((set->framebuffers == NULL) || (set->dmabuffers == NULL))
+	{
+		IMX_VPU_ERROR("allocating memory for framebuffer structures failed");
+		return 0;
+	}
+
+	memset(set->framebuffers, 0, sizeof(ImxVpuFramebuffer) * num_framebuffers);
+	memset(set->dmabuffers, 0, sizeof(ImxVpuDMABuffer *) * num_framebuffers);
+
+	for (i = 0; i < num_framebuffers; ++i)
+	{
+		set->dmabuffers[i] = imx_vpu_dma_buffer_allocate(transcoder->dma_buffer_allocator, set->calculated_sizes.total_size, alignment, 0);
+		if (set->dmabuffers[i] == NULL)
+		{
+			IMX_VPU_ERROR("could not allocate DMA buffer for framebuffer #%u", i);
+			return 0;
+		}
+
+		imx_vpu_fill_framebuffer_params(&(set->framebuffers[i]), &(set->calculated_sizes), set->dmabuffers[i], 0);
+	}
+
+	return 1;
+}
+
+
+static void imx_vpu_transcoder_deallocate_framebuffers(ImxVpuTranscoderFramebufferSet *set)
+{
+	unsigned int i;
+
+	if (set->dmabuffers != NULL)
+	{
+		for (i = 0; i < set->num_framebuffers; ++i)
+		{
+			if (set->dmabuffers[i] != NULL)
+				imx_vpu_dma_buffer_deallocate(set->dmabuffers[i]);
+		}
+
+		IMX_VPU_FREE(set->dmabuffers, sizeof(ImxVpuDMABuffer *) * set->num_framebuffers);
+		set->dmabuffers = NULL;
+	}
+
+	if (set->framebuffers != NULL)
+	{
+		IMX_VPU_FREE(set->framebuffers, sizeof(ImxVpuFramebuffer) * set->num_framebuffers);
+		set->framebuffers = NULL;
+	}
+
+	set->num_framebuffers = 0;
+}
+
+
+static void imx_vpu_transcoder_close_encoder(ImxVpuTranscoder *transcoder)
+{
+	if (transcoder->encoder != NULL)
+	{
+		imx_vpu_enc_close(transcoder->encoder);
+		transcoder->encoder = NULL;
+	}
+
+	imx_vpu_transcoder_deallocate_framebuffers(&(transcoder->enc_framebuffers));
+}
+
+
+static int initial_info_callback(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *new_initial_info, unsigned int output_code, void *user_data)
+{
+	ImxVpuTranscoder *transcoder = (ImxVpuTranscoder *)user_data;
+	ImxVpuEncOpenParams enc_open_params;
+	ImxVpuEncInitialInfo enc_initial_info;
+	ImxVpuEncReturnCodes enc_ret;
+	ImxVpuDecReturnCodes dec_ret;
+	ImxVpuColorFormat enc_color_format;
+	unsigned int alignment;
+
+	IMXVPUAPI_UNUSED_PARAM(decoder);
+	IMXVPUAPI_UNUSED_PARAM(output_code);
+
+	/* The encoding of the previous frame is always finished before
+	 * decoding starts, so no framebuffer is in use by the encoder here */
+	assert(!(transcoder->encoding_pending));
+
+	IMX_VPU_DEBUG(
+		"initial info:  size: %ux%u pixel  rate: %u/%u  min num required framebuffers: %u  interlacing: %d  framebuffer alignment: %u  color format: %s",
+		new_initial_info->frame_width,
+		new_initial_info->frame_height,
+		new_initial_info->frame_rate_numerator,
+		new_initial_info->frame_rate_denominator,
+		new_initial_info->min_num_required_framebuffers,
+		new_initial_info->interlacing,
+		new_initial_info->framebuffer_alignment,
+		imx_vpu_color_format_string(new_initial_info->color_format)
+	);
+
+	switch (new_initial_info->color_format)
+	{
+		case IMX_VPU_COLOR_FORMAT_YUV420:
+			enc_color_format = IMX_VPU_COLOR_FORMAT_YUV420;
+			transcoder->skip_chroma_rows = 0;
+			break;
+		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL:
+			/* Each chroma row of a 4:2:2 frame with horizontal subsampling has the
+			 * width of a 4:2:0 chroma row, so by skipping every second row, the
+			 * encoder sees a 4:2:0 frame */
+			enc_color_format = IMX_VPU_COLOR_FORMAT_YUV420;
+			transcoder->skip_chroma_rows = 1;
+			break;
+		case IMX_VPU_COLOR_FORMAT_YUV400:
+			enc_color_format = IMX_VPU_COLOR_FORMAT_YUV400;
+			transcoder->skip_chroma_rows = 0;
+			break;
+		default:
+			IMX_VPU_ERROR("cannot transcode frames with color format %s", imx_vpu_color_format_string(new_initial_info->color_format));
+			return 0;
+	}
+
+	/* If the parameters changed midstream, the encoder and the
+	 * framebuffers were set up for the old ones, and are replaced */
+	imx_vpu_transcoder_close_encoder(transcoder);
+	imx_vpu_transcoder_deallocate_framebuffers(&(transcoder->dec_framebuffers));
+
+
+	/* Open the encoder first, since its framebuffer alignment
+	 * is needed for allocating the decoder's framebuffers */
+
+	enc_open_params = transcoder->enc_open_params;
+	enc_open_params.frame_width = new_initial_info->frame_width;
+	enc_open_params.frame_height = new_initial_info->frame_height;
+	enc_open_params.color_format = enc_color_format;
+	enc_open_params.chroma_interleave = transcoder->chroma_interleave;
+
+	if ((enc_ret = imx_vpu_enc_open(&(transcoder->encoder), &enc_open_params, transcoder->enc_bitstream_buffer)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		IMX_VPU_ERROR("could not open encoder: %s", imx_vpu_enc_error_string(enc_ret));
+		transcoder->encoder = NULL;
+		goto error;
+	}
+
+	if ((enc_ret = imx_vpu_enc_get_initial_info(transcoder->encoder, &enc_initial_info)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		IMX_VPU_ERROR("could not get encoder initial info: %s", imx_vpu_enc_error_string(enc_ret));
+		goto error;
+	}
+
+	/* The decoded frames are read by the encoder, so their planes
+	 * must be aligned for both the decoder and the encoder */
+	alignment = imx_vpu_transcoder_lcm(new_initial_info->framebuffer_alignment, enc_initial_info.framebuffer_alignment);
+	IMX_VPU_DEBUG("framebuffer alignment:  decoder: %u  encoder: %u  combined: %u", new_initial_info->framebuffer_alignment, enc_initial_info.framebuffer_alignment, alignment);
+
+
+	/* Allocate and register the decoder framebuffers */
+
+	imx_vpu_calc_framebuffer_sizes(new_initial_info->color_format, new_initial_info->frame_width, new_initial_info->frame_height, alignment, new_initial_info->interlacing, transcoder->chroma_interleave, &(transcoder->dec_framebuffers.calculated_sizes));
+
+	if (!imx_vpu_transcoder_allocate_framebuffers(transcoder, &(transcoder->dec_framebuffers), new_initial_info->min_num_required_framebuffers + NUM_PIPELINE_FRAMEBUFFERS + transcoder->num_extra_framebuffers, alignment))
+		goto error;
+
+	if ((dec_ret = imx_vpu_dec_register_framebuffers(transcoder->decoder, transcoder->dec_framebuffers.framebuffers, transcoder->dec_framebuffers.num_framebuffers)) != IMX_VPU_DEC_RETURN_CODE_OK)
+	{
+		IMX_VPU_ERROR("could not register decoder framebuffers: %s", imx_vpu_dec_error_string(dec_ret));
+		goto error;
+	}
+
+
+	/* Allocate and register the encoder framebuffers. These hold the rotated
+	 * frames, so with 90 and 270 degree rotations, width and height are swapped,
+	 * and the sizes (including the strides) are calculated from the rotated
+	 * frame size. Their strides therefore only match the ones of the decoded
+	 * frames if there is no such rotation. */
+
+	if ((enc_open_params.rotation == IMX_VPU_ROTATION_90) || (enc_open_params.rotation == IMX_VPU_ROTATION_270))
+		imx_vpu_calc_framebuffer_sizes(enc_color_format, new_initial_info->frame_height, new_initial_info->frame_width, alignment, 0, transcoder->chroma_interleave, &(transcoder->enc_framebuffers.calculated_sizes));
+	else
+		imx_vpu_calc_framebuffer_sizes(enc_color_format, new_initial_info->frame_width, new_initial_info->frame_height, alignment, 0, transcoder->chroma_interleave, &(transcoder->enc_framebuffers.calculated_sizes));
+
+	if (!imx_vpu_transcoder_allocate_framebuffers(transcoder, &(transcoder->enc_framebuffers), enc_initial_info.min_num_required_framebuffers, alignment))
+		goto error;
+
+	if ((enc_ret = imx_vpu_enc_register_framebuffers(transcoder->encoder, transcoder->enc_framebuffers.framebuffers, transcoder->enc_framebuffers.num_framebuffers)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		IMX_VPU_ERROR("could not register encoder framebuffers: %s", imx_vpu_enc_error_string(enc_ret));
+		goto error;
+	}
+
+	IMX_VPU_DEBUG("allocated %u decoder and %u encoder framebuffers", transcoder->dec_framebuffers.num_framebuffers, transcoder->enc_framebuffers.num_framebuffers);
+
+	return 1;
+
+error:
+	imx_vpu_transcoder_close_encoder(transcoder);
+	imx_vpu_transcoder_deallocate_framebuffers(&(transcoder->dec_framebuffers));
+	return 0;
+}
+
+
+
+
+/*****************************/
+/******* ENCODING STEPS ******/
+/*****************************/
+
+
+static ImxVpuDecReturnCodes imx_vpu_transcoder_finish_encoding(ImxVpuTranscoder *transcoder)
+{
+	ImxVpuEncodedFrame encoded_frame;
+	ImxVpuEncReturnCodes enc_ret;
+	unsigned int enc_output_code = 0;
+
+	if (!(transcoder->encoding_pending))
+		return IMX_VPU_DEC_RETURN_CODE_OK;
+
+	memset(&encoded_frame, 0, sizeof(encoded_frame));
+	enc_ret = imx_vpu_enc_encode_finish(transcoder->encoder, &encoded_frame, &enc_output_code);
+
+	/* The VPU no longer reads from the decoded frame,
+	 * so the decoder can reuse its framebuffer */
+	imx_vpu_dec_mark_framebuffer_as_displayed(transcoder->decoder, transcoder->pending_dec_framebuffer);
+	transcoder->pending_dec_framebuffer = NULL;
+	transcoder->encoding_pending = 0;
+
+	transcoder->encoded_frame_callback(transcoder, enc_ret, &encoded_frame, enc_output_code, transcoder->callback_user_data);
+
+	if (enc_ret != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		IMX_VPU_ERROR("could not encode frame: %s", imx_vpu_enc_error_string(enc_ret));
+		return IMX_VPU_DEC_RETURN_CODE_ERROR;
+	}
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+static ImxVpuDecReturnCodes imx_vpu_transcoder_start_encoding(ImxVpuTranscoder *transcoder, unsigned int dec_output_code, ImxVpuEncParams *encoding_params)
+{
+	ImxVpuRawFrame raw_frame;
+	ImxVpuDecReturnCodes dec_ret;
+	ImxVpuEncReturnCodes enc_ret;
+
+	assert(!(transcoder->encoding_pending));
+
+	if (!(dec_output_code & IMX_VPU_DEC_OUTPUT_CODE_DECODED_FRAME_AVAILABLE))
+		return IMX_VPU_DEC_RETURN_CODE_OK;
+
+	if ((dec_ret = imx_vpu_dec_get_decoded_frame(transcoder->decoder, &raw_frame)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		return dec_ret;
+
+	/* The raw frame's context, PTS, and DTS are those of the input frame,
+	 * and the encoder passes them on to the encoded frame */
+	transcoder->encoder_input_framebuffer = *(raw_frame.framebuffer);
+	if (transcoder->skip_chroma_rows)
+		transcoder->encoder_input_framebuffer.cbcr_stride *= 2;
+	transcoder->pending_dec_framebuffer = raw_frame.framebuffer;
+	raw_frame.framebuffer = &(transcoder->encoder_input_framebuffer);
+
+	if ((enc_ret = imx_vpu_enc_encode_start(transcoder->encoder, &raw_frame, encoding_params)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		IMX_VPU_ERROR("could not start encoding: %s", imx_vpu_enc_error_string(enc_ret));
+		imx_vpu_dec_mark_framebuffer_as_displayed(transcoder->decoder, transcoder->pending_dec_framebuffer);
+		transcoder->pending_dec_framebuffer = NULL;
+		return IMX_VPU_DEC_RETURN_CODE_ERROR;
+	}
+
+	transcoder->encoding_pending = 1;
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+
+
+/*****************************************/
+/******* PUBLIC TRANSCODER FUNCTIONS *****/
+/*****************************************/
+
+
+void imx_vpu_transcoder_set_default_open_params(ImxVpuCodecFormat input_codec_format, ImxVpuCodecFormat output_codec_format, ImxVpuTranscoderOpenParams *open_params)
+{
+	assert(open_params != NULL);
+
+	memset(open_params, 0, sizeof(ImxVpuTranscoderOpenParams));
+
+	open_params->dec_open_params.codec_format = input_codec_format;
+	open_params->dec_open_params.enable_frame_reordering = 1;
+	open_params->dec_open_params.rotation = IMX_VPU_ROTATION_NONE;
+	open_params->dec_open_params.mirror = IMX_VPU_MIRROR_NONE;
+
+	imx_vpu_enc_set_default_open_params(output_codec_format, &(open_params->enc_open_params));
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_transcoder_open(ImxVpuTranscoder **transcoder, ImxVpuTranscoderOpenParams const *open_params)
+{
+	ImxVpuDecOpenParams dec_open_params;
+	ImxVpuDecReturnCodes ret = IMX_VPU_DEC_RETURN_CODE_OK;
+	ImxVpuTranscoder *transc = NULL;
+	size_t bitstream_buffer_size;
+	unsigned int bitstream_buffer_alignment;
+
+	assert(transcoder != NULL);
+	assert(open_params != NULL);
+	assert(open_params->encoded_frame_callback != NULL);
+
+	if ((ret = imx_vpu_dec_load()) != IMX_VPU_DEC_RETURN_CODE_OK)
+		return ret;
+
+	if (imx_vpu_enc_load() != IMX_VPU_ENC_RETURN_CODE_OK)
+	{
+		imx_vpu_dec_unload();
+		return IMX_VPU_DEC_RETURN_CODE_ERROR;
+	}
+
+	transc = IMX_VPU_ALLOC(sizeof(ImxVpuTranscoder));
+	if (transc == NULL)
+	{
+		IMX_VPU_ERROR("allocating memory for transcoder object failed");
+		ret = IMX_VPU_DEC_RETURN_CODE_ERROR;
+		goto error;
+	}
+
+	memset(transc, 0, sizeof(ImxVpuTranscoder));
+
+	transc->dma_buffer_allocator = (open_params->dma_buffer_allocator != NULL) ? open_params->dma_buffer_allocator : imx_vpu_dec_get_default_allocator();
+	transc->enc_open_params = open_params->enc_open_params;
+	transc->chroma_interleave = open_params->dec_open_params.chroma_interleave;
+	transc->num_extra_framebuffers = open_params->num_extra_framebuffers;
+	transc->encoded_frame_callback = open_params->encoded_frame_callback;
+	transc->callback_user_data = open_params->callback_user_data;
+
+	imx_vpu_dec_get_bitstream_buffer_info(&bitstream_buffer_size, &bitstream_buffer_alignment);
+	transc->dec_bitstream_buffer = imx_vpu_dma_buffer_allocate(transc->dma_buffer_allocator, bitstream_buffer_size, bitstream_buffer_alignment, 0);
+	if (transc->dec_bitstream_buffer == NULL)
+	{
+		IMX_VPU_ERROR("could not allocate DMA buffer for decoder bitstream buffer with %zu bytes and alignment %u", bitstream_buffer_size, bitstream_buffer_alignment);
+		ret = IMX_VPU_DEC_RETURN_CODE_ERROR;
+		goto error;
+	}
+
+	/* The encoder bitstream buffer is kept for the transcoder's whole lifetime,
+	 * even if the encoder is reopened due to a frame size change */
+	imx_vpu_enc_get_bitstream_buffer_info(&bitstream_buffer_size, &bitstream_buffer_alignment);
+	transc->enc_bitstream_buffer = imx_vpu_dma_buffer_allocate(transc->dma_buffer_allocator, bitstream_buffer_size, bitstream_buffer_alignment, 0);
+	if (transc->enc_bitstream_buffer == NULL)
+	{
+		IMX_VPU_ERROR("could not allocate DMA buffer for encoder bitstream buffer with %zu bytes and alignment %u", bitstream_buffer_size, bitstream_buffer_alignment);
+		ret = IMX_VPU_DEC_RETURN_CODE_ERROR;
+		goto error;
+	}
+
+	/* The framebuffers are allocated by the transcoder, with an alignment
+	 * that suits the encoder, so the decoder must not reuse them on its own
+	 * if the frame size changes */
+	dec_open_params = open_params->dec_open_params;
+	dec_open_params.max_frame_width = 0;
+	dec_open_params.max_frame_height = 0;
+
+	if ((ret = imx_vpu_dec_open(&(transc->decoder), &dec_open_params, transc->dec_bitstream_buffer, initial_info_callback, transc)) != IMX_VPU_DEC_RETURN_CODE_OK)
+	{
+		transc->decoder = NULL;
+		goto error;
+	}
+
+	*transcoder = transc;
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+
+error:
+	if (transc != NULL)
+	{
+		if (transc->enc_bitstream_buffer != NULL)
+			imx_vpu_dma_buffer_deallocate(transc->enc_bitstream_buffer);
+		if (transc->dec_bitstream_buffer != NULL)
+			imx_vpu_dma_buffer_deallocate(transc->dec_bitstream_buffer);
+		IMX_VPU_FREE(transc, sizeof(ImxVpuTranscoder));
+	}
+
+	imx_vpu_enc_unload();
+	imx_vpu_dec_unload();
+
+	return ret;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_transcoder_close(ImxVpuTranscoder *transcoder)
+{
+	assert(transcoder != NULL);
+
+	imx_vpu_transcoder_finish_encoding(transcoder);
+
+	imx_vpu_transcoder_close_encoder(transcoder);
+
+	if (transcoder->decoder != NULL)
+		imx_vpu_dec_close(transcoder->decoder);
+
+	imx_vpu_transcoder_deallocate_framebuffers(&(transcoder->dec_framebuffers));
+
+	imx_vpu_dma_buffer_deallocate(transcoder->enc_bitstream_buffer);
+	imx_vpu_dma_buffer_deallocate(transcoder->dec_bitstream_buffer);
+
+	IMX_VPU_FREE(transcoder, sizeof(ImxVpuTranscoder));
+
+	imx_vpu_enc_unload();
+	imx_vpu_dec_unload();
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_transcoder_transcode(ImxVpuTranscoder *transcoder, ImxVpuEncodedFrame const *input_frame, ImxVpuEncParams *encoding_params, unsigned int *output_code)
+{
+	ImxVpuDecInputSpace input_space;
+	ImxVpuDecReturnCodes ret, encoding_ret;
+
+	assert(transcoder != NULL);
+	assert(input_frame != NULL);
+	assert(encoding_params != NULL);
+	assert(output_code != NULL);
+
+	*output_code = 0;
+
+	if ((input_frame->data == NULL) || (input_frame->data_size == 0))
+	{
+		IMX_VPU_ERROR("input frame contains no data");
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	/* Write the input data into the bitstream buffer while the VPU may
+	 * still be encoding the previous frame. The decoder is idle during
+	 * that time, so this is possible with all codec formats. */
+	if ((ret = imx_vpu_dec_reserve_input_space(transcoder->decoder, input_frame->data_size, &input_space)) != IMX_VPU_DEC_RETURN_CODE_OK)
+	{
+		/* Finish the encoding anyway, so its framebuffer is not lost */
+		imx_vpu_transcoder_finish_encoding(transcoder);
+		return ret;
+	}
+
+	memcpy(input_space.regions[0], input_frame->data, input_space.region_sizes[0]);
+	if (input_space.regions[1] != NULL)
+		memcpy(input_space.regions[1], input_frame->data + input_space.region_sizes[0], input_space.region_sizes[1]);
+
+	/* The encoding must be finished before decoding, since the VPU
+	 * can only process one frame at a time, and since the decoder may
+	 * need the framebuffer the encoder reads from */
+	encoding_ret = imx_vpu_transcoder_finish_encoding(transcoder);
+
+	if ((ret = imx_vpu_dec_commit_input_space(transcoder->decoder, input_frame, output_code)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		return ret;
+
+	if ((ret = imx_vpu_transcoder_start_encoding(transcoder, *output_code, encoding_params)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		return ret;
+
+	return encoding_ret;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_transcoder_drain(ImxVpuTranscoder *transcoder, ImxVpuEncParams *encoding_params)
+{
+	ImxVpuEncodedFrame empty_frame;
+	ImxVpuDecReturnCodes ret;
+	unsigned int output_code;
+
+	assert(transcoder != NULL);
+	assert(encoding_params != NULL);
+
+	if ((ret = imx_vpu_transcoder_finish_encoding(transcoder)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		return ret;
+
+	if ((ret = imx_vpu_dec_enable_drain_mode(transcoder->decoder, 1)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		return ret;
+
+	memset(&empty_frame, 0, sizeof(empty_frame));
+
+	/* Here, each frame is encoded right after it was decoded; there is
+	 * no new input whose preparation could overlap with the encoding */
+	for (;;)
+	{
+		if ((ret = imx_vpu_dec_decode(transcoder->decoder, &empty_frame, &output_code)) != IMX_VPU_DEC_RETURN_CODE_OK)
+			break;
+
+		if ((ret = imx_vpu_transcoder_start_encoding(transcoder, output_code, encoding_params)) != IMX_VPU_DEC_RETURN_CODE_OK)
+			break;
+		if ((ret = imx_vpu_transcoder_finish_encoding(transcoder)) != IMX_VPU_DEC_RETURN_CODE_OK)
+			break;
+
+		if ((output_code & IMX_VPU_DEC_OUTPUT_CODE_EOS) || !(output_code & (IMX_VPU_DEC_OUTPUT_CODE_DECODED_FRAME_AVAILABLE | IMX_VPU_DEC_OUTPUT_CODE_DROPPED)))
+			break;
+	}
+
+	imx_vpu_dec_enable_drain_mode(transcoder->decoder, 0);
+	imx_vpu_dec_flush(transcoder->decoder);
+
+	return ret;
+}
+
+
+ImxVpuDecoder* imx_vpu_transcoder_get_decoder(ImxVpuTranscoder *transcoder)
+{
+	assert(transcoder != NULL);
+	return transcoder->decoder;
+}
+
+
+ImxVpuEncoder* imx_vpu_transcoder_get_encoder(ImxVpuTranscoder *transcoder)
+{
+	assert(transcoder != NULL);
+	return transcoder->encoder;
+}
@@ -0,0 +1,158 @@
+/* imxvpuapi transcoder, passing decoded frames directly into an encoder
+ * Copyright (C) 2014 Carlos Rafael Giani
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+
+/* The transcoder combines a decoder and an encoder. Decoded frames are passed
+ * to the encoder as they are, without copying them into separate encoder input
+ * framebuffers. To make this possible, the transcoder allocates the decoder's
+ * framebuffers itself, with an alignment that satisfies both the decoder and
+ * the encoder (the framebuffer_alignment values of ImxVpuDecInitialInfo and
+ * ImxVpuEncInitialInfo), and opens the encoder as soon as the decoder reports
+ * the frame size.
+ *
+ * Frames are processed in a pipeline. Each imx_vpu_transcoder_transcode() call
+ * decodes one input frame, starts encoding the decoded frame, and returns while
+ * the VPU is still encoding. The next call first writes its input data into the
+ * decoder's bitstream buffer, then finishes the previous encoding (which invokes
+ * the encoded frame callback), returns the previous frame's framebuffer to the
+ * decoder, and then decodes. This way, encoding frame N overlaps with whatever
+ * the caller does to get frame N+1 (like reading it from a camera or a file) and
+ * with the copying of frame N+1's data. The VPU itself can only process one frame
+ * at a time, so the decoding and encoding steps themselves do not overlap.
+ *
+ * Encoded frames are written out with the output functions of the ImxVpuEncParams
+ * that were passed to the imx_vpu_transcoder_transcode() call which decoded the
+ * frame, just like with imx_vpu_enc_encode(). The callback is invoked afterwards,
+ * with the encoded frame's information.
+ *
+ * Decoded frames with 4:2:0 and 4:0:0 color formats are encoded as they are. Motion
+ * JPEG data often uses 4:2:2 with horizontal subsampling; such frames are encoded
+ * as 4:2:0 by letting the encoder read only every second chroma row (this is done
+ * by doubling the chroma stride, so it does not involve a copy either). Other color
+ * formats cannot be transcoded.
+ *
+ * If the frame size changes midstream (which can happen with motion JPEG), the
+ * encoder is reopened with the new size, and the encoded stream continues with new
+ * headers. With other codec formats, such changes set the
+ * IMX_VPU_DEC_OUTPUT_CODE_VIDEO_PARAMS_CHANGED output code; the transcoder must then
+ * be drained, closed, and reopened, just like a decoder.
+ *
+ * The transcoder is not thread safe. */
+
+#ifndef IMXVPUAPI_TRANSCODER_H
+#define IMXVPUAPI_TRANSCODER_H
+
+#include "imxvpuapi.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct _ImxVpuTranscoder ImxVpuTranscoder;
+
+
+/* Callback for encoded frames. ret, encoded_frame, and output_code are the values
+ * imx_vpu_enc_encode_finish() produced. encoded_frame is only valid during this
+ * callback. Its context, pts, and dts fields are the ones of the input frame the
+ * encoded frame was decoded from. user_data is the callback_user_data value from
+ * ImxVpuTranscoderOpenParams. */
+typedef void (*ImxVpuTranscoderEncodedFrameCallback)(ImxVpuTranscoder *transcoder, ImxVpuEncReturnCodes ret, ImxVpuEncodedFrame *encoded_frame, unsigned int output_code, void *user_data);
+
+
+/* Structure used together with imx_vpu_transcoder_open(). */
+typedef struct
+{
+	/* Decoder parameters. chroma_interleave is also used for the encoder.
+	 * max_frame_width and max_frame_height are ignored. */
+	ImxVpuDecOpenParams dec_open_params;
+
+	/* Encoder parameters. frame_width, frame_height, color_format, and
+	 * chroma_interleave are set by the transcoder, based on the decoded
+	 * frames; the values set here are ignored. */
+	ImxVpuEncOpenParams enc_open_params;
+
+	/* Number of decoder framebuffers to allocate in addition to the ones the
+	 * decoder and the pipeline need. Usually, this can be zero. */
+	unsigned int num_extra_framebuffers;
+
+	/* Allocator for the bitstream buffers and framebuffers. If this is NULL,
+	 * imx_vpu_dec_get_default_allocator() is used. */
+	ImxVpuDMABufferAllocator *dma_buffer_allocator;
+
+	/* Invoked for each encoded frame. Must not be NULL. */
+	ImxVpuTranscoderEncodedFrameCallback encoded_frame_callback;
+	void *callback_user_data;
+}
+ImxVpuTranscoderOpenParams;
+
+
+/* Fills open_params with default values for transcoding from input_codec_format
+ * to output_codec_format. The encoder parameters are the defaults from
+ * imx_vpu_enc_set_default_open_params(). encoded_frame_callback still has to be
+ * set afterwards. */
+void imx_vpu_transcoder_set_default_open_params(ImxVpuCodecFormat input_codec_format, ImxVpuCodecFormat output_codec_format, ImxVpuTranscoderOpenParams *open_params);
+
+/* Opens a new transcoder. Internally, this calls imx_vpu_dec_load() and
+ * imx_vpu_enc_load(), allocates the bitstream buffers, and opens the decoder.
+ * The encoder is opened later, once the decoder knows the frame size. */
+ImxVpuDecReturnCodes imx_vpu_transcoder_open(ImxVpuTranscoder **transcoder, ImxVpuTranscoderOpenParams const *open_params);
+
+/* Closes the transcoder. If an encoding is still in progress, it is finished
+ * first, and the callback is invoked for it. Frames still in the decoder are
+ * discarded; use imx_vpu_transcoder_drain() to get them encoded. */
+ImxVpuDecReturnCodes imx_vpu_transcoder_close(ImxVpuTranscoder *transcoder);
+
+/* Transcodes one input frame. input_frame works like in imx_vpu_dec_decode(); its
+ * context, pts, and dts values are passed on to the encoded frame. If this produces
+ * a decoded frame, it is encoded with encoding_params, which are copied. The encoded
+ * frame is delivered when the encoding is finished, which happens during the next
+ * imx_vpu_transcoder_transcode(), imx_vpu_transcoder_drain(), or
+ * imx_vpu_transcoder_close() call. output_code is the decoder's output code (see
+ * ImxVpuDecOutputCodes), and must not be NULL.
+ *
+ * The input data is written into the decoder's bitstream buffer with
+ * imx_vpu_dec_reserve_input_space(), so the same restrictions apply; in particular,
+ * WVC1 frames must start with a frame start code.
+ *
+ * Returns IMX_VPU_DEC_RETURN_CODE_ERROR if encoding the previous frame failed. The
+ * callback is invoked with the encoder's return code in that case. */
+ImxVpuDecReturnCodes imx_vpu_transcoder_transcode(ImxVpuTranscoder *transcoder, ImxVpuEncodedFrame const *input_frame, ImxVpuEncParams *encoding_params, unsigned int *output_code);
+
+/* Finishes the encoding that is in progress, then drains the decoder, and encodes
+ * the frames that come out of it with encoding_params. Afterwards, all frames have
+ * been delivered to the callback. The decoder is flushed, so the transcoder can be
+ * used for new input afterwards (for example, after seeking). */
+ImxVpuDecReturnCodes imx_vpu_transcoder_drain(ImxVpuTranscoder *transcoder, ImxVpuEncParams *encoding_params);
+
+/* Returns the transcoder's decoder and encoder. These can be used for functions
+ * which do not decode or encode, like imx_vpu_dec_set_codec_data(),
+ * imx_vpu_dec_get_dropped_frame_info(), or the statistics functions. The encoder
+ * is NULL until the first frame was decoded. */
+ImxVpuDecoder* imx_vpu_transcoder_get_decoder(ImxVpuTranscoder *transcoder);
+ImxVpuEncoder* imx_vpu_transcoder_get_encoder(ImxVpuTranscoder *transcoder);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
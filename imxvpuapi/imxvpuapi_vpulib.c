@@ -20,6 +20,7 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <vpu_lib.h>
@@ -58,7 +59,7 @@
 
 
 #define MIN_NUM_FREE_FB_REQUIRED 5
-#define FRAME_ALIGN 16
+#define FRAME_ALIGN IMX_VPU_FRAME_ALIGN
 
 #define VPU_MEMORY_ALIGNMENT         0x8
 #define VPU_DEC_MAIN_BITSTREAM_BUFFER_SIZE (1024*1024*3)
@@ -77,6 +78,18 @@
 
 #define VPU_ENC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE  (VPU_ENC_MAIN_BITSTREAM_BUFFER_SIZE + VPU_ENC_MPEG4_SCRATCH_SIZE)
 
+/* Bitstream buffers smaller than the sizes above are accepted as well.
+ * In that case, the codec format specific areas are sized for the
+ * codec format and frame size given to the open function, and the
+ * rest is used as the main bitstream buffer; see
+ * imx_vpu_dec_calc_bitstream_buffer_layout() and
+ * imx_vpu_enc_calc_bitstream_buffer_layout() for details. The VPU
+ * requires the main bitstream buffer size to be a multiple of 1024. */
+#define VPU_MIN_MAIN_BITSTREAM_BUFFER_SIZE  (1024*256)
+#define VPU_BITSTREAM_BUFFER_SIZE_ALIGNMENT 1024
+#define VPU_DEFAULT_MAX_FRAME_WIDTH         1920
+#define VPU_DEFAULT_MAX_FRAME_HEIGHT        1088
+
 #define VPU_ENC_NUM_EXTRA_SUBSAMPLE_FRAMEBUFFERS  2
 
 #define VP8_SEQUENCE_HEADER_SIZE  32
@@ -87,11 +100,32 @@
 
 #define VC1_NAL_FRAME_LAYER_MAX_SIZE   4
 
+/* Largest amount of bytes imx_vpu_dec_get_frame_headers() can produce
+ * (not counting codec data); this is the VP8 main and frame header */
+#define VPU_DEC_MAX_FRAME_HEADERS_SIZE (VP8_SEQUENCE_HEADER_SIZE + VP8_FRAME_HEADER_SIZE)
+
+/* Sizes of the frame header templates; the largest main header is the
+ * VP8 IVF one, the largest frame header is the VP8 IVF frame header */
+#define VPU_DEC_MAIN_HEADER_TEMPLATE_SIZE   VP8_SEQUENCE_HEADER_SIZE
+#define VPU_DEC_FRAME_HEADER_TEMPLATE_SIZE  VP8_FRAME_HEADER_SIZE
+
+/* Maximum number of header chunks imx_vpu_dec_get_frame_headers() produces */
+#define VPU_DEC_MAX_NUM_HEADER_CHUNKS  2
+
 #define VPU_WAIT_TIMEOUT             500 /* milliseconds to wait for frame completion */
 #define VPU_MAX_TIMEOUT_COUNTS       4   /* how many timeouts are allowed in series */
+#define VPU_ENC_SLICE_OUTPUT_POLL_INTERVAL  1 /* milliseconds between checks for new data in slice output mode */
+
+/* In slice output mode, this many bytes of a frame are collected before
+ * delivering the first ones, to be able to determine if the frame is an
+ * intra frame, which needs headers in front of it */
+#define VPU_ENC_FRAME_TYPE_PROBE_SIZE  32
 
 #define MJPEG_ENC_HEADER_DATA_MAX_SIZE  2048
 
+/* Number of entries in the MJPEG table and header cache */
+#define MJPEG_ENC_CACHE_SIZE  8
+
 
 /* h.264 access unit delimiter data */
 uint8_t const h264_aud[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
@@ -306,6 +340,18 @@ static uint8_t const mjpeg_enc_huffman_value_chroma_ac[162] =
 
 static unsigned long vpu_init_inst_counter = 0;
 
+/* Decoder or encoder whose frame the VPU is currently processing, or NULL
+ * if no frame is in flight, and the thread which started that frame. The
+ * VPU interrupt and busy state are global, so only one frame can be in
+ * flight at a time, across all instances. Ownership is taken right before
+ * the VPU is started, and given up once the output information was
+ * retrieved. All of these are protected by vpu_frame_owner_mutex;
+ * vpu_frame_owner_cond is signaled when ownership is given up. */
+static pthread_mutex_t vpu_frame_owner_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vpu_frame_owner_cond = PTHREAD_COND_INITIALIZER;
+static void const *vpu_frame_owner = NULL;
+static pthread_t vpu_frame_owner_thread;
+
 
 static BOOL imx_vpu_load(void)
 {
@@ -355,6 +401,97 @@ static BOOL imx_vpu_unload(void)
 }
 
 
+static BOOL imx_vpu_acquire_frame_ownership(void const *instance)
+{
+	/* Waits until no other instance has a frame in flight, and makes the
+	 * given instance the owner. Starting a frame while another instance's
+	 * frame is in flight would make the two instances wait for the same
+	 * interrupt. If the other frame was started by this same thread, it
+	 * cannot finish while this thread waits, so an error is returned
+	 * instead of waiting forever. */
+
+	BOOL ret = TRUE;
+
+	pthread_mutex_lock(&vpu_frame_owner_mutex);
+
+	while ((vpu_frame_owner != NULL) && (vpu_frame_owner != instance))
+	{
+		if (pthread_equal(vpu_frame_owner_thread, pthread_self()))
+		{
+			IMX_VPU_ERROR("cannot start frame; this thread already started a frame of another instance which is not finished yet");
+			ret = FALSE;
+			break;
+		}
+
+		pthread_cond_wait(&vpu_frame_owner_cond, &vpu_frame_owner_mutex);
+	}
+
+	if (ret)
+	{
+		vpu_frame_owner = instance;
+		vpu_frame_owner_thread = pthread_self();
+	}
+
+	pthread_mutex_unlock(&vpu_frame_owner_mutex);
+
+	return ret;
+}
+
+
+static void imx_vpu_release_frame_ownership(void const *instance)
+{
+	pthread_mutex_lock(&vpu_frame_owner_mutex);
+
+	if (vpu_frame_owner == instance)
+	{
+		vpu_frame_owner = NULL;
+		pthread_cond_broadcast(&vpu_frame_owner_cond);
+	}
+
+	pthread_mutex_unlock(&vpu_frame_owner_mutex);
+}
+
+
+static BOOL imx_vpu_is_frame_owner(void const *instance)
+{
+	BOOL ret;
+
+	pthread_mutex_lock(&vpu_frame_owner_mutex);
+	ret = (vpu_frame_owner == instance);
+	pthread_mutex_unlock(&vpu_frame_owner_mutex);
+
+	return ret;
+}
+
+
+static BOOL imx_vpu_poll_for_completion(void const *instance, unsigned int timeout_ms)
+{
+	/* Checks if the VPU finished the current decoding or encoding
+	 * operation of the given instance, waiting for up to timeout_ms
+	 * milliseconds. */
+
+	/* Only the instance which started the frame may consume the interrupt */
+	if (!imx_vpu_is_frame_owner(instance))
+		return FALSE;
+
+	if (vpu_IsBusy())
+	{
+		if (timeout_ms == 0)
+			return FALSE;
+
+		return (vpu_WaitForInt((int)timeout_ms) == RETCODE_SUCCESS);
+	}
+
+	/* The VPU is no longer busy, but its interrupt may still be pending.
+	 * Consume it here; otherwise, the next vpu_WaitForInt() call would
+	 * return immediately, even though the VPU is not done at that point.
+	 * timeout_ms is respected, so polls with a zero timeout never block. */
+	vpu_WaitForInt((int)timeout_ms);
+
+	return TRUE;
+}
+
+
 static void convert_frame_type(ImxVpuCodecFormat codec_format, int vpu_pic_type, BOOL interlaced, ImxVpuFrameType *frame_types)
 {
 	ImxVpuFrameType type = IMX_VPU_FRAME_TYPE_UNKNOWN;
@@ -614,102 +751,6 @@ static DefaultDMABufferAllocator default_dma_buffer_allocator =
 
 
 
-/******************************************************/
-/******* MISCELLANEOUS STRUCTURES AND FUNCTIONS *******/
-/******************************************************/
-
-
-void imx_vpu_calc_framebuffer_sizes(ImxVpuColorFormat color_format, unsigned int frame_width, unsigned int frame_height, unsigned int framebuffer_alignment, int uses_interlacing, int chroma_interleave, ImxVpuFramebufferSizes *calculated_sizes)
-{
-	int alignment;
-
-	assert(calculated_sizes != NULL);
-	assert(frame_width > 0);
-	assert(frame_height > 0);
-
-	calculated_sizes->aligned_frame_width = IMX_VPU_ALIGN_VAL_TO(frame_width, FRAME_ALIGN);
-	if (uses_interlacing)
-		calculated_sizes->aligned_frame_height = IMX_VPU_ALIGN_VAL_TO(frame_height, (2 * FRAME_ALIGN));
-	else
-		calculated_sizes->aligned_frame_height = IMX_VPU_ALIGN_VAL_TO(frame_height, FRAME_ALIGN);
-
-	calculated_sizes->y_stride = calculated_sizes->aligned_frame_width;
-	calculated_sizes->y_size = calculated_sizes->y_stride * calculated_sizes->aligned_frame_height;
-
-	switch (color_format)
-	{
-		case IMX_VPU_COLOR_FORMAT_YUV420:
-			calculated_sizes->cbcr_stride = calculated_sizes->y_stride / 2;
-			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = calculated_sizes->y_size / 4;
-			break;
-		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL:
-		case IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL:
-			calculated_sizes->cbcr_stride = calculated_sizes->y_stride / 2;
-			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = calculated_sizes->y_size / 2;
-			break;
-		case IMX_VPU_COLOR_FORMAT_YUV444:
-			calculated_sizes->cbcr_stride = calculated_sizes->y_stride;
-			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = calculated_sizes->y_size;
-			break;
-		case IMX_VPU_COLOR_FORMAT_YUV400:
-			calculated_sizes->cbcr_stride = 0;
-			calculated_sizes->cbcr_size = calculated_sizes->mvcol_size = 0;
-			break;
-		default:
-			assert(FALSE);
-	}
-
-	if (chroma_interleave)
-	{
-		/* chroma_interleave != 0 means the Cb and Cr values are interleaved
-		 * and share one plane. The stride values are doubled compared to
-		 * the chroma_interleave == 0 case because the interleaving happens
-		 * horizontally, meaning 2 bytes in the shared chroma plane for the
-		 * chroma information of one pixel. */
-
-		calculated_sizes->cbcr_stride *= 2;
-		calculated_sizes->cbcr_size *= 2;
-	}
-
-	alignment = framebuffer_alignment;
-	if (alignment > 1)
-	{
-		calculated_sizes->y_size = IMX_VPU_ALIGN_VAL_TO(calculated_sizes->y_size, alignment);
-		calculated_sizes->cbcr_size = IMX_VPU_ALIGN_VAL_TO(calculated_sizes->cbcr_size, alignment);
-		calculated_sizes->mvcol_size = IMX_VPU_ALIGN_VAL_TO(calculated_sizes->mvcol_size, alignment);
-	}
-
-	/* cbcr_size is added twice if chroma_interleave is 0, since in that case,
-	 * there are *two* separate planes for Cb and Cr, each one with cbcr_size bytes,
-	 * while in the chroma_interleave == 1 case, there is one shared chroma plane
-	 * for both Cb and Cr data, with cbcr_size bytes */
-	calculated_sizes->total_size = calculated_sizes->y_size
-	                             + (chroma_interleave ? calculated_sizes->cbcr_size : (calculated_sizes->cbcr_size * 2))
-	                             + calculated_sizes->mvcol_size
-	                             + alignment;
-
-	calculated_sizes->chroma_interleave = chroma_interleave;
-}
-
-
-void imx_vpu_fill_framebuffer_params(ImxVpuFramebuffer *framebuffer, ImxVpuFramebufferSizes *calculated_sizes, ImxVpuDMABuffer *fb_dma_buffer, void* context)
-{
-	assert(framebuffer != NULL);
-	assert(calculated_sizes != NULL);
-
-	framebuffer->dma_buffer = fb_dma_buffer;
-	framebuffer->context = context;
-	framebuffer->y_stride = calculated_sizes->y_stride;
-	framebuffer->cbcr_stride = calculated_sizes->cbcr_stride;
-	framebuffer->y_offset = 0;
-	framebuffer->cb_offset = calculated_sizes->y_size;
-	framebuffer->cr_offset = calculated_sizes->y_size + calculated_sizes->cbcr_size;
-	framebuffer->mvcol_offset = calculated_sizes->y_size + calculated_sizes->cbcr_size * (calculated_sizes->chroma_interleave ? 1 : 2);
-}
-
-
-
-
 /************************************************/
 /******* DECODER STRUCTURES AND FUNCTIONS *******/
 /************************************************/
@@ -736,15 +777,15 @@ typedef enum
 FrameMode;
 
 
+/* A block of input data which is written into the bitstream buffer. Frame
+ * headers and frame data are passed to imx_vpu_dec_push_input_data() as
+ * a list of chunks, so they are written together. */
 typedef struct
 {
-	void *context;
-	uint64_t pts, dts;
-	ImxVpuFrameType frame_types[2];
-	ImxVpuInterlacingMode interlacing_mode;
-	FrameMode mode;
+	uint8_t const *data;
+	size_t size;
 }
-ImxVpuDecFrameEntry;
+ImxVpuDecInputChunk;
 
 
 struct _ImxVpuDecoder
@@ -754,6 +795,11 @@ struct _ImxVpuDecoder
 	ImxVpuDMABuffer *bitstream_buffer;
 	uint8_t *bitstream_buffer_virtual_address;
 	imx_vpu_phys_addr_t bitstream_buffer_physical_address;
+	/* Layout of the bitstream buffer. The main bitstream buffer comes
+	 * first; the slice and PS save buffers follow, and the VP8 MB
+	 * prediction buffer shares their space. */
+	size_t main_bitstream_buffer_size;
+	size_t slice_buffer_size, ps_save_buffer_size, vp8_mb_pred_buffer_size;
 
 	uint8_t const *codec_data;
 	size_t codec_data_size;
@@ -764,21 +810,84 @@ struct _ImxVpuDecoder
 	unsigned int old_jpeg_width, old_jpeg_height;
 	ImxVpuColorFormat old_jpeg_color_format;
 
+	/* Rotator settings, only used with motion JPEG */
+	ImxVpuRotation rotation;
+	ImxVpuMirrorDirection mirror;
+
+	/* Maximum frame size for reusing framebuffers after motion JPEG
+	 * frame size changes; see imx_vpu_dec_reinterpret_framebuffers() */
+	unsigned int max_frame_width, max_frame_height;
+	BOOL chroma_interleave;
+
 	unsigned int num_framebuffers, num_used_framebuffers;
 	/* internal_framebuffers and framebuffers are separate from
 	 * frame_entries: internal_framebuffers must be given directly
 	 * to the vpu_DecRegisterFrameBuffer() function, and framebuffers
-	 * is a user-supplied input value */
+	 * is a user-supplied input value. frame_entries, internal_framebuffers,
+	 * and frame_modes all reside in one memory block (framebuffer_arrays).
+	 * frame_modes contains FrameMode values; framebuffer_tracker mirrors
+	 * which of these are FrameMode_Free, and is used for finding free
+	 * framebuffers quickly. Frame modes must therefore only be changed
+	 * with imx_vpu_dec_set_frame_mode(). */
+	void *framebuffer_arrays;
+	size_t framebuffer_arrays_size;
 	FrameBuffer *internal_framebuffers;
 	ImxVpuFramebuffer *framebuffers;
 	ImxVpuDecFrameEntry *frame_entries;
+	/* The frame modes are accessed much more often than the frame entries,
+	 * so they are kept in this separate, compact array */
+	uint8_t *frame_modes;
+	ImxVpuFramebufferTracker framebuffer_tracker;
 	ImxVpuDecFrameEntry dropped_frame_entry;
 
+	/* Framebuffers returned by imx_vpu_dec_return_framebuffer() from other
+	 * threads; these are marked as displayed by
+	 * imx_vpu_dec_process_returned_framebuffers() */
+	ImxVpuIndexReturnQueue returned_framebuffers;
+
 	BOOL main_header_pushed;
 
+	/* Frame header templates (see imx_vpu_dec_init_frame_header_templates()).
+	 * These are filled once per stream, before the first frame is pushed.
+	 * Afterwards, only their frame size fields are patched for each frame. */
+	uint8_t main_header_template[VPU_DEC_MAIN_HEADER_TEMPLATE_SIZE];
+	size_t main_header_template_size;
+	uint8_t frame_header_template[VPU_DEC_FRAME_HEADER_TEMPLATE_SIZE];
+	size_t frame_header_template_size;
+
 	BOOL drain_mode_enabled;
 	BOOL drain_eos_sent_to_vpu;
 
+	/* Trick play settings; see imx_vpu_dec_set_skip_mode() and
+	 * imx_vpu_dec_enable_keyframe_search(). Applied to the DecParam
+	 * values each time a frame decoding is started. */
+	ImxVpuDecSkipMode skip_mode;
+	BOOL keyframe_search_enabled;
+
+	/* Set by imx_vpu_dec_reserve_input_space(), and cleared by
+	 * imx_vpu_dec_commit_input_space() and imx_vpu_dec_flush() */
+	BOOL input_space_reserved;
+	size_t reserved_input_space_sizes[2];
+	/* Offset of the first region in the bitstream buffer. The second
+	 * region (if any) always starts at the beginning of the buffer. */
+	size_t reserved_input_space_offset;
+	/* The frame headers are written in front of the reserved space, but
+	 * the VPU's write pointer is only moved past them when the space is
+	 * committed, so that the headers and the frame data are handed to the
+	 * VPU with one bitstream buffer update */
+	size_t reserved_input_headers_size;
+	BOOL reserved_input_includes_main_header;
+
+	/* decoding_pending is set by imx_vpu_dec_decode_start() and cleared by
+	 * imx_vpu_dec_decode_finish(). decoding_started is set if the VPU was
+	 * actually started; decoding_completed is set if imx_vpu_dec_decode_poll()
+	 * detected the completion. */
+	BOOL decoding_pending, decoding_started, decoding_completed;
+	unsigned int pending_output_code;
+	int jpeg_frame_idx;
+	void *started_frame_context;
+	uint64_t started_frame_pts, started_frame_dts;
+
 	DecInitialInfo initial_info;
 	BOOL initial_info_available;
 
@@ -787,6 +896,19 @@ struct _ImxVpuDecoder
 
 	imx_vpu_dec_new_initial_info_callback initial_info_callback;
 	void *callback_user_data;
+
+	/* Statistics. cur_frame_stats is filled during a decoding step, and
+	 * added to stats by imx_vpu_dec_end_frame_stats(). output_begin_time
+	 * is 0 if the VPU was not started during the current step. */
+	ImxVpuDecStats stats;
+	ImxVpuFrameStats cur_frame_stats;
+	uint64_t cur_frame_begin_time, cur_output_begin_time;
+	ImxVpuDecFrameStatsCallback frame_stats_callback;
+	void *frame_stats_callback_user_data;
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	ImxVpuTraceRing trace_ring;
+#endif
 };
 
 
@@ -809,15 +931,29 @@ static void imx_vpu_dec_insert_vp8_ivf_main_header(uint8_t *header, unsigned int
 static void imx_vpu_dec_insert_vp8_ivf_frame_header(uint8_t *header, size_t main_data_size, uint64_t pts);
 
 static void imx_vpu_dec_insert_wmv3_sequence_layer_header(uint8_t *header, unsigned int frame_width, unsigned int frame_height, size_t main_data_size, uint8_t const *codec_data);
-static void imx_vpu_dec_insert_wmv3_frame_layer_header(uint8_t *header, size_t main_data_size);
 
-static void imx_vpu_dec_insert_vc1_frame_layer_header(uint8_t *header, uint8_t *main_data, size_t *actual_header_length);
+static BOOL imx_vpu_dec_vc1_frame_needs_start_code(uint8_t const *main_data);
+
+static ImxVpuDecReturnCodes imx_vpu_dec_init_frame_header_templates(ImxVpuDecoder *decoder);
+static ImxVpuDecReturnCodes imx_vpu_dec_get_frame_headers(ImxVpuDecoder *decoder, uint8_t const *main_data, size_t main_data_size, ImxVpuDecInputChunk *chunks, unsigned int *num_chunks, BOOL *includes_main_header);
 
-static ImxVpuDecReturnCodes imx_vpu_dec_insert_frame_headers(ImxVpuDecoder *decoder, uint8_t const *codec_data, size_t codec_data_size, uint8_t *main_data, size_t main_data_size);
+static size_t imx_vpu_dec_write_input_chunks(ImxVpuDecoder *decoder, size_t write_offset, ImxVpuDecInputChunk const *chunks, unsigned int num_chunks);
+static ImxVpuDecReturnCodes imx_vpu_dec_push_input_data(ImxVpuDecoder *decoder, ImxVpuDecInputChunk const *chunks, unsigned int num_chunks);
 
-static ImxVpuDecReturnCodes imx_vpu_dec_push_input_data(ImxVpuDecoder *decoder, void const *data, size_t data_size);
+static void imx_vpu_dec_process_returned_framebuffers(ImxVpuDecoder *decoder);
+
+static ImxVpuDecReturnCodes imx_vpu_dec_start_decoding(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, uint8_t const *jpeg_data, uint8_t *jpeg_chunk_virtual_address, imx_vpu_phys_addr_t jpeg_chunk_physical_address, unsigned int *output_code);
+static ImxVpuDecReturnCodes imx_vpu_dec_finish_decoding(ImxVpuDecoder *decoder, unsigned int *output_code);
+static ImxVpuDecReturnCodes imx_vpu_dec_decode_pushed_data(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, uint8_t const *jpeg_data, uint8_t *jpeg_chunk_virtual_address, imx_vpu_phys_addr_t jpeg_chunk_physical_address, unsigned int *output_code);
 
 static int imx_vpu_dec_find_free_framebuffer(ImxVpuDecoder *decoder);
+static BOOL imx_vpu_dec_reinterpret_framebuffers(ImxVpuDecoder *decoder, unsigned int jpeg_width, unsigned int jpeg_height, ImxVpuDecInitialInfo const *initial_info);
+static void imx_vpu_dec_set_frame_mode(ImxVpuDecoder *decoder, unsigned int idx, FrameMode mode);
+
+static void imx_vpu_dec_apply_rotation_to_initial_info(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *initial_info);
+
+static void imx_vpu_dec_begin_frame_stats(ImxVpuDecoder *decoder, size_t num_bytes);
+static void imx_vpu_dec_end_frame_stats(ImxVpuDecoder *decoder, ImxVpuDecReturnCodes ret, unsigned int output_code);
 
 static void imx_vpu_dec_free_internal_arrays(ImxVpuDecoder *decoder);
 
@@ -917,25 +1053,6 @@ static ImxVpuDecReturnCodes imx_vpu_dec_handle_error_full(char const *fn, int li
 }
 
 
-char const * imx_vpu_dec_error_string(ImxVpuDecReturnCodes code)
-{
-	switch (code)
-	{
-		case IMX_VPU_DEC_RETURN_CODE_OK:                        return "ok";
-		case IMX_VPU_DEC_RETURN_CODE_ERROR:                     return "unspecified error";
-		case IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS:            return "invalid params";
-		case IMX_VPU_DEC_RETURN_CODE_INVALID_HANDLE:            return "invalid handle";
-		case IMX_VPU_DEC_RETURN_CODE_INVALID_FRAMEBUFFER:       return "invalid framebuffer";
-		case IMX_VPU_DEC_RETURN_CODE_INSUFFICIENT_FRAMEBUFFERS: return "insufficient framebuffers";
-		case IMX_VPU_DEC_RETURN_CODE_INVALID_STRIDE:            return "invalid stride";
-		case IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE:       return "wrong call sequence";
-		case IMX_VPU_DEC_RETURN_CODE_TIMEOUT:                   return "timeout";
-		case IMX_VPU_DEC_RETURN_CODE_ALREADY_CALLED:            return "already called";
-		default: return "<unknown>";
-	}
-}
-
-
 ImxVpuDecReturnCodes imx_vpu_dec_load(void)
 {
 	return imx_vpu_load() ? IMX_VPU_DEC_RETURN_CODE_OK : IMX_VPU_DEC_RETURN_CODE_ERROR;
@@ -966,6 +1083,129 @@ void imx_vpu_dec_get_bitstream_buffer_info(size_t *size, unsigned int *alignment
 }
 
 
+static void imx_vpu_dec_calc_codec_area_sizes(ImxVpuCodecFormat codec_format, unsigned int max_frame_width, unsigned int max_frame_height, size_t *slice_buffer_size, size_t *ps_save_buffer_size, size_t *vp8_mb_pred_buffer_size)
+{
+	/* Only h.264 needs the slice and PS save buffers, and only VP8 needs
+	 * the MB prediction buffer. Their sizes scale with the frame size
+	 * (the default sizes are the ones for 1920x1088). */
+
+	size_t num_pixels;
+
+	if ((max_frame_width == 0) || (max_frame_height == 0))
+	{
+		max_frame_width = VPU_DEFAULT_MAX_FRAME_WIDTH;
+		max_frame_height = VPU_DEFAULT_MAX_FRAME_HEIGHT;
+	}
+
+	num_pixels = (size_t)IMX_VPU_ALIGN_VAL_TO(max_frame_width, FRAME_ALIGN) * (size_t)IMX_VPU_ALIGN_VAL_TO(max_frame_height, FRAME_ALIGN);
+
+	*slice_buffer_size = 0;
+	*ps_save_buffer_size = 0;
+	*vp8_mb_pred_buffer_size = 0;
+
+	switch (codec_format)
+	{
+		case IMX_VPU_CODEC_FORMAT_H264:
+			*slice_buffer_size = IMX_VPU_ALIGN_VAL_TO(num_pixels * 15 / 20, VPU_BITSTREAM_BUFFER_SIZE_ALIGNMENT);
+			*ps_save_buffer_size = VPU_PS_SAVE_BUFFER_SIZE;
+			break;
+
+		case IMX_VPU_CODEC_FORMAT_VP8:
+			*vp8_mb_pred_buffer_size = IMX_VPU_ALIGN_VAL_TO(68 * (num_pixels / 256), VPU_BITSTREAM_BUFFER_SIZE_ALIGNMENT);
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+static size_t imx_vpu_dec_calc_bitstream_buffer_layout(ImxVpuDecoder *decoder, size_t bitstream_buffer_size, ImxVpuDecOpenParams const *open_params)
+{
+	/* Fills the layout fields of the decoder, and returns the total
+	 * size of the layout, or 0 if the buffer is too small. Buffers
+	 * with the default size use the same layout as always. */
+
+	size_t codec_area_size;
+
+	if (bitstream_buffer_size >= VPU_DEC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE)
+	{
+		decoder->main_bitstream_buffer_size = VPU_DEC_MAIN_BITSTREAM_BUFFER_SIZE;
+		decoder->slice_buffer_size = VPU_MAX_SLICE_BUFFER_SIZE;
+		decoder->ps_save_buffer_size = VPU_PS_SAVE_BUFFER_SIZE;
+		decoder->vp8_mb_pred_buffer_size = VPU_VP8_MB_PRED_BUFFER_SIZE;
+		return VPU_DEC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE;
+	}
+
+	/* max_frame_width/height take precedence, since the frame_width/height
+	 * values are usually 0 with formats that store the size in the bitstream */
+	if ((open_params->max_frame_width != 0) && (open_params->max_frame_height != 0))
+		imx_vpu_dec_calc_codec_area_sizes(open_params->codec_format, open_params->max_frame_width, open_params->max_frame_height, &(decoder->slice_buffer_size), &(decoder->ps_save_buffer_size), &(decoder->vp8_mb_pred_buffer_size));
+	else
+		imx_vpu_dec_calc_codec_area_sizes(open_params->codec_format, open_params->frame_width, open_params->frame_height, &(decoder->slice_buffer_size), &(decoder->ps_save_buffer_size), &(decoder->vp8_mb_pred_buffer_size));
+
+	codec_area_size = decoder->slice_buffer_size + decoder->ps_save_buffer_size;
+	if (codec_area_size < decoder->vp8_mb_pred_buffer_size)
+		codec_area_size = decoder->vp8_mb_pred_buffer_size;
+
+	if (bitstream_buffer_size < (codec_area_size + VPU_MIN_MAIN_BITSTREAM_BUFFER_SIZE))
+		return 0;
+
+	decoder->main_bitstream_buffer_size = (bitstream_buffer_size - codec_area_size) / VPU_BITSTREAM_BUFFER_SIZE_ALIGNMENT * VPU_BITSTREAM_BUFFER_SIZE_ALIGNMENT;
+
+	return decoder->main_bitstream_buffer_size + codec_area_size;
+}
+
+
+void imx_vpu_dec_get_bitstream_buffer_info_with_hints(ImxVpuBitstreamBufferHints const *hints, size_t *size, unsigned int *alignment)
+{
+	size_t main_size, codec_area_size;
+	size_t slice_buffer_size, ps_save_buffer_size, vp8_mb_pred_buffer_size;
+	unsigned int width, height;
+
+	assert(hints != NULL);
+	assert(size != NULL);
+	assert(alignment != NULL);
+
+	width = hints->max_frame_width;
+	height = hints->max_frame_height;
+	if ((width == 0) || (height == 0))
+	{
+		width = VPU_DEFAULT_MAX_FRAME_WIDTH;
+		height = VPU_DEFAULT_MAX_FRAME_HEIGHT;
+	}
+
+	imx_vpu_dec_calc_codec_area_sizes(hints->codec_format, width, height, &slice_buffer_size, &ps_save_buffer_size, &vp8_mb_pred_buffer_size);
+	codec_area_size = slice_buffer_size + ps_save_buffer_size;
+	if (codec_area_size < vp8_mb_pred_buffer_size)
+		codec_area_size = vp8_mb_pred_buffer_size;
+
+	/* A compressed frame practically never gets larger than an uncompressed
+	 * 4:2:0 frame. Motion JPEG frames are always placed at the beginning of
+	 * the main bitstream buffer, so it must be able to hold an entire frame,
+	 * which can be up to an uncompressed 4:4:4 frame. With the other formats,
+	 * the buffer must additionally be able to hold half a second of data to
+	 * be able to absorb bitrate peaks. */
+	if (hints->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
+		main_size = (size_t)width * height * 3;
+	else
+	{
+		main_size = (size_t)width * height * 3 / 2;
+		if (main_size < ((size_t)(hints->max_bitrate) * 1000 / 8 / 2))
+			main_size = (size_t)(hints->max_bitrate) * 1000 / 8 / 2;
+	}
+
+	if (main_size < VPU_MIN_MAIN_BITSTREAM_BUFFER_SIZE)
+		main_size = VPU_MIN_MAIN_BITSTREAM_BUFFER_SIZE;
+	main_size = IMX_VPU_ALIGN_VAL_TO(main_size, VPU_BITSTREAM_BUFFER_SIZE_ALIGNMENT);
+
+	*size = main_size + codec_area_size;
+	if (*size > VPU_DEC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE)
+		*size = VPU_DEC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE;
+	*alignment = VPU_MEMORY_ALIGNMENT;
+}
+
+
 ImxVpuDecReturnCodes imx_vpu_dec_open(ImxVpuDecoder **decoder, ImxVpuDecOpenParams *open_params, ImxVpuDMABuffer *bitstream_buffer, imx_vpu_dec_new_initial_info_callback new_initial_info_callback, void *callback_user_data)
 {
 	ImxVpuDecReturnCodes ret;
@@ -980,8 +1220,14 @@ ImxVpuDecReturnCodes imx_vpu_dec_open(ImxVpuDecoder **decoder, ImxVpuDecOpenPara
 	IMX_VPU_DEBUG("opening decoder");
 
 
-	/* Check that the allocated bitstream buffer is big enough */
-	assert(imx_vpu_dma_buffer_get_size(bitstream_buffer) >= VPU_DEC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE);
+	/* The rotator can only be used with motion JPEG. With the other formats,
+	 * the VPU would need separate rotator output framebuffers, since the
+	 * decoded frames are also used as reference frames. */
+	if ((open_params->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG) && ((open_params->rotation != IMX_VPU_ROTATION_NONE) || (open_params->mirror != IMX_VPU_MIRROR_NONE)))
+	{
+		IMX_VPU_ERROR("rotation and mirroring are only supported with motion JPEG");
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
 
 
 	/* Allocate decoder instance */
@@ -998,8 +1244,23 @@ ImxVpuDecReturnCodes imx_vpu_dec_open(ImxVpuDecoder **decoder, ImxVpuDecOpenPara
 	(*decoder)->available_decoded_frame_idx = -1;
 
 
-	/* Map the bitstream buffer. This mapping will persist until the decoder is closed. */
-	(*decoder)->bitstream_buffer_virtual_address = imx_vpu_dma_buffer_map(bitstream_buffer, 0);
+	/* Check that the allocated bitstream buffer is big enough,
+	 * and determine how it is split into its areas */
+	if (imx_vpu_dec_calc_bitstream_buffer_layout(*decoder, imx_vpu_dma_buffer_get_size(bitstream_buffer), open_params) == 0)
+	{
+		IMX_VPU_ERROR("bitstream buffer with %zu byte is too small for this codec format and frame size", imx_vpu_dma_buffer_get_size(bitstream_buffer));
+		IMX_VPU_FREE(*decoder, sizeof(ImxVpuDecoder));
+		*decoder = NULL;
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	IMX_VPU_DEBUG("bitstream buffer layout:  main: %zu byte  slice: %zu byte  PS save: %zu byte  VP8 MB prediction: %zu byte", (*decoder)->main_bitstream_buffer_size, (*decoder)->slice_buffer_size, (*decoder)->ps_save_buffer_size, (*decoder)->vp8_mb_pred_buffer_size);
+
+
+	/* Map the bitstream buffer. This mapping will persist until the decoder is closed.
+	 * Only the ranges that are written to are synced for the VPU, instead of the
+	 * entire buffer, which makes cached bitstream buffers worthwhile. */
+	(*decoder)->bitstream_buffer_virtual_address = imx_vpu_dma_buffer_map(bitstream_buffer, IMX_VPU_MAPPING_FLAG_MANUAL_SYNC);
 	(*decoder)->bitstream_buffer_physical_address = imx_vpu_dma_buffer_get_physical_address(bitstream_buffer);
 	(*decoder)->bitstream_buffer = bitstream_buffer;
 
@@ -1041,7 +1302,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_open(ImxVpuDecoder **decoder, ImxVpuDecOpenPara
 	}
 
 	dec_open_param.bitstreamBuffer = (*decoder)->bitstream_buffer_physical_address;
-	dec_open_param.bitstreamBufferSize = VPU_DEC_MAIN_BITSTREAM_BUFFER_SIZE;
+	dec_open_param.bitstreamBufferSize = (*decoder)->main_bitstream_buffer_size;
 	dec_open_param.qpReport = 0;
 	dec_open_param.mp4DeblkEnable = 0;
 	dec_open_param.chromaInterleave = open_params->chroma_interleave;
@@ -1052,8 +1313,8 @@ ImxVpuDecReturnCodes imx_vpu_dec_open(ImxVpuDecoder **decoder, ImxVpuDecOpenPara
 	dec_open_param.dynamicAllocEnable = 0;
 	dec_open_param.streamStartByteOffset = 0;
 	dec_open_param.mjpg_thumbNailDecEnable = 0;
-	dec_open_param.psSaveBuffer = (*decoder)->bitstream_buffer_physical_address + VPU_DEC_MAIN_BITSTREAM_BUFFER_SIZE + VPU_MAX_SLICE_BUFFER_SIZE;
-	dec_open_param.psSaveBufferSize = VPU_PS_SAVE_BUFFER_SIZE;
+	dec_open_param.psSaveBuffer = (*decoder)->bitstream_buffer_physical_address + (*decoder)->main_bitstream_buffer_size + (*decoder)->slice_buffer_size;
+	dec_open_param.psSaveBufferSize = (*decoder)->ps_save_buffer_size;
 	dec_open_param.mapType = 0;
 	dec_open_param.tiled2LinearEnable = 0; /* this must ALWAYS be 0, otherwise VPU hangs eventually (it is 0 in the FSL wrapper except for MX6X) */
 	dec_open_param.bitstreamMode = 1;
@@ -1088,6 +1349,11 @@ ImxVpuDecReturnCodes imx_vpu_dec_open(ImxVpuDecoder **decoder, ImxVpuDecOpenPara
 	(*decoder)->codec_format = open_params->codec_format;
 	(*decoder)->frame_width = open_params->frame_width;
 	(*decoder)->frame_height = open_params->frame_height;
+	(*decoder)->rotation = open_params->rotation;
+	(*decoder)->mirror = open_params->mirror;
+	(*decoder)->max_frame_width = open_params->max_frame_width;
+	(*decoder)->max_frame_height = open_params->max_frame_height;
+	(*decoder)->chroma_interleave = !!(open_params->chroma_interleave);
 
 
 	/* Finish & cleanup (in case of error) */
@@ -1116,6 +1382,15 @@ ImxVpuDecReturnCodes imx_vpu_dec_close(ImxVpuDecoder *decoder)
 	IMX_VPU_DEBUG("closing decoder");
 
 
+	/* If a frame is still being decoded, finish it first, since the VPU
+	 * cannot close the instance before vpu_DecGetOutputInfo() is called */
+	if (decoder->decoding_pending)
+	{
+		unsigned int output_code;
+		imx_vpu_dec_decode_finish(decoder, &output_code);
+	}
+
+
 	/* Flush the VPU bit buffer */
 	if (decoder->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG)
 	{
@@ -1178,6 +1453,56 @@ int imx_vpu_dec_is_drain_mode_enabled(ImxVpuDecoder *decoder)
 }
 
 
+ImxVpuDecReturnCodes imx_vpu_dec_set_skip_mode(ImxVpuDecoder *decoder, ImxVpuDecSkipMode skip_mode)
+{
+	assert(decoder != NULL);
+
+	if (decoder->decoding_pending)
+	{
+		IMX_VPU_ERROR("cannot change skip mode while a decoding is in progress");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	decoder->skip_mode = skip_mode;
+
+	IMX_VPU_INFO("set decoder skip mode to %d", (int)skip_mode);
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+ImxVpuDecSkipMode imx_vpu_dec_get_skip_mode(ImxVpuDecoder *decoder)
+{
+	assert(decoder != NULL);
+	return decoder->skip_mode;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_enable_keyframe_search(ImxVpuDecoder *decoder, int enabled)
+{
+	assert(decoder != NULL);
+
+	if (decoder->decoding_pending)
+	{
+		IMX_VPU_ERROR("cannot change keyframe search while a decoding is in progress");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	decoder->keyframe_search_enabled = TO_BOOL(enabled);
+
+	IMX_VPU_INFO("set decoder keyframe search to %d", enabled);
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+int imx_vpu_dec_is_keyframe_search_enabled(ImxVpuDecoder *decoder)
+{
+	assert(decoder != NULL);
+	return decoder->keyframe_search_enabled;
+}
+
+
 ImxVpuDecReturnCodes imx_vpu_dec_flush(ImxVpuDecoder *decoder)
 {
 	ImxVpuDecReturnCodes ret;
@@ -1188,6 +1513,16 @@ ImxVpuDecReturnCodes imx_vpu_dec_flush(ImxVpuDecoder *decoder)
 
 	IMX_VPU_DEBUG("flushing decoder");
 
+	if (decoder->decoding_pending)
+	{
+		IMX_VPU_ERROR("cannot flush decoder while decoding is in progress");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_FLUSH, 0, 0, 0);
+
+	imx_vpu_dec_process_returned_framebuffers(decoder);
+
 	if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_WMV3)
 		return IMX_VPU_DEC_RETURN_CODE_OK;
 
@@ -1196,11 +1531,11 @@ ImxVpuDecReturnCodes imx_vpu_dec_flush(ImxVpuDecoder *decoder)
 	 * are being used for decoding (since flushing will clear them) */
 	for (i = 0; i < decoder->num_framebuffers; ++i)
 	{
-		if (decoder->frame_entries[i].mode == FrameMode_ReservedForDecoding)
+		if (decoder->frame_modes[i] == FrameMode_ReservedForDecoding)
 		{
 			dec_ret = vpu_DecClrDispFlag(decoder->handle, i);
 			IMX_VPU_DEC_HANDLE_ERROR("vpu_DecClrDispFlag failed while flushing", dec_ret);
-			decoder->frame_entries[i].mode = FrameMode_Free;
+			imx_vpu_dec_set_frame_mode(decoder, i, FrameMode_Free);
 		}
 	}
 
@@ -1219,6 +1554,9 @@ ImxVpuDecReturnCodes imx_vpu_dec_flush(ImxVpuDecoder *decoder)
 
 	decoder->num_used_framebuffers = 0;
 
+	/* Any reserved input space is invalid after the flush */
+	decoder->input_space_reserved = FALSE;
+
 
 	IMX_VPU_DEBUG("successfully flushed decoder");
 
@@ -1251,20 +1589,31 @@ ImxVpuDecReturnCodes imx_vpu_dec_register_framebuffers(ImxVpuDecoder *decoder, I
 	}
 
 
-	/* Allocate memory for framebuffer structures and contexts */
+	/* Allocate memory for framebuffer structures and contexts. All arrays
+	 * are placed in one block. frame_entries comes first, since it contains
+	 * 64-bit values and therefore has the strictest alignment requirements. */
 
-	decoder->internal_framebuffers = IMX_VPU_ALLOC(sizeof(FrameBuffer) * num_framebuffers);
-	if (decoder->internal_framebuffers == NULL)
+	decoder->framebuffer_arrays_size = (sizeof(ImxVpuDecFrameEntry) + sizeof(FrameBuffer) + sizeof(uint8_t)) * num_framebuffers;
+	decoder->framebuffer_arrays = IMX_VPU_ALLOC(decoder->framebuffer_arrays_size);
+	if (decoder->framebuffer_arrays == NULL)
+	{
+		IMX_VPU_ERROR("allocating memory for framebuffers and frame entries failed");
+		ret = IMX_VPU_DEC_RETURN_CODE_ERROR;
+		goto cleanup;
+	}
+
+	decoder->frame_entries = (ImxVpuDecFrameEntry *)(decoder->framebuffer_arrays);
+	decoder->internal_framebuffers = (FrameBuffer *)(decoder->frame_entries + num_framebuffers);
+	decoder->frame_modes = (uint8_t *)(decoder->internal_framebuffers + num_framebuffers);
+
+	if (!imx_vpu_framebuffer_tracker_init(&(decoder->framebuffer_tracker), num_framebuffers))
 	{
-		IMX_VPU_ERROR("allocating memory for framebuffers failed");
 		ret = IMX_VPU_DEC_RETURN_CODE_ERROR;
 		goto cleanup;
 	}
 
-	decoder->frame_entries = IMX_VPU_ALLOC(sizeof(ImxVpuDecFrameEntry) * num_framebuffers);
-	if (decoder->frame_entries == NULL)
+	if (!imx_vpu_index_return_queue_init(&(decoder->returned_framebuffers), num_framebuffers))
 	{
-		IMX_VPU_ERROR("allocating memory for frame entries failed");
 		ret = IMX_VPU_DEC_RETURN_CODE_ERROR;
 		goto cleanup;
 	}
@@ -1304,10 +1653,10 @@ ImxVpuDecReturnCodes imx_vpu_dec_register_framebuffers(ImxVpuDecoder *decoder, I
 	/* Initialize the extra AVC slice buf info; its DMA buffer backing store is
 	 * located inside the bitstream buffer, right after the actual bitstream content */
 	memset(&buf_info, 0, sizeof(buf_info));
-	buf_info.avcSliceBufInfo.bufferBase = decoder->bitstream_buffer_physical_address + VPU_DEC_MAIN_BITSTREAM_BUFFER_SIZE;
-	buf_info.avcSliceBufInfo.bufferSize = VPU_MAX_SLICE_BUFFER_SIZE;
-	buf_info.vp8MbDataBufInfo.bufferBase = decoder->bitstream_buffer_physical_address + VPU_DEC_MAIN_BITSTREAM_BUFFER_SIZE;
-	buf_info.vp8MbDataBufInfo.bufferSize = VPU_VP8_MB_PRED_BUFFER_SIZE;
+	buf_info.avcSliceBufInfo.bufferBase = decoder->bitstream_buffer_physical_address + decoder->main_bitstream_buffer_size;
+	buf_info.avcSliceBufInfo.bufferSize = decoder->slice_buffer_size;
+	buf_info.vp8MbDataBufInfo.bufferBase = decoder->bitstream_buffer_physical_address + decoder->main_bitstream_buffer_size;
+	buf_info.vp8MbDataBufInfo.bufferSize = decoder->vp8_mb_pred_buffer_size;
 
 	/* The actual registration */
 	if (decoder->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG)
@@ -1325,18 +1674,25 @@ ImxVpuDecReturnCodes imx_vpu_dec_register_framebuffers(ImxVpuDecoder *decoder, I
 	}
 
 
-	/* Set default rotator settings for motion JPEG */
+	/* Set rotator settings for motion JPEG. The rotator is always used for
+	 * motion JPEG, since its output framebuffer is set with SET_ROTATOR_OUTPUT;
+	 * rotation and mirroring are only enabled if requested. */
 	if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
 	{
 		/* the datatypes are int, but this is undocumented; determined by looking
 		 * into the imx-vpu library's vpu_lib.c vpu_DecGiveCommand() definition */
-		int rotation_angle = 0;
-		int mirror = 0;
+		int rotation_angle = (int)(decoder->rotation);
+		int mirror = (int)(decoder->mirror);
 		int stride = framebuffers[0].y_stride;
 
 		vpu_DecGiveCommand(decoder->handle, SET_ROTATION_ANGLE, (void *)(&rotation_angle));
 		vpu_DecGiveCommand(decoder->handle, SET_MIRROR_DIRECTION,(void *)(&mirror));
 		vpu_DecGiveCommand(decoder->handle, SET_ROTATOR_STRIDE, (void *)(&stride));
+
+		if (rotation_angle != 0)
+			vpu_DecGiveCommand(decoder->handle, ENABLE_ROTATION, 0);
+		if (mirror != 0)
+			vpu_DecGiveCommand(decoder->handle, ENABLE_MIRRORING, 0);
 	}
 
 
@@ -1347,7 +1703,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_register_framebuffers(ImxVpuDecoder *decoder, I
 	for (i = 0; i < num_framebuffers; ++i)
 	{
 		decoder->frame_entries[i].context = NULL;
-		decoder->frame_entries[i].mode = FrameMode_Free;
+		decoder->frame_modes[i] = FrameMode_Free;
 	}
 
 	return IMX_VPU_DEC_RETURN_CODE_OK;
@@ -1507,117 +1863,83 @@ static void imx_vpu_dec_insert_wmv3_sequence_layer_header(uint8_t *header, unsig
 }
 
 
-static void imx_vpu_dec_insert_wmv3_frame_layer_header(uint8_t *header, size_t main_data_size)
-{
-	/* Header as specified in the VC-1 specification, Annex J and L,
-	 * L.3 , Frame Layer */
-	WRITE_32BIT_LE(header, 0, main_data_size);
-}
-
-
-static void imx_vpu_dec_insert_vc1_frame_layer_header(uint8_t *header, uint8_t *main_data, size_t *actual_header_length)
+static BOOL imx_vpu_dec_vc1_frame_needs_start_code(uint8_t const *main_data)
 {
 	static uint8_t const start_code_prefix[3] = { 0x00, 0x00, 0x01 };
 
-	/* Detect if a start code is present; if not, insert one.
+	/* Detect if a start code is present; if not, one has to be inserted.
 	 * Detection works according to SMPTE 421M Annex E E.2.1:
 	 * If the first two bytes are 0x00, and the third byte is
 	 * 0x01, then this is a start code. Otherwise, it isn't
 	 * one, and a frame start code is inserted. */
-	if (memcmp(main_data, start_code_prefix, 3) != 0)
-	{
-		static uint8_t const frame_start_code[4] = { 0x00, 0x00, 0x01, 0x0D };
-		memcpy(header, frame_start_code, 4);
-		*actual_header_length = 4;
-	}
-	else
-		*actual_header_length = 0;
+	return (memcmp(main_data, start_code_prefix, 3) != 0);
 }
 
 
-static ImxVpuDecReturnCodes imx_vpu_dec_insert_frame_headers(ImxVpuDecoder *decoder, uint8_t const *codec_data, size_t codec_data_size, uint8_t *main_data, size_t main_data_size)
+static ImxVpuDecReturnCodes imx_vpu_dec_init_frame_header_templates(ImxVpuDecoder *decoder)
 {
-	ImxVpuDecReturnCodes ret = IMX_VPU_DEC_RETURN_CODE_OK;
+	/* Most of the header bytes stay the same during a stream. Therefore, the
+	 * headers are generated here once, and imx_vpu_dec_get_frame_headers()
+	 * only patches the frame size into them. The frame size fields are left
+	 * at zero here. */
+
+	decoder->main_header_template_size = 0;
+	decoder->frame_header_template_size = 0;
 
 	switch (decoder->codec_format)
 	{
 		case IMX_VPU_CODEC_FORMAT_WMV3:
 		{
-			/* Add RCV headers. RCV is a thin layer on
-			 * top of WMV3 to make it ASF independent. */
+			/* RCV headers. RCV is a thin layer on top of
+			 * WMV3 to make it ASF independent. The last field
+			 * of the sequence layer header is the size of the
+			 * first frame, so the first frame does not get a
+			 * frame layer header. */
 
-			if (decoder->main_header_pushed)
+			if (decoder->codec_data == NULL)
 			{
-				uint8_t header[WMV3_RCV_FRAME_LAYER_SIZE];
-				imx_vpu_dec_insert_wmv3_frame_layer_header(header, main_data_size);
-				ret = imx_vpu_dec_push_input_data(decoder, header, WMV3_RCV_FRAME_LAYER_SIZE);
+				IMX_VPU_ERROR("WMV3 input expects codec data, but none has been set");
+				return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
 			}
-			else
-			{
-				uint8_t header[WMV3_RCV_SEQUENCE_LAYER_SIZE];
 
-				if (codec_data == NULL)
-				{
-					IMX_VPU_ERROR("WMV3 input expects codec data, but none has been set");
-					return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
-				}
+			if (decoder->codec_data_size < 4)
+			{
+				IMX_VPU_ERROR("WMV3 input expects codec data size of 4 bytes, got %zu bytes", decoder->codec_data_size);
+				return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+			}
 
-				if (codec_data_size < 4)
-				{
-					IMX_VPU_ERROR("WMV3 input expects codec data size of 4 bytes, got %u bytes", codec_data_size);
-					return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
-				}
+			imx_vpu_dec_insert_wmv3_sequence_layer_header(decoder->main_header_template, decoder->frame_width, decoder->frame_height, 0, decoder->codec_data);
+			decoder->main_header_template_size = WMV3_RCV_SEQUENCE_LAYER_SIZE;
 
-				imx_vpu_dec_insert_wmv3_sequence_layer_header(header, decoder->frame_width, decoder->frame_height, main_data_size, codec_data);
-				ret = imx_vpu_dec_push_input_data(decoder, header, WMV3_RCV_SEQUENCE_LAYER_SIZE);
-				decoder->main_header_pushed = TRUE;
-			}
+			/* The frame layer header (VC-1 specification, Annex J
+			 * and L, L.3) consists of the frame size only */
+			memset(decoder->frame_header_template, 0, WMV3_RCV_FRAME_LAYER_SIZE);
+			decoder->frame_header_template_size = WMV3_RCV_FRAME_LAYER_SIZE;
 
 			break;
 		}
 
 		case IMX_VPU_CODEC_FORMAT_WVC1:
 		{
-			if (!(decoder->main_header_pushed))
+			if (decoder->codec_data == NULL)
 			{
-				if (codec_data == NULL)
-				{
-					IMX_VPU_ERROR("WVC1 input expects codec data, but none has been set");
-					return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
-				}
+				IMX_VPU_ERROR("WVC1 input expects codec data, but none has been set");
+				return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+			}
 
-				if (codec_data_size == 0)
-				{
-					IMX_VPU_ERROR("WVC1 input expects codec data with nonzero length");
-					return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
-				}
+			if (decoder->codec_data_size == 0)
+			{
+				IMX_VPU_ERROR("WVC1 input expects codec data with nonzero length");
+				return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+			}
 
-				/* First, push the codec_data (except for its first byte,
-				 * which contains the size of the codec data), since it
-				 * contains the sequence layer header */
-				IMX_VPU_LOG("pushing codec data with %zu byte", codec_data_size - 1);
-				if ((ret = imx_vpu_dec_push_input_data(decoder, codec_data + 1, codec_data_size - 1)) != IMX_VPU_DEC_RETURN_CODE_OK)
-				{
-					IMX_VPU_ERROR("could not push codec data to bitstream buffer");
-					return ret;
-				}
-
-				decoder->main_header_pushed = TRUE;
-
-				/* Next, the frame layer header will be pushed by the
-				 * block below */
-			}
-
-			if (decoder->main_header_pushed)
+			/* The codec data contains the sequence layer header, and is
+			 * pushed directly, so it is not copied into a template. The
+			 * frame layer header is a constant frame start code. */
 			{
-				uint8_t header[VC1_NAL_FRAME_LAYER_MAX_SIZE];
-				size_t actual_header_length;
-				imx_vpu_dec_insert_vc1_frame_layer_header(header, main_data, &actual_header_length);
-				if (actual_header_length > 0)
-				{
-					IMX_VPU_LOG("pushing frame layer header with %zu byte", actual_header_length);
-					ret = imx_vpu_dec_push_input_data(decoder, header, actual_header_length);
-				}
+				static uint8_t const frame_start_code[VC1_NAL_FRAME_LAYER_MAX_SIZE] = { 0x00, 0x00, 0x01, 0x0D };
+				memcpy(decoder->frame_header_template, frame_start_code, VC1_NAL_FRAME_LAYER_MAX_SIZE);
+				decoder->frame_header_template_size = VC1_NAL_FRAME_LAYER_MAX_SIZE;
 			}
 
 			break;
@@ -1630,62 +1952,215 @@ static ImxVpuDecReturnCodes imx_vpu_dec_insert_frame_headers(ImxVpuDecoder *deco
 			 * XXX the vpu wrapper has a special mode for "raw VP8 data". What is this?
 			 * Perhaps it means raw IVF-contained VP8? */
 
-			uint8_t header[VP8_SEQUENCE_HEADER_SIZE + VP8_FRAME_HEADER_SIZE];
-			size_t header_size = 0;
+			imx_vpu_dec_insert_vp8_ivf_main_header(decoder->main_header_template, decoder->frame_width, decoder->frame_height);
+			decoder->main_header_template_size = VP8_SEQUENCE_HEADER_SIZE;
+
+			/* The timestamp fields of the frame headers are always 0 */
+			imx_vpu_dec_insert_vp8_ivf_frame_header(decoder->frame_header_template, 0, 0);
+			decoder->frame_header_template_size = VP8_FRAME_HEADER_SIZE;
+
+			break;
+		}
+
+		default:
+			break;
+	}
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+static ImxVpuDecReturnCodes imx_vpu_dec_get_frame_headers(ImxVpuDecoder *decoder, uint8_t const *main_data, size_t main_data_size, ImxVpuDecInputChunk *chunks, unsigned int *num_chunks, BOOL *includes_main_header)
+{
+	/* Fills chunks with the headers that have to be pushed in front of the
+	 * frame data. Nothing is written to the bitstream buffer here; the caller
+	 * writes the headers and the frame data in one go. The chunks point to
+	 * the templates or to the codec data, so they are valid until the next
+	 * call. includes_main_header is set to TRUE if the chunks contain the main
+	 * header or the codec data; the caller then sets main_header_pushed once
+	 * the data actually was pushed. */
+
+	ImxVpuDecReturnCodes ret;
+
+	*num_chunks = 0;
+	*includes_main_header = FALSE;
+
+	if (!(decoder->main_header_pushed))
+	{
+		if ((ret = imx_vpu_dec_init_frame_header_templates(decoder)) != IMX_VPU_DEC_RETURN_CODE_OK)
+			return ret;
+	}
 
+	switch (decoder->codec_format)
+	{
+		case IMX_VPU_CODEC_FORMAT_WMV3:
+		{
 			if (decoder->main_header_pushed)
 			{
-				imx_vpu_dec_insert_vp8_ivf_frame_header(&(header[0]), main_data_size, 0);
-				header_size = VP8_FRAME_HEADER_SIZE;
-				IMX_VPU_LOG("pushing VP8 IVF frame header data with %zu byte", header_size);
+				WRITE_32BIT_LE(decoder->frame_header_template, 0, main_data_size);
+				chunks[0].data = decoder->frame_header_template;
+				chunks[0].size = decoder->frame_header_template_size;
 			}
 			else
 			{
-				imx_vpu_dec_insert_vp8_ivf_main_header(&(header[0]), decoder->frame_width, decoder->frame_height);
-				imx_vpu_dec_insert_vp8_ivf_frame_header(&(header[VP8_SEQUENCE_HEADER_SIZE]), main_data_size, 0);
-				header_size = VP8_SEQUENCE_HEADER_SIZE + VP8_FRAME_HEADER_SIZE;
-				decoder->main_header_pushed = TRUE;
-				IMX_VPU_LOG("pushing VP8 IVF main and frame header data with %zu byte total", header_size);
+				WRITE_32BIT_LE(decoder->main_header_template, WMV3_RCV_SEQUENCE_LAYER_SIZE - 4, main_data_size);
+				chunks[0].data = decoder->main_header_template;
+				chunks[0].size = decoder->main_header_template_size;
+				*includes_main_header = TRUE;
 			}
 
-			if (header_size != 0)
-				ret = imx_vpu_dec_push_input_data(decoder, header, header_size);
+			*num_chunks = 1;
 
 			break;
 		}
 
-		default:
+		case IMX_VPU_CODEC_FORMAT_WVC1:
+		{
+			if (!(decoder->main_header_pushed))
+			{
+				/* First, push the codec_data (except for its first byte,
+				 * which contains the size of the codec data), since it
+				 * contains the sequence layer header */
+				IMX_VPU_LOG("pushing codec data with %zu byte", decoder->codec_data_size - 1);
+				chunks[*num_chunks].data = decoder->codec_data + 1;
+				chunks[*num_chunks].size = decoder->codec_data_size - 1;
+				++(*num_chunks);
+				*includes_main_header = TRUE;
+			}
+
+			/* main_data is NULL if the frame data isn't written yet (this
+			 * is the case with imx_vpu_dec_reserve_input_space()); the
+			 * frame layer header cannot be inserted then */
+			if ((main_data != NULL) && imx_vpu_dec_vc1_frame_needs_start_code(main_data))
+			{
+				IMX_VPU_LOG("pushing frame layer header with %zu byte", decoder->frame_header_template_size);
+				chunks[*num_chunks].data = decoder->frame_header_template;
+				chunks[*num_chunks].size = decoder->frame_header_template_size;
+				++(*num_chunks);
+			}
+
+			break;
+		}
+
+		case IMX_VPU_CODEC_FORMAT_VP8:
 		{
-			if (!(decoder->main_header_pushed) && (codec_data != NULL) && (codec_data_size > 0))
+			WRITE_32BIT_LE(decoder->frame_header_template, 0, main_data_size);
+
+			if (decoder->main_header_pushed)
 			{
-				IMX_VPU_LOG("pushing codec data with %zu byte", codec_data_size);
+				IMX_VPU_LOG("pushing VP8 IVF frame header data with %zu byte", decoder->frame_header_template_size);
+			}
+			else
+			{
+				IMX_VPU_LOG("pushing VP8 IVF main and frame header data with %zu byte total", decoder->main_header_template_size + decoder->frame_header_template_size);
+				chunks[*num_chunks].data = decoder->main_header_template;
+				chunks[*num_chunks].size = decoder->main_header_template_size;
+				++(*num_chunks);
+				*includes_main_header = TRUE;
+			}
+
+			chunks[*num_chunks].data = decoder->frame_header_template;
+			chunks[*num_chunks].size = decoder->frame_header_template_size;
+			++(*num_chunks);
+
+			break;
+		}
 
-				ret = imx_vpu_dec_push_input_data(decoder, codec_data, codec_data_size);
-				decoder->main_header_pushed = TRUE;
+		default:
+		{
+			if (!(decoder->main_header_pushed) && (decoder->codec_data != NULL) && (decoder->codec_data_size > 0))
+			{
+				IMX_VPU_LOG("pushing codec data with %zu byte", decoder->codec_data_size);
+				chunks[0].data = decoder->codec_data;
+				chunks[0].size = decoder->codec_data_size;
+				*num_chunks = 1;
+				*includes_main_header = TRUE;
 			}
 		}
 	}
 
-	return ret;
+	assert(*num_chunks <= VPU_DEC_MAX_NUM_HEADER_CHUNKS);
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
 }
 
 
-static ImxVpuDecReturnCodes imx_vpu_dec_push_input_data(ImxVpuDecoder *decoder, void const *data, size_t data_size)
+static size_t imx_vpu_dec_write_input_chunks(ImxVpuDecoder *decoder, size_t write_offset, ImxVpuDecInputChunk const *chunks, unsigned int num_chunks)
+{
+	/* Only touch data within the first main_bitstream_buffer_size bytes of the
+	 * overall bitstream buffer, since the bytes beyond are reserved for slice and
+	 * ps save data and/or VP8 data */
+	size_t bbuf_size = decoder->main_bitstream_buffer_size;
+	size_t start_offset = write_offset;
+	size_t total_size = 0, num_bytes_at_end;
+	unsigned int i;
+
+	/* The bitstream buffer behaves like a ring buffer. The chunks are written
+	 * one after the other; if the write position reaches the end of the buffer,
+	 * writing continues at the beginning. */
+	for (i = 0; i < num_chunks; ++i)
+	{
+		size_t read_offset = 0;
+
+		while (read_offset < chunks[i].size)
+		{
+			size_t num_bytes_to_write = chunks[i].size - read_offset;
+			size_t num_free_bytes_at_end = bbuf_size - write_offset;
+			if (num_bytes_to_write > num_free_bytes_at_end)
+				num_bytes_to_write = num_free_bytes_at_end;
+
+			memcpy(decoder->bitstream_buffer_virtual_address + write_offset, chunks[i].data + read_offset, num_bytes_to_write);
+
+			read_offset += num_bytes_to_write;
+			write_offset += num_bytes_to_write;
+
+			/* Handle wrap-around if it occurs */
+			if (write_offset >= bbuf_size)
+				write_offset -= bbuf_size;
+		}
+
+		total_size += chunks[i].size;
+	}
+
+	/* Make the written bytes visible to the VPU. This is done once for all
+	 * chunks, and covers at most two ranges: one up to the end of the buffer,
+	 * and one at its beginning if the data wrapped around. */
+	num_bytes_at_end = bbuf_size - start_offset;
+	if (num_bytes_at_end > total_size)
+		num_bytes_at_end = total_size;
+
+	if (num_bytes_at_end > 0)
+		imx_vpu_dma_buffer_sync_for_device(decoder->bitstream_buffer, start_offset, num_bytes_at_end);
+	if (total_size > num_bytes_at_end)
+		imx_vpu_dma_buffer_sync_for_device(decoder->bitstream_buffer, 0, total_size - num_bytes_at_end);
+
+	return total_size;
+}
+
+
+static ImxVpuDecReturnCodes imx_vpu_dec_push_input_data(ImxVpuDecoder *decoder, ImxVpuDecInputChunk const *chunks, unsigned int num_chunks)
 {
 	PhysicalAddress read_ptr, write_ptr;
 	Uint32 num_free_bytes;
 	RetCode dec_ret;
-	size_t read_offset, write_offset, num_free_bytes_at_end, num_bytes_to_push;
-	size_t bbuf_size;
-	int i;
+	size_t write_offset, data_size;
+	unsigned int i;
 	ImxVpuDecReturnCodes ret;
 
 	assert(decoder != NULL);
 
-	/* Only touch data within the first VPU_DEC_MAIN_BITSTREAM_BUFFER_SIZE bytes of the
-	 * overall bitstream buffer, since the bytes beyond are reserved for slice and
-	 * ps save data and/or VP8 data */
-	bbuf_size = VPU_DEC_MAIN_BITSTREAM_BUFFER_SIZE;
+	data_size = 0;
+	for (i = 0; i < num_chunks; ++i)
+		data_size += chunks[i].size;
+
+	/* Motion JPEG frames must fit in the main bitstream buffer as a whole
+	 * (see below), which matters with bitstream buffers that were sized
+	 * with imx_vpu_dec_get_bitstream_buffer_info_with_hints() */
+	if ((decoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG) && (data_size > decoder->main_bitstream_buffer_size))
+	{
+		IMX_VPU_ERROR("motion JPEG frame with %zu byte does not fit in the %zu byte large bitstream buffer", data_size, decoder->main_bitstream_buffer_size);
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
 
 
 	/* Get the current read and write position pointers in the bitstream buffer For
@@ -1693,104 +2168,198 @@ static ImxVpuDecReturnCodes imx_vpu_dec_push_input_data(ImxVpuDecoder *decoder,
 	 * These pointers are physical addresses. To get an offset value for the write
 	 * position for example, one calculates:
 	 * write_offset = (write_ptr - bitstream_buffer_physical_address)
-	 * Also, since MJPEG uses line buffer mode, this is not done for MJPEG */
-	if (decoder->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG)
+	 * With motion JPEG, the decoder operates in the line buffer mode. Meaning that
+	 * the encoded JPEG frame is always placed at the beginning of the bitstream
+	 * buffer. It does not have to work like a ring buffer, since with motion JPEG,
+	 * one input frame immediately produces one decoded output frame. */
+	if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
+	{
+		write_offset = 0;
+	}
+	else
 	{
 		dec_ret = vpu_DecGetBitstreamBuffer(decoder->handle, &read_ptr, &write_ptr, &num_free_bytes);
 		ret = IMX_VPU_DEC_HANDLE_ERROR("could not retrieve bitstream buffer information", dec_ret);
 		if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
 			return ret;
 		IMX_VPU_LOG("bitstream buffer status:  read ptr 0x%x  write ptr 0x%x  num free bytes %u", read_ptr, write_ptr, num_free_bytes);
+
+		write_offset = write_ptr - decoder->bitstream_buffer_physical_address;
 	}
 
+	imx_vpu_dec_write_input_chunks(decoder, write_offset, chunks, num_chunks);
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_PUSH_INPUT, data_size, write_offset, 0);
 
-	/* The bitstream buffer behaves like a ring buffer. This means that incoming data
-	 * be written at once, if there is enough room at the current write position, or
-	 * the write position may be near the end of the buffer, in which case two writes
-	 * have to be performed (the first N bytes at the end of the buffer, and the remaining
-	 * (bbuf_size - N) bytes at the beginning).
-	 * Exception: motion JPEG data. With motion JPEG, the decoder operates in the line
-	 * buffer mode. Meaning that the encoded JPEG frame is always placed at the beginning
-	 * of the bitstream buffer. It does not have to work like a ring buffer, since with
-	 * motion JPEG, one input frame immediately produces one decoded output frame. */
-	if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
-		write_offset = 0;
-	else
-		write_offset = write_ptr - decoder->bitstream_buffer_physical_address;
+	/* Update the bitstream buffer pointers. Since MJPEG does not use the
+	 * ring buffer (instead it uses the line buffer mode), update it only
+	 * for non-MJPEG codec formats. This is done once for all chunks, even
+	 * if they wrapped around the end of the buffer, since
+	 * vpu_DecUpdateBitstreamBuffer() wraps the write pointer itself. */
+	if ((decoder->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG) && (data_size > 0))
+	{
+		dec_ret = vpu_DecUpdateBitstreamBuffer(decoder->handle, data_size);
+		ret = IMX_VPU_DEC_HANDLE_ERROR("could not update bitstream buffer with new data", dec_ret);
+		if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
+			return ret;
+	}
+
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+static int imx_vpu_dec_find_free_framebuffer(ImxVpuDecoder *decoder)
+{
+	/* For motion JPEG, the user has to find a free framebuffer manually;
+	 * the VPU does not do that in this case */
 
-	num_free_bytes_at_end = bbuf_size - write_offset;
+	return imx_vpu_framebuffer_tracker_find_free(&(decoder->framebuffer_tracker));
+}
+
+
+static BOOL imx_vpu_dec_reinterpret_framebuffers(ImxVpuDecoder *decoder, unsigned int jpeg_width, unsigned int jpeg_height, ImxVpuDecInitialInfo const *initial_info)
+{
+	/* Motion JPEG frames are written by the rotator into the framebuffer that is
+	 * specified with SET_ROTATOR_OUTPUT, using the stride set with SET_ROTATOR_STRIDE.
+	 * The VPU itself therefore does not need to know about the framebuffer layout,
+	 * so if the DMA buffers are large enough, the layout can be changed by just
+	 * recalculating strides and offsets. */
 
-	read_offset = 0;
+	unsigned int i;
+	int stride;
+	ImxVpuFramebufferSizes sizes;
 
-	/* This stores the number of bytes to push in the next immediate write operation
-	 * If the write position is near the end of the buffer, not all bytes can be written
-	 * at once, as described above */
-	num_bytes_to_push = (num_free_bytes_at_end < data_size) ? num_free_bytes_at_end : data_size;
+	if ((decoder->max_frame_width == 0) || (decoder->max_frame_height == 0) || (decoder->framebuffers == NULL))
+		return FALSE;
 
-	/* Write the bytes to the bitstream buffer, either in one, or in two steps (see above) */
-	for (i = 0; (i < 2) && (read_offset < data_size); ++i)
+	if ((jpeg_width > decoder->max_frame_width) || (jpeg_height > decoder->max_frame_height))
 	{
-		/* The actual write */
-		uint8_t *src = ((uint8_t*)data) + read_offset;
-		uint8_t *dest = ((uint8_t*)(decoder->bitstream_buffer_virtual_address)) + write_offset;
-		memcpy(dest, src, num_bytes_to_push);
+		IMX_VPU_DEBUG("new frame size %ux%u exceeds maximum size %ux%u; framebuffers need to be reallocated", jpeg_width, jpeg_height, decoder->max_frame_width, decoder->max_frame_height);
+		return FALSE;
+	}
 
-		/* Update the bitstream buffer pointers. Since MJPEG does not use the
-		 * ring buffer (instead it uses the line buffer mode), update it only
-		 * for non-MJPEG codec formats */
-		if (decoder->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG)
+	imx_vpu_calc_framebuffer_sizes(initial_info->color_format, initial_info->frame_width, initial_info->frame_height, initial_info->framebuffer_alignment, initial_info->interlacing, decoder->chroma_interleave, &sizes);
+
+	for (i = 0; i < decoder->num_framebuffers; ++i)
+	{
+		ImxVpuFramebuffer *fb = &(decoder->framebuffers[i]);
+
+		if (imx_vpu_dma_buffer_get_size(fb->dma_buffer) < sizes.total_size)
 		{
-			dec_ret = vpu_DecUpdateBitstreamBuffer(decoder->handle, num_bytes_to_push);
-			ret = IMX_VPU_DEC_HANDLE_ERROR("could not update bitstream buffer with new data", dec_ret);
-			if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
-				return ret;
+			IMX_VPU_DEBUG("framebuffer #%u is too small for the new frame size (%zu < %u byte); framebuffers need to be reallocated", i, imx_vpu_dma_buffer_get_size(fb->dma_buffer), sizes.total_size);
+			return FALSE;
 		}
+	}
 
-		/* Update offsets and write sizes */
-		read_offset += num_bytes_to_push;
-		write_offset += num_bytes_to_push;
-		num_bytes_to_push = data_size - read_offset;
+	for (i = 0; i < decoder->num_framebuffers; ++i)
+	{
+		ImxVpuFramebuffer *fb = &(decoder->framebuffers[i]);
+		FrameBuffer *internal_fb = &(decoder->internal_framebuffers[i]);
+		imx_vpu_phys_addr_t phys_addr = imx_vpu_dma_buffer_get_physical_address(fb->dma_buffer);
+
+		/* dma_buffer, context, already_marked, and internal stay as they are */
+		imx_vpu_fill_framebuffer_params(fb, &sizes, fb->dma_buffer, fb->context);
 
-		/* Handle wrap-around if it occurs */
-		if (write_offset >= bbuf_size)
-			write_offset -= bbuf_size;
+		internal_fb->strideY = fb->y_stride;
+		internal_fb->strideC = fb->cbcr_stride;
+		internal_fb->bufY = (PhysicalAddress)(phys_addr + fb->y_offset);
+		internal_fb->bufCb = (PhysicalAddress)(phys_addr + fb->cb_offset);
+		internal_fb->bufCr = (PhysicalAddress)(phys_addr + fb->cr_offset);
+		internal_fb->bufMvCol = (PhysicalAddress)(phys_addr + fb->mvcol_offset);
 	}
 
+	stride = sizes.y_stride;
+	vpu_DecGiveCommand(decoder->handle, SET_ROTATOR_STRIDE, (void *)(&stride));
 
-	return IMX_VPU_DEC_RETURN_CODE_OK;
+	IMX_VPU_DEBUG("reusing %u framebuffers for new frame size %ux%u", decoder->num_framebuffers, jpeg_width, jpeg_height);
+
+	return TRUE;
 }
 
 
-static int imx_vpu_dec_find_free_framebuffer(ImxVpuDecoder *decoder)
+static void imx_vpu_dec_set_frame_mode(ImxVpuDecoder *decoder, unsigned int idx, FrameMode mode)
 {
-	unsigned int i;
+	decoder->frame_modes[idx] = mode;
+	imx_vpu_framebuffer_tracker_set_free(&(decoder->framebuffer_tracker), idx, mode == FrameMode_Free);
+}
 
-	/* For motion JPEG, the user has to find a free framebuffer manually;
-	 * the VPU does not do that in this case */
 
-	for (i = 0; i < decoder->num_framebuffers; ++i)
+static void imx_vpu_dec_apply_rotation_to_initial_info(ImxVpuDecoder *decoder, ImxVpuDecInitialInfo *initial_info)
+{
+	/* With 90 and 270 degree rotations, the rotator writes frames with
+	 * swapped width and height into the framebuffers, so the framebuffers
+	 * must be allocated for that size. Chroma subsampling directions are
+	 * swapped as well. */
+
+	unsigned int tmp;
+
+	if ((decoder->rotation != IMX_VPU_ROTATION_90) && (decoder->rotation != IMX_VPU_ROTATION_270))
+		return;
+
+	tmp = initial_info->frame_width;
+	initial_info->frame_width = initial_info->frame_height;
+	initial_info->frame_height = tmp;
+
+	switch (initial_info->color_format)
 	{
-		if (decoder->frame_entries[i].mode == FrameMode_Free)
-			return (int)i;
+		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL:
+			initial_info->color_format = IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL;
+			break;
+		case IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL:
+			initial_info->color_format = IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL;
+			break;
+		default:
+			break;
 	}
+}
 
-	return -1;
+
+static void imx_vpu_dec_begin_frame_stats(ImxVpuDecoder *decoder, size_t num_bytes)
+{
+	memset(&(decoder->cur_frame_stats), 0, sizeof(ImxVpuFrameStats));
+	decoder->cur_frame_stats.num_bytes = num_bytes;
+	decoder->cur_frame_begin_time = imx_vpu_get_monotonic_time();
+	decoder->cur_output_begin_time = 0;
+
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_STEP_BEGIN, num_bytes, 0, 0);
+}
+
+
+static void imx_vpu_dec_end_frame_stats(ImxVpuDecoder *decoder, ImxVpuDecReturnCodes ret, unsigned int output_code)
+{
+	ImxVpuFrameStats *frame_stats = &(decoder->cur_frame_stats);
+	uint64_t now = imx_vpu_get_monotonic_time();
+
+	/* If the VPU was not started, the entire step consisted of input handling */
+	if (decoder->cur_output_begin_time == 0)
+		frame_stats->push_time = now - decoder->cur_frame_begin_time;
+	else
+		frame_stats->output_time = now - decoder->cur_output_begin_time;
+	frame_stats->total_time = now - decoder->cur_frame_begin_time;
+
+	imx_vpu_dec_add_step_stats(&(decoder->stats), frame_stats, output_code);
+
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_STEP_END, ret, output_code, frame_stats->num_bytes);
+
+	if (decoder->frame_stats_callback != NULL)
+		decoder->frame_stats_callback(decoder, ret, output_code, frame_stats, decoder->frame_stats_callback_user_data);
 }
 
 
 static void imx_vpu_dec_free_internal_arrays(ImxVpuDecoder *decoder)
 {
-	if (decoder->internal_framebuffers != NULL)
+	if (decoder->framebuffer_arrays != NULL)
 	{
-		IMX_VPU_FREE(decoder->internal_framebuffers, sizeof(FrameBuffer) * decoder->num_framebuffers);
+		IMX_VPU_FREE(decoder->framebuffer_arrays, decoder->framebuffer_arrays_size);
+		decoder->framebuffer_arrays = NULL;
 		decoder->internal_framebuffers = NULL;
-	}
-
-	if (decoder->frame_entries != NULL)
-	{
-		IMX_VPU_FREE(decoder->frame_entries, sizeof(ImxVpuDecFrameEntry) * decoder->num_framebuffers);
 		decoder->frame_entries = NULL;
+		decoder->frame_modes = NULL;
 	}
+
+	imx_vpu_framebuffer_tracker_cleanup(&(decoder->framebuffer_tracker));
+
+	imx_vpu_index_return_queue_cleanup(&(decoder->returned_framebuffers));
 }
 
 
@@ -1804,17 +2373,40 @@ void imx_vpu_dec_set_codec_data(ImxVpuDecoder *decoder, uint8_t const *codec_dat
 ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, unsigned int *output_code)
 {
 	ImxVpuDecReturnCodes ret;
-	unsigned int jpeg_width, jpeg_height;
-	ImxVpuColorFormat jpeg_color_format;
+
+	assert(output_code != NULL);
+
+	*output_code = 0;
+
+	if ((ret = imx_vpu_dec_decode_start(decoder, encoded_frame)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		return ret;
+
+	return imx_vpu_dec_decode_finish(decoder, output_code);
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_decode_start(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame)
+{
+	ImxVpuDecReturnCodes ret;
+	/* The output code is stored until imx_vpu_dec_decode_finish() is called */
+	unsigned int *output_code;
 
 
 	assert(decoder != NULL);
 	assert(encoded_frame != NULL);
-	assert(output_code != NULL);
 
+	if (decoder->decoding_pending)
+	{
+		IMX_VPU_ERROR("cannot start decoding; previous decoding was not finished yet");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	output_code = &(decoder->pending_output_code);
 	*output_code = 0;
 	ret = IMX_VPU_DEC_RETURN_CODE_OK;
 
+	imx_vpu_dec_begin_frame_stats(decoder, decoder->drain_mode_enabled ? 0 : encoded_frame->data_size);
+
 
 	IMX_VPU_LOG("input info: %d byte", encoded_frame->data_size);
 
@@ -1834,6 +2426,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 			 * VPU decodes them as soon as they arrive). However, the
 			 * VPU also does not report an EOS. So, do this manually. */
 			*output_code = IMX_VPU_DEC_OUTPUT_CODE_EOS;
+			decoder->decoding_pending = TRUE;
 			return IMX_VPU_DEC_RETURN_CODE_OK;
 		}
 		if (!(decoder->drain_eos_sent_to_vpu))
@@ -1850,19 +2443,415 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 	{
 		/* Regular mode */
 
-		/* Insert any necessary extra frame headers */
-		if ((ret = imx_vpu_dec_insert_frame_headers(decoder, decoder->codec_data, decoder->codec_data_size, encoded_frame->data, encoded_frame->data_size)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		ImxVpuDecInputChunk chunks[VPU_DEC_MAX_NUM_HEADER_CHUNKS + 1];
+		unsigned int num_chunks;
+		BOOL includes_main_header;
+
+		if (decoder->input_space_reserved)
+		{
+			IMX_VPU_ERROR("cannot decode while input space is reserved");
+			return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+		}
+
+		/* Get any necessary extra frame headers. These are pushed together
+		 * with the main frame data, so the bitstream buffer is updated only
+		 * once per frame. */
+		if ((ret = imx_vpu_dec_get_frame_headers(decoder, encoded_frame->data, encoded_frame->data_size, chunks, &num_chunks, &includes_main_header)) != IMX_VPU_DEC_RETURN_CODE_OK)
 			return ret;
 
-		/* Handle main frame data */
+		chunks[num_chunks].data = encoded_frame->data;
+		chunks[num_chunks].size = encoded_frame->data_size;
+		++num_chunks;
+
 		IMX_VPU_LOG("pushing main frame data with %zu byte", encoded_frame->data_size);
-		if ((ret = imx_vpu_dec_push_input_data(decoder, encoded_frame->data, encoded_frame->data_size)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		if ((ret = imx_vpu_dec_push_input_data(decoder, chunks, num_chunks)) != IMX_VPU_DEC_RETURN_CODE_OK)
+			return ret;
+
+		if (includes_main_header)
+			decoder->main_header_pushed = TRUE;
+	}
+
+	*output_code |= IMX_VPU_DEC_OUTPUT_CODE_INPUT_USED;
+
+	ret = imx_vpu_dec_start_decoding(
+		decoder,
+		encoded_frame,
+		encoded_frame->data,
+		decoder->bitstream_buffer_virtual_address,
+		decoder->bitstream_buffer_physical_address,
+		output_code
+	);
+
+	if (ret == IMX_VPU_DEC_RETURN_CODE_OK)
+		decoder->decoding_pending = TRUE;
+
+	return ret;
+}
+
+
+int imx_vpu_dec_decode_poll(ImxVpuDecoder *decoder, unsigned int timeout_ms)
+{
+	uint64_t wait_begin_time;
+	BOOL completed;
+
+	assert(decoder != NULL);
+
+	if (!(decoder->decoding_started) || decoder->decoding_completed)
+		return 1;
+
+	wait_begin_time = imx_vpu_get_monotonic_time();
+	completed = imx_vpu_poll_for_completion(decoder, timeout_ms);
+	decoder->cur_frame_stats.wait_time += imx_vpu_get_monotonic_time() - wait_begin_time;
+
+	if (!completed)
+		return 0;
+
+	decoder->decoding_completed = TRUE;
+	return 1;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_decode_finish(ImxVpuDecoder *decoder, unsigned int *output_code)
+{
+	ImxVpuDecReturnCodes ret;
+
+	assert(decoder != NULL);
+	assert(output_code != NULL);
+
+	if (!(decoder->decoding_pending))
+	{
+		IMX_VPU_ERROR("cannot finish decoding; decoding was not started");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	decoder->decoding_pending = FALSE;
+	*output_code = decoder->pending_output_code;
+
+	ret = imx_vpu_dec_finish_decoding(decoder, output_code);
+	imx_vpu_dec_end_frame_stats(decoder, ret, *output_code);
+
+	return ret;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_decode_dma_buffer(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, ImxVpuDMABuffer *input_dma_buffer, size_t input_offset, unsigned int *output_code)
+{
+	ImxVpuDecReturnCodes ret;
+	uint8_t *input_virtual_address;
+	imx_vpu_phys_addr_t input_physical_address;
+
+	assert(decoder != NULL);
+	assert(encoded_frame != NULL);
+	assert(input_dma_buffer != NULL);
+	assert(output_code != NULL);
+
+
+	/* The input data is not used in drain mode */
+	if (decoder->drain_mode_enabled)
+		return imx_vpu_dec_decode(decoder, encoded_frame, output_code);
+
+	if ((input_offset + encoded_frame->data_size) > imx_vpu_dma_buffer_get_size(input_dma_buffer))
+	{
+		IMX_VPU_ERROR("input offset %zu and data size %zu exceed the size of the input DMA buffer", input_offset, encoded_frame->data_size);
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	input_virtual_address = imx_vpu_dma_buffer_map(input_dma_buffer, IMX_VPU_MAPPING_FLAG_READ);
+	if (input_virtual_address == NULL)
+	{
+		IMX_VPU_ERROR("could not map input DMA buffer");
+		return IMX_VPU_DEC_RETURN_CODE_ERROR;
+	}
+
+	input_virtual_address += input_offset;
+
+	if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
+	{
+		/* Motion JPEG uses the line buffer mode, which means that the VPU
+		 * can read the frame from anywhere in physical memory. Therefore, the
+		 * data does not have to be copied into the bitstream buffer; instead,
+		 * the VPU is instructed to read it directly from the input DMA buffer. */
+
+		if (decoder->input_space_reserved || decoder->decoding_pending)
+		{
+			IMX_VPU_ERROR("cannot decode while input space is reserved or decoding is in progress");
+			ret = IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+			goto cleanup;
+		}
+
+		input_physical_address = imx_vpu_dma_buffer_get_physical_address(input_dma_buffer);
+		if (input_physical_address == 0)
+		{
+			IMX_VPU_ERROR("input DMA buffer has no physical address");
+			ret = IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+			goto cleanup;
+		}
+
+		input_physical_address += input_offset;
+		if ((input_physical_address % VPU_MEMORY_ALIGNMENT) != 0)
+		{
+			IMX_VPU_ERROR("physical address %" IMX_VPU_PHYS_ADDR_FORMAT " of input data is not aligned to %u bytes", input_physical_address, VPU_MEMORY_ALIGNMENT);
+			ret = IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+			goto cleanup;
+		}
+
+		*output_code = IMX_VPU_DEC_OUTPUT_CODE_INPUT_USED;
+
+		imx_vpu_dec_begin_frame_stats(decoder, encoded_frame->data_size);
+
+		ret = imx_vpu_dec_decode_pushed_data(
+			decoder,
+			encoded_frame,
+			input_virtual_address,
+			input_virtual_address,
+			input_physical_address,
+			output_code
+		);
+	}
+	else
+	{
+		/* Other formats use the bitstream buffer as a ring buffer, so
+		 * the data has to be pushed into it like in imx_vpu_dec_decode() */
+
+		ImxVpuEncodedFrame mapped_encoded_frame = *encoded_frame;
+		mapped_encoded_frame.data = input_virtual_address;
+		ret = imx_vpu_dec_decode(decoder, &mapped_encoded_frame, output_code);
+	}
+
+cleanup:
+	imx_vpu_dma_buffer_unmap(input_dma_buffer);
+	return ret;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_reserve_input_space(ImxVpuDecoder *decoder, size_t size, ImxVpuDecInputSpace *input_space)
+{
+	PhysicalAddress read_ptr, write_ptr;
+	Uint32 num_free_bytes;
+	RetCode dec_ret;
+	size_t write_offset, num_free_bytes_at_end, num_required_bytes;
+	ImxVpuDecInputChunk chunks[VPU_DEC_MAX_NUM_HEADER_CHUNKS];
+	unsigned int num_chunks;
+	size_t headers_size = 0;
+	BOOL includes_main_header = FALSE;
+	ImxVpuDecReturnCodes ret;
+
+	assert(decoder != NULL);
+	assert(input_space != NULL);
+
+
+	if (decoder->drain_mode_enabled)
+	{
+		IMX_VPU_ERROR("cannot reserve input space in drain mode");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	if (decoder->input_space_reserved)
+	{
+		IMX_VPU_ERROR("input space is already reserved");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+
+	if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
+	{
+		/* Motion JPEG frames are always placed at the beginning of
+		 * the bitstream buffer, since the line buffer mode is used
+		 * (see imx_vpu_dec_push_input_data() for details). This also
+		 * means that the space cannot be reserved while the VPU may
+		 * still be reading the previous frame from there. */
+
+		if (decoder->decoding_pending)
+		{
+			IMX_VPU_ERROR("cannot reserve input space for motion JPEG while decoding is in progress");
+			return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+		}
+
+		if (size > decoder->main_bitstream_buffer_size)
+		{
+			IMX_VPU_ERROR("cannot reserve %zu byte; maximum size for motion JPEG frames is %zu byte", size, decoder->main_bitstream_buffer_size);
+			return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+		}
+
+		input_space->regions[0] = decoder->bitstream_buffer_virtual_address;
+		input_space->region_sizes[0] = size;
+		input_space->regions[1] = NULL;
+		input_space->region_sizes[1] = 0;
+	}
+	else
+	{
+		/* Check that the reserved space, the frame headers, and the codec data
+		 * (if it wasn't pushed already) fit in the bitstream buffer before
+		 * pushing anything. Otherwise, if this fails, the headers would remain
+		 * in the bitstream buffer without the frame they belong to. */
+
+		num_required_bytes = size + VPU_DEC_MAX_FRAME_HEADERS_SIZE;
+		if (!(decoder->main_header_pushed))
+			num_required_bytes += decoder->codec_data_size;
+
+		dec_ret = vpu_DecGetBitstreamBuffer(decoder->handle, &read_ptr, &write_ptr, &num_free_bytes);
+		ret = IMX_VPU_DEC_HANDLE_ERROR("could not retrieve bitstream buffer information", dec_ret);
+		if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
 			return ret;
+
+		if (num_free_bytes < num_required_bytes)
+		{
+			IMX_VPU_ERROR("not enough free space in bitstream buffer: %zu byte required, %u byte free", num_required_bytes, num_free_bytes);
+			return IMX_VPU_DEC_RETURN_CODE_ERROR;
+		}
+
+		IMX_VPU_LOG("bitstream buffer status:  read ptr 0x%x  write ptr 0x%x  num free bytes %u", read_ptr, write_ptr, num_free_bytes);
+
+		/* Get any necessary extra frame headers, and write them in front of
+		 * the reserved space. The VPU's write pointer is moved past them in
+		 * imx_vpu_dec_commit_input_space(), together with the frame data. */
+		if ((ret = imx_vpu_dec_get_frame_headers(decoder, NULL, size, chunks, &num_chunks, &includes_main_header)) != IMX_VPU_DEC_RETURN_CODE_OK)
+			return ret;
+
+		write_offset = write_ptr - decoder->bitstream_buffer_physical_address;
+		headers_size = imx_vpu_dec_write_input_chunks(decoder, write_offset, chunks, num_chunks);
+		write_offset += headers_size;
+		if (write_offset >= decoder->main_bitstream_buffer_size)
+			write_offset -= decoder->main_bitstream_buffer_size;
+
+		num_free_bytes_at_end = decoder->main_bitstream_buffer_size - write_offset;
+
+		/* If the space wraps around the end of the ring buffer,
+		 * split it in two regions */
+		input_space->regions[0] = decoder->bitstream_buffer_virtual_address + write_offset;
+		if (num_free_bytes_at_end < size)
+		{
+			input_space->region_sizes[0] = num_free_bytes_at_end;
+			input_space->regions[1] = decoder->bitstream_buffer_virtual_address;
+			input_space->region_sizes[1] = size - num_free_bytes_at_end;
+		}
+		else
+		{
+			input_space->region_sizes[0] = size;
+			input_space->regions[1] = NULL;
+			input_space->region_sizes[1] = 0;
+		}
+	}
+
+	decoder->reserved_input_space_offset = input_space->regions[0] - decoder->bitstream_buffer_virtual_address;
+	decoder->reserved_input_space_sizes[0] = input_space->region_sizes[0];
+	decoder->reserved_input_space_sizes[1] = input_space->region_sizes[1];
+	decoder->reserved_input_headers_size = headers_size;
+	decoder->reserved_input_includes_main_header = includes_main_header;
+	decoder->input_space_reserved = TRUE;
+
+	IMX_VPU_LOG("reserved %zu byte of input space (regions: %zu byte at %p, %zu byte at %p)", size, input_space->region_sizes[0], (void *)(input_space->regions[0]), input_space->region_sizes[1], (void *)(input_space->regions[1]));
+
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+ImxVpuDecReturnCodes imx_vpu_dec_commit_input_space(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, unsigned int *output_code)
+{
+	size_t reserved_size, num_bytes_to_commit;
+	RetCode dec_ret;
+	ImxVpuDecReturnCodes ret;
+
+	assert(decoder != NULL);
+	assert(encoded_frame != NULL);
+	assert(output_code != NULL);
+
+	*output_code = 0;
+
+
+	if (!(decoder->input_space_reserved))
+	{
+		IMX_VPU_ERROR("no input space was reserved");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	if (decoder->decoding_pending)
+	{
+		IMX_VPU_ERROR("cannot commit input space; previous decoding was not finished yet");
+		return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
 	}
 
+	reserved_size = decoder->reserved_input_space_sizes[0] + decoder->reserved_input_space_sizes[1];
+
+	if (encoded_frame->data_size > reserved_size)
+	{
+		IMX_VPU_ERROR("data size %zu is larger than the reserved input space size %zu", encoded_frame->data_size, reserved_size);
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	/* The WMV3 and VP8 frame headers contain the frame size, and have
+	 * already been written, so the size must not change */
+	if (((decoder->codec_format == IMX_VPU_CODEC_FORMAT_WMV3) || (decoder->codec_format == IMX_VPU_CODEC_FORMAT_VP8)) && (encoded_frame->data_size != reserved_size))
+	{
+		IMX_VPU_ERROR("data size %zu must be equal to the reserved input space size %zu for this format", encoded_frame->data_size, reserved_size);
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	decoder->input_space_reserved = FALSE;
+
+	imx_vpu_dec_begin_frame_stats(decoder, encoded_frame->data_size);
+
+	/* The caller wrote the data through the CPU, so make it visible to the VPU */
+	num_bytes_to_commit = (decoder->reserved_input_space_sizes[0] < encoded_frame->data_size) ? decoder->reserved_input_space_sizes[0] : encoded_frame->data_size;
+	imx_vpu_dma_buffer_sync_for_device(decoder->bitstream_buffer, decoder->reserved_input_space_offset, num_bytes_to_commit);
+	imx_vpu_dma_buffer_sync_for_device(decoder->bitstream_buffer, 0, encoded_frame->data_size - num_bytes_to_commit);
+
+
+	/* Update the bitstream buffer pointers for the frame headers that were
+	 * written by imx_vpu_dec_reserve_input_space() and the committed data,
+	 * with one update (vpu_DecUpdateBitstreamBuffer() handles wrap-arounds
+	 * itself). As with imx_vpu_dec_push_input_data(), this is not done for
+	 * motion JPEG. */
+	if (decoder->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG)
+	{
+		num_bytes_to_commit = decoder->reserved_input_headers_size + encoded_frame->data_size;
+
+		if (num_bytes_to_commit > 0)
+		{
+			dec_ret = vpu_DecUpdateBitstreamBuffer(decoder->handle, num_bytes_to_commit);
+			ret = IMX_VPU_DEC_HANDLE_ERROR("could not update bitstream buffer with new data", dec_ret);
+			if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
+				return ret;
+		}
+
+		if (decoder->reserved_input_includes_main_header)
+			decoder->main_header_pushed = TRUE;
+	}
+
+	IMX_VPU_LOG("committed %zu byte of input data", encoded_frame->data_size);
+
 	*output_code |= IMX_VPU_DEC_OUTPUT_CODE_INPUT_USED;
 
 
+	return imx_vpu_dec_decode_pushed_data(
+		decoder,
+		encoded_frame,
+		decoder->bitstream_buffer_virtual_address,
+		decoder->bitstream_buffer_virtual_address,
+		decoder->bitstream_buffer_physical_address,
+		output_code
+	);
+}
+
+
+static ImxVpuDecReturnCodes imx_vpu_dec_start_decoding(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, uint8_t const *jpeg_data, uint8_t *jpeg_chunk_virtual_address, imx_vpu_phys_addr_t jpeg_chunk_physical_address, unsigned int *output_code)
+{
+	/* Starts decoding the data that has been placed in the bitstream buffer (or, in
+	 * case of motion JPEG, at jpeg_chunk_virtual_address / jpeg_chunk_physical_address).
+	 * jpeg_data is used for parsing the JPEG header. It is unused for other formats.
+	 * If this returns IMX_VPU_DEC_RETURN_CODE_OK, imx_vpu_dec_finish_decoding()
+	 * must be called afterwards. */
+
+	ImxVpuDecReturnCodes ret = IMX_VPU_DEC_RETURN_CODE_OK;
+	unsigned int jpeg_width, jpeg_height;
+	ImxVpuColorFormat jpeg_color_format;
+
+
+	/* Mark framebuffers returned by other threads as displayed
+	 * before the VPU picks a framebuffer to decode into */
+	imx_vpu_dec_process_returned_framebuffers(decoder);
+
 	if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
 	{
 		/* JPEGs are a special case
@@ -1872,7 +2861,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 		 * If so, invoke the initial_info_callback again.
 		 */
 
-		if (!imx_vpu_parse_jpeg_header(encoded_frame->data, encoded_frame->data_size, &jpeg_width, &jpeg_height, &jpeg_color_format))
+		if (!imx_vpu_parse_jpeg_header((void *)jpeg_data, encoded_frame->data_size, &jpeg_width, &jpeg_height, &jpeg_color_format))
 		{
 			IMX_VPU_ERROR("encoded frame is not valid JPEG data");
 			return IMX_VPU_DEC_RETURN_CODE_ERROR;
@@ -1892,8 +2881,14 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 			initial_info.interlacing = 0;
 			initial_info.framebuffer_alignment = 1;
 
+			imx_vpu_dec_apply_rotation_to_initial_info(decoder, &initial_info);
+
+			/* If the registered framebuffers can hold the new frames, adapt
+			 * them instead of letting the callback reallocate them */
+			initial_info.framebuffers_reused = imx_vpu_dec_reinterpret_framebuffers(decoder, jpeg_width, jpeg_height, &initial_info);
+
 			/* Invoke the initial_info_callback. Framebuffers for decoding are allocated
-			 * and registered there. */
+			 * and registered there, unless they were reused. */
 			if (!decoder->initial_info_callback(decoder, &initial_info, *output_code, decoder->callback_user_data))
 			{
 				IMX_VPU_ERROR("initial info callback reported failure - cannot continue");
@@ -1957,6 +2952,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 		initial_info.min_num_required_framebuffers = decoder->initial_info.minFrameBufferCount + MIN_NUM_FREE_FB_REQUIRED;
 		initial_info.interlacing = decoder->initial_info.interlace ? 1 : 0;
 		initial_info.framebuffer_alignment = 1; /* for maptype 0 (linear, non-tiling) */
+		initial_info.framebuffers_reused = 0;
 
 		/* Make sure that at least one framebuffer is allocated and registered
 		 * (Also for motion JPEG, even though the VPU doesn't use framebuffers then) */
@@ -1993,6 +2989,8 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 				return IMX_VPU_DEC_RETURN_CODE_ERROR;
 		}
 
+		imx_vpu_dec_apply_rotation_to_initial_info(decoder, &initial_info);
+
 		/* Invoke the initial_info_callback. Framebuffers for decoding are allocated
 		 * and registered there. */
 		if (!decoder->initial_info_callback(decoder, &initial_info, *output_code, decoder->callback_user_data))
@@ -2005,8 +3003,8 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 	{
 		RetCode dec_ret;
 		DecParam params;
-		BOOL timeout;
 		int jpeg_frame_idx = -1;
+		uint64_t start_begin_time;
 
 		memset(&params, 0, sizeof(params));
 
@@ -2018,11 +3016,12 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 			params.chunkSize = encoded_frame->data_size;
 
 			/* Set the virtual and physical memory pointers that point to the
-			 * start of the frame. These always point to the beginning of the
-			 * bitstream buffer, because the VPU operates in line buffer mode
-			 * when decoding motion JPEG data. */
-			params.virtJpgChunkBase = (unsigned char *)(decoder->bitstream_buffer_virtual_address);
-			params.phyJpgChunkBase = decoder->bitstream_buffer_physical_address;
+			 * start of the frame. The VPU operates in line buffer mode when
+			 * decoding motion JPEG data, so these either point to the beginning
+			 * of the bitstream buffer, or directly to the caller's DMA buffer
+			 * (see imx_vpu_dec_decode_dma_buffer()). */
+			params.virtJpgChunkBase = (unsigned char *)jpeg_chunk_virtual_address;
+			params.phyJpgChunkBase = jpeg_chunk_physical_address;
 
 			/* The framebuffer array isn't used when decoding motion JPEG data.
 			 * Instead, the user has to manually specify a framebuffer for the
@@ -2037,7 +3036,55 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 			}
 		}
 
-		/* XXX: currently, iframe search and skip frame modes are not supported */
+		/* Set up trick play. With iframe search, the VPU skips everything
+		 * until the next I frame (IDR frame with h.264), and ignores the
+		 * skip frame mode. Skipped frames are not decoded, and are reported
+		 * as dropped in imx_vpu_dec_finish_decoding(). Motion JPEG frames
+		 * are all intra frames, so there is nothing to skip. */
+		if (decoder->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG)
+		{
+			if (decoder->keyframe_search_enabled)
+				params.iframeSearchEnable = 1;
+
+			switch (decoder->skip_mode)
+			{
+				case IMX_VPU_DEC_SKIP_MODE_NON_REFERENCE_FRAMES:
+					params.skipframeMode = 2;
+					params.skipframeNum = 1;
+					break;
+				case IMX_VPU_DEC_SKIP_MODE_NON_INTRA_FRAMES:
+					params.skipframeMode = 1;
+					params.skipframeNum = 1;
+					break;
+				default:
+					break;
+			}
+		}
+
+
+		/* Record the bitstream buffer fill level for the statistics. This
+		 * has to be done here, since the VPU is busy after it is started.
+		 * (With motion JPEG, the bitstream buffer is not used as a ring
+		 * buffer, so the fill level is always 0.) */
+		if (decoder->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG)
+		{
+			PhysicalAddress read_ptr, write_ptr;
+			Uint32 num_free_bytes;
+
+			if (vpu_DecGetBitstreamBuffer(decoder->handle, &read_ptr, &write_ptr, &num_free_bytes) == RETCODE_SUCCESS)
+			{
+				decoder->cur_frame_stats.bitstream_buffer_fill_level = decoder->main_bitstream_buffer_size - num_free_bytes;
+				decoder->stats.bitstream_buffer_fill_level = decoder->cur_frame_stats.bitstream_buffer_fill_level;
+			}
+		}
+
+		/* Wait until frames of other instances are done. This time
+		 * is counted as part of the push time. */
+		if (!imx_vpu_acquire_frame_ownership(decoder))
+			return IMX_VPU_DEC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+
+		start_begin_time = imx_vpu_get_monotonic_time();
+		decoder->cur_frame_stats.push_time = start_begin_time - decoder->cur_frame_begin_time;
 
 
 		/* Start frame decoding
@@ -2046,11 +3093,16 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 		 * vpu_DecStartOneFrame() "locks out" most VPU calls until
 		 * vpu_DecGetOutputInfo() is called, so this must be called *always*
 		 * after vpu_DecStartOneFrame(), even if an error occurred. */
+		IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_VPU_START, 0, 0, 0);
 		dec_ret = vpu_DecStartOneFrame(decoder->handle, &params);
 
+		decoder->cur_output_begin_time = imx_vpu_get_monotonic_time();
+		decoder->cur_frame_stats.start_time = decoder->cur_output_begin_time - start_begin_time;
+
 		if (dec_ret == RETCODE_JPEG_BIT_EMPTY)
 		{
 			vpu_DecGetOutputInfo(decoder->handle, &(decoder->dec_output_info));
+			imx_vpu_release_frame_ownership(decoder);
 			*output_code |= IMX_VPU_DEC_OUTPUT_CODE_NOT_ENOUGH_INPUT_DATA;
 			return IMX_VPU_DEC_RETURN_CODE_OK;
 		}
@@ -2063,230 +3115,301 @@ ImxVpuDecReturnCodes imx_vpu_dec_decode(ImxVpuDecoder *decoder, ImxVpuEncodedFra
 		if ((ret = IMX_VPU_DEC_HANDLE_ERROR("could not decode frame", dec_ret)) != IMX_VPU_DEC_RETURN_CODE_OK)
 		{
 			vpu_DecGetOutputInfo(decoder->handle, &(decoder->dec_output_info));
+			imx_vpu_release_frame_ownership(decoder);
 			return ret;
 		}
 
 
-		/* Wait for frame completion */
-		{
-			int cnt;
+		/* Store the information imx_vpu_dec_finish_decoding() needs */
+		decoder->decoding_started = TRUE;
+		decoder->decoding_completed = FALSE;
+		decoder->jpeg_frame_idx = jpeg_frame_idx;
+		decoder->started_frame_context = encoded_frame->context;
+		decoder->started_frame_pts = encoded_frame->pts;
+		decoder->started_frame_dts = encoded_frame->dts;
+	}
+
+
+	return ret;
+}
+
+
+static ImxVpuDecReturnCodes imx_vpu_dec_finish_decoding(ImxVpuDecoder *decoder, unsigned int *output_code)
+{
+	/* Waits until the VPU finished decoding the frame that was started by
+	 * imx_vpu_dec_start_decoding(), and processes the result */
+
+	ImxVpuDecReturnCodes ret = IMX_VPU_DEC_RETURN_CODE_OK;
+	RetCode dec_ret;
+	BOOL timeout;
+	int jpeg_frame_idx;
+
+
+	/* If imx_vpu_dec_start_decoding() did not actually start the VPU
+	 * (for example, because more input data is needed), there is
+	 * nothing to finish */
+	if (!(decoder->decoding_started))
+		return IMX_VPU_DEC_RETURN_CODE_OK;
+
+	decoder->decoding_started = FALSE;
+	jpeg_frame_idx = decoder->jpeg_frame_idx;
+
+
+	/* Wait for frame completion, unless imx_vpu_dec_decode_poll()
+	 * already detected that the VPU is done */
+	timeout = FALSE;
+	if (!(decoder->decoding_completed))
+	{
+		int cnt;
+		uint64_t wait_begin_time = imx_vpu_get_monotonic_time();
+
+		IMX_VPU_LOG("waiting for decoding completion");
+
+		/* Wait a few times, since sometimes, it takes more than
+		 * one vpu_WaitForInt() call to cover the decoding interval */
+		timeout = TRUE;
+		for (cnt = 0; cnt < VPU_MAX_TIMEOUT_COUNTS; ++cnt)
+		{
+			if (vpu_WaitForInt(VPU_WAIT_TIMEOUT) != RETCODE_SUCCESS)
+			{
+				IMX_VPU_INFO("timeout after waiting %d ms for frame completion", VPU_WAIT_TIMEOUT);
+				decoder->cur_frame_stats.num_wait_timeouts++;
+				IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_WAIT_TIMEOUT, decoder->cur_frame_stats.num_wait_timeouts, 0, 0);
+			}
+			else
+			{
+				timeout = FALSE;
+				break;
+			}
+		}
+
+		decoder->cur_frame_stats.wait_time += imx_vpu_get_monotonic_time() - wait_begin_time;
+	}
+
+	/* The output stage begins after the wait */
+	decoder->cur_output_begin_time = imx_vpu_get_monotonic_time();
+
+
+	/* Retrieve information about the result of the decode process There may be no
+	 * decoded frame yet though; this only finishes processing the input frame. In
+	 * case of formats like h.264, it may take several input frames until output
+	 * frames start coming out. However, the output information does contain valuable
+	 * data even at the beginning, like which framebuffer in the framebuffer array
+	 * is used for decoding the frame into.
+	 *
+	 * Also, vpu_DecGetOutputInfo() is called even if a timeout occurred. This is
+	 * intentional, since according to the VPU docs, vpu_DecStartOneFrame() won't be
+	 * usable again until vpu_DecGetOutputInfo() is called. In other words, the
+	 * vpu_DecStartOneFrame() locks down some internals inside the VPU, and
+	 * vpu_DecGetOutputInfo() releases them. */
+
+	dec_ret = vpu_DecGetOutputInfo(decoder->handle, &(decoder->dec_output_info));
+	imx_vpu_release_frame_ownership(decoder);
+	ret = IMX_VPU_DEC_HANDLE_ERROR("could not get output information", dec_ret);
+	if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
+		return ret;
+
+
+	/* If a timeout occurred earlier, this is the correct time to abort
+	 * decoding and return an error code, since vpu_DecGetOutputInfo()
+	 * has been called, unlocking the VPU decoder calls. */
+	if (timeout)
+		return IMX_VPU_DEC_RETURN_CODE_TIMEOUT;
+
 
-			IMX_VPU_LOG("waiting for decoding completion");
+	/* Log some information about the decoded frame */
+	IMX_VPU_LOG(
+		"output info:  indexFrameDisplay %d  indexFrameDecoded %d  NumDecFrameBuf %d  picType %d  idrFlg %d  numOfErrMBs %d  hScaleFlag %d  vScaleFlag %d  notSufficientPsBuffer %d  notSufficientSliceBuffer %d  decodingSuccess %d  interlacedFrame %d  mp4PackedPBframe %d  h264Npf %d  pictureStructure %d  topFieldFirst %d  repeatFirstField %d  fieldSequence %d  decPicWidth %d  decPicHeight %d",
+		decoder->dec_output_info.indexFrameDisplay,
+		decoder->dec_output_info.indexFrameDecoded,
+		decoder->dec_output_info.NumDecFrameBuf,
+		decoder->dec_output_info.picType,
+		decoder->dec_output_info.idrFlg,
+		decoder->dec_output_info.numOfErrMBs,
+		decoder->dec_output_info.hScaleFlag,
+		decoder->dec_output_info.vScaleFlag,
+		decoder->dec_output_info.notSufficientPsBuffer,
+		decoder->dec_output_info.notSufficientSliceBuffer,
+		decoder->dec_output_info.decodingSuccess,
+		decoder->dec_output_info.interlacedFrame,
+		decoder->dec_output_info.mp4PackedPBframe,
+		decoder->dec_output_info.h264Npf,
+		decoder->dec_output_info.pictureStructure,
+		decoder->dec_output_info.topFieldFirst,
+		decoder->dec_output_info.repeatFirstField,
+		decoder->dec_output_info.fieldSequence,
+		decoder->dec_output_info.decPicWidth,
+		decoder->dec_output_info.decPicHeight
+	);
 
-			/* Wait a few times, since sometimes, it takes more than
-			 * one vpu_WaitForInt() call to cover the decoding interval */
-			timeout = TRUE;
-			for (cnt = 0; cnt < VPU_MAX_TIMEOUT_COUNTS; ++cnt)
-			{
-				if (vpu_WaitForInt(VPU_WAIT_TIMEOUT) != RETCODE_SUCCESS)
-				{
-					IMX_VPU_INFO("timeout after waiting %d ms for frame completion", VPU_WAIT_TIMEOUT);
-				}
-				else
-				{
-					timeout = FALSE;
-					break;
-				}
-			}
-		}
 
+	/* VP8 requires some workarounds */
+	if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_VP8)
+	{
+		if ((decoder->dec_output_info.indexFrameDecoded >= 0) && (decoder->dec_output_info.indexFrameDisplay == VPU_DECODER_DISPLAYIDX_NO_FRAME_TO_DISPLAY))
+		{
+			/* Internal invisible frames are supposed to be used for decoding only,
+			 * so don't output it, and drop it instead; to that end, set the index
+			 * values to resemble indices used for dropped frames to make sure the
+			 * dropped frames block below thinks this frame got dropped by the VPU */
+			IMX_VPU_DEBUG("skip internal invisible frame for VP8");
+			decoder->dec_output_info.indexFrameDecoded = VPU_DECODER_DECODEIDX_FRAME_NOT_DECODED;
+			decoder->dec_output_info.indexFrameDisplay = VPU_DECODER_DISPLAYIDX_NO_FRAME_TO_DISPLAY;
+		}
+	}
 
-		/* Retrieve information about the result of the decode process There may be no
-		 * decoded frame yet though; this only finishes processing the input frame. In
-		 * case of formats like h.264, it may take several input frames until output
-		 * frames start coming out. However, the output information does contain valuable
-		 * data even at the beginning, like which framebuffer in the framebuffer array
-		 * is used for decoding the frame into.
-		 *
-		 * Also, vpu_DecGetOutputInfo() is called even if a timeout occurred. This is
-		 * intentional, since according to the VPU docs, vpu_DecStartOneFrame() won't be
-		 * usable again until vpu_DecGetOutputInfo() is called. In other words, the
-		 * vpu_DecStartOneFrame() locks down some internals inside the VPU, and
-		 * vpu_DecGetOutputInfo() releases them. */
+	/* Motion JPEG requires frame index adjustments */
+	if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
+	{
+		IMX_VPU_DEBUG("MJPEG data -> adjust indexFrameDisplay and indexFrameDecoded values to %d", jpeg_frame_idx);
+		decoder->dec_output_info.indexFrameDecoded = jpeg_frame_idx;
+		decoder->dec_output_info.indexFrameDisplay = jpeg_frame_idx;
+	}
 
-		dec_ret = vpu_DecGetOutputInfo(decoder->handle, &(decoder->dec_output_info));
-		ret = IMX_VPU_DEC_HANDLE_ERROR("could not get output information", dec_ret);
-		if (ret != IMX_VPU_DEC_RETURN_CODE_OK)
-			return ret;
+	/* Check if video sequence parameters changed. If so, abort any
+	 * additional checks and processing; the decoder has to be drained
+	 * and reopened to support the changed parameters. */
+	if (decoder->dec_output_info.decodingSuccess & (1 << 20))
+	{
+		IMX_VPU_DEBUG("video sequence parameters changed");
+		*output_code |= IMX_VPU_DEC_OUTPUT_CODE_VIDEO_PARAMS_CHANGED;
+		return IMX_VPU_DEC_RETURN_CODE_OK;
+	}
 
+	/* Check if there were enough output framebuffers */
+	if (decoder->dec_output_info.indexFrameDecoded == VPU_DECODER_DECODEIDX_ALL_FRAMES_DECODED)
+	{
+		IMX_VPU_DEBUG("not enough output framebuffers were available");
+		*output_code |= IMX_VPU_DEC_OUTPUT_CODE_NOT_ENOUGH_OUTPUT_FRAMES;
+	}
 
-		/* If a timeout occurred earlier, this is the correct time to abort
-		 * decoding and return an error code, since vpu_DecGetOutputInfo()
-		 * has been called, unlocking the VPU decoder calls. */
-		if (timeout)
-			return IMX_VPU_DEC_RETURN_CODE_TIMEOUT;
+	/* Check if decoding was incomplete (bit #0 is then 0, bit #4 1).
+	 * Incomplete decoding indicates incomplete input data. */
+	if (decoder->dec_output_info.decodingSuccess & (1 << 4))
+	{
+		IMX_VPU_DEBUG("not enough input data was available");
+		*output_code = IMX_VPU_DEC_OUTPUT_CODE_NOT_ENOUGH_INPUT_DATA;
+	}
 
+	/* Report dropped frames. With trick play, the VPU may still output
+	 * a previously decoded frame for display after skipping the current
+	 * one, so the display index is not checked in that case. */
+	if (
+	  (((*output_code) & IMX_VPU_DEC_OUTPUT_CODE_NOT_ENOUGH_INPUT_DATA) == 0) &&
+	  (decoder->dec_output_info.indexFrameDecoded == VPU_DECODER_DECODEIDX_FRAME_NOT_DECODED) &&
+	  (
+	    (decoder->dec_output_info.indexFrameDisplay == VPU_DECODER_DISPLAYIDX_NO_FRAME_TO_DISPLAY) ||
+	    (decoder->dec_output_info.indexFrameDisplay == VPU_DECODER_DISPLAYIDX_SKIP_MODE_NO_FRAME_TO_DISPLAY) ||
+	    (decoder->skip_mode != IMX_VPU_DEC_SKIP_MODE_NONE) ||
+	    decoder->keyframe_search_enabled
+	  )
+	)
+	{
+		IMX_VPU_DEBUG("frame got dropped (context: %p pts %" PRIu64 " dts %" PRIu64 ")", decoder->started_frame_context, decoder->started_frame_pts, decoder->started_frame_dts);
+		decoder->dropped_frame_entry.context = decoder->started_frame_context;
+		decoder->dropped_frame_entry.pts = decoder->started_frame_pts;
+		decoder->dropped_frame_entry.dts = decoder->started_frame_dts;
+		*output_code |= IMX_VPU_DEC_OUTPUT_CODE_DROPPED;
+	}
 
-		/* Log some information about the decoded frame */
-		IMX_VPU_LOG(
-			"output info:  indexFrameDisplay %d  indexFrameDecoded %d  NumDecFrameBuf %d  picType %d  idrFlg %d  numOfErrMBs %d  hScaleFlag %d  vScaleFlag %d  notSufficientPsBuffer %d  notSufficientSliceBuffer %d  decodingSuccess %d  interlacedFrame %d  mp4PackedPBframe %d  h264Npf %d  pictureStructure %d  topFieldFirst %d  repeatFirstField %d  fieldSequence %d  decPicWidth %d  decPicHeight %d",
-			decoder->dec_output_info.indexFrameDisplay,
-			decoder->dec_output_info.indexFrameDecoded,
-			decoder->dec_output_info.NumDecFrameBuf,
-			decoder->dec_output_info.picType,
-			decoder->dec_output_info.idrFlg,
-			decoder->dec_output_info.numOfErrMBs,
-			decoder->dec_output_info.hScaleFlag,
-			decoder->dec_output_info.vScaleFlag,
-			decoder->dec_output_info.notSufficientPsBuffer,
-			decoder->dec_output_info.notSufficientSliceBuffer,
-			decoder->dec_output_info.decodingSuccess,
-			decoder->dec_output_info.interlacedFrame,
-			decoder->dec_output_info.mp4PackedPBframe,
-			decoder->dec_output_info.h264Npf,
-			decoder->dec_output_info.pictureStructure,
-			decoder->dec_output_info.topFieldFirst,
-			decoder->dec_output_info.repeatFirstField,
-			decoder->dec_output_info.fieldSequence,
-			decoder->dec_output_info.decPicWidth,
-			decoder->dec_output_info.decPicHeight
-		);
+	/* Check if information about the decoded frame is available.
+	 * In particular, the index of the framebuffer where the frame is being
+	 * decoded into is essential with formats like h.264, which allow for both
+	 * delays between decoding and presentation, and reordering of frames.
+	 * With the indexFrameDecoded value, it is possible to know which framebuffer
+	 * is associated with what input buffer. This is necessary to properly
+	 * associate context information which can later be retrieved again when a
+	 * frame can be displayed.
+	 * indexFrameDecoded can be negative, meaning there is no frame currently being
+	 * decoded. This typically happens when the drain mode is enabled, since then,
+	 * there will be no more input data. */
+
+	if (decoder->dec_output_info.indexFrameDecoded >= 0)
+	{
+		ImxVpuFrameType *frame_types;
+		int idx_decoded = decoder->dec_output_info.indexFrameDecoded;
+		assert(idx_decoded < (int)(decoder->num_framebuffers));
+
+		decoder->frame_entries[idx_decoded].context = decoder->started_frame_context;
+		decoder->frame_entries[idx_decoded].pts = decoder->started_frame_pts;
+		decoder->frame_entries[idx_decoded].dts = decoder->started_frame_dts;
+		imx_vpu_dec_set_frame_mode(decoder, idx_decoded, FrameMode_ReservedForDecoding);
+		decoder->frame_entries[idx_decoded].interlacing_mode = convert_interlacing_mode(decoder->codec_format, &(decoder->dec_output_info));
+
+		/* XXX: The VPU documentation seems to be incorrect about IDR types.
+		 * There is an undocumented idrFlg field which is also used by the
+		 * VPU wrapper. If this flag's first bit is set, then this is an IDR
+		 * frame, otherwise it is a non-IDR one. The non-IDR case is then
+		 * handled in the default way (see convert_frame_type() for details). */
+		frame_types = &(decoder->frame_entries[idx_decoded].frame_types[0]);
+		if ((decoder->codec_format == IMX_VPU_CODEC_FORMAT_H264) && (decoder->dec_output_info.idrFlg & 0x01))
+			frame_types[0] = frame_types[1] = IMX_VPU_FRAME_TYPE_IDR;
+		else
+			convert_frame_type(decoder->codec_format, decoder->dec_output_info.picType, !!(decoder->dec_output_info.interlacedFrame), frame_types);
 
+		decoder->num_used_framebuffers++;			
 
-		/* VP8 requires some workarounds */
-		if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_VP8)
+		/* A frame was decoded, so the keyframe search is done */
+		if (decoder->keyframe_search_enabled)
 		{
-			if ((decoder->dec_output_info.indexFrameDecoded >= 0) && (decoder->dec_output_info.indexFrameDisplay == VPU_DECODER_DISPLAYIDX_NO_FRAME_TO_DISPLAY))
-			{
-				/* Internal invisible frames are supposed to be used for decoding only,
-				 * so don't output it, and drop it instead; to that end, set the index
-				 * values to resemble indices used for dropped frames to make sure the
-				 * dropped frames block below thinks this frame got dropped by the VPU */
-				IMX_VPU_DEBUG("skip internal invisible frame for VP8");
-				decoder->dec_output_info.indexFrameDecoded = VPU_DECODER_DECODEIDX_FRAME_NOT_DECODED;
-				decoder->dec_output_info.indexFrameDisplay = VPU_DECODER_DISPLAYIDX_NO_FRAME_TO_DISPLAY;
-			}
+			IMX_VPU_DEBUG("keyframe found; disabling keyframe search");
+			decoder->keyframe_search_enabled = FALSE;
 		}
+	}
 
-		/* Motion JPEG requires frame index adjustments */
-		if (decoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
-		{
-			IMX_VPU_DEBUG("MJPEG data -> adjust indexFrameDisplay and indexFrameDecoded values to %d", jpeg_frame_idx);
-			decoder->dec_output_info.indexFrameDecoded = jpeg_frame_idx;
-			decoder->dec_output_info.indexFrameDisplay = jpeg_frame_idx;
-		}
 
-		/* Check if video sequence parameters changed. If so, abort any
-		 * additional checks and processing; the decoder has to be drained
-		 * and reopened to support the changed parameters. */
-		if (decoder->dec_output_info.decodingSuccess & (1 << 20))
-		{
-			IMX_VPU_DEBUG("video sequence parameters changed");
-			*output_code |= IMX_VPU_DEC_OUTPUT_CODE_VIDEO_PARAMS_CHANGED;
-			return IMX_VPU_DEC_RETURN_CODE_OK;
-		}
+	/* Check if information about a displayable frame is available.
+	 * A frame can be presented when it is fully decoded. In that case,
+	 * indexFrameDisplay is >= 0. If no fully decoded and displayable
+	 * frame exists (yet), indexFrameDisplay is -2 or -3 (depending on the
+	 * currently enabled frame skip mode). If indexFrameDisplay is -1,
+	 * all frames have been decoded. This typically happens after drain
+	 * mode was enabled.
+	 * This index is later used to retrieve the context that was associated
+	 * with the input data that corresponds to the decoded and displayable
+	 * frame (see above). available_decoded_frame_idx stores the index for
+	 * this precise purpose. Also see imx_vpu_dec_get_decoded_frame(). */
 
-		/* Check if there were enough output framebuffers */
-		if (decoder->dec_output_info.indexFrameDecoded == VPU_DECODER_DECODEIDX_ALL_FRAMES_DECODED)
-		{
-			IMX_VPU_DEBUG("not enough output framebuffers were available");
-			*output_code |= IMX_VPU_DEC_OUTPUT_CODE_NOT_ENOUGH_OUTPUT_FRAMES;
-		}
-
-		/* Check if decoding was incomplete (bit #0 is then 0, bit #4 1).
-		 * Incomplete decoding indicates incomplete input data. */
-		if (decoder->dec_output_info.decodingSuccess & (1 << 4))
-		{
-			IMX_VPU_DEBUG("not enough input data was available");
-			*output_code = IMX_VPU_DEC_OUTPUT_CODE_NOT_ENOUGH_INPUT_DATA;
-		}
-
-		/* Report dropped frames */
-		if (
-		  (((*output_code) & IMX_VPU_DEC_OUTPUT_CODE_NOT_ENOUGH_INPUT_DATA) == 0) &&
-		  (decoder->dec_output_info.indexFrameDecoded == VPU_DECODER_DECODEIDX_FRAME_NOT_DECODED) &&
-		  (
-		    (decoder->dec_output_info.indexFrameDisplay == VPU_DECODER_DISPLAYIDX_NO_FRAME_TO_DISPLAY) ||
-		    (decoder->dec_output_info.indexFrameDisplay == VPU_DECODER_DISPLAYIDX_SKIP_MODE_NO_FRAME_TO_DISPLAY)
-		  )
-		)
-		{
-			IMX_VPU_DEBUG("frame got dropped (context: %p pts %" PRIu64 " dts %" PRIu64 ")", encoded_frame->context, encoded_frame->pts, encoded_frame->dts);
-			decoder->dropped_frame_entry.context = encoded_frame->context;
-			decoder->dropped_frame_entry.pts = encoded_frame->pts;
-			decoder->dropped_frame_entry.dts = encoded_frame->dts;
-			*output_code |= IMX_VPU_DEC_OUTPUT_CODE_DROPPED;
-		}
-
-		/* Check if information about the decoded frame is available.
-		 * In particular, the index of the framebuffer where the frame is being
-		 * decoded into is essential with formats like h.264, which allow for both
-		 * delays between decoding and presentation, and reordering of frames.
-		 * With the indexFrameDecoded value, it is possible to know which framebuffer
-		 * is associated with what input buffer. This is necessary to properly
-		 * associate context information which can later be retrieved again when a
-		 * frame can be displayed.
-		 * indexFrameDecoded can be negative, meaning there is no frame currently being
-		 * decoded. This typically happens when the drain mode is enabled, since then,
-		 * there will be no more input data. */
-
-		if (decoder->dec_output_info.indexFrameDecoded >= 0)
-		{
-			ImxVpuFrameType *frame_types;
-			int idx_decoded = decoder->dec_output_info.indexFrameDecoded;
-			assert(idx_decoded < (int)(decoder->num_framebuffers));
-
-			decoder->frame_entries[idx_decoded].context = encoded_frame->context;
-			decoder->frame_entries[idx_decoded].pts = encoded_frame->pts;
-			decoder->frame_entries[idx_decoded].dts = encoded_frame->dts;
-			decoder->frame_entries[idx_decoded].mode = FrameMode_ReservedForDecoding;
-			decoder->frame_entries[idx_decoded].interlacing_mode = convert_interlacing_mode(decoder->codec_format, &(decoder->dec_output_info));
-
-			/* XXX: The VPU documentation seems to be incorrect about IDR types.
-			 * There is an undocumented idrFlg field which is also used by the
-			 * VPU wrapper. If this flag's first bit is set, then this is an IDR
-			 * frame, otherwise it is a non-IDR one. The non-IDR case is then
-			 * handled in the default way (see convert_frame_type() for details). */
-			frame_types = &(decoder->frame_entries[idx_decoded].frame_types[0]);
-			if ((decoder->codec_format == IMX_VPU_CODEC_FORMAT_H264) && (decoder->dec_output_info.idrFlg & 0x01))
-				frame_types[0] = frame_types[1] = IMX_VPU_FRAME_TYPE_IDR;
-			else
-				convert_frame_type(decoder->codec_format, decoder->dec_output_info.picType, !!(decoder->dec_output_info.interlacedFrame), frame_types);
+	if (decoder->dec_output_info.indexFrameDisplay >= 0)
+	{
+		ImxVpuDecFrameEntry *entry;
+		int idx_display = decoder->dec_output_info.indexFrameDisplay;
+		assert(idx_display < (int)(decoder->num_framebuffers));
 
-			decoder->num_used_framebuffers++;			
-		}
+		entry = &(decoder->frame_entries[idx_display]);
 
+		IMX_VPU_LOG("decoded and displayable frame available (framebuffer display index: %d context: %p pts: %" PRIu64 " dts: %" PRIu64 ")", idx_display, entry->context, entry->pts, entry->dts);
 
-		/* Check if information about a displayable frame is available.
-		 * A frame can be presented when it is fully decoded. In that case,
-		 * indexFrameDisplay is >= 0. If no fully decoded and displayable
-		 * frame exists (yet), indexFrameDisplay is -2 or -3 (depending on the
-		 * currently enabled frame skip mode). If indexFrameDisplay is -1,
-		 * all frames have been decoded. This typically happens after drain
-		 * mode was enabled.
-		 * This index is later used to retrieve the context that was associated
-		 * with the input data that corresponds to the decoded and displayable
-		 * frame (see above). available_decoded_frame_idx stores the index for
-		 * this precise purpose. Also see imx_vpu_dec_get_decoded_frame(). */
+		imx_vpu_dec_set_frame_mode(decoder, idx_display, FrameMode_ContainsDisplayableFrame);
 
-		if (decoder->dec_output_info.indexFrameDisplay >= 0)
-		{
-			ImxVpuDecFrameEntry *entry;
-			int idx_display = decoder->dec_output_info.indexFrameDisplay;
-			assert(idx_display < (int)(decoder->num_framebuffers));
+		decoder->available_decoded_frame_idx = idx_display;
+		*output_code |= IMX_VPU_DEC_OUTPUT_CODE_DECODED_FRAME_AVAILABLE;
+	}
+	else if (decoder->dec_output_info.indexFrameDisplay == VPU_DECODER_DISPLAYIDX_ALL_FRAMES_DISPLAYED)
+	{
+		IMX_VPU_LOG("EOS reached");
+		decoder->available_decoded_frame_idx = -1;
+		*output_code |= IMX_VPU_DEC_OUTPUT_CODE_EOS;
+	}
+	else
+	{
+		IMX_VPU_LOG("nothing yet to display ; indexFrameDisplay: %d", decoder->dec_output_info.indexFrameDisplay);
+	}
 
-			entry = &(decoder->frame_entries[idx_display]);
 
-			IMX_VPU_LOG("decoded and displayable frame available (framebuffer display index: %d context: %p pts: %" PRIu64 " dts: %" PRIu64 ")", idx_display, entry->context, entry->pts, entry->dts);
+	return ret;
+}
 
-			entry->mode = FrameMode_ContainsDisplayableFrame;
 
-			decoder->available_decoded_frame_idx = idx_display;
-			*output_code |= IMX_VPU_DEC_OUTPUT_CODE_DECODED_FRAME_AVAILABLE;
-		}
-		else if (decoder->dec_output_info.indexFrameDisplay == VPU_DECODER_DISPLAYIDX_ALL_FRAMES_DISPLAYED)
-		{
-			IMX_VPU_LOG("EOS reached");
-			decoder->available_decoded_frame_idx = -1;
-			*output_code |= IMX_VPU_DEC_OUTPUT_CODE_EOS;
-		}
-		else
-		{
-			IMX_VPU_LOG("nothing yet to display ; indexFrameDisplay: %d", decoder->dec_output_info.indexFrameDisplay);
-		}
+static ImxVpuDecReturnCodes imx_vpu_dec_decode_pushed_data(ImxVpuDecoder *decoder, ImxVpuEncodedFrame const *encoded_frame, uint8_t const *jpeg_data, uint8_t *jpeg_chunk_virtual_address, imx_vpu_phys_addr_t jpeg_chunk_physical_address, unsigned int *output_code)
+{
+	ImxVpuDecReturnCodes ret;
 
-	}
+	if ((ret = imx_vpu_dec_start_decoding(decoder, encoded_frame, jpeg_data, jpeg_chunk_virtual_address, jpeg_chunk_physical_address, output_code)) != IMX_VPU_DEC_RETURN_CODE_OK)
+		return ret;
 
+	ret = imx_vpu_dec_finish_decoding(decoder, output_code);
+	imx_vpu_dec_end_frame_stats(decoder, ret, *output_code);
 
 	return ret;
 }
@@ -2352,8 +3475,10 @@ void imx_vpu_dec_get_dropped_frame_info(ImxVpuDecoder *decoder, void **context,
 
 int imx_vpu_dec_check_if_can_decode(ImxVpuDecoder *decoder)
 {
+	int num_free_framebuffers;
 	assert(decoder != NULL);
-	int num_free_framebuffers = decoder->num_framebuffers - decoder->num_used_framebuffers;
+	imx_vpu_dec_process_returned_framebuffers(decoder);
+	num_free_framebuffers = decoder->num_framebuffers - decoder->num_used_framebuffers;
 	return num_free_framebuffers >= MIN_NUM_FREE_FB_REQUIRED;
 }
 
@@ -2384,7 +3509,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_mark_framebuffer_as_displayed(ImxVpuDecoder *de
 
 
 	/* frame is no longer being used */
-	decoder->frame_entries[idx].mode = FrameMode_Free;
+	imx_vpu_dec_set_frame_mode(decoder, idx, FrameMode_Free);
 
 
 	/* mark it as displayed in the VPU */
@@ -2398,6 +3523,7 @@ ImxVpuDecReturnCodes imx_vpu_dec_mark_framebuffer_as_displayed(ImxVpuDecoder *de
 	}
 
 	IMX_VPU_LOG("marked framebuffer with index #%d as displayed", idx);
+	IMX_VPU_TRACE_EVENT(&(decoder->trace_ring), IMX_VPU_TRACE_EVENT_DEC_FRAMEBUFFER_DISPLAYED, idx, 0, 0);
 
 
 	/* set the already_marked flag to inform the rest of the imxvpuapi
@@ -2411,6 +3537,97 @@ ImxVpuDecReturnCodes imx_vpu_dec_mark_framebuffer_as_displayed(ImxVpuDecoder *de
 }
 
 
+ImxVpuDecReturnCodes imx_vpu_dec_return_framebuffer(ImxVpuDecoder *decoder, ImxVpuFramebuffer *framebuffer)
+{
+	int idx;
+
+	assert(decoder != NULL);
+	assert(framebuffer != NULL);
+
+	/* the index into the framebuffer array is stored in the "internal" field */
+	idx = (int)(framebuffer->internal);
+	assert(idx < (int)(decoder->num_framebuffers));
+
+	if (!imx_vpu_index_return_queue_push(&(decoder->returned_framebuffers), idx))
+	{
+		IMX_VPU_ERROR("framebuffer with index #%d has already been returned", idx);
+		return IMX_VPU_DEC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	return IMX_VPU_DEC_RETURN_CODE_OK;
+}
+
+
+static void imx_vpu_dec_process_returned_framebuffers(ImxVpuDecoder *decoder)
+{
+	int idx;
+
+	if (decoder->returned_framebuffers.num_indices == 0)
+		return;
+
+	idx = imx_vpu_index_return_queue_take_all(&(decoder->returned_framebuffers));
+	while (idx >= 0)
+	{
+		int next_idx = imx_vpu_index_return_queue_next(&(decoder->returned_framebuffers), idx);
+		imx_vpu_dec_mark_framebuffer_as_displayed(decoder, &(decoder->framebuffers[idx]));
+		idx = next_idx;
+	}
+}
+
+
+void imx_vpu_dec_get_stats(ImxVpuDecoder *decoder, ImxVpuDecStats *stats)
+{
+	assert(decoder != NULL);
+	assert(stats != NULL);
+
+	*stats = decoder->stats;
+	stats->bitstream_buffer_size = decoder->main_bitstream_buffer_size;
+	stats->num_framebuffers = decoder->num_framebuffers;
+	stats->num_used_framebuffers = decoder->num_used_framebuffers;
+}
+
+
+void imx_vpu_dec_reset_stats(ImxVpuDecoder *decoder)
+{
+	assert(decoder != NULL);
+
+	imx_vpu_dec_clear_stats(&(decoder->stats));
+}
+
+
+void imx_vpu_dec_set_frame_stats_callback(ImxVpuDecoder *decoder, ImxVpuDecFrameStatsCallback callback, void *user_data)
+{
+	assert(decoder != NULL);
+
+	decoder->frame_stats_callback = callback;
+	decoder->frame_stats_callback_user_data = user_data;
+}
+
+
+unsigned int imx_vpu_dec_get_trace_events(ImxVpuDecoder *decoder, ImxVpuTraceEvent *events, unsigned int max_events)
+{
+	assert(decoder != NULL);
+	assert(events != NULL);
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	return imx_vpu_trace_ring_get_events(&(decoder->trace_ring), events, max_events);
+#else
+	IMXVPUAPI_UNUSED_PARAM(max_events);
+	return 0;
+#endif
+}
+
+
+void imx_vpu_dec_clear_trace_events(ImxVpuDecoder *decoder)
+{
+	assert(decoder != NULL);
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	imx_vpu_trace_ring_clear(&(decoder->trace_ring));
+#endif
+}
+
+
 
 
 /************************************************/
@@ -2425,6 +3642,9 @@ struct _ImxVpuEncoder
 	ImxVpuDMABuffer *bitstream_buffer;
 	uint8_t *bitstream_buffer_virtual_address;
 	imx_vpu_phys_addr_t bitstream_buffer_physical_address;
+	/* Layout of the bitstream buffer. The main bitstream
+	 * buffer comes first, followed by the MPEG-4 scratch buffer. */
+	size_t main_bitstream_buffer_size, mpeg4_scratch_buffer_size;
 
 	ImxVpuDMABufferAllocator *additional_dmabuffers_allocator;
 
@@ -2434,6 +3654,11 @@ struct _ImxVpuEncoder
 	unsigned int frame_rate_numerator, frame_rate_denominator;
 	unsigned int aud_enable;
 
+	/* Rotator settings. frame_width and frame_height above are the size
+	 * of the input frames, not the rotated ones. */
+	ImxVpuRotation rotation;
+	ImxVpuMirrorDirection mirror;
+
 	unsigned int num_framebuffers;
 	FrameBuffer *internal_framebuffers;
 	ImxVpuFramebuffer *framebuffers;
@@ -2445,6 +3670,54 @@ struct _ImxVpuEncoder
 
 	BOOL first_frame;
 
+	/* If slice_output_enabled is set, the bitstream buffer is used in ring
+	 * buffer mode, and encoded data is delivered during encoding. The other
+	 * two values are the per-frame state of the delivery: slice_output_started
+	 * is set once the first data of the frame (and any headers in front of it)
+	 * was delivered, and slice_output_data_size is the total size of all
+	 * delivered data of the frame. */
+	BOOL slice_output_enabled;
+	BOOL slice_output_started;
+	size_t slice_output_data_size;
+
+	/* Copies of the open params and the initial info, for
+	 * imx_vpu_enc_save_state(). If headers_restored is set, the
+	 * header data was restored by imx_vpu_enc_open_from_state(),
+	 * and does not have to be generated. */
+	ImxVpuEncOpenParams open_params;
+	ImxVpuEncInitialInfo initial_info;
+	BOOL initial_info_available;
+	BOOL headers_restored;
+
+	/* MJPEG quality factor, and the size of the JPEG header in
+	 * headers.mjpeg_header_data. The header is the same for all frames,
+	 * so it is generated only once. 0 means it was not generated yet. */
+	unsigned int mjpeg_quality_factor;
+	size_t mjpeg_header_size;
+
+	/* encoding_started is set by imx_vpu_enc_encode_start() and cleared by
+	 * imx_vpu_enc_encode_finish(). encoding_completed is set if
+	 * imx_vpu_enc_encode_poll() detected the completion. */
+	BOOL encoding_started, encoding_completed;
+	ImxVpuEncParams pending_encoding_params;
+	unsigned int pending_output_code;
+	size_t pending_mjpeg_header_size;
+	void *started_frame_context;
+	uint64_t started_frame_pts, started_frame_dts;
+
+	/* Statistics; the same as in the decoder */
+	ImxVpuEncStats stats;
+	ImxVpuFrameStats cur_frame_stats;
+	uint64_t cur_frame_begin_time, cur_output_begin_time;
+	ImxVpuEncFrameStatsCallback frame_stats_callback;
+	void *frame_stats_callback_user_data;
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	ImxVpuTraceRing trace_ring;
+#endif
+
+	ImxVpuEncRateAdapter rate_adapter;
+
 	union
 	{
 		struct
@@ -2608,61 +3881,261 @@ static void imx_vpu_enc_set_mjpeg_tables(unsigned int quality_factor, EncMjpgPar
 	uint8_t const *component_info_table;
 	unsigned int scale_factor;
 
-	assert(mjpeg_params != NULL);
+	assert(mjpeg_params != NULL);
+
+
+	/* NOTE: The tables in structure referred to by mjpeg_params must
+	 * have been filled with nullbytes, and the mjpg_sourceFormat field
+	 * must be valid */
+
+
+	/* Copy the Huffman tables */
+
+	memcpy(mjpeg_params->huffBits[DC_TABLE_INDEX0], mjpeg_enc_huffman_bits_luma_dc, sizeof(mjpeg_enc_huffman_bits_luma_dc));
+	memcpy(mjpeg_params->huffBits[AC_TABLE_INDEX0], mjpeg_enc_huffman_bits_luma_ac, sizeof(mjpeg_enc_huffman_bits_luma_ac));
+	memcpy(mjpeg_params->huffBits[DC_TABLE_INDEX1], mjpeg_enc_huffman_bits_chroma_dc, sizeof(mjpeg_enc_huffman_bits_chroma_dc));
+	memcpy(mjpeg_params->huffBits[AC_TABLE_INDEX1], mjpeg_enc_huffman_bits_chroma_ac, sizeof(mjpeg_enc_huffman_bits_chroma_ac));
+
+	memcpy(mjpeg_params->huffVal[DC_TABLE_INDEX0], mjpeg_enc_huffman_value_luma_dc, sizeof(mjpeg_enc_huffman_value_luma_dc));
+	memcpy(mjpeg_params->huffVal[AC_TABLE_INDEX0], mjpeg_enc_huffman_value_luma_ac, sizeof(mjpeg_enc_huffman_value_luma_ac));
+	memcpy(mjpeg_params->huffVal[DC_TABLE_INDEX1], mjpeg_enc_huffman_value_chroma_dc, sizeof(mjpeg_enc_huffman_value_chroma_dc));
+	memcpy(mjpeg_params->huffVal[AC_TABLE_INDEX1], mjpeg_enc_huffman_value_chroma_ac, sizeof(mjpeg_enc_huffman_value_chroma_ac));
+
+
+	/* Copy the quantization tables */
+
+	/* Ensure the quality factor is in the 1..100 range */
+	if (quality_factor < 1)
+		quality_factor = 1;
+	if (quality_factor > 100)
+		quality_factor = 100;
+
+	/* Using the Independent JPEG Group's formula, used in libjpeg, for generating
+	 * a scale factor out of a quality factor in the 1..100 range */
+	if (quality_factor < 50)
+		scale_factor = 5000 / quality_factor;
+	else
+		scale_factor = 200 - quality_factor * 2;
+
+	/* We use the same quant table for Cb and Cr */
+	imx_vpu_enc_copy_quantization_table(mjpeg_params->qMatTab[0], mjpeg_enc_quantization_luma,   sizeof(mjpeg_enc_quantization_luma),   scale_factor); /* Y */
+	imx_vpu_enc_copy_quantization_table(mjpeg_params->qMatTab[1], mjpeg_enc_quantization_chroma, sizeof(mjpeg_enc_quantization_chroma), scale_factor); /* Cb */
+	imx_vpu_enc_copy_quantization_table(mjpeg_params->qMatTab[2], mjpeg_enc_quantization_chroma, sizeof(mjpeg_enc_quantization_chroma), scale_factor); /* Cr */
+
+
+	/* Copy the component info table (depends on the format) */
+
+	switch (mjpeg_params->mjpg_sourceFormat)
+	{
+		case FORMAT_420: component_info_table = mjpeg_enc_component_info_tables[0]; break;
+		case FORMAT_422: component_info_table = mjpeg_enc_component_info_tables[1]; break;
+		case FORMAT_224: component_info_table = mjpeg_enc_component_info_tables[2]; break;
+		case FORMAT_444: component_info_table = mjpeg_enc_component_info_tables[3]; break;
+		case FORMAT_400: component_info_table = mjpeg_enc_component_info_tables[4]; break;
+		default: assert(FALSE);
+	}
+
+	memcpy(mjpeg_params->cInfoTab, component_info_table, 4 * 6);
+}
+
+
+static BOOL imx_vpu_enc_get_mjpeg_source_format(ImxVpuColorFormat color_format, int *source_format)
+{
+	switch (color_format)
+	{
+		case IMX_VPU_COLOR_FORMAT_YUV420:            *source_format = FORMAT_420; return TRUE;
+		case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL: *source_format = FORMAT_422; return TRUE;
+		case IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL:   *source_format = FORMAT_224; return TRUE;
+		case IMX_VPU_COLOR_FORMAT_YUV444:            *source_format = FORMAT_444; return TRUE;
+		case IMX_VPU_COLOR_FORMAT_YUV400:            *source_format = FORMAT_400; return TRUE;
+		default: return FALSE;
+	}
+}
+
+
+/* Process-wide LRU cache for MJPEG encoder tables and JPEG headers.
+ * Computing the quantization tables and generating the header are
+ * repeated for every new MJPEG encoder instance otherwise. The tables
+ * only depend on the quality factor and color format; the header
+ * additionally depends on the frame size. Like imx_vpu_enc_load(),
+ * accesses to this cache are not thread safe. */
+
+typedef struct
+{
+	BOOL valid;
+	unsigned long last_use;
+
+	unsigned int quality_factor;
+	ImxVpuColorFormat color_format;
+	unsigned int frame_width, frame_height;
+
+	EncMjpgParam mjpeg_params;
+
+	/* The header is generated by the VPU library with an open encoder
+	 * instance, so it is filled in by the first encoder which uses this
+	 * entry. header_size is 0 until then. */
+	uint8_t header_data[MJPEG_ENC_HEADER_DATA_MAX_SIZE];
+	size_t header_size;
+}
+ImxVpuEncMJPEGCacheEntry;
+
+static ImxVpuEncMJPEGCacheEntry mjpeg_enc_cache[MJPEG_ENC_CACHE_SIZE];
+static unsigned long mjpeg_enc_cache_use_counter = 0;
+
+
+static ImxVpuEncMJPEGCacheEntry* imx_vpu_enc_find_mjpeg_cache_entry(unsigned int quality_factor, ImxVpuColorFormat color_format, unsigned int frame_width, unsigned int frame_height)
+{
+	unsigned int i;
+
+	for (i = 0; i < MJPEG_ENC_CACHE_SIZE; ++i)
+	{
+		ImxVpuEncMJPEGCacheEntry *entry = &(mjpeg_enc_cache[i]);
+
+		if (entry->valid
+		 && (entry->quality_factor == quality_factor)
+		 && (entry->color_format == color_format)
+		 && (entry->frame_width == frame_width)
+		 && (entry->frame_height == frame_height))
+		{
+			entry->last_use = ++mjpeg_enc_cache_use_counter;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+
+static ImxVpuEncMJPEGCacheEntry* imx_vpu_enc_get_mjpeg_cache_entry(unsigned int quality_factor, ImxVpuColorFormat color_format, int source_format, unsigned int frame_width, unsigned int frame_height)
+{
+	unsigned int i;
+	ImxVpuEncMJPEGCacheEntry *entry;
+
+	entry = imx_vpu_enc_find_mjpeg_cache_entry(quality_factor, color_format, frame_width, frame_height);
+	if (entry != NULL)
+	{
+		IMX_VPU_LOG("using cached MJPEG tables for quality factor %u", quality_factor);
+		return entry;
+	}
+
+	/* Not in the cache; replace an unused entry, or the least recently used one */
+	entry = &(mjpeg_enc_cache[0]);
+	for (i = 0; i < MJPEG_ENC_CACHE_SIZE; ++i)
+	{
+		if (!(mjpeg_enc_cache[i].valid))
+		{
+			entry = &(mjpeg_enc_cache[i]);
+			break;
+		}
+
+		if (mjpeg_enc_cache[i].last_use < entry->last_use)
+			entry = &(mjpeg_enc_cache[i]);
+	}
+
+	memset(entry, 0, sizeof(ImxVpuEncMJPEGCacheEntry));
+	entry->valid = TRUE;
+	entry->last_use = ++mjpeg_enc_cache_use_counter;
+	entry->quality_factor = quality_factor;
+	entry->color_format = color_format;
+	entry->frame_width = frame_width;
+	entry->frame_height = frame_height;
+
+	entry->mjpeg_params.mjpg_sourceFormat = source_format;
+	imx_vpu_enc_set_mjpeg_tables(quality_factor, &(entry->mjpeg_params));
+
+	IMX_VPU_LOG("computed MJPEG tables for quality factor %u and stored them in the cache", quality_factor);
+
+	return entry;
+}
+
+
+static BOOL imx_vpu_enc_swaps_frame_dimensions(ImxVpuRotation rotation)
+{
+	return (rotation == IMX_VPU_ROTATION_90) || (rotation == IMX_VPU_ROTATION_270);
+}
+
+
+static void imx_vpu_enc_set_rotator_params(ImxVpuEncoder *encoder)
+{
+	/* the datatypes are int, but this is undocumented; determined by looking
+	 * into the imx-vpu library's vpu_lib.c vpu_EncGiveCommand() definition */
+	int rotation_angle = (int)(encoder->rotation);
+	int mirror = (int)(encoder->mirror);
+
+	vpu_EncGiveCommand(encoder->handle, SET_ROTATION_ANGLE, (void *)(&rotation_angle));
+	vpu_EncGiveCommand(encoder->handle, SET_MIRROR_DIRECTION,(void *)(&mirror));
 
+	vpu_EncGiveCommand(encoder->handle, (rotation_angle != 0) ? ENABLE_ROTATION : DISABLE_ROTATION, 0);
+	vpu_EncGiveCommand(encoder->handle, (mirror != 0) ? ENABLE_MIRRORING : DISABLE_MIRRORING, 0);
+}
 
-	/* NOTE: The tables in structure referred to by mjpeg_params must
-	 * have been filled with nullbytes, and the mjpg_sourceFormat field
-	 * must be valid */
 
+/* Makes data which the VPU wrote into the bitstream buffer visible to the CPU. */
+static void imx_vpu_enc_sync_bitstream_for_cpu(ImxVpuEncoder *encoder, uint8_t const *data, size_t size)
+{
+	imx_vpu_dma_buffer_sync_for_cpu(encoder->bitstream_buffer, (size_t)(data - encoder->bitstream_buffer_virtual_address), size);
+}
 
-	/* Copy the Huffman tables */
 
-	memcpy(mjpeg_params->huffBits[DC_TABLE_INDEX0], mjpeg_enc_huffman_bits_luma_dc, sizeof(mjpeg_enc_huffman_bits_luma_dc));
-	memcpy(mjpeg_params->huffBits[AC_TABLE_INDEX0], mjpeg_enc_huffman_bits_luma_ac, sizeof(mjpeg_enc_huffman_bits_luma_ac));
-	memcpy(mjpeg_params->huffBits[DC_TABLE_INDEX1], mjpeg_enc_huffman_bits_chroma_dc, sizeof(mjpeg_enc_huffman_bits_chroma_dc));
-	memcpy(mjpeg_params->huffBits[AC_TABLE_INDEX1], mjpeg_enc_huffman_bits_chroma_ac, sizeof(mjpeg_enc_huffman_bits_chroma_ac));
+/* In ring buffer mode (= slice output mode), retrieves the encoded data which the
+ * VPU wrote into the bitstream buffer, and which has not been consumed yet. The data
+ * can wrap around at the end of the main bitstream buffer, so it is returned as two
+ * regions; the second one has size 0 if there is no wraparound. The data must be
+ * consumed with vpu_EncUpdateBitstreamBuffer() once it is no longer needed. */
+static ImxVpuEncReturnCodes imx_vpu_enc_get_ring_buffer_data(ImxVpuEncoder *encoder, ImxVpuEncOutputSegment *regions, size_t *total_size)
+{
+	ImxVpuEncReturnCodes ret;
+	RetCode enc_ret;
+	PhysicalAddress read_ptr, write_ptr;
+	Uint32 num_bytes;
+	size_t offset, num_bytes_until_end;
 
-	memcpy(mjpeg_params->huffVal[DC_TABLE_INDEX0], mjpeg_enc_huffman_value_luma_dc, sizeof(mjpeg_enc_huffman_value_luma_dc));
-	memcpy(mjpeg_params->huffVal[AC_TABLE_INDEX0], mjpeg_enc_huffman_value_luma_ac, sizeof(mjpeg_enc_huffman_value_luma_ac));
-	memcpy(mjpeg_params->huffVal[DC_TABLE_INDEX1], mjpeg_enc_huffman_value_chroma_dc, sizeof(mjpeg_enc_huffman_value_chroma_dc));
-	memcpy(mjpeg_params->huffVal[AC_TABLE_INDEX1], mjpeg_enc_huffman_value_chroma_ac, sizeof(mjpeg_enc_huffman_value_chroma_ac));
+	enc_ret = vpu_EncGetBitstreamBuffer(encoder->handle, &read_ptr, &write_ptr, &num_bytes);
+	if ((ret = IMX_VPU_ENC_HANDLE_ERROR("could not get bitstream buffer data", enc_ret)) != IMX_VPU_ENC_RETURN_CODE_OK)
+		return ret;
 
+	offset = (size_t)(read_ptr - encoder->bitstream_buffer_physical_address);
+	num_bytes_until_end = encoder->main_bitstream_buffer_size - offset;
 
-	/* Copy the quantization tables */
+	regions[0].data = encoder->bitstream_buffer_virtual_address + offset;
+	regions[0].size = (num_bytes < num_bytes_until_end) ? num_bytes : num_bytes_until_end;
+	regions[1].data = encoder->bitstream_buffer_virtual_address;
+	regions[1].size = num_bytes - regions[0].size;
 
-	/* Ensure the quality factor is in the 1..100 range */
-	if (quality_factor < 1)
-		quality_factor = 1;
-	if (quality_factor > 100)
-		quality_factor = 100;
+	imx_vpu_enc_sync_bitstream_for_cpu(encoder, regions[0].data, regions[0].size);
+	imx_vpu_enc_sync_bitstream_for_cpu(encoder, regions[1].data, regions[1].size);
 
-	/* Using the Independent JPEG Group's formula, used in libjpeg, for generating
-	 * a scale factor out of a quality factor in the 1..100 range */
-	if (quality_factor < 50)
-		scale_factor = 5000 / quality_factor;
-	else
-		scale_factor = 200 - quality_factor * 2;
+	*total_size = num_bytes;
 
-	/* We use the same quant table for Cb and Cr */
-	imx_vpu_enc_copy_quantization_table(mjpeg_params->qMatTab[0], mjpeg_enc_quantization_luma,   sizeof(mjpeg_enc_quantization_luma),   scale_factor); /* Y */
-	imx_vpu_enc_copy_quantization_table(mjpeg_params->qMatTab[1], mjpeg_enc_quantization_chroma, sizeof(mjpeg_enc_quantization_chroma), scale_factor); /* Cb */
-	imx_vpu_enc_copy_quantization_table(mjpeg_params->qMatTab[2], mjpeg_enc_quantization_chroma, sizeof(mjpeg_enc_quantization_chroma), scale_factor); /* Cr */
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
 
 
-	/* Copy the component info table (depends on the format) */
+/* Copies all unconsumed data from the ring buffer into a newly allocated
+ * memory block, and consumes it. Used for the header data, which the VPU
+ * writes into the ring buffer in ring buffer mode. */
+static ImxVpuEncReturnCodes imx_vpu_enc_take_ring_buffer_data(ImxVpuEncoder *encoder, uint8_t **data, size_t *size)
+{
+	ImxVpuEncReturnCodes ret;
+	ImxVpuEncOutputSegment regions[2];
+	size_t total_size;
 
-	switch (mjpeg_params->mjpg_sourceFormat)
+	if ((ret = imx_vpu_enc_get_ring_buffer_data(encoder, regions, &total_size)) != IMX_VPU_ENC_RETURN_CODE_OK)
+		return ret;
+
+	if ((*data = IMX_VPU_ALLOC(total_size)) == NULL)
 	{
-		case FORMAT_420: component_info_table = mjpeg_enc_component_info_tables[0]; break;
-		case FORMAT_422: component_info_table = mjpeg_enc_component_info_tables[1]; break;
-		case FORMAT_224: component_info_table = mjpeg_enc_component_info_tables[2]; break;
-		case FORMAT_444: component_info_table = mjpeg_enc_component_info_tables[3]; break;
-		case FORMAT_400: component_info_table = mjpeg_enc_component_info_tables[4]; break;
-		default: assert(FALSE);
+		IMX_VPU_ERROR("could not allocate %zu byte for ring buffer data", total_size);
+		return IMX_VPU_ENC_RETURN_CODE_ERROR;
 	}
 
-	memcpy(mjpeg_params->cInfoTab, component_info_table, 4 * 6);
+	memcpy(*data, regions[0].data, regions[0].size);
+	memcpy(*data + regions[0].size, regions[1].data, regions[1].size);
+	*size = total_size;
+
+	vpu_EncUpdateBitstreamBuffer(encoder->handle, total_size);
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
 }
 
 
@@ -2679,20 +4152,30 @@ static ImxVpuEncReturnCodes imx_vpu_enc_generate_header_data(ImxVpuEncoder *enco
 		if ((ret = IMX_VPU_ENC_HANDLE_ERROR("header generation command failed", enc_ret)) != IMX_VPU_ENC_RETURN_CODE_OK) \
 			return ret; \
 		\
-		if ((encoder->headers.HEADER_FIELD = IMX_VPU_ALLOC(enc_header_param.size)) == NULL) \
+		if (encoder->slice_output_enabled) \
 		{ \
-			IMX_VPU_ERROR("could not allocate %d byte for %s memory block", enc_header_param.size, (DESCRIPTION)); \
-			return IMX_VPU_ENC_RETURN_CODE_ERROR; \
+			/* In ring buffer mode, the VPU does not fill in buf and size */ \
+			if ((ret = imx_vpu_enc_take_ring_buffer_data(encoder, &(encoder->headers.HEADER_FIELD), &(encoder->headers.HEADER_FIELD ## _size))) != IMX_VPU_ENC_RETURN_CODE_OK) \
+				return ret; \
+		} \
+		else \
+		{ \
+			if ((encoder->headers.HEADER_FIELD = IMX_VPU_ALLOC(enc_header_param.size)) == NULL) \
+			{ \
+				IMX_VPU_ERROR("could not allocate %d byte for %s memory block", enc_header_param.size, (DESCRIPTION)); \
+				return IMX_VPU_ENC_RETURN_CODE_ERROR; \
+			} \
+			\
+			imx_vpu_enc_sync_bitstream_for_cpu(encoder, encoder->bitstream_buffer_virtual_address + (enc_header_param.buf - encoder->bitstream_buffer_physical_address), enc_header_param.size); \
+			memcpy( \
+				encoder->headers.HEADER_FIELD, \
+				encoder->bitstream_buffer_virtual_address + (enc_header_param.buf - encoder->bitstream_buffer_physical_address), \
+				enc_header_param.size \
+			); \
+			encoder->headers.HEADER_FIELD ## _size = enc_header_param.size; \
 		} \
 		\
-		memcpy( \
-			encoder->headers.HEADER_FIELD, \
-			encoder->bitstream_buffer_virtual_address + (enc_header_param.buf - encoder->bitstream_buffer_physical_address), \
-			enc_header_param.size \
-		); \
-		encoder->headers.HEADER_FIELD ## _size = enc_header_param.size; \
-		\
-		IMX_VPU_LOG("generated %s with %d byte", (DESCRIPTION), enc_header_param.size); \
+		IMX_VPU_LOG("generated %s with %zu byte", (DESCRIPTION), encoder->headers.HEADER_FIELD ## _size); \
 	} \
 	while (0)
 
@@ -2890,22 +4373,314 @@ static ImxVpuEncReturnCodes imx_vpu_enc_write_header_data(ImxVpuEncoder *encoder
 }
 
 
-char const * imx_vpu_enc_error_string(ImxVpuEncReturnCodes code)
+static BOOL imx_vpu_enc_read_exp_golomb(uint8_t const *data, size_t size, size_t *bit_pos, unsigned int *value)
+{
+	/* Reads an unsigned Exp-Golomb code, as described in
+	 * ISO/IEC 14496-10 section 9.1 */
+	unsigned int num_leading_zero_bits = 0, i;
+
+	for (;;)
+	{
+		if (((*bit_pos >> 3) >= size) || (num_leading_zero_bits > 31))
+			return FALSE;
+
+		if ((data[*bit_pos >> 3] >> (7 - (*bit_pos & 7))) & 1)
+			break;
+
+		num_leading_zero_bits++;
+		(*bit_pos)++;
+	}
+	(*bit_pos)++;
+
+	*value = 0;
+	for (i = 0; i < num_leading_zero_bits; ++i)
+	{
+		if ((*bit_pos >> 3) >= size)
+			return FALSE;
+
+		*value = (*value << 1) | ((data[*bit_pos >> 3] >> (7 - (*bit_pos & 7))) & 1);
+		(*bit_pos)++;
+	}
+
+	*value += (1u << num_leading_zero_bits) - 1;
+
+	return TRUE;
+}
+
+
+/* Checks if the given encoded data belongs to an intra frame, by looking at the
+ * first slice or VOP header in it. This is necessary in slice output mode, since
+ * the headers have to be written before any of the frame's data, but the VPU
+ * reports the frame type only after the entire frame was encoded. */
+static BOOL imx_vpu_enc_is_intra_frame_data(ImxVpuCodecFormat codec_format, uint8_t const *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; (i + 3) < size; ++i)
+	{
+		/* Look for start codes */
+		if ((data[i] != 0x00) || (data[i + 1] != 0x00) || (data[i + 2] != 0x01))
+			continue;
+
+		switch (codec_format)
+		{
+			case IMX_VPU_CODEC_FORMAT_H264:
+			{
+				unsigned int nal_unit_type = data[i + 3] & 0x1F;
+
+				if (nal_unit_type == 5)
+				{
+					/* IDR slice */
+					return TRUE;
+				}
+				else if (nal_unit_type == 1)
+				{
+					/* Non-IDR slice; its header begins with the first_mb_in_slice
+					 * and slice_type values. Slice types 2 and 7 are I slices,
+					 * 4 and 9 are SI slices. */
+					size_t bit_pos = 0;
+					unsigned int first_mb_in_slice, slice_type;
+
+					if (!imx_vpu_enc_read_exp_golomb(data + i + 4, size - (i + 4), &bit_pos, &first_mb_in_slice))
+						return FALSE;
+					if (!imx_vpu_enc_read_exp_golomb(data + i + 4, size - (i + 4), &bit_pos, &slice_type))
+						return FALSE;
+
+					return ((slice_type % 5) == 2) || ((slice_type % 5) == 4);
+				}
+
+				/* Other NAL units can precede the slice; skip them */
+				break;
+			}
+
+			case IMX_VPU_CODEC_FORMAT_MPEG4:
+			{
+				/* VOP start code; the two most significant bits of the next
+				 * byte are the vop_coding_type, which is 0 for I-VOPs */
+				if (data[i + 3] == 0xB6)
+					return ((i + 4) < size) && ((data[i + 4] >> 6) == 0);
+
+				/* Other start codes (like GOV) can precede the VOP; skip them */
+				break;
+			}
+
+			default:
+				return FALSE;
+		}
+	}
+
+	return FALSE;
+}
+
+
+/* Delivers the encoded data which the VPU wrote into the ring buffer since the last
+ * call in slice output mode, and consumes it. Before the first data of a frame, the
+ * AUD and the headers are written if necessary. If discard is TRUE, the data is only
+ * consumed (this is done after errors, to keep the VPU from stalling). */
+static ImxVpuEncReturnCodes imx_vpu_enc_write_slice_output(ImxVpuEncoder *encoder, ImxVpuEncodedFrame *encoded_frame, ImxVpuEncParams *encoding_params, BOOL frame_completed, BOOL discard, unsigned int *output_code)
+{
+	ImxVpuEncReturnCodes ret;
+	ImxVpuEncOutputSegment regions[2];
+	size_t total_size;
+	unsigned int i;
+
+	if ((ret = imx_vpu_enc_get_ring_buffer_data(encoder, regions, &total_size)) != IMX_VPU_ENC_RETURN_CODE_OK)
+		return ret;
+
+	if (total_size == 0)
+		return IMX_VPU_ENC_RETURN_CODE_OK;
+
+	if (discard)
+	{
+		vpu_EncUpdateBitstreamBuffer(encoder->handle, total_size);
+		return IMX_VPU_ENC_RETURN_CODE_OK;
+	}
+
+	if (!(encoder->slice_output_started))
+	{
+		uint8_t probe[VPU_ENC_FRAME_TYPE_PROBE_SIZE];
+		size_t probe_size, probe_size_first_region;
+		BOOL add_header;
+		ImxVpuEncWriteContext write_context;
+
+		/* Wait until there is enough data for determining the
+		 * frame type, unless the frame is already complete */
+		if ((total_size < VPU_ENC_FRAME_TYPE_PROBE_SIZE) && !frame_completed)
+			return IMX_VPU_ENC_RETURN_CODE_OK;
+
+		probe_size = (total_size < VPU_ENC_FRAME_TYPE_PROBE_SIZE) ? total_size : VPU_ENC_FRAME_TYPE_PROBE_SIZE;
+		probe_size_first_region = (probe_size < regions[0].size) ? probe_size : regions[0].size;
+		memcpy(probe, regions[0].data, probe_size_first_region);
+		memcpy(probe + probe_size_first_region, regions[1].data, probe_size - probe_size_first_region);
+
+		switch (encoder->codec_format)
+		{
+			case IMX_VPU_CODEC_FORMAT_H264:
+			case IMX_VPU_CODEC_FORMAT_MPEG4:
+				add_header = encoder->first_frame || encoding_params->force_I_frame || imx_vpu_enc_is_intra_frame_data(encoder->codec_format, probe, probe_size);
+				break;
+
+			default:
+				add_header = FALSE;
+		}
+
+		/* The data goes directly to write_output_data(),
+		 * so the write context is not actually used */
+		memset(&write_context, 0, sizeof(write_context));
+
+		if (encoder->aud_enable)
+		{
+			if ((ret = imx_vpu_enc_write_h264_aud(encoded_frame, encoding_params, &write_context)) != IMX_VPU_ENC_RETURN_CODE_OK)
+				goto error;
+			encoder->slice_output_data_size += sizeof(h264_aud);
+		}
+
+		if (add_header)
+		{
+			if ((ret = imx_vpu_enc_write_header_data(encoder, encoded_frame, encoding_params, &write_context, output_code)) != IMX_VPU_ENC_RETURN_CODE_OK)
+				goto error;
+
+			if (encoder->codec_format == IMX_VPU_CODEC_FORMAT_H264)
+				encoder->slice_output_data_size += encoder->headers.h264_headers.sps_rbsp_size + encoder->headers.h264_headers.pps_rbsp_size;
+			else
+				encoder->slice_output_data_size += encoder->headers.mpeg4_headers.vos_header_size + encoder->headers.mpeg4_headers.vis_header_size + encoder->headers.mpeg4_headers.vol_header_size;
+		}
+
+		encoder->slice_output_started = TRUE;
+	}
+
+	for (i = 0; i < 2; ++i)
+	{
+		if (regions[i].size == 0)
+			continue;
+
+		if (encoding_params->write_output_data(encoding_params->output_buffer_context, regions[i].data, regions[i].size, encoded_frame) == 0)
+		{
+			IMX_VPU_ERROR("could not output encoded data with %zu byte: write callback reported failure", regions[i].size);
+			ret = IMX_VPU_ENC_RETURN_CODE_WRITE_CALLBACK_FAILED;
+			goto error;
+		}
+	}
+
+	vpu_EncUpdateBitstreamBuffer(encoder->handle, total_size);
+	encoder->slice_output_data_size += total_size;
+	*output_code |= IMX_VPU_ENC_OUTPUT_CODE_ENCODED_FRAME_AVAILABLE;
+
+	IMX_VPU_LOG("delivered %zu byte of encoded data", total_size);
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+
+error:
+	vpu_EncUpdateBitstreamBuffer(encoder->handle, total_size);
+	return ret;
+}
+
+
+/* Waits for the VPU to finish encoding the frame in slice output mode, and delivers
+ * the encoded data during the wait. Errors during delivery are stored in ret; the
+ * wait continues in that case, since vpu_EncGetOutputInfo() can only be called
+ * once the VPU is done. Returns FALSE if a timeout occurred. */
+static BOOL imx_vpu_enc_wait_with_slice_output(ImxVpuEncoder *encoder, ImxVpuEncodedFrame *encoded_frame, ImxVpuEncParams *encoding_params, ImxVpuEncReturnCodes *ret, unsigned int *output_code)
+{
+	uint64_t timeout_time = imx_vpu_get_monotonic_time() + (uint64_t)(VPU_WAIT_TIMEOUT * VPU_MAX_TIMEOUT_COUNTS) * 1000;
+
+	for (;;)
+	{
+		/* The VPU also raises an interrupt if the ring buffer is
+		 * full, so check that it actually finished the frame */
+		if ((vpu_WaitForInt(VPU_ENC_SLICE_OUTPUT_POLL_INTERVAL) == RETCODE_SUCCESS) && !vpu_IsBusy())
+			return TRUE;
+
+		if (*ret == IMX_VPU_ENC_RETURN_CODE_OK)
+			*ret = imx_vpu_enc_write_slice_output(encoder, encoded_frame, encoding_params, FALSE, FALSE, output_code);
+		else
+			imx_vpu_enc_write_slice_output(encoder, encoded_frame, encoding_params, FALSE, TRUE, output_code);
+
+		if (imx_vpu_get_monotonic_time() >= timeout_time)
+		{
+			IMX_VPU_INFO("timeout after waiting %d ms for frame completion", VPU_WAIT_TIMEOUT * VPU_MAX_TIMEOUT_COUNTS);
+			encoder->cur_frame_stats.num_wait_timeouts++;
+			IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_WAIT_TIMEOUT, encoder->cur_frame_stats.num_wait_timeouts, 0, 0);
+			return FALSE;
+		}
+	}
+}
+
+
+static ImxVpuEncReturnCodes imx_vpu_enc_write_output_segments(ImxVpuEncoder *encoder, ImxVpuEncodedFrame *encoded_frame, ImxVpuEncParams *encoding_params, EncOutputInfo const *enc_output_info, BOOL add_header, size_t mjpeg_header_size, unsigned int *output_code)
 {
-	switch (code)
+	/* Scatter/gather output. Instead of copying the AUD, the headers, and
+	 * the encoded data into one block, pass pointers to all of them to the
+	 * write_output_segments() function. Since the bitstream buffer is not
+	 * used in ring buffer mode, the encoded data is always contiguous. */
+
+	ImxVpuEncOutputSegment segments[IMX_VPU_ENC_MAX_OUTPUT_SEGMENTS];
+	unsigned int num_segments = 0;
+
+#define ADD_SEGMENT(DATA, SIZE) \
+	do \
+	{ \
+		if ((SIZE) > 0) \
+		{ \
+			segments[num_segments].data = (DATA); \
+			segments[num_segments].size = (SIZE); \
+			++num_segments; \
+		} \
+	} \
+	while (0)
+
+	if (encoder->aud_enable)
+		ADD_SEGMENT(h264_aud, sizeof(h264_aud));
+
+	if (add_header)
+	{
+		switch (encoder->codec_format)
+		{
+			case IMX_VPU_CODEC_FORMAT_H264:
+				ADD_SEGMENT(encoder->headers.h264_headers.sps_rbsp, encoder->headers.h264_headers.sps_rbsp_size);
+				ADD_SEGMENT(encoder->headers.h264_headers.pps_rbsp, encoder->headers.h264_headers.pps_rbsp_size);
+				break;
+
+			case IMX_VPU_CODEC_FORMAT_MPEG4:
+				ADD_SEGMENT(encoder->headers.mpeg4_headers.vos_header, encoder->headers.mpeg4_headers.vos_header_size);
+				ADD_SEGMENT(encoder->headers.mpeg4_headers.vis_header, encoder->headers.mpeg4_headers.vis_header_size);
+				ADD_SEGMENT(encoder->headers.mpeg4_headers.vol_header, encoder->headers.mpeg4_headers.vol_header_size);
+				break;
+
+			case IMX_VPU_CODEC_FORMAT_MJPEG:
+				ADD_SEGMENT(encoder->headers.mjpeg_header_data, mjpeg_header_size);
+				break;
+
+			default:
+				break;
+		}
+
+		*output_code |= IMX_VPU_ENC_OUTPUT_CODE_CONTAINS_HEADER;
+	}
+
+	if (enc_output_info->bitstreamBuffer != 0)
+	{
+		imx_vpu_enc_sync_bitstream_for_cpu(encoder, IMX_VPU_ENC_GET_BITSTREAM_VIRT_ADDR(encoder, enc_output_info->bitstreamBuffer), (size_t)(enc_output_info->bitstreamSize));
+		ADD_SEGMENT(IMX_VPU_ENC_GET_BITSTREAM_VIRT_ADDR(encoder, enc_output_info->bitstreamBuffer), (size_t)(enc_output_info->bitstreamSize));
+	}
+
+#undef ADD_SEGMENT
+
+	/* Add this flag since the raw frame has been successfully consumed */
+	*output_code |= IMX_VPU_ENC_OUTPUT_CODE_INPUT_USED;
+
+	if (encoding_params->write_output_segments(encoding_params->output_buffer_context, segments, num_segments, encoded_frame) == 0)
 	{
-		case IMX_VPU_ENC_RETURN_CODE_OK:                        return "ok";
-		case IMX_VPU_ENC_RETURN_CODE_ERROR:                     return "unspecified error";
-		case IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS:            return "invalid params";
-		case IMX_VPU_ENC_RETURN_CODE_INVALID_HANDLE:            return "invalid handle";
-		case IMX_VPU_ENC_RETURN_CODE_INVALID_FRAMEBUFFER:       return "invalid framebuffer";
-		case IMX_VPU_ENC_RETURN_CODE_INSUFFICIENT_FRAMEBUFFERS: return "insufficient framebuffers";
-		case IMX_VPU_ENC_RETURN_CODE_INVALID_STRIDE:            return "invalid stride";
-		case IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE:       return "wrong call sequence";
-		case IMX_VPU_ENC_RETURN_CODE_TIMEOUT:                   return "timeout";
-		case IMX_VPU_ENC_RETURN_CODE_WRITE_CALLBACK_FAILED:     return "write callback failed";
-		default: return "<unknown>";
+		IMX_VPU_ERROR("could not output %u segments with %zu byte: write callback reported failure", num_segments, encoded_frame->data_size);
+		return IMX_VPU_ENC_RETURN_CODE_WRITE_CALLBACK_FAILED;
 	}
+
+	IMX_VPU_LOG("output %u segments with %zu byte", num_segments, encoded_frame->data_size);
+
+	if (enc_output_info->bitstreamBuffer != 0)
+		*output_code |= IMX_VPU_ENC_OUTPUT_CODE_ENCODED_FRAME_AVAILABLE;
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
 }
 
 
@@ -2927,10 +4702,88 @@ ImxVpuDMABufferAllocator* imx_vpu_enc_get_default_allocator(void)
 }
 
 
-void imx_vpu_enc_get_bitstream_buffer_info(size_t *size, unsigned int *alignment)
-{
-	*size = VPU_ENC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE;
-	*alignment = VPU_MEMORY_ALIGNMENT;
+void imx_vpu_enc_get_bitstream_buffer_info(size_t *size, unsigned int *alignment)
+{
+	*size = VPU_ENC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE;
+	*alignment = VPU_MEMORY_ALIGNMENT;
+}
+
+
+static size_t imx_vpu_enc_calc_bitstream_buffer_layout(ImxVpuEncoder *encoder, size_t bitstream_buffer_size, ImxVpuCodecFormat codec_format)
+{
+	/* Fills the layout fields of the encoder, and returns the total
+	 * size of the layout, or 0 if the buffer is too small. Buffers
+	 * with the default size use the same layout as always. Only
+	 * MPEG-4 needs the scratch buffer. */
+
+	if (bitstream_buffer_size >= VPU_ENC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE)
+	{
+		encoder->main_bitstream_buffer_size = VPU_ENC_MAIN_BITSTREAM_BUFFER_SIZE;
+		encoder->mpeg4_scratch_buffer_size = VPU_ENC_MPEG4_SCRATCH_SIZE;
+		return VPU_ENC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE;
+	}
+
+	encoder->mpeg4_scratch_buffer_size = (codec_format == IMX_VPU_CODEC_FORMAT_MPEG4) ? VPU_ENC_MPEG4_SCRATCH_SIZE : 0;
+
+	if (bitstream_buffer_size < (encoder->mpeg4_scratch_buffer_size + VPU_MIN_MAIN_BITSTREAM_BUFFER_SIZE))
+		return 0;
+
+	encoder->main_bitstream_buffer_size = (bitstream_buffer_size - encoder->mpeg4_scratch_buffer_size) / VPU_BITSTREAM_BUFFER_SIZE_ALIGNMENT * VPU_BITSTREAM_BUFFER_SIZE_ALIGNMENT;
+
+	return encoder->main_bitstream_buffer_size + encoder->mpeg4_scratch_buffer_size;
+}
+
+
+void imx_vpu_enc_get_bitstream_buffer_info_with_hints(ImxVpuBitstreamBufferHints const *hints, size_t *size, unsigned int *alignment)
+{
+	size_t main_size;
+	unsigned int width, height;
+
+	assert(hints != NULL);
+	assert(size != NULL);
+	assert(alignment != NULL);
+
+	width = hints->max_frame_width;
+	height = hints->max_frame_height;
+	if ((width == 0) || (height == 0))
+	{
+		width = VPU_DEFAULT_MAX_FRAME_WIDTH;
+		height = VPU_DEFAULT_MAX_FRAME_HEIGHT;
+	}
+
+	/* The main bitstream buffer only has to hold one encoded frame at a time.
+	 * An encoded frame practically never gets larger than an uncompressed 4:2:0
+	 * frame (motion JPEG frames can be up to an uncompressed 4:4:4 frame).
+	 * The bitrate does not matter here. */
+	if (hints->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
+		main_size = (size_t)width * height * 3;
+	else
+		main_size = (size_t)width * height * 3 / 2;
+
+	if (main_size < VPU_MIN_MAIN_BITSTREAM_BUFFER_SIZE)
+		main_size = VPU_MIN_MAIN_BITSTREAM_BUFFER_SIZE;
+	main_size = IMX_VPU_ALIGN_VAL_TO(main_size, VPU_BITSTREAM_BUFFER_SIZE_ALIGNMENT);
+
+	*size = main_size + ((hints->codec_format == IMX_VPU_CODEC_FORMAT_MPEG4) ? VPU_ENC_MPEG4_SCRATCH_SIZE : 0);
+	if (*size > VPU_ENC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE)
+		*size = VPU_ENC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE;
+	*alignment = VPU_MEMORY_ALIGNMENT;
+}
+
+
+ImxVpuEncReturnCodes imx_vpu_enc_preload_mjpeg_tables(unsigned int quality_factor, ImxVpuColorFormat color_format, unsigned int frame_width, unsigned int frame_height)
+{
+	int source_format;
+
+	if (!imx_vpu_enc_get_mjpeg_source_format(color_format, &source_format))
+	{
+		IMX_VPU_ERROR("unknown color format value %d", color_format);
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+	imx_vpu_enc_get_mjpeg_cache_entry(quality_factor, color_format, source_format, frame_width, frame_height);
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
 }
 
 
@@ -2963,6 +4816,9 @@ void imx_vpu_enc_set_default_open_params(ImxVpuCodecFormat codec_format, ImxVpuE
 	open_params->additional_intra_cost_weight = 0;
 	open_params->chroma_interleave = 0;
 	open_params->additional_dmabuffers_allocator = NULL;
+	open_params->rotation = IMX_VPU_ROTATION_NONE;
+	open_params->mirror = IMX_VPU_MIRROR_NONE;
+	open_params->enable_slice_output = 0;
 
 	switch (codec_format)
 	{
@@ -3005,13 +4861,25 @@ ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenPara
 	EncOpenParam enc_open_param;
 	RetCode enc_ret;
 
+	unsigned int encoded_width, encoded_height;
+
 	assert(encoder != NULL);
 	assert(open_params != NULL);
 	assert(bitstream_buffer != NULL);
 
 
-	/* Check that the allocated bitstream buffer is big enough */
-	assert(imx_vpu_dma_buffer_get_size(bitstream_buffer) >= VPU_ENC_MIN_REQUIRED_BITSTREAM_BUFFER_SIZE);
+	/* With 90 and 270 degree rotations, the encoded frames have
+	 * the width and height of the input frames swapped */
+	if (imx_vpu_enc_swaps_frame_dimensions(open_params->rotation))
+	{
+		encoded_width = open_params->frame_height;
+		encoded_height = open_params->frame_width;
+	}
+	else
+	{
+		encoded_width = open_params->frame_width;
+		encoded_height = open_params->frame_height;
+	}
 
 
 	/* Allocate encoder instance */
@@ -3027,10 +4895,33 @@ ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenPara
 	memset(*encoder, 0, sizeof(ImxVpuEncoder));
 	memset(&enc_open_param, 0, sizeof(enc_open_param));
 	(*encoder)->first_frame = TRUE;
+	(*encoder)->open_params = *open_params;
+	(*encoder)->slice_output_enabled = TO_BOOL(open_params->enable_slice_output);
+
+	/* Motion JPEG requires the line buffer mode */
+	if ((*encoder)->slice_output_enabled && (open_params->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG))
+	{
+		IMX_VPU_ERROR("slice output is not supported with motion JPEG");
+		IMX_VPU_FREE(*encoder, sizeof(ImxVpuEncoder));
+		*encoder = NULL;
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+	}
+
+
+	/* Check that the allocated bitstream buffer is big enough,
+	 * and determine how it is split into its areas */
+	if (imx_vpu_enc_calc_bitstream_buffer_layout(*encoder, imx_vpu_dma_buffer_get_size(bitstream_buffer), open_params->codec_format) == 0)
+	{
+		IMX_VPU_ERROR("bitstream buffer with %zu byte is too small for this codec format", imx_vpu_dma_buffer_get_size(bitstream_buffer));
+		IMX_VPU_FREE(*encoder, sizeof(ImxVpuEncoder));
+		*encoder = NULL;
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+	}
 
 
-	/* Map the bitstream buffer. This mapping will persist until the encoder is closed. */
-	(*encoder)->bitstream_buffer_virtual_address = imx_vpu_dma_buffer_map(bitstream_buffer, 0);
+	/* Map the bitstream buffer. This mapping will persist until the encoder is closed.
+	 * Only the ranges containing encoded data are synced for the CPU before reading them. */
+	(*encoder)->bitstream_buffer_virtual_address = imx_vpu_dma_buffer_map(bitstream_buffer, IMX_VPU_MAPPING_FLAG_MANUAL_SYNC);
 	(*encoder)->bitstream_buffer_physical_address = imx_vpu_dma_buffer_get_physical_address(bitstream_buffer);
 	(*encoder)->bitstream_buffer = bitstream_buffer;
 
@@ -3042,9 +4933,11 @@ ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenPara
 	 * both buffers share one DMA memory block, the actual bitstream buffer
 	 * comes first, followed by the scratch buffer. */
 	enc_open_param.bitstreamBuffer = (*encoder)->bitstream_buffer_physical_address;
-	enc_open_param.bitstreamBufferSize = VPU_ENC_MAIN_BITSTREAM_BUFFER_SIZE;
+	enc_open_param.bitstreamBufferSize = (*encoder)->main_bitstream_buffer_size;
 
-	/* Miscellaneous codec format independent values */
+	/* Miscellaneous codec format independent values. picWidth and picHeight
+	 * are the size of the input frames; the VPU library swaps them internally
+	 * if the rotator is set to 90 or 270 degrees. */
 	enc_open_param.picWidth = open_params->frame_width;
 	enc_open_param.picHeight = open_params->frame_height;
 	enc_open_param.frameRateInfo = (open_params->frame_rate_numerator & 0xffffUL) | (((open_params->frame_rate_denominator - 1) & 0xffffUL) << 16);
@@ -3091,9 +4984,10 @@ ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenPara
 	/* The i.MX6 does not support dynamic allocation */
 	enc_open_param.dynamicAllocEnable = 0;
 
-	/* Ring buffer mode isn't needed, so disable it, instructing
-	 * the VPU to use the line buffer mode instead */
-	enc_open_param.ringBufferEnable = 0;
+	/* Ring buffer mode is only needed for slice output, where the
+	 * encoded data is retrieved while the VPU is still encoding.
+	 * Otherwise, the VPU uses the line buffer mode. */
+	enc_open_param.ringBufferEnable = (*encoder)->slice_output_enabled;
 
 	/* Currently, no tiling is supported */
 	enc_open_param.linear2TiledEnable = 1;
@@ -3157,8 +5051,8 @@ ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenPara
 
 			/* Check if the frame fits within the 16-pixel boundaries.
 			 * If not, crop the remainders. */
-			width_remainder = open_params->frame_width & 15;
-			height_remainder = open_params->frame_height & 15;
+			width_remainder = encoded_width & 15;
+			height_remainder = encoded_height & 15;
 			enc_open_param.EncStdParam.avcParam.avc_frameCroppingFlag = (width_remainder != 0) || (height_remainder != 0);
 			enc_open_param.EncStdParam.avcParam.avc_frameCropRight = width_remainder;
 			enc_open_param.EncStdParam.avcParam.avc_frameCropBottom = height_remainder;
@@ -3168,33 +5062,29 @@ ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenPara
 
 		case IMX_VPU_CODEC_FORMAT_MJPEG:
 		{
+			int source_format;
+			ImxVpuEncMJPEGCacheEntry *cache_entry;
+
 			enc_open_param.bitstreamFormat = STD_MJPG;
 
-			switch (open_params->color_format)
+			if (!imx_vpu_enc_get_mjpeg_source_format(open_params->color_format, &source_format))
 			{
-				case IMX_VPU_COLOR_FORMAT_YUV420:
-					enc_open_param.EncStdParam.mjpgParam.mjpg_sourceFormat = FORMAT_420;
-					break;
-				case IMX_VPU_COLOR_FORMAT_YUV422_HORIZONTAL:
-					enc_open_param.EncStdParam.mjpgParam.mjpg_sourceFormat = FORMAT_422;
-					break;
-				case IMX_VPU_COLOR_FORMAT_YUV422_VERTICAL:
-					enc_open_param.EncStdParam.mjpgParam.mjpg_sourceFormat = FORMAT_224;
-					break;
-				case IMX_VPU_COLOR_FORMAT_YUV444:
-					enc_open_param.EncStdParam.mjpgParam.mjpg_sourceFormat = FORMAT_444;
-					break;
-				case IMX_VPU_COLOR_FORMAT_YUV400:
-					enc_open_param.EncStdParam.mjpgParam.mjpg_sourceFormat = FORMAT_400;
-					break;
-
-				default:
-					IMX_VPU_ERROR("unknown color format value %d", open_params->color_format);
-					ret = IMX_VPU_DEC_RETURN_CODE_ERROR;
-					goto cleanup;
+				IMX_VPU_ERROR("unknown color format value %d", open_params->color_format);
+				ret = IMX_VPU_DEC_RETURN_CODE_ERROR;
+				goto cleanup;
 			}
 
-			imx_vpu_enc_set_mjpeg_tables(open_params->codec_params.mjpeg_params.quality_factor, &(enc_open_param.EncStdParam.mjpgParam));
+			cache_entry = imx_vpu_enc_get_mjpeg_cache_entry(open_params->codec_params.mjpeg_params.quality_factor, open_params->color_format, source_format, open_params->frame_width, open_params->frame_height);
+			enc_open_param.EncStdParam.mjpgParam = cache_entry->mjpeg_params;
+
+			/* The JPEG header contains the size of the encoded frames, which
+			 * is not part of the cache key, so cached headers cannot be used
+			 * with 90 and 270 degree rotations */
+			if ((cache_entry->header_size != 0) && !imx_vpu_enc_swaps_frame_dimensions(open_params->rotation))
+			{
+				memcpy((*encoder)->headers.mjpeg_header_data, cache_entry->header_data, cache_entry->header_size);
+				(*encoder)->mjpeg_header_size = cache_entry->header_size;
+			}
 
 			enc_open_param.EncStdParam.mjpgParam.mjpg_restartInterval = 60;
 			enc_open_param.EncStdParam.mjpgParam.mjpg_thumbNailEnable = 0;
@@ -3209,12 +5099,19 @@ ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenPara
 
 
 	/* Now actually open the encoder instance */
-	IMX_VPU_LOG("opening encoder, frame size: %u x %u pixel", open_params->frame_width, open_params->frame_height);
+	IMX_VPU_LOG("opening encoder, frame size: %u x %u pixel, encoded frame size: %u x %u pixel, rotation: %d degrees, mirror direction: %d", open_params->frame_width, open_params->frame_height, encoded_width, encoded_height, (int)(open_params->rotation), (int)(open_params->mirror));
 	enc_ret = vpu_EncOpen(&((*encoder)->handle), &enc_open_param);
 	ret = IMX_VPU_ENC_HANDLE_ERROR("could not open encoder", enc_ret);
 	if (ret != IMX_VPU_ENC_RETURN_CODE_OK)
 		goto cleanup;
 
+	/* The rotator settings must be set before the sequence is initialized
+	 * in imx_vpu_enc_get_initial_info(), since the VPU library uses them
+	 * to determine the size of the encoded frames */
+	(*encoder)->rotation = open_params->rotation;
+	(*encoder)->mirror = open_params->mirror;
+	imx_vpu_enc_set_rotator_params(*encoder);
+
 
 	/* Store some parameters internally for later use */
 	(*encoder)->additional_dmabuffers_allocator = (open_params->additional_dmabuffers_allocator != NULL) ? open_params->additional_dmabuffers_allocator : imx_vpu_enc_get_default_allocator();
@@ -3224,6 +5121,7 @@ ImxVpuEncReturnCodes imx_vpu_enc_open(ImxVpuEncoder **encoder, ImxVpuEncOpenPara
 	(*encoder)->frame_height = open_params->frame_height;
 	(*encoder)->frame_rate_numerator = open_params->frame_rate_numerator;
 	(*encoder)->frame_rate_denominator = open_params->frame_rate_denominator;
+	(*encoder)->mjpeg_quality_factor = open_params->codec_params.mjpeg_params.quality_factor;
 
 
 finish:
@@ -3252,6 +5150,18 @@ ImxVpuEncReturnCodes imx_vpu_enc_close(ImxVpuEncoder *encoder)
 	IMX_VPU_DEBUG("closing encoder");
 
 
+	/* If a frame is still being encoded, retrieve its output information
+	 * first, since this unlocks the VPU (see imx_vpu_enc_encode_finish()) */
+	if (encoder->encoding_started)
+	{
+		EncOutputInfo enc_output_info;
+		imx_vpu_poll_for_completion(encoder, VPU_WAIT_TIMEOUT);
+		vpu_EncGetOutputInfo(encoder->handle, &enc_output_info);
+		encoder->encoding_started = FALSE;
+		imx_vpu_release_frame_ownership(encoder);
+	}
+
+
 	/* Close the encoder handle */
 
 	enc_ret = vpu_EncClose(encoder->handle);
@@ -3307,6 +5217,8 @@ ImxVpuDMABuffer* imx_vpu_enc_get_bitstream_buffer(ImxVpuEncoder *encoder)
 
 ImxVpuEncReturnCodes imx_vpu_enc_flush(ImxVpuEncoder *encoder)
 {
+	IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_FLUSH, 0, 0, 0);
+
 	encoder->first_frame = TRUE;
 
 	/* NOTE: A vpu_SWReset() call would require a re-registering of the
@@ -3365,6 +5277,18 @@ ImxVpuEncReturnCodes imx_vpu_enc_register_framebuffers(ImxVpuEncoder *encoder, I
 		aligned_frame_width = IMX_VPU_ALIGN_VAL_TO(encoder->frame_width, FRAME_ALIGN);
 		aligned_frame_height = IMX_VPU_ALIGN_VAL_TO(encoder->frame_height, (2 * FRAME_ALIGN));
 
+		/* With 90 and 270 degree rotations, the same dummy planes are used
+		 * for the input frames and the (rotated) framebuffers, so make them
+		 * large enough for both orientations. Their content is constant,
+		 * so the stride mismatch does not matter. */
+		if (imx_vpu_enc_swaps_frame_dimensions(encoder->rotation))
+		{
+			aligned_frame_width = aligned_frame_height = IMX_VPU_ALIGN_VAL_TO(
+				(encoder->frame_width > encoder->frame_height) ? encoder->frame_width : encoder->frame_height,
+				(2 * FRAME_ALIGN)
+			);
+		}
+
 		encoder->dummy_cbcr_stride = aligned_frame_width / 2;
 		encoder->dummy_cbcr_size = encoder->dummy_mvcol_size = aligned_frame_width * aligned_frame_height / 4;
 
@@ -3481,8 +5405,8 @@ ImxVpuEncReturnCodes imx_vpu_enc_register_framebuffers(ImxVpuEncoder *encoder, I
 	 * is located in the same DMA buffer as the bitstream buffer
 	 * (the bitstream buffer comes first, and is the largest part of
 	 * the DMA buffer, followed by the scratch buffer). */
-	scratch_cfg.bufferBase = encoder->bitstream_buffer_physical_address + VPU_ENC_MAIN_BITSTREAM_BUFFER_SIZE;
-	scratch_cfg.bufferSize = VPU_ENC_MPEG4_SCRATCH_SIZE;
+	scratch_cfg.bufferBase = encoder->bitstream_buffer_physical_address + encoder->main_bitstream_buffer_size;
+	scratch_cfg.bufferSize = encoder->mpeg4_scratch_buffer_size;
 
 	{
 		/* NOTE: The vpu_EncRegisterFrameBuffer() API changed several times
@@ -3527,16 +5451,10 @@ ImxVpuEncReturnCodes imx_vpu_enc_register_framebuffers(ImxVpuEncoder *encoder, I
 	}
 
 
-	/* Set default rotator settings for motion JPEG */
+	/* Set rotator settings for motion JPEG */
 	if (encoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
 	{
-		/* the datatypes are int, but this is undocumented; determined by looking
-		 * into the imx-vpu library's vpu_lib.c vpu_EncGiveCommand() definition */
-		int rotation_angle = 0;
-		int mirror = 0;
-
-		vpu_EncGiveCommand(encoder->handle, SET_ROTATION_ANGLE, (void *)(&rotation_angle));
-		vpu_EncGiveCommand(encoder->handle, SET_MIRROR_DIRECTION,(void *)(&mirror));
+		imx_vpu_enc_set_rotator_params(encoder);
 
 #ifdef HAVE_ENC_ENABLE_SOF_STUFF
 		{
@@ -3607,14 +5525,37 @@ ImxVpuEncReturnCodes imx_vpu_enc_get_initial_info(ImxVpuEncoder *encoder, ImxVpu
 
 	/* Generate out-of-band header data if necessary
 	 * This data does not change during encoding, so
-	 * it only has to be generated once */
-	if ((ret = imx_vpu_enc_generate_header_data(encoder)) != IMX_VPU_ENC_RETURN_CODE_OK)
+	 * it only has to be generated once. If it was
+	 * restored from a saved state, the VPU does not
+	 * have to be asked to generate it at all. */
+	if (!(encoder->headers_restored) && ((ret = imx_vpu_enc_generate_header_data(encoder)) != IMX_VPU_ENC_RETURN_CODE_OK))
 		return ret;
 
+	encoder->initial_info = *info;
+	encoder->initial_info_available = TRUE;
+
 	return IMX_VPU_ENC_RETURN_CODE_OK;
 }
 
 
+int imx_vpu_enc_get_state_params(ImxVpuEncoder *encoder, ImxVpuEncOpenParams *open_params, ImxVpuEncInitialInfo *initial_info)
+{
+	if (!(encoder->initial_info_available))
+		return 0;
+
+	*open_params = encoder->open_params;
+	*initial_info = encoder->initial_info;
+
+	return 1;
+}
+
+
+void imx_vpu_enc_set_headers_restored(ImxVpuEncoder *encoder)
+{
+	encoder->headers_restored = TRUE;
+}
+
+
 void imx_vpu_enc_query_header_data(ImxVpuEncoder *encoder, ImxVpuEncHeaderDataTypes header_data_type, uint8_t const **header_data, size_t *header_data_size)
 {
 	assert(encoder != NULL);
@@ -3745,57 +5686,158 @@ void imx_vpu_enc_configure_intra_qp(ImxVpuEncoder *encoder, int intra_qp)
 }
 
 
+ImxVpuEncReturnCodes imx_vpu_enc_enable_rate_adaptation(ImxVpuEncoder *encoder, ImxVpuEncRateAdaptationParams const *params)
+{
+	assert(encoder != NULL);
+
+	if (encoder->encoding_started)
+	{
+		IMX_VPU_ERROR("cannot change rate adaptation while an encoding is in progress");
+		return IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	if (!imx_vpu_enc_rate_adapter_init(&(encoder->rate_adapter), params, &(encoder->open_params)))
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
+
+
+void imx_vpu_enc_get_rate_adaptation_state(ImxVpuEncoder *encoder, ImxVpuEncRateAdaptationState *state)
+{
+	assert(encoder != NULL);
+	imx_vpu_enc_rate_adapter_get_state(&(encoder->rate_adapter), state);
+}
+
+
+static void imx_vpu_enc_end_frame_stats(ImxVpuEncoder *encoder, ImxVpuEncReturnCodes ret, unsigned int output_code, size_t num_bytes)
+{
+	ImxVpuFrameStats *frame_stats = &(encoder->cur_frame_stats);
+	uint64_t now = imx_vpu_get_monotonic_time();
+
+	frame_stats->num_bytes = num_bytes;
+	frame_stats->output_time = now - encoder->cur_output_begin_time;
+	frame_stats->total_time = now - encoder->cur_frame_begin_time;
+
+	imx_vpu_enc_add_step_stats(&(encoder->stats), frame_stats, output_code);
+
+	IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_STEP_END, ret, output_code, num_bytes);
+
+	if (encoder->frame_stats_callback != NULL)
+		encoder->frame_stats_callback(encoder, ret, output_code, frame_stats, encoder->frame_stats_callback_user_data);
+}
+
+
 ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame const *raw_frame, ImxVpuEncodedFrame *encoded_frame, ImxVpuEncParams *encoding_params, unsigned int *output_code)
+{
+	ImxVpuEncReturnCodes ret;
+
+	assert(encoded_frame != NULL);
+	assert(output_code != NULL);
+
+	*output_code = 0;
+
+	/* Set this here to ensure that the handle is NULL if an error occurs
+	 * before acquire_output_buffer() is called */
+	encoded_frame->acquired_handle = NULL;
+
+	if ((ret = imx_vpu_enc_encode_start(encoder, raw_frame, encoding_params)) != IMX_VPU_ENC_RETURN_CODE_OK)
+		return ret;
+
+	return imx_vpu_enc_encode_finish(encoder, encoded_frame, output_code);
+}
+
+
+ImxVpuEncReturnCodes imx_vpu_enc_encode_start(ImxVpuEncoder *encoder, ImxVpuRawFrame const *raw_frame, ImxVpuEncParams *encoding_params)
 {
 	ImxVpuEncReturnCodes ret;
 	RetCode enc_ret;
 	EncParam enc_param;
-	EncOutputInfo enc_output_info;
 	FrameBuffer source_framebuffer;
 	imx_vpu_phys_addr_t raw_frame_phys_addr;
 	BOOL fake_grayscale_mode;
-	BOOL timeout;
-	BOOL add_header;
-	size_t encoded_data_size;
-	ImxVpuEncWriteContext write_context;
+	uint64_t start_begin_time;
+	unsigned int new_bitrate;
+	/* The output code is stored until imx_vpu_enc_encode_finish() is called */
+	unsigned int *output_code;
 
 	ret = IMX_VPU_ENC_RETURN_CODE_OK;
 
 	assert(encoder != NULL);
-	assert(encoded_frame != NULL);
+	assert(raw_frame != NULL);
 	assert(encoding_params != NULL);
-	assert(output_code != NULL);
-	assert(encoding_params->write_output_data != NULL || encoding_params->acquire_output_buffer != NULL);
-	assert(encoding_params->write_output_data != NULL || encoding_params->finish_output_buffer != NULL);
+	assert(encoding_params->write_output_segments != NULL || encoding_params->write_output_data != NULL || encoding_params->acquire_output_buffer != NULL);
+	assert(encoding_params->write_output_segments != NULL || encoding_params->write_output_data != NULL || encoding_params->finish_output_buffer != NULL);
+
+	if (encoder->encoding_started)
+	{
+		IMX_VPU_ERROR("cannot start encoding; previous encoding was not finished yet");
+		return IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	if (encoder->slice_output_enabled && ((encoding_params->write_output_data == NULL) || (encoding_params->write_output_segments != NULL)))
+	{
+		IMX_VPU_ERROR("slice output requires write_output_data, and does not support write_output_segments");
+		return IMX_VPU_ENC_RETURN_CODE_INVALID_PARAMS;
+	}
 
+	output_code = &(encoder->pending_output_code);
 	*output_code = 0;
-	memset(&write_context, 0, sizeof(write_context));
+	encoder->pending_mjpeg_header_size = 0;
+	encoder->slice_output_started = FALSE;
+	encoder->slice_output_data_size = 0;
+
+	memset(&(encoder->cur_frame_stats), 0, sizeof(ImxVpuFrameStats));
+	encoder->cur_frame_begin_time = imx_vpu_get_monotonic_time();
+	IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_STEP_BEGIN, raw_frame->pts, 0, 0);
+
+	/* Work with a copy of the encoding parameters, since rate adaptation
+	 * may modify them. imx_vpu_enc_encode_finish() uses this copy as well,
+	 * since the caller is not required to keep the parameters around. */
+	encoder->pending_encoding_params = *encoding_params;
+	encoding_params = &(encoder->pending_encoding_params);
+
+	new_bitrate = imx_vpu_enc_rate_adapter_begin_frame(&(encoder->rate_adapter), encoder, encoding_params);
+	if (new_bitrate != 0)
+		imx_vpu_enc_configure_bitrate(encoder, new_bitrate);
 
 	/* See comments inside imx_vpu_enc_register_framebuffers() for a description of
 	 * the "fake grayscale mode". */
 	fake_grayscale_mode = (encoder->codec_format != IMX_VPU_CODEC_FORMAT_MJPEG) && (encoder->color_format == IMX_VPU_COLOR_FORMAT_YUV400);
 
-	/* Set this here to ensure that the handle is NULL if an error occurs
-	 * before acquire_output_buffer() is called */
-	encoded_frame->acquired_handle = NULL;
-
 	/* Get the physical address for the raw_frame that shall be encoded
 	 * and the virtual pointer to the output buffer */
 	raw_frame_phys_addr = imx_vpu_dma_buffer_get_physical_address(raw_frame->framebuffer->dma_buffer);
 
-	/* MJPEG frames always need JPEG headers, since each frame is an independent JPEG frame */
+	/* MJPEG frames always need JPEG headers, since each frame is an independent JPEG frame.
+	 * The header is the same for all frames, so it is generated only once, and reused
+	 * from then on. It is also stored in the MJPEG cache, for future encoder instances. */
 	if (encoder->codec_format == IMX_VPU_CODEC_FORMAT_MJPEG)
 	{
-		EncParamSet mjpeg_param;
-		memset(&mjpeg_param, 0, sizeof(mjpeg_param));
+		if (encoder->mjpeg_header_size == 0)
+		{
+			EncParamSet mjpeg_param;
+			ImxVpuEncMJPEGCacheEntry *cache_entry;
+
+			memset(&mjpeg_param, 0, sizeof(mjpeg_param));
 
-		mjpeg_param.size = MJPEG_ENC_HEADER_DATA_MAX_SIZE;
-		mjpeg_param.pParaSet = encoder->headers.mjpeg_header_data;
+			mjpeg_param.size = MJPEG_ENC_HEADER_DATA_MAX_SIZE;
+			mjpeg_param.pParaSet = encoder->headers.mjpeg_header_data;
 
-		vpu_EncGiveCommand(encoder->handle, ENC_GET_JPEG_HEADER, &mjpeg_param);
-		IMX_VPU_LOG("added JPEG header with %d byte", mjpeg_param.size);
+			vpu_EncGiveCommand(encoder->handle, ENC_GET_JPEG_HEADER, &mjpeg_param);
+			IMX_VPU_LOG("generated JPEG header with %d byte", mjpeg_param.size);
+
+			encoder->mjpeg_header_size = mjpeg_param.size;
+
+			cache_entry = imx_vpu_enc_swaps_frame_dimensions(encoder->rotation) ? NULL : imx_vpu_enc_find_mjpeg_cache_entry(encoder->mjpeg_quality_factor, encoder->color_format, encoder->frame_width, encoder->frame_height);
+			if (cache_entry != NULL)
+			{
+				memcpy(cache_entry->header_data, encoder->headers.mjpeg_header_data, encoder->mjpeg_header_size);
+				cache_entry->header_size = encoder->mjpeg_header_size;
+			}
+		}
 
-		write_context.mjpeg_header_size = mjpeg_param.size;
+		encoder->pending_mjpeg_header_size = encoder->mjpeg_header_size;
 
 		*output_code |= IMX_VPU_ENC_OUTPUT_CODE_CONTAINS_HEADER;
 	}
@@ -3847,36 +5889,162 @@ ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame c
 	enc_param.enableAutoSkip = encoding_params->enable_autoskip;
 
 
-	/* Do the actual encoding */
+	/* Do the actual encoding. First, wait until frames of other instances
+	 * are done; this time is counted as part of the push time. */
+
+	if (!imx_vpu_acquire_frame_ownership(encoder))
+	{
+		imx_vpu_enc_rate_adapter_end_frame(&(encoder->rate_adapter), 0, IMX_VPU_FRAME_TYPE_UNKNOWN);
+		return IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	start_begin_time = imx_vpu_get_monotonic_time();
+	encoder->cur_frame_stats.push_time = start_begin_time - encoder->cur_frame_begin_time;
 
+	IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_VPU_START, 0, 0, 0);
 	enc_ret = vpu_EncStartOneFrame(encoder->handle, &enc_param);
 	ret = IMX_VPU_ENC_HANDLE_ERROR("could not start frame encoding", enc_ret);
 	if (ret != IMX_VPU_ENC_RETURN_CODE_OK)
-		goto finish;
+	{
+		/* imx_vpu_enc_encode_finish() will not be called for this frame,
+		 * so conclude the frame that begin_frame started here */
+		imx_vpu_release_frame_ownership(encoder);
+		imx_vpu_enc_rate_adapter_end_frame(&(encoder->rate_adapter), 0, IMX_VPU_FRAME_TYPE_UNKNOWN);
+		return ret;
+	}
+
+	encoder->cur_frame_stats.start_time = imx_vpu_get_monotonic_time() - start_begin_time;
+
+
+	/* Store the information imx_vpu_enc_encode_finish() needs. The
+	 * encoding parameters were already copied above. */
+	encoder->encoding_started = TRUE;
+	encoder->encoding_completed = FALSE;
+	encoder->started_frame_context = raw_frame->context;
+	encoder->started_frame_pts = raw_frame->pts;
+	encoder->started_frame_dts = raw_frame->dts;
+
+
+	return IMX_VPU_ENC_RETURN_CODE_OK;
+}
+
+
+int imx_vpu_enc_encode_poll(ImxVpuEncoder *encoder, unsigned int timeout_ms)
+{
+	uint64_t wait_begin_time;
+	BOOL completed;
+
+	assert(encoder != NULL);
+
+	if (!(encoder->encoding_started) || encoder->encoding_completed)
+		return 1;
+
+	wait_begin_time = imx_vpu_get_monotonic_time();
+	completed = imx_vpu_poll_for_completion(encoder, timeout_ms);
+	encoder->cur_frame_stats.wait_time += imx_vpu_get_monotonic_time() - wait_begin_time;
+
+	if (!completed)
+		return 0;
+
+	/* In slice output mode, the VPU also raises an interrupt if the
+	 * ring buffer is full; in that case, it is not done yet */
+	if (encoder->slice_output_enabled && vpu_IsBusy())
+		return 0;
+
+	encoder->encoding_completed = TRUE;
+	return 1;
+}
+
+
+ImxVpuEncReturnCodes imx_vpu_enc_encode_finish(ImxVpuEncoder *encoder, ImxVpuEncodedFrame *encoded_frame, unsigned int *output_code)
+{
+	ImxVpuEncReturnCodes ret;
+	RetCode enc_ret;
+	EncOutputInfo enc_output_info;
+	ImxVpuEncParams *encoding_params;
+	BOOL timeout;
+	BOOL add_header;
+	size_t encoded_data_size;
+	ImxVpuEncWriteContext write_context;
+	ImxVpuEncReturnCodes slice_output_ret = IMX_VPU_ENC_RETURN_CODE_OK;
+
+	ret = IMX_VPU_ENC_RETURN_CODE_OK;
+
+	assert(encoder != NULL);
+	assert(encoded_frame != NULL);
+	assert(output_code != NULL);
 
-	/* Wait for frame completion */
+	if (!(encoder->encoding_started))
 	{
-		int cnt;
+		IMX_VPU_ERROR("cannot finish encoding; encoding was not started");
+		return IMX_VPU_ENC_RETURN_CODE_WRONG_CALL_SEQUENCE;
+	}
+
+	encoder->encoding_started = FALSE;
+
+	*output_code = encoder->pending_output_code;
+	encoding_params = &(encoder->pending_encoding_params);
+
+	memset(&write_context, 0, sizeof(write_context));
+	write_context.mjpeg_header_size = encoder->pending_mjpeg_header_size;
+
+	/* Set this here to ensure that the handle is NULL if an error occurs
+	 * before acquire_output_buffer() is called */
+	encoded_frame->acquired_handle = NULL;
+
+	/* In slice output mode, data is written already while waiting,
+	 * so the encoded frame must contain valid context and timestamps
+	 * by then. The size is known only after the frame is done. */
+	if (encoder->slice_output_enabled)
+	{
+		encoded_frame->context = encoder->started_frame_context;
+		encoded_frame->pts = encoder->started_frame_pts;
+		encoded_frame->dts = encoder->started_frame_dts;
+		encoded_frame->data_size = 0;
+	}
+
+	/* Wait for frame completion, unless imx_vpu_enc_encode_poll()
+	 * already detected that the VPU is done */
+	timeout = FALSE;
+	if (!(encoder->encoding_completed))
+	{
+		uint64_t wait_begin_time = imx_vpu_get_monotonic_time();
 
 		IMX_VPU_LOG("waiting for encoding completion");
 
-		/* Wait a few times, since sometimes, it takes more than
-		 * one vpu_WaitForInt() call to cover the encoding interval */
-		timeout = TRUE;
-		for (cnt = 0; cnt < VPU_MAX_TIMEOUT_COUNTS; ++cnt)
+		if (encoder->slice_output_enabled)
 		{
-			if (vpu_WaitForInt(VPU_WAIT_TIMEOUT) != RETCODE_SUCCESS)
-			{
-				IMX_VPU_INFO("timeout after waiting %d ms for frame completion", VPU_WAIT_TIMEOUT);
-			}
-			else
+			timeout = !imx_vpu_enc_wait_with_slice_output(encoder, encoded_frame, encoding_params, &slice_output_ret, output_code);
+		}
+		else
+		{
+			int cnt;
+
+			/* Wait a few times, since sometimes, it takes more than
+			 * one vpu_WaitForInt() call to cover the encoding interval */
+			timeout = TRUE;
+			for (cnt = 0; cnt < VPU_MAX_TIMEOUT_COUNTS; ++cnt)
 			{
-				timeout = FALSE;
-				break;
+				if (vpu_WaitForInt(VPU_WAIT_TIMEOUT) != RETCODE_SUCCESS)
+				{
+					IMX_VPU_INFO("timeout after waiting %d ms for frame completion", VPU_WAIT_TIMEOUT);
+					encoder->cur_frame_stats.num_wait_timeouts++;
+					IMX_VPU_TRACE_EVENT(&(encoder->trace_ring), IMX_VPU_TRACE_EVENT_ENC_WAIT_TIMEOUT, encoder->cur_frame_stats.num_wait_timeouts, 0, 0);
+				}
+				else
+				{
+					timeout = FALSE;
+					break;
+				}
 			}
 		}
+
+		encoder->cur_frame_stats.wait_time += imx_vpu_get_monotonic_time() - wait_begin_time;
 	}
 
+	/* The output stage begins after the wait */
+	encoder->cur_output_begin_time = imx_vpu_get_monotonic_time();
+
 	/* Retrieve information about the result of the encode process. Do so even if
 	 * a timeout occurred. This is intentional, since according to the VPU docs,
 	 * vpu_EncStartOneFrame() won't be usable again until vpu_EncGetOutputInfo()
@@ -3885,6 +6053,7 @@ ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame c
 
 	memset(&enc_output_info, 0, sizeof(enc_output_info));
 	enc_ret = vpu_EncGetOutputInfo(encoder->handle, &enc_output_info);
+	imx_vpu_release_frame_ownership(encoder);
 	ret = IMX_VPU_ENC_HANDLE_ERROR("could not get output information", enc_ret);
 	if (ret != IMX_VPU_ENC_RETURN_CODE_OK)
 		goto finish;
@@ -3895,6 +6064,10 @@ ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame c
 	 * has been called, unlocking the VPU encoder calls. */
 	if (timeout)
 	{
+		/* Discard the partial frame, so it does not end up in front of the next one */
+		if (encoder->slice_output_enabled)
+			imx_vpu_enc_write_slice_output(encoder, encoded_frame, encoding_params, TRUE, TRUE, output_code);
+
 		ret = IMX_VPU_ENC_RETURN_CODE_TIMEOUT;
 		goto finish;
 	}
@@ -3907,6 +6080,28 @@ ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame c
 	}
 
 
+	/* In slice output mode, deliver the rest of the frame; the
+	 * AUD and the headers were written before the first data */
+	if (encoder->slice_output_enabled)
+	{
+		BOOL discard = (slice_output_ret != IMX_VPU_ENC_RETURN_CODE_OK);
+		ret = imx_vpu_enc_write_slice_output(encoder, encoded_frame, encoding_params, TRUE, discard, output_code);
+		if (discard)
+			ret = slice_output_ret;
+
+		if (ret == IMX_VPU_ENC_RETURN_CODE_OK)
+		{
+			*output_code |= IMX_VPU_ENC_OUTPUT_CODE_INPUT_USED;
+			encoder->first_frame = FALSE;
+		}
+
+		encoded_frame->data_size = encoder->slice_output_data_size;
+		IMX_VPU_LOG("frame with %zu byte was delivered in slice output mode", encoded_frame->data_size);
+
+		goto finish;
+	}
+
+
 	IMX_VPU_LOG(
 		"output info:  bitstreamBuffer %" IMX_VPU_PHYS_ADDR_FORMAT "  bitstreamSize %u  bitstreamWrapAround %d  skipEncoded %d  picType %d (%s)  numOfSlices %d",
 		enc_output_info.bitstreamBuffer,
@@ -3964,12 +6159,20 @@ ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame c
 	 * or reordering, this is appropriate, because in that
 	 * case, one input frame always immediately leads to
 	 * one output frame */
-	encoded_frame->context = raw_frame->context;
-	encoded_frame->pts = raw_frame->pts;
-	encoded_frame->dts = raw_frame->dts;
+	encoded_frame->context = encoder->started_frame_context;
+	encoded_frame->pts = encoder->started_frame_pts;
+	encoded_frame->dts = encoder->started_frame_dts;
 
 	encoded_frame->data_size = encoded_data_size;
 
+	if (encoding_params->write_output_segments != NULL)
+	{
+		ret = imx_vpu_enc_write_output_segments(encoder, encoded_frame, encoding_params, &enc_output_info, add_header, write_context.mjpeg_header_size, output_code);
+		if (ret == IMX_VPU_ENC_RETURN_CODE_OK)
+			encoder->first_frame = FALSE;
+		goto finish;
+	}
+
 	if (encoding_params->write_output_data == NULL)
 	{
 		write_context.write_ptr_start = encoding_params->acquire_output_buffer(encoding_params->output_buffer_context, encoded_data_size, &(encoded_frame->acquired_handle));
@@ -4012,6 +6215,8 @@ ImxVpuEncReturnCodes imx_vpu_enc_encode(ImxVpuEncoder *encoder, ImxVpuRawFrame c
 	{
 		uint8_t const *output_data_ptr = IMX_VPU_ENC_GET_BITSTREAM_VIRT_ADDR(encoder, enc_output_info.bitstreamBuffer);
 
+		imx_vpu_enc_sync_bitstream_for_cpu(encoder, output_data_ptr, enc_output_info.bitstreamSize);
+
 		if (encoding_params->write_output_data == NULL)
 		{
 			ptrdiff_t available_space = write_context.write_ptr_end - write_context.write_ptr;
@@ -4050,5 +6255,60 @@ finish:
 	if (write_context.write_ptr_start != NULL)
 		encoding_params->finish_output_buffer(encoding_params->output_buffer_context, encoded_frame->acquired_handle);
 
+	imx_vpu_enc_rate_adapter_end_frame(&(encoder->rate_adapter), (*output_code & IMX_VPU_ENC_OUTPUT_CODE_ENCODED_FRAME_AVAILABLE) ? encoded_frame->data_size : 0, (ret == IMX_VPU_ENC_RETURN_CODE_OK) ? encoded_frame->frame_type : IMX_VPU_FRAME_TYPE_UNKNOWN);
+	imx_vpu_enc_end_frame_stats(encoder, ret, *output_code, (*output_code & IMX_VPU_ENC_OUTPUT_CODE_ENCODED_FRAME_AVAILABLE) ? encoded_frame->data_size : 0);
+
 	return ret;
 }
+
+
+void imx_vpu_enc_get_stats(ImxVpuEncoder *encoder, ImxVpuEncStats *stats)
+{
+	assert(encoder != NULL);
+	assert(stats != NULL);
+
+	*stats = encoder->stats;
+	stats->bitstream_buffer_size = encoder->main_bitstream_buffer_size;
+	stats->num_framebuffers = encoder->num_framebuffers;
+}
+
+
+void imx_vpu_enc_reset_stats(ImxVpuEncoder *encoder)
+{
+	assert(encoder != NULL);
+
+	imx_vpu_enc_clear_stats(&(encoder->stats));
+}
+
+
+void imx_vpu_enc_set_frame_stats_callback(ImxVpuEncoder *encoder, ImxVpuEncFrameStatsCallback callback, void *user_data)
+{
+	assert(encoder != NULL);
+
+	encoder->frame_stats_callback = callback;
+	encoder->frame_stats_callback_user_data = user_data;
+}
+
+
+unsigned int imx_vpu_enc_get_trace_events(ImxVpuEncoder *encoder, ImxVpuTraceEvent *events, unsigned int max_events)
+{
+	assert(encoder != NULL);
+	assert(events != NULL);
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	return imx_vpu_trace_ring_get_events(&(encoder->trace_ring), events, max_events);
+#else
+	IMXVPUAPI_UNUSED_PARAM(max_events);
+	return 0;
+#endif
+}
+
+
+void imx_vpu_enc_clear_trace_events(ImxVpuEncoder *encoder)
+{
+	assert(encoder != NULL);
+
+#ifdef IMXVPUAPI_ENABLE_TRACING
+	imx_vpu_trace_ring_clear(&(encoder->trace_ring));
+#endif
+}